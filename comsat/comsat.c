@@ -437,7 +437,8 @@ notify_user (const char *user, const char *device, const char *path,
 
   if ((status = mu_mailbox_create (&mbox, path)) != 0 ||
       (status = mu_mailbox_open (mbox,
-				 MU_STREAM_READ|MU_STREAM_QACCESS)) != 0)
+				 MU_STREAM_READ|MU_STREAM_QACCESS
+				   |MU_STREAM_HEADERS_ONLY)) != 0)
     {
       mu_error (_("cannot open mailbox %s: %s"),
 	      path, mu_strerror (status));
@@ -18,16 +18,21 @@
 #include <stdlib.h>
 #include <mailutils/mailutils.h>
 #include <mailutils/sys/envelope.h>
+#include <mailutils/sys/mime.h>
+#include <mailutils/md5.h>
 #include <muaux.h>
 #include <sysexits.h>
+#include <unistd.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/wait.h>
 
 int truncate_opt;
 int from_filter;
 int recode_charset;
 char *charset;
 int fd_err;
+int jobs;
 
 static struct mu_option decodemail_options[] = 
 {
@@ -40,6 +45,9 @@ static struct mu_option decodemail_options[] =
   { "recode", 'R', NULL, MU_OPTION_DEFAULT,
     N_("recode text parts to the current charset"),
     mu_c_bool, &recode_charset },
+  { "jobs", 'j', N_("N"), MU_OPTION_DEFAULT,
+    N_("decode messages using N parallel workers"),
+    mu_c_int, &jobs },
   MU_OPTION_END
 }, *options[] = { decodemail_options, NULL };
 
@@ -80,6 +88,9 @@ static mu_message_t message_decode (mu_message_t, mu_coord_t *, size_t);
 
 static void message_store_mbox (mu_message_t, mu_mailbox_t);
 static void message_store_stdout (mu_message_t, mu_mailbox_t);
+static void message_format_stdout (mu_stream_t, mu_message_t);
+
+static void (*message_store) (mu_message_t, mu_mailbox_t);
 
 static void
 enable_log_prefix (int on)
@@ -162,16 +173,515 @@ output_mbox_cleanup (void *arg)
     }
 }
 
+/* Decode message MSG, which is Nth message in the input mailbox, and
+   store the result in OMBOX. */
+static void
+decode_and_store (mu_message_t msg, size_t n, mu_coord_t *crd,
+		  mu_mailbox_t ombox)
+{
+  mu_message_t newmsg;
+
+  (*crd)[1] = n;
+  fd_err = 0;
+  newmsg = message_decode (msg, crd, 1);
+  message_store (newmsg, ombox);
+  mu_message_unref (newmsg);
+  mu_message_unref (msg);
+}
+
+static int
+decode_serial (mu_mailbox_t imbox, mu_mailbox_t ombox, mu_coord_t *crd)
+{
+  int rc;
+  mu_iterator_t itr;
+  unsigned long i;
+  int err = 0;
+
+  rc = mu_mailbox_get_iterator (imbox, &itr);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_get_iterator", NULL, rc);
+      abend (EX_SOFTWARE);
+    }
+
+  for (mu_iterator_first (itr), i = 1; !mu_iterator_is_done (itr);
+       mu_iterator_next (itr), i++)
+    {
+      mu_message_t msg;
+
+      rc = mu_iterator_current (itr, (void **)&msg);
+      if (rc)
+	{
+	  mu_error (_("cannot read message %lu: %s"),
+		    i, mu_strerror (rc));
+	  err = 1;
+	  continue;
+	}
+      decode_and_store (msg, i, crd, ombox);
+    }
+  mu_iterator_destroy (&itr);
+  return err;
+}
+
+/* Parallel decoding.
+
+   Messages are decoded by JOBS worker processes.  Each worker opens its
+   own handle of the input mailbox and decodes the messages assigned to
+   it: message N goes to the worker number (N - 1) % JOBS.  Decoded
+   messages are sent over a pipe to the master, which stores them in
+   message number order, so that the result is the same as that of a
+   serial run.
+
+   Each record sent by a worker starts with the line
+
+     MSGNO STATUS LOGLEN FLAGS SLEN DLEN SIZE
+
+   where STATUS is 'M' if a decoded message follows, and 'F' if the
+   worker was unable to read the message, which must then be processed
+   by the master.  LOGLEN is the number of bytes of diagnostic output
+   produced while decoding.  FLAGS are the message attribute flags.
+   SLEN and DLEN are lengths of the envelope sender and date, or -1 if
+   these are not available.  The line is followed by SLEN bytes of the
+   sender, DLEN bytes of the date, and SIZE bytes of the message.  When
+   writing to the standard output, the message is already formatted
+   for output, and FLAGS, SLEN and DLEN are not used.
+
+   Decoded parts are not streamed to the output.  Each message exists
+   in three copies: the decoded message built by message_decode and its
+   serialized form in the worker, and the record read from the pipe in
+   the master.  Bodies are kept in temporary streams, which spill to
+   disk when they grow large, but the peak memory usage is nevertheless
+   higher than that of a serial run.
+
+   Diagnostic output of each worker goes to a temporary file, which the
+   master copies to its standard error when storing the message. */
+
+struct decode_worker
+{
+  pid_t pid;        /* Worker PID */
+  mu_stream_t in;   /* Result records, or NULL if the worker failed */
+  int logfd;        /* Diagnostic output */
+  mu_off_t logoff;  /* Offset of the first byte not yet copied */
+};
+
+/* Write message MSG to STR as is.  Return its envelope and attributes
+   in PSENDER, PDATE, and PFLAGS. */
+static int
+message_serialize (mu_stream_t str, mu_message_t msg,
+		   char **psender, char **pdate, int *pflags)
+{
+  mu_envelope_t env;
+  mu_attribute_t attr;
+  mu_stream_t istr;
+  int rc;
+
+  *psender = *pdate = NULL;
+  if (mu_message_get_envelope (msg, &env) == 0
+      && mu_envelope_aget_sender (env, psender) == 0
+      && mu_envelope_aget_date (env, pdate))
+    {
+      free (*psender);
+      *psender = NULL;
+    }
+
+  *pflags = 0;
+  if (mu_message_get_attribute (msg, &attr) == 0)
+    mu_attribute_get_flags (attr, pflags);
+
+  rc = mu_message_get_streamref (msg, &istr);
+  if (rc == 0)
+    {
+      rc = mu_stream_copy (str, istr, 0, NULL);
+      mu_stream_destroy (&istr);
+    }
+  return rc;
+}
+
+static void
+decode_worker (char const *name, size_t first, size_t total, int fd,
+	       int logfd)
+{
+  int rc;
+  mu_mailbox_t mbox;
+  mu_stream_t out, rec;
+  mu_coord_t crd;
+  mu_off_t off = 0;
+  size_t n;
+
+  if (dup2 (logfd, MU_STDERR_FD) == -1)
+    _exit (EX_OSERR);
+  close (logfd);
+
+  if ((rc = mu_fd_stream_create (&out, NULL, fd, MU_STREAM_WRITE)) != 0
+      || (rc = mu_temp_stream_create (&rec, 0)) != 0)
+    {
+      mu_error (_("cannot create stream: %s"), mu_strerror (rc));
+      _exit (EX_SOFTWARE);
+    }
+
+  if ((rc = mu_mailbox_create_default (&mbox, name)) != 0
+      || (rc = mu_mailbox_open (mbox, MU_STREAM_READ)) != 0)
+    {
+      mu_error (_("worker cannot open mailbox: %s"), mu_strerror (rc));
+      _exit (EX_UNAVAILABLE);
+    }
+
+  if (mu_coord_alloc (&crd, 1))
+    mu_alloc_die ();
+
+  for (n = first; n <= total; n += jobs)
+    {
+      mu_message_t msg, newmsg;
+      char *sender = NULL, *date = NULL;
+      int flags = 0;
+      char status = 'F';
+      mu_off_t size = 0, end;
+
+      mu_stream_seek (rec, 0, MU_SEEK_SET, NULL);
+      mu_stream_truncate (rec, 0);
+      if (mu_mailbox_get_message (mbox, n, &msg) == 0)
+	{
+	  crd[1] = n;
+	  fd_err = 0;
+	  newmsg = message_decode (msg, &crd, 1);
+	  if (message_store == message_store_stdout)
+	    {
+	      message_format_stdout (rec, newmsg);
+	      rc = mu_stream_err (rec) ? EIO : 0;
+	    }
+	  else
+	    rc = message_serialize (rec, newmsg, &sender, &date, &flags);
+	  mu_message_unref (newmsg);
+	  mu_message_unref (msg);
+	  if (rc == 0 && mu_stream_size (rec, &size) == 0)
+	    status = 'M';
+	  else
+	    size = 0;
+	}
+
+      mu_stream_flush (mu_strerr);
+      end = lseek (MU_STDERR_FD, 0, SEEK_CUR);
+      if (end == -1)
+	end = off;
+      mu_stream_printf (out, "%lu %c %lu %d %ld %ld %lu\n",
+			(unsigned long) n, status,
+			(unsigned long) (end - off),
+			flags,
+			sender ? (long) strlen (sender) : -1,
+			date ? (long) strlen (date) : -1,
+			(unsigned long) size);
+      off = end;
+      if (sender)
+	mu_stream_write (out, sender, strlen (sender), NULL);
+      if (date)
+	mu_stream_write (out, date, strlen (date), NULL);
+      free (sender);
+      free (date);
+      mu_stream_seek (rec, 0, MU_SEEK_SET, NULL);
+      rc = mu_stream_copy (out, rec, size, NULL);
+      if (rc == 0)
+	rc = mu_stream_flush (out);
+      if (rc)
+	/* Master is gone */
+	break;
+    }
+
+  mu_stream_destroy (&out);
+  mu_stream_destroy (&rec);
+  mu_mailbox_close (mbox);
+  mu_mailbox_destroy (&mbox);
+  _exit (EX_OK);
+}
+
+/* Copy LEN bytes of diagnostic output of the worker WP to stderr. */
+static void
+copy_worker_log (struct decode_worker *wp, size_t len, int output)
+{
+  char buf[512];
+
+  if (output)
+    {
+      mu_stream_flush (mu_strerr);
+      while (len)
+	{
+	  ssize_t n = pread (wp->logfd, buf,
+			     len < sizeof buf ? len : sizeof buf,
+			     wp->logoff);
+	  if (n <= 0)
+	    break;
+	  if (write (MU_STDERR_FD, buf, n) != n)
+	    break;
+	  wp->logoff += n;
+	  len -= n;
+	}
+    }
+  wp->logoff += len;
+}
+
+static void
+worker_fail (struct decode_worker *wp)
+{
+  mu_error (_("worker %lu failed; processing its messages serially"),
+	    (unsigned long) wp->pid);
+  mu_stream_destroy (&wp->in);
+}
+
+/* Read a string of LEN bytes from STR.  If LEN is negative, store NULL
+   in PRET. */
+static int
+read_string (mu_stream_t str, long len, char **pret)
+{
+  char *s;
+  size_t n;
+  int rc;
+
+  if (len < 0)
+    {
+      *pret = NULL;
+      return 0;
+    }
+  s = mu_alloc (len + 1);
+  rc = mu_stream_read (str, s, len, &n);
+  if (rc == 0 && n != (size_t) len)
+    rc = MU_ERR_READ;
+  if (rc)
+    {
+      free (s);
+      return rc;
+    }
+  s[len] = 0;
+  *pret = s;
+  return 0;
+}
+
+/* Store the message that was decoded by the worker WP. */
+static void
+store_record (mu_stream_t str, char *sender, char *date, int flags,
+	      mu_mailbox_t ombox)
+{
+  mu_envelope_t env = NULL;
+  mu_message_t msg;
+  mu_attribute_t attr;
+  int rc;
+
+  if (!ombox)
+    {
+      rc = mu_stream_copy (mu_strout, str, 0, NULL);
+      if (rc)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_stream_copy", NULL, rc);
+	  abend (EX_IOERR);
+	}
+      return;
+    }
+
+  if (sender && date)
+    {
+      rc = mu_envelope_create (&env, NULL);
+      if (rc)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_envelope_create", NULL, rc);
+	  abend (EX_OSERR);
+	}
+      env->sender = sender;
+      env->date = date;
+    }
+  else
+    {
+      free (sender);
+      free (date);
+    }
+
+  rc = mu_message_from_stream_with_envelope (&msg, str, env);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_message_from_stream_with_envelope",
+		       NULL, rc);
+      abend (EX_SOFTWARE);
+    }
+  if (mu_message_get_attribute (msg, &attr) == 0)
+    {
+      mu_attribute_unset_flags (attr, ~flags);
+      mu_attribute_set_flags (attr, flags);
+    }
+  message_store (msg, ombox);
+  mu_message_unref (msg);
+  mu_envelope_destroy (&env, NULL);
+}
+
+/* Store the message MSGNO decoded by the worker WP to OMBOX.  Return 0
+   if the message has been stored, and 1 if it must be processed by the
+   caller. */
+static int
+decode_commit (mu_mailbox_t ombox, size_t msgno, struct decode_worker *wp)
+{
+  char *buf = NULL;
+  size_t size = 0, n;
+  unsigned long num, loglen, len;
+  int flags;
+  long slen, dlen;
+  char status;
+  char *sender = NULL, *date = NULL;
+  mu_stream_t str;
+  mu_off_t copied;
+  int rc;
+
+  if (!wp->in)
+    return 1;
+  rc = mu_stream_getline (wp->in, &buf, &size, &n);
+  if (rc || n == 0
+      || sscanf (buf, "%lu %c %lu %d %ld %ld %lu", &num, &status, &loglen,
+		 &flags, &slen, &dlen, &len) != 7
+      || num != msgno)
+    {
+      free (buf);
+      worker_fail (wp);
+      return 1;
+    }
+  free (buf);
+
+  copy_worker_log (wp, loglen, status == 'M');
+  if (status != 'M')
+    return 1;
+
+  rc = mu_temp_stream_create (&str, 0);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_temp_stream_create", NULL, rc);
+      abend (EX_OSERR);
+    }
+
+  if (read_string (wp->in, slen, &sender)
+      || read_string (wp->in, dlen, &date)
+      || mu_stream_copy (str, wp->in, len, &copied)
+      || copied != len)
+    {
+      free (sender);
+      free (date);
+      mu_stream_destroy (&str);
+      worker_fail (wp);
+      return 1;
+    }
+
+  mu_stream_seek (str, 0, MU_SEEK_SET, NULL);
+  store_record (str, sender, date, flags, ombox);
+  mu_stream_unref (str);
+  return 0;
+}
+
+static int
+decode_parallel (char const *name, mu_mailbox_t imbox, mu_mailbox_t ombox,
+		 mu_coord_t *crd)
+{
+  int rc;
+  size_t total, i, n;
+  struct decode_worker *wtab;
+  int err = 0;
+
+  rc = mu_mailbox_messages_count (imbox, &total);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_messages_count", NULL, rc);
+      abend (EX_SOFTWARE);
+    }
+  if ((size_t) jobs > total)
+    jobs = total;
+  if (jobs < 2)
+    return decode_serial (imbox, ombox, crd);
+
+  wtab = mu_calloc (jobs, sizeof wtab[0]);
+
+  mu_stream_flush (mu_strout);
+  mu_stream_flush (mu_strerr);
+  for (i = 0; i < (size_t) jobs; i++)
+    {
+      int p[2];
+      struct decode_worker *wp = &wtab[i];
+
+      rc = mu_tempfile (NULL, 0, &wp->logfd, NULL);
+      if (rc)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_tempfile", NULL, rc);
+	  wp->logfd = -1;
+	  continue;
+	}
+      if (pipe (p))
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "pipe", NULL, errno);
+	  continue;
+	}
+
+      wp->pid = fork ();
+      if (wp->pid == -1)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "fork", NULL, errno);
+	  close (p[0]);
+	  close (p[1]);
+	  continue;
+	}
+      if (wp->pid == 0)
+	{
+	  size_t j;
+
+	  close (p[0]);
+	  for (j = 0; j < i; j++)
+	    {
+	      mu_stream_destroy (&wtab[j].in);
+	      if (wtab[j].logfd != -1)
+		close (wtab[j].logfd);
+	    }
+	  decode_worker (name, i + 1, total, p[1], wp->logfd);
+	}
+      close (p[1]);
+      rc = mu_fd_stream_create (&wp->in, NULL, p[0], MU_STREAM_READ);
+      if (rc)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_fd_stream_create", NULL, rc);
+	  close (p[0]);
+	}
+      else
+	mu_stream_set_buffer (wp->in, mu_buffer_full, 0);
+    }
+
+  for (n = 1; n <= total; n++)
+    {
+      if (decode_commit (ombox, n, &wtab[(n - 1) % jobs]))
+	{
+	  mu_message_t msg;
+
+	  rc = mu_mailbox_get_message (imbox, n, &msg);
+	  if (rc)
+	    {
+	      mu_error (_("cannot read message %lu: %s"),
+			(unsigned long) n, mu_strerror (rc));
+	      err = 1;
+	      continue;
+	    }
+	  decode_and_store (msg, n, crd, ombox);
+	}
+    }
+
+  for (i = 0; i < (size_t) jobs; i++)
+    {
+      struct decode_worker *wp = &wtab[i];
+      mu_stream_destroy (&wp->in);
+      if (wp->logfd != -1)
+	close (wp->logfd);
+      if (wp->pid > 0)
+	waitpid (wp->pid, NULL, 0);
+    }
+  free (wtab);
+
+  return err;
+}
+
 int
 main (int argc, char **argv)
 {
   int rc;
   mu_mailbox_t imbox, ombox = NULL;
   char *imbox_name = NULL, *ombox_name = NULL;
-  void (*message_store) (mu_message_t, mu_mailbox_t);
-  mu_iterator_t itr;
-  unsigned long i;
-  int err = 0;
+  int err;
   mu_coord_t crd;
   
   /* Native Language Support */
@@ -287,38 +797,15 @@ main (int argc, char **argv)
       from_filter = 1;
     }
   
-  rc = mu_mailbox_get_iterator (imbox, &itr);
-  if (rc)
-    {
-      mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_get_iterator", NULL, rc);
-      abend (EX_SOFTWARE);
-    }
-
   rc = mu_coord_alloc (&crd, 1);
   if (rc)
     mu_alloc_die ();
 
   enable_log_prefix (1);
-  for (mu_iterator_first (itr), i = 1; !mu_iterator_is_done (itr);
-       mu_iterator_next (itr), i++)
-    {
-      mu_message_t msg, newmsg;
-
-      rc = mu_iterator_current (itr, (void **)&msg);
-      if (rc)
-	{
-	  mu_error (_("cannot read message %lu: %s"),
-		    i, mu_strerror (rc));
-	  err = 1;
-	  continue;
-	}
-      crd[1] = i;
-      fd_err = 0;
-      newmsg = message_decode (msg, &crd, 1);
-      message_store (newmsg, ombox);
-      mu_message_unref (newmsg);
-      mu_message_unref (msg);
-    }
+  if (jobs > 1)
+    err = decode_parallel (imbox_name, imbox, ombox, &crd);
+  else
+    err = decode_serial (imbox, ombox, &crd);
   enable_log_prefix (0);
   
   mu_mailbox_destroy (&imbox);
@@ -354,7 +841,7 @@ message_store_mbox (mu_message_t msg, mu_mailbox_t mbx)
 }
 
 static void
-env_print (mu_message_t msg)
+env_print (mu_stream_t str, mu_message_t msg)
 {
   mu_envelope_t env;
   char const *buf;
@@ -363,7 +850,7 @@ env_print (mu_message_t msg)
   mu_message_get_envelope (msg, &env);
   if (mu_envelope_sget_sender (env, &buf))
     buf = "UNKNOWN";
-  mu_printf ("From %s ", buf);
+  mu_stream_printf (str, "From %s ", buf);
   
   if (mu_envelope_sget_date (env, &buf))
     { 
@@ -377,22 +864,28 @@ env_print (mu_message_t msg)
       buf = datebuf;
     }
 
-  mu_printf ("%s", buf);
+  mu_stream_printf (str, "%s", buf);
   len = strlen (buf);
   if (len > 1 && buf[len-1] != '\n')
-    mu_printf ("\n");
+    mu_stream_printf (str, "\n");
 }
 
 static void
-message_store_stdout (mu_message_t msg, mu_mailbox_t mbx)
+message_format_stdout (mu_stream_t out, mu_message_t msg)
 {
   mu_stream_t str;
 
-  env_print (msg);
+  env_print (out, msg);
   mu_message_get_streamref (msg, &str);
-  mu_stream_copy_nl (mu_strout, str, 0, NULL);
+  mu_stream_copy_nl (out, str, 0, NULL);
   mu_stream_destroy (&str);  
-  mu_printf ("\n");
+  mu_stream_printf (out, "\n");
+}
+
+static void
+message_store_stdout (mu_message_t msg, mu_mailbox_t mbx)
+{
+  message_format_stdout (mu_strout, msg);
 }
 
 static inline int
@@ -689,6 +1182,49 @@ message_decode_nomime (mu_message_t msg)
   return newmsg;
 }
 
+/* Replace the randomly generated boundary of the multipart MIME with
+   a string derived from the original boundary (taken from the content
+   type CT) and the part coordinates.  This makes the output independent
+   of the time and process that created it, so that serial and parallel
+   runs produce identical results. */
+static void
+mime_set_boundary (mu_mime_t mime, mu_content_type_t ct,
+		   mu_coord_t crd, size_t dim)
+{
+  struct mu_mime_param *p, *orig;
+  struct md5_ctx ctx;
+  unsigned char digest[16];
+  char *coord;
+  char *value;
+  int i, rc;
+
+  rc = mu_assoc_lookup (mime->content_type->param, "boundary", &p);
+  if (rc)
+    return;
+
+  mu_md5_init_ctx (&ctx);
+  if (mu_assoc_lookup (ct->param, "boundary", &orig) == 0 && orig->value)
+    mu_md5_process_bytes (orig->value, strlen (orig->value), &ctx);
+  mu_md5_finish_ctx (&ctx, digest);
+
+  coord = mu_coord_part_string (crd, dim);
+  if (!coord)
+    mu_alloc_die ();
+  rc = mu_asprintf (&value, "=_decodemail-%s-", coord);
+  free (coord);
+  if (rc)
+    mu_alloc_die ();
+  value = mu_realloc (value, strlen (value) + 16 + 3);
+  coord = value + strlen (value);
+  for (i = 0; i < 8; i++, coord += 2)
+    sprintf (coord, "%02x", digest[i]);
+  strcpy (coord, "=_");
+
+  free (p->value);
+  p->value = value;
+  mime->boundary = value;
+}
+
 static mu_message_t
 message_decode_mime (mu_message_t msg, mu_coord_t *crd, size_t dim)
 {
@@ -736,6 +1272,8 @@ message_decode_mime (mu_message_t msg, mu_coord_t *crd, size_t dim)
     }
       
   rc = mu_mime_create_multipart (&mime, ct->subtype, ct->param);
+  if (rc == 0)
+    mime_set_boundary (mime, ct, *crd, dim);
   mu_content_type_destroy (&ct);
   if (rc)
     {
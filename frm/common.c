@@ -550,7 +550,7 @@ frm_scan (char *mailbox_name, frm_select_t fun, size_t *total)
 
   mu_mailbox_get_url (mbox, &url);
 
-  status = mu_mailbox_open (mbox, MU_STREAM_READ);
+  status = mu_mailbox_open (mbox, MU_STREAM_READ|MU_STREAM_HEADERS_ONLY);
   if (status == ENOENT)
     *total = 0;
   else if (status != 0)
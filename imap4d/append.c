@@ -15,6 +15,7 @@
    along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "imap4d.h"
+#include <mailutils/locker.h>
 
 struct _temp_envelope
 {
@@ -80,73 +81,106 @@ _temp_envelope_destroy (mu_envelope_t envelope)
   return 0;
 }
 
-int
-imap4d_append0 (mu_mailbox_t mbox, int flags, char *date_time, char *text,
-		char **err_text)
+/* A message being appended */
+struct append_item
 {
-  mu_stream_t stream;
-  int rc = 0;
-  mu_message_t msg = 0;
-  mu_envelope_t env = NULL;
-  size_t size;
+  int flags;                      /* Attribute flags */
+  char *date_time;                /* Internal date or NULL */
+  char *text;                     /* Message text, unless spooled */
+  mu_stream_t spool;              /* Spooled message text */
+  mu_off_t size;                  /* Message size */
+  mu_message_t msg;               /* Message to append */
+  mu_envelope_t env;              /* Its envelope, if date_time is given */
   struct _temp_envelope tenv;
+};
 
-  memset (&tenv, 0, sizeof (tenv));
-	  
-  text = mu_str_skip_class (text, MU_CTYPE_BLANK);
+static void
+append_item_free (struct append_item *item)
+{
+  mu_message_unref (item->msg);
+  item->msg = NULL;
+  if (item->env)
+    mu_envelope_destroy (&item->env, mu_envelope_get_owner (item->env));
+}
 
-  size = strlen (text);
-  rc = quota_check (size);
-  if (rc != RESP_OK)
-    {
-      *err_text = rc == RESP_NO ?
-	                   "Mailbox quota exceeded" : "Operation failed";
-      return 1;
-    }
+/* Create a stream for reading the spooled message text SPOOL, with
+   leading whitespace skipped. */
+static int
+spool_stream_create (mu_stream_t *pstream, mu_stream_t spool)
+{
+  mu_off_t off = 0;
+  char c;
+  size_t n;
+  int rc;
+
+  while ((rc = mu_stream_read (spool, &c, 1, &n)) == 0 && n == 1
+	 && mu_isblank (c))
+    off++;
+  if (rc)
+    return rc;
+  return mu_streamref_create_abridged (pstream, spool, off, 0);
+}
+
+/* Create the message for ITEM.  Return 0 on success.  On failure, return
+   non-zero and optionally set *ERR_TEXT. */
+static int
+append_item_prepare (struct append_item *item, char **err_text)
+{
+  mu_stream_t stream;
+  int rc;
 
   /* If a date_time is specified, the internal date SHOULD be set in the
      resulting message; otherwise, the internal date of the resulting
      message is set to the current date and time by default. */
-  if (date_time)
+  if (item->date_time)
     {
-      if (mu_scan_datetime (date_time, MU_DATETIME_INTERNALDATE, &tenv.tm,
-			    &tenv.tz, NULL))
+      if (mu_scan_datetime (item->date_time, MU_DATETIME_INTERNALDATE,
+			    &item->tenv.tm, &item->tenv.tz, NULL))
 	{
 	  *err_text = "Invalid date/time format";
 	  return 1;
 	}
-      rc = mu_envelope_create (&env, &tenv);
+      rc = mu_envelope_create (&item->env, &item->tenv);
       if (rc)
 	return rc;
-      mu_envelope_set_date (env, _temp_envelope_date, &tenv);
-      mu_envelope_set_sender (env, _temp_envelope_sender, &tenv);
-      mu_envelope_set_destroy (env, _temp_envelope_destroy, &tenv);
+      mu_envelope_set_date (item->env, _temp_envelope_date, &item->tenv);
+      mu_envelope_set_sender (item->env, _temp_envelope_sender, &item->tenv);
+      mu_envelope_set_destroy (item->env, _temp_envelope_destroy,
+			       &item->tenv);
     }
 
-  if (mu_static_memory_stream_create (&stream, text, size))
+  if (item->spool)
     {
-      if (env)
-	mu_envelope_destroy (&env, mu_envelope_get_owner (env));
-      return 1;
+      rc = spool_stream_create (&stream, item->spool);
+      if (rc == 0)
+	rc = mu_stream_size (stream, &item->size);
+      if (rc)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "spool_stream_create", NULL, rc);
+	  return rc;
+	}
     }
-  
-  rc = mu_message_from_stream_with_envelope (&msg, stream, env);
-  mu_stream_unref (stream);
-
-  if (rc)
+  else
     {
-      if (env)
-	mu_envelope_destroy (&env, mu_envelope_get_owner (env));
-      return 1;
+      char *text = mu_str_skip_class (item->text, MU_CTYPE_BLANK);
+      item->size = strlen (text);
+      rc = mu_static_memory_stream_create (&stream, text, item->size);
+      if (rc)
+	return rc;
     }
 
-  if (env)
+  rc = mu_message_from_stream_with_envelope (&item->msg, stream, item->env);
+  mu_stream_unref (stream);
+  if (rc)
+    return rc;
+
+  if (item->env)
     {
       /* Restore sender */
       mu_header_t hdr = NULL;
       char *val;
       
-      mu_message_get_header (msg, &hdr);
+      mu_message_get_header (item->msg, &hdr);
       if (mu_header_aget_value_unfold (hdr, MU_HEADER_ENV_SENDER, &val) == 0 ||
 	  mu_header_aget_value_unfold (hdr, MU_HEADER_SENDER, &val) == 0 ||
 	  mu_header_aget_value_unfold (hdr, MU_HEADER_FROM, &val) == 0)
@@ -156,44 +190,184 @@ imap4d_append0 (mu_mailbox_t mbox, int flags, char *date_time, char *text,
 	  free (val);
 	  if (rc == 0)
 	    {
-	      mu_address_aget_email (addr, 1, &tenv.sender);
+	      mu_address_aget_email (addr, 1, &item->tenv.sender);
 	      mu_address_destroy (&addr);
 	    }
 	}
 
-      if (!tenv.sender)
-	tenv.sender = mu_strdup ("GNU-imap4d");
+      if (!item->tenv.sender)
+	item->tenv.sender = mu_strdup ("GNU-imap4d");
+    }
+  return 0;
+}
+
+/* Remove the COUNT messages appended to MBOX after its first START
+   messages.  Used to roll back a partially completed MULTIAPPEND. */
+static int
+append_rollback (mu_mailbox_t mbox, size_t start, size_t count)
+{
+  mu_msgset_t msgset;
+  size_t i;
+  int rc;
+
+  rc = mu_msgset_create (&msgset, mbox, MU_MSGSET_NUM);
+  if (rc)
+    return rc;
+  rc = mu_msgset_add_range (msgset, start + 1, start + count, MU_MSGSET_NUM);
+  for (i = start + 1; rc == 0 && i <= start + count; i++)
+    {
+      mu_message_t msg;
+      mu_attribute_t attr;
+
+      rc = mu_mailbox_get_message (mbox, i, &msg);
+      if (rc == 0)
+	rc = mu_message_get_attribute (msg, &attr);
+      if (rc == 0)
+	mu_attribute_set_deleted (attr);
     }
-      
-  imap4d_enter_critical ();
-  rc = mu_mailbox_append_message (mbox, msg);
   if (rc == 0)
+    rc = mu_mailbox_expunge_msgset (mbox, msgset);
+  mu_msgset_free (msgset);
+  return rc;
+}
+
+/* Append COUNT messages described by ITEMS to MBOX.  The messages are
+   appended while holding the mailbox lock, so that the batch is not
+   interleaved with other deliveries.  RFC 3502 requires the command to
+   be atomic: if any message cannot be appended, the ones appended
+   before it are removed.
+
+   If *UIDS is not NULL, it points to an array of COUNT elements, where
+   the UIDs of the appended messages are stored.  They are obtained
+   while the lock is still held, so that they cannot refer to messages
+   delivered concurrently.  If a UID cannot be obtained, the array is
+   freed and *UIDS is set to NULL. */
+static int
+imap4d_append0 (mu_mailbox_t mbox, struct append_item *items, size_t count,
+		size_t **uids, char **err_text)
+{
+  size_t i;
+  size_t start = 0;
+  mu_off_t total = 0;
+  mu_locker_t lck = NULL;
+  int rc;
+
+  for (i = 0; i < count; i++)
+    {
+      rc = append_item_prepare (&items[i], err_text);
+      if (rc)
+	return rc;
+      total += items[i].size;
+    }
+
+  rc = quota_check (total);
+  if (rc != RESP_OK)
+    {
+      *err_text = rc == RESP_NO ?
+	                   "Mailbox quota exceeded" : "Operation failed";
+      return 1;
+    }
+
+  imap4d_enter_critical ();
+  if (mu_mailbox_get_locker (mbox, &lck) == 0 && lck)
     {
-      if (flags)
+      rc = mu_locker_lock (lck);
+      if (rc)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_locker_lock", NULL, rc);
+	  imap4d_leave_critical ();
+	  return rc;
+	}
+    }
+  else
+    lck = NULL;
+
+  rc = mu_mailbox_messages_count (mbox, &start);
+  for (i = 0; rc == 0 && i < count; i++)
+    {
+      size_t num = 0;
+      mu_message_t temp = NULL;
+
+      rc = mu_mailbox_append_message (mbox, items[i].msg);
+      if (rc)
+	break;
+      if (items[i].flags || *uids)
 	{
-	  size_t num = 0;
-	  mu_attribute_t attr = NULL;
-	  mu_message_t temp;
-	  
 	  mu_mailbox_messages_count (mbox, &num);
 	  mu_mailbox_get_message (mbox, num, &temp);
+	}
+      if (items[i].flags)
+	{
+	  mu_attribute_t attr = NULL;
+	  
 	  mu_message_get_attribute (temp, &attr);
-	  mu_attribute_set_flags (attr, flags);
+	  mu_attribute_set_flags (attr, items[i].flags);
+	}
+      if (*uids && (!temp || mu_message_get_uid (temp, &(*uids)[i])))
+	{
+	  free (*uids);
+	  *uids = NULL;
 	}
       /* FIXME: If not INBOX */
-      quota_update (size);
+      quota_update (items[i].size);
+    }
+
+  if (rc && i > 0)
+    {
+      int res;
+      size_t j;
+
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_append_message", NULL, rc);
+      res = append_rollback (mbox, start, i);
+      if (res)
+	mu_diag_funcall (MU_DIAG_ERROR, "append_rollback", NULL, res);
+      else
+	for (j = 0; j < i; j++)
+	  quota_update (- items[j].size);
     }
+
+  if (lck)
+    mu_locker_unlock (lck);
   imap4d_leave_critical ();
-  
-  mu_message_unref (msg);
-  if (env)
-    mu_envelope_destroy (&env, mu_envelope_get_owner (env));
 
   return rc;
 }
 
-
-/* APPEND mbox [(flags)] [date_time] message_literal */
+/* Format the APPENDUID response code for COUNT messages with the
+   given UIDS. */
+static char *
+appenduid_format (unsigned long uidvalidity, size_t *uids, size_t count)
+{
+  mu_opool_t pool;
+  char *ret;
+  
+  mu_opool_create (&pool, MU_OPOOL_ENOMEMABRT);
+  mu_opool_appendz (pool, "[APPENDUID ");
+  mu_opool_appendz (pool, mu_umaxtostr (0, uidvalidity));
+  mu_opool_append_char (pool, ' ');
+  imap4d_uidlist_format (pool, uids, count);
+  mu_opool_appendz (pool, "] Completed");
+  mu_opool_append_char (pool, 0);
+  ret = mu_strdup (mu_opool_finish (pool, NULL));
+  mu_opool_destroy (&pool);
+  return ret;
+}
+
+/*
+  6.3.11 APPEND Command
+
+  Arguments:  mailbox name
+              OPTIONAL flag parenthesized list
+              OPTIONAL date/time string
+              message literal
+
+  RFC 3502 (MULTIAPPEND) allows for several sets of flags, date/time
+  and literal to follow the mailbox name:
+
+  append          = "APPEND" SP mailbox 1*append-message
+  append-message  = append-opts SP append-data
+  append-opts     = [SP flag-list] [SP date-time]
+*/
 int
 imap4d_append (struct imap4d_session *session,
                struct imap4d_command *command, imap4d_tokbuf_t tok)
@@ -201,13 +375,15 @@ imap4d_append (struct imap4d_session *session,
   int i;
   char *mboxname;
   mu_record_t record;
-  int flags = 0;
   mu_mailbox_t dest_mbox = NULL;
   int status;
   int argc = imap4d_tokbuf_argc (tok);
-  char *date_time;
-  char *msg_text;
+  struct append_item *items = NULL;
+  size_t count = 0, max = 0, n;
   char *err_text = "[TRYCREATE] failed";
+  unsigned long uidvalidity = 0;
+  char *uidtext = NULL;
+  size_t *uids = NULL;
   
   if (argc < 4)
     return io_completion_response (command, RESP_BAD, "Too few arguments");
@@ -217,45 +393,91 @@ imap4d_append (struct imap4d_session *session,
     return io_completion_response (command, RESP_BAD, "Too few arguments");
 
   i = IMAP4_ARG_2;
-  if (imap4d_tokbuf_getarg (tok, i)[0] == '(')
+  while (i < argc)
     {
-      while (++i < argc)
+      struct append_item *item;
+      int flags = 0;
+      char *date_time = NULL;
+      mu_stream_t spool = NULL;
+      
+      if (imap4d_tokbuf_getarg (tok, i)[0] == '(')
 	{
-	  char *arg = imap4d_tokbuf_getarg (tok, i);
+	  while (++i < argc)
+	    {
+	      char *arg = imap4d_tokbuf_getarg (tok, i);
 	  
-	  if (arg[0] == ')')
-	    break;
-	  if (mu_imap_flag_to_attribute (arg, &flags))
-	    return io_completion_response (command, RESP_BAD,
-					   "Unrecognized flag");
+	      if (arg[0] == ')')
+		break;
+	      if (mu_imap_flag_to_attribute (arg, &flags))
+		{
+		  free (items);
+		  return io_completion_response (command, RESP_BAD,
+						 "Unrecognized flag");
+		}
+	    }
+	  if (i == argc)
+	    {
+	      free (items);
+	      return io_completion_response (command, RESP_BAD, 
+					     "Missing closing parenthesis");
+	    }
+	  i++;
 	}
+
+      /* The message must be a literal.  For compatibility with older
+	 versions, a quoted string is accepted as the last argument. */
+      if (i + 1 < argc
+	  && imap4d_tokbuf_getliteral (tok, i, NULL) == MU_ERR_NOENT)
+	{
+	  /* Date/time is present */
+	  date_time = imap4d_tokbuf_getarg (tok, i);
+	  i++;
+	}
+
       if (i == argc)
-	return io_completion_response (command, RESP_BAD, 
-	                               "Missing closing parenthesis");
-      i++;
-    }
+	{
+	  free (items);
+	  return io_completion_response (command, RESP_BAD,
+					 "Too few arguments");
+	}
+      
+      switch (imap4d_tokbuf_getliteral (tok, i, &spool))
+	{
+	case 0:
+	  break;
 
-  switch (argc - i)
-    {
-    case 2:
-      /* Date/time is present */
-      date_time = imap4d_tokbuf_getarg (tok, i);
-      i++;
-      break;
+	case MU_ERR_NOENT:
+	  if (i + 1 == argc)
+	    break;
+	  free (items);
+	  return io_completion_response (command, RESP_BAD,
+					 "Too many arguments");
 
-    case 1:
-      date_time = NULL;
-      break;
+	default:
+	  /* The literal could not be spooled */
+	  free (items);
+	  return io_completion_response (command, RESP_NO,
+					 "Operation failed");
+	}
 
-    default:
-      return io_completion_response (command, RESP_BAD, "Too many arguments");
+      if (count == max)
+	items = mu_2nrealloc (items, &max, sizeof (items[0]));
+      item = &items[count++];
+      memset (item, 0, sizeof (*item));
+      item->flags = flags;
+      item->date_time = date_time;
+      item->text = imap4d_tokbuf_getarg (tok, i);
+      item->spool = spool;
+      i++;
     }
 
-  msg_text = imap4d_tokbuf_getarg (tok, i);
-
   mboxname = namespace_get_name (mboxname, &record, NULL);
   if (!mboxname)
-    return io_completion_response (command, RESP_NO, "Couldn't open mailbox"); 
+    {
+      free (items);
+      return io_completion_response (command, RESP_NO,
+				     "Couldn't open mailbox");
+    }
 
   status = mu_mailbox_create_from_record (&dest_mbox, record, mboxname);
   if (status == 0)
@@ -264,18 +486,36 @@ imap4d_append (struct imap4d_session *session,
       status = mu_mailbox_open (dest_mbox, MU_STREAM_RDWR);
       if (status == 0)
 	{
-	  status = imap4d_append0 (dest_mbox, flags, date_time, msg_text,
-				   &err_text);
+	  /* Obtain UIDVALIDITY first, so that the new messages are
+	     assigned UIDs.  */
+	  if (mu_mailbox_uidvalidity (dest_mbox, &uidvalidity) == 0
+	      && uidvalidity)
+	    uids = mu_calloc (count, sizeof (uids[0]));
+	  status = imap4d_append0 (dest_mbox, items, count, &uids, &err_text);
+	  if (status == 0 && uids)
+	    uidtext = appenduid_format (uidvalidity, uids, count);
+	  free (uids);
 	  mu_mailbox_close (dest_mbox);
 	}
       mu_mailbox_destroy (&dest_mbox);
     }
-  
+
+  for (n = 0; n < count; n++)
+    append_item_free (&items[n]);
+  free (items);
   free (mboxname);
+  
   if (status == 0)
-    return io_completion_response (command, RESP_OK, "Completed");
+    {
+      /* RFC 4315, 3: APPENDUID response code */
+      if (uidtext)
+	{
+	  status = io_completion_response (command, RESP_OK, "%s", uidtext);
+	  free (uidtext);
+	  return status;
+	}
+      return io_completion_response (command, RESP_OK, "Completed");
+    }
 
   return io_completion_response (command, RESP_NO, "%s", err_text);
 }
-
-
@@ -58,6 +58,9 @@ imap4d_bye_command (int reason, struct imap4d_command *command)
 	{
 	  imap4d_enter_critical ();
 	  mu_mailbox_flush (mbox, 0);
+	  fcache_close ();
+	  modseq_close ();
+	  sort_key_close ();
 	  mu_mailbox_close (mbox);
 	  manlock_unlock (mbox);
 	  mu_mailbox_destroy (&mbox);
@@ -51,6 +51,12 @@ imap4d_capability_init ()
     "IDLE",
     "LITERAL+",
     "UNSELECT",
+    "SORT",
+    "THREAD=ORDEREDSUBJECT",
+    "THREAD=REFERENCES",
+    "UIDPLUS",
+    "MOVE",
+    "MULTIAPPEND",
     NULL
   };
   int i;
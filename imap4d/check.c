@@ -27,11 +27,79 @@
                BAD - command unknown or arguments invalid
 */
 
+/* Pending attribute changes of AMD mailboxes are written back at most
+   this many seconds after the command that made them.  0 disables
+   the timed write-back. */
+unsigned checkpoint_interval = 60;
+
+/* Time of the next scheduled checkpoint.  Zero if none. */
+static struct timeval checkpoint_time;
+
+/* Return true if the selected mailbox is writable and keeps attribute
+   changes in memory until synchronized, i.e. is an MH or maildir one.
+   Synchronizing other formats (mbox, dotmail) rewrites the mailbox file,
+   which is too expensive to do without an explicit request. */
+static int
+checkpoint_mailbox_p (void)
+{
+  int flags;
+  mu_url_t url;
+  
+  return mbox
+         && mu_mailbox_get_flags (mbox, &flags) == 0
+         && (flags & MU_STREAM_WRITE)
+         && mu_mailbox_get_url (mbox, &url) == 0
+         && (mu_url_is_scheme (url, "maildir")
+	     || mu_url_is_scheme (url, "mh"));
+}
+
+/* Write back pending changes of the selected mailbox. */
+void
+imap4d_checkpoint (void)
+{
+  timerclear (&checkpoint_time);
+  if (checkpoint_mailbox_p ())
+    {
+      int rc;
+      
+      imap4d_enter_critical ();
+      rc = mu_mailbox_sync (mbox);
+      imap4d_leave_critical ();
+      if (rc)
+	mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_sync", NULL, rc);
+    }
+}
+
+/* Schedule a checkpoint after a command that could have changed
+   message attributes. */
+void
+imap4d_checkpoint_schedule (void)
+{
+  if (checkpoint_interval && !timerisset (&checkpoint_time)
+      && checkpoint_mailbox_p ())
+    {
+      gettimeofday (&checkpoint_time, NULL);
+      checkpoint_time.tv_sec += checkpoint_interval;
+    }
+}
+
+/* If a checkpoint is scheduled, store its time in TV and return 0.
+   Otherwise, return MU_ERR_NOENT. */
+int
+imap4d_checkpoint_time (struct timeval *tv)
+{
+  if (!timerisset (&checkpoint_time))
+    return MU_ERR_NOENT;
+  *tv = checkpoint_time;
+  return 0;
+}
+
 int
 imap4d_check (struct imap4d_session *session,
               struct imap4d_command *command, imap4d_tokbuf_t tok)
 {
   if (imap4d_tokbuf_argc (tok) != 2)
     return io_completion_response (command, RESP_BAD, "Invalid arguments");
+  imap4d_checkpoint ();
   return io_completion_response (command, RESP_OK, "Completed");
 }
@@ -41,6 +41,10 @@ imap4d_close0 (struct imap4d_command *command, imap4d_tokbuf_t tok,
 	}
     }
   
+  fcache_close ();
+  modseq_close ();
+  sort_key_close ();
+  
   /* No messages are removed, and no error is given, if the mailbox is
      selected by an EXAMINE command or is otherwise selected read-only.  */
   imap4d_enter_critical ();
@@ -39,13 +39,18 @@ struct imap4d_command imap4d_command_table [] =
   { "UNSELECT", imap4d_unselect, STATE_SEL, STATE_AUTH, STATE_AUTH, NULL },
   { "EXPUNGE", imap4d_expunge, STATE_SEL, STATE_NONE, STATE_NONE, NULL },
   { "SEARCH", imap4d_search, STATE_SEL, STATE_NONE, STATE_NONE, NULL },
+  { "SORT", imap4d_sort, STATE_SEL, STATE_NONE, STATE_NONE, NULL },
+  { "THREAD", imap4d_thread, STATE_SEL, STATE_NONE, STATE_NONE, NULL },
   { "FETCH", imap4d_fetch, STATE_SEL, STATE_NONE, STATE_NONE, NULL },
   { "STORE", imap4d_store, STATE_SEL, STATE_NONE, STATE_NONE, NULL },
   { "COPY", imap4d_copy, STATE_SEL, STATE_NONE, STATE_NONE, NULL },
+  { "MOVE", imap4d_move, STATE_SEL, STATE_NONE, STATE_NONE, NULL },
   { "UID", imap4d_uid, STATE_SEL, STATE_NONE, STATE_NONE, NULL },
   { "NAMESPACE", imap4d_namespace, STATE_AUTH | STATE_SEL, STATE_NONE, STATE_NONE, NULL },
   { "ID", imap4d_id, STATE_AUTH | STATE_SEL, STATE_NONE, STATE_NONE, NULL },
   { "IDLE", imap4d_idle, STATE_SEL, STATE_NONE, STATE_NONE, NULL },
+  { "ENABLE", imap4d_enable, STATE_AUTH, STATE_NONE, STATE_NONE, NULL },
+  { "COMPRESS", imap4d_compress, STATE_AUTH | STATE_SEL, STATE_NONE, STATE_NONE, NULL },
   { "STARTTLS", imap4d_starttls, STATE_NONAUTH, STATE_NONE, STATE_NONE, NULL },
   { NULL, 0, 0, 0, 0, NULL }
 };
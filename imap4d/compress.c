@@ -0,0 +1,74 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   GNU Mailutils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Mailutils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Implementation of COMPRESS extension (RFC 4978) */
+
+#include "imap4d.h"
+
+/* Compression level to use.  0 means COMPRESS is disabled. */
+int compression_level;
+
+/*
+3.  The COMPRESS Command
+
+   Arguments: Name of compression mechanism: "DEFLATE".
+
+   Responses: None
+
+   Result:    OK The server will compress its responses and expects the
+                 client to compress its commands.
+              NO Compression is already active via another layer.
+              BAD Command unknown, invalid or unknown argument, or COMPRESS
+                 already active.
+
+   The compression layer is installed immediately after the tagged OK
+   response has been sent.  Compressed output is flushed at response
+   boundaries, i.e. whenever the server is about to wait for the next
+   command.
+*/
+int
+imap4d_compress (struct imap4d_session *session,
+		 struct imap4d_command *command, imap4d_tokbuf_t tok)
+{
+  int status;
+
+  if (!compression_level)
+    return io_completion_response (command, RESP_BAD, "Invalid command");
+
+  if (imap4d_tokbuf_argc (tok) != 3)
+    return io_completion_response (command, RESP_BAD, "Invalid arguments");
+
+  if (mu_c_strcasecmp (imap4d_tokbuf_getarg (tok, IMAP4_ARG_1), "DEFLATE"))
+    return io_completion_response (command, RESP_BAD,
+				   "Unsupported compression mechanism");
+
+  if (io_compression_active ())
+    return io_completion_response (command, RESP_NO,
+				   "[COMPRESSIONACTIVE] DEFLATE active");
+
+  status = io_completion_response (command, RESP_OK, "DEFLATE active");
+  io_flush ();
+
+  if (io_compress (compression_level))
+    {
+      mu_diag_output (MU_DIAG_ERROR, _("session terminated"));
+      util_bye ();
+      exit (EX_OK);
+    }
+  imap4d_capability_remove (IMAP_CAPA_COMPRESS);
+
+  return status;
+}
@@ -57,7 +57,6 @@ imap4d_copy (struct imap4d_session *session,
 
 struct copy_env
 {
-  mu_mailbox_t dst;
   mu_off_t total;
   int ret;
   char **err_text;
@@ -81,33 +80,12 @@ size_sum (size_t msgno, mu_message_t msg, void *data)
   return 0;
 }
 
-static int
-do_copy (size_t msgno, mu_message_t msg, void *data)
-{
-  struct copy_env *env = data;
-  int status;
-
-  imap4d_enter_critical ();
-  status = mu_mailbox_append_message (env->dst, msg);
-  imap4d_leave_critical ();
-  if (status)
-    {
-      mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_append_message", NULL,
-		       status);
-      env->ret = RESP_BAD;
-      return MU_ERR_FAILURE;
-    }
-
-  return 0;
-}
-
 static int
 try_copy (mu_mailbox_t dst, mu_msgset_t msgset, char **err_text)
 {
   int rc;
   struct copy_env env;
 
-  env.dst = dst;
   env.total = 0;
   env.ret = RESP_OK;
   env.err_text = err_text;
@@ -126,16 +104,101 @@ try_copy (mu_mailbox_t dst, mu_msgset_t msgset, char **err_text)
       *env.err_text = "Mailbox quota exceeded";
       return RESP_NO;
     }
-  env.total = 0;
-  rc = mu_msgset_foreach_message (msgset, do_copy, &env);
-  quota_update (env.total);
+  imap4d_enter_critical ();
+  rc = mu_mailbox_append_msgset (dst, mbox, msgset);
+  imap4d_leave_critical ();
   if (rc)
-    return RESP_NO;
-  return env.ret;
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_append_msgset", NULL, rc);
+      return RESP_NO;
+    }
+  quota_update (env.total);
+  return RESP_OK;
 }
   
+/* UIDPLUS (RFC 4315) support: UIDs of the copied messages. */
+struct copyuid
+{
+  unsigned long uidvalidity;   /* UIDVALIDITY of the destination */
+  size_t *src;                 /* UIDs of the source messages */
+  size_t *dst;                 /* UIDs assigned to their copies */
+  size_t count;                /* Number of used entries in both arrays */
+  size_t max;                  /* Number of allocated entries */
+  int valid;                   /* Non-zero if the above is valid */
+};
+
 static int
-safe_copy (mu_mailbox_t dst, mu_msgset_t msgset, char **err_text)
+copyuid_add_src (size_t uid, void *data)
+{
+  struct copyuid *cu = data;
+  if (cu->count == cu->max)
+    cu->src = mu_2nrealloc (cu->src, &cu->max, sizeof (cu->src[0]));
+  cu->src[cu->count++] = uid;
+  return 0;
+}
+
+static void
+copyuid_free (struct copyuid *cu)
+{
+  free (cu->src);
+  free (cu->dst);
+}
+
+/* Format the list of UIDS as an IMAP sequence set.  The UIDs are in
+   ascending order, so that runs of consecutive values can be collapsed
+   into ranges without affecting the correspondence between source and
+   destination sets. */
+void
+imap4d_uidlist_format (mu_opool_t pool, size_t *uids, size_t count)
+{
+  size_t i, j;
+
+  for (i = 0; i < count; i = j)
+    {
+      for (j = i + 1; j < count && uids[j] == uids[j-1] + 1; j++)
+	;
+      if (i)
+	mu_opool_append_char (pool, ',');
+      mu_opool_appendz (pool, mu_umaxtostr (0, uids[i]));
+      if (j - i > 1)
+	{
+	  mu_opool_append_char (pool, ':');
+	  mu_opool_appendz (pool, mu_umaxtostr (0, uids[j-1]));
+	}
+    }
+}
+
+/* Return the COPYUID response code for CU followed by TEXT.  The
+   returned string is valid until the next call. */
+static char *
+copyuid_format (struct copyuid *cu, char const *text)
+{
+  static char *retbuf;
+  mu_opool_t pool;
+
+  free (retbuf);
+  retbuf = NULL;
+  if (!cu->valid || cu->count == 0)
+    return (char*) text;
+  
+  mu_opool_create (&pool, MU_OPOOL_ENOMEMABRT);
+  mu_opool_appendz (pool, "[COPYUID ");
+  mu_opool_appendz (pool, mu_umaxtostr (0, cu->uidvalidity));
+  mu_opool_append_char (pool, ' ');
+  imap4d_uidlist_format (pool, cu->src, cu->count);
+  mu_opool_append_char (pool, ' ');
+  imap4d_uidlist_format (pool, cu->dst, cu->count);
+  mu_opool_appendz (pool, "] ");
+  mu_opool_appendz (pool, text);
+  mu_opool_append_char (pool, 0);
+  retbuf = mu_strdup (mu_opool_finish (pool, NULL));
+  mu_opool_destroy (&pool);
+  return retbuf;
+}
+
+static int
+safe_copy (mu_mailbox_t dst, mu_msgset_t msgset, struct copyuid *cu,
+	   char **err_text)
 {
   size_t nmesg;
   int status;
@@ -149,6 +212,11 @@ safe_copy (mu_mailbox_t dst, mu_msgset_t msgset, char **err_text)
       return RESP_NO;
     }
 
+  /* Obtain the UIDVALIDITY before copying: some formats assign UIDs
+     to the appended messages only if it has been requested. */
+  cu->valid = mu_mailbox_uidvalidity (dst, &cu->uidvalidity) == 0
+              && mu_msgset_foreach_msguid (msgset, copyuid_add_src, cu) == 0;
+
   status = try_copy (dst, msgset, err_text);
   if (status != RESP_OK)
     {
@@ -195,12 +263,32 @@ safe_copy (mu_mailbox_t dst, mu_msgset_t msgset, char **err_text)
 	}
       return RESP_NO;
     }
+
+  if (cu->valid)
+    {
+      size_t i;
+
+      cu->dst = mu_calloc (cu->count, sizeof (cu->dst[0]));
+      for (i = 0; i < cu->count; i++)
+	{
+	  mu_message_t msg;
+	  
+	  if (mu_mailbox_get_message (dst, nmesg + i + 1, &msg)
+	      || mu_message_get_uid (msg, &cu->dst[i]))
+	    {
+	      cu->valid = 0;
+	      break;
+	    }
+	}
+    }
   
   return RESP_OK;
 }
 
-int
-imap4d_copy0 (imap4d_tokbuf_t tok, int isuid, char **err_text)
+/* Copy messages to another mailbox.  If MOVE is set, remove them from
+   the current mailbox afterwards (RFC 6851). */
+static int
+copy_messages (imap4d_tokbuf_t tok, int isuid, int move, char **err_text)
 {
   int status;
   char *msgset_str;
@@ -212,6 +300,7 @@ imap4d_copy0 (imap4d_tokbuf_t tok, int isuid, char **err_text)
   int arg = IMAP4_ARG_1 + !!isuid;
   int mode = 0;
   mu_record_t record;
+  struct copyuid cu;
   
   *err_text = NULL;
   if (imap4d_tokbuf_argc (tok) != arg + 2)
@@ -220,6 +309,18 @@ imap4d_copy0 (imap4d_tokbuf_t tok, int isuid, char **err_text)
       return 1;
     }
   
+  if (move)
+    {
+      int flags;
+
+      /* Messages cannot be removed from a mailbox selected by EXAMINE */
+      if (mu_mailbox_get_flags (mbox, &flags) || !(flags & MU_STREAM_WRITE))
+	{
+	  *err_text = "Mailbox is read-only";
+	  return RESP_NO;
+	}
+    }
+  
   msgset_str = imap4d_tokbuf_getarg (tok, arg);
   name = imap4d_tokbuf_getarg (tok, arg + 1);
   status = mu_msgset_create (&msgset, mbox, MU_MSGSET_NUM);
@@ -249,6 +350,8 @@ imap4d_copy0 (imap4d_tokbuf_t tok, int isuid, char **err_text)
       return RESP_NO;
     }
 
+  memset (&cu, 0, sizeof (cu));
+  
   /* If the destination mailbox does not exist, a server should return
      an error. */
   status = mu_mailbox_create_from_record (&cmbox, record, mailbox_name);
@@ -258,29 +361,90 @@ imap4d_copy0 (imap4d_tokbuf_t tok, int isuid, char **err_text)
       status = mu_mailbox_open (cmbox, MU_STREAM_RDWR | mode);
       if (status == 0)
 	{
-	  mu_list_t msglist;
-	  mu_msgset_get_list (msgset, &msglist);
-	  if (!mu_list_is_empty (msglist))
-	    status = safe_copy (cmbox, msgset, err_text);
+	  if (!mu_msgset_is_empty (msgset))
+	    status = safe_copy (cmbox, msgset, &cu, err_text);
 	  mu_mailbox_close (cmbox);
 	}
       mu_mailbox_destroy (&cmbox);
     }
-  mu_msgset_free (msgset);
   free (mailbox_name);
   
   if (status == 0)
     {
-      *err_text = "Completed";
-      return RESP_OK;
+      if (move)
+	{
+	  /* RFC 6851, 4.3: the server SHOULD send the COPYUID response
+	     code in an untagged OK before sending the EXPUNGE or VANISHED
+	     responses. */
+	  if (cu.valid && cu.count)
+	    io_untagged_response (RESP_OK, "%s", copyuid_format (&cu, "Moved"));
+	  if (imap4d_expunge_msgset (msgset, 1))
+	    {
+	      *err_text = "Expunge failed";
+	      status = RESP_NO;
+	    }
+	  else
+	    {
+	      *err_text = "Completed";
+	      status = RESP_OK;
+	    }
+	}
+      else
+	{
+	  *err_text = copyuid_format (&cu, "Completed");
+	  status = RESP_OK;
+	}
+    }
+  else
+    {
+      /* Unless it is certain that the destination mailbox cannot be
+	 created, the server MUST send the response code "[TRYCREATE]" as
+	 the prefix of the text of the tagged NO response.  This gives a
+	 hint to the client that it can attempt a CREATE command and retry
+	 the copy if the CREATE is successful.  */
+      if (!*err_text)
+	*err_text = "[TRYCREATE] failed";
+      status = RESP_NO;
     }
+  copyuid_free (&cu);
+  mu_msgset_free (msgset);
+  return status;
+}
+
+int
+imap4d_copy0 (imap4d_tokbuf_t tok, int isuid, char **err_text)
+{
+  return copy_messages (tok, isuid, 0, err_text);
+}
+
+int
+imap4d_move0 (imap4d_tokbuf_t tok, int isuid, char **err_text)
+{
+  return copy_messages (tok, isuid, 1, err_text);
+}
+
+/*
+RFC 6851, 3.1.  MOVE Command
+
+   Arguments:  sequence set
+               mailbox name
 
-  /* Unless it is certain that the destination mailbox cannot be created,
-     the server MUST send the response code "[TRYCREATE]" as the prefix
-     of the text of the tagged NO response.  This gives a hint to the
-     client that it can attempt a CREATE command and retry the copy if
-     the CREATE is successful.  */
-  if (!*err_text)
-    *err_text = "[TRYCREATE] failed";
-  return RESP_NO;
+   Responses:  no specific responses for this command
+
+   Result:     OK - move completed
+               NO - move error: can't move those messages or to that
+                    name
+               BAD - command unknown or arguments invalid
+*/
+int
+imap4d_move (struct imap4d_session *session,
+             struct imap4d_command *command, imap4d_tokbuf_t tok)
+{
+  int rc;
+  char *text;
+
+  if (imap4d_tokbuf_argc (tok) != 4)
+    return io_completion_response (command, RESP_BAD, "Invalid arguments");
+  rc = imap4d_move0 (tok, 0, &text);
+  return io_completion_response (command, rc, "%s", text);
 }
@@ -0,0 +1,87 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   GNU Mailutils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Mailutils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Implementation of ENABLE extension (RFC 5161) */
+
+#include "imap4d.h"
+
+struct enable_tab
+{
+  char *name;
+  int mask;
+};
+
+static struct enable_tab enable_tab[] = {
+  { "CONDSTORE", IMAP4D_ENABLE_CONDSTORE },
+  /* RFC 7162, 3.2.3: enabling QRESYNC implies enabling CONDSTORE */
+  { "QRESYNC",   IMAP4D_ENABLE_QRESYNC|IMAP4D_ENABLE_CONDSTORE },
+  { NULL }
+};
+
+static struct enable_tab *
+find_enable_tab (char const *name)
+{
+  struct enable_tab *p;
+
+  for (p = enable_tab; p->name; p++)
+    if (mu_c_strcasecmp (p->name, name) == 0)
+      return p;
+  return NULL;
+}
+
+/*
+3.1.  The ENABLE Command
+
+   Arguments: capability names
+
+   Result:    OK: Relevant capabilities enabled
+              BAD: No arguments, or syntax error in an argument
+
+   The ENABLE command takes a list of capability names, and requests the
+   server to enable the named extensions.  Once enabled using ENABLE,
+   each extension remains active until the IMAP connection is closed.
+   The server responds with an untagged ENABLED response listing the
+   capabilities that were enabled by this command.
+*/
+int
+imap4d_enable (struct imap4d_session *session,
+	       struct imap4d_command *command, imap4d_tokbuf_t tok)
+{
+  int argc = imap4d_tokbuf_argc (tok);
+  int i;
+
+  if (argc < 3)
+    return io_completion_response (command, RESP_BAD, "Invalid arguments");
+
+  io_sendf ("* ENABLED");
+  for (i = IMAP4_ARG_1; i < argc; i++)
+    {
+      char *arg = imap4d_tokbuf_getarg (tok, i);
+      struct enable_tab *ent;
+
+      /* Extensions that are not supported are silently ignored */
+      if (!modseq_dir || (ent = find_enable_tab (arg)) == NULL)
+	continue;
+      /* Respond only with extensions that were not enabled before */
+      if ((enabled_extensions & ent->mask) != ent->mask)
+	{
+	  enabled_extensions |= ent->mask;
+	  io_sendf (" %s", ent->name);
+	}
+    }
+  io_sendf ("\n");
+  return io_completion_response (command, RESP_OK, "Completed");
+}
@@ -45,3 +45,95 @@ imap4d_expunge (struct imap4d_session *session,
   imap4d_sync ();
   return io_completion_response (command, RESP_OK, "Completed");
 }
+
+static int
+mark_deleted (size_t n, mu_message_t msg, void *data)
+{
+  mu_attribute_t attr;
+  mu_list_t marked = data;
+  
+  if (mu_message_get_attribute (msg, &attr) == 0
+      && !mu_attribute_is_deleted (attr))
+    {
+      mu_attribute_set_deleted (attr);
+      mu_list_append (marked, msg);
+    }
+  return 0;
+}
+
+static int
+unmark_deleted (void *item, void *data)
+{
+  mu_attribute_t attr;
+
+  if (mu_message_get_attribute (item, &attr) == 0)
+    mu_attribute_unset_deleted (attr);
+  return 0;
+}
+
+/* Expunge messages from MSGSET, leaving intact all other messages
+   marked as \Deleted.  If FORCE is set, all messages in MSGSET are
+   expunged, otherwise only those that have the \Deleted flag set.
+   If the expunge fails, the \Deleted flags set because of FORCE are
+   cleared again.  */
+int
+imap4d_expunge_msgset (mu_msgset_t msgset, int force)
+{
+  mu_list_t marked = NULL;
+  int rc = 0;
+  
+  imap4d_enter_critical ();
+  if (force)
+    {
+      rc = mu_list_create (&marked);
+      if (rc == 0)
+	rc = mu_msgset_foreach_message (msgset, mark_deleted, marked);
+    }
+  if (rc == 0)
+    {
+      rc = mu_mailbox_expunge_msgset (mbox, msgset);
+      if (rc)
+	mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_expunge_msgset", NULL, rc);
+    }
+  if (rc && marked)
+    mu_list_foreach (marked, unmark_deleted, NULL);
+  imap4d_leave_critical ();
+  mu_list_destroy (&marked);
+  
+  imap4d_sync_invalidate ();
+  imap4d_sync ();
+  return rc;
+}
+
+/* UID EXPUNGE sequence-set (RFC 4315, 2.1) */
+int
+imap4d_expunge0 (imap4d_tokbuf_t tok, int isuid, char **err_text)
+{
+  mu_msgset_t msgset;
+  char *end;
+  int rc;
+  
+  if (imap4d_tokbuf_argc (tok) != IMAP4_ARG_2 + 1)
+    {
+      *err_text = "Invalid arguments";
+      return RESP_BAD;
+    }
+  rc = mu_msgset_create (&msgset, mbox, MU_MSGSET_NUM);
+  if (rc)
+    {
+      *err_text = "Software error";
+      return RESP_BAD;
+    }
+  rc = mu_msgset_parse_imap (msgset, MU_MSGSET_UID,
+			     imap4d_tokbuf_getarg (tok, IMAP4_ARG_2), &end);
+  if (rc)
+    {
+      mu_msgset_free (msgset);
+      *err_text = "Error parsing message set";
+      return RESP_BAD;
+    }
+  rc = imap4d_expunge_msgset (msgset, 0);
+  mu_msgset_free (msgset);
+  *err_text = "Completed";
+  return rc ? RESP_NO : RESP_OK;
+}
@@ -0,0 +1,353 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   GNU Mailutils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Mailutils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "imap4d.h"
+#include <mailutils/assoc.h>
+
+/* Persistent cache of serialized FETCH items.
+
+   Computing ENVELOPE and BODYSTRUCTURE requires parsing message headers,
+   addresses and MIME structure.  Clients tend to request these items for
+   the whole mailbox each time they reconnect, so the rendered responses
+   are kept in a per-mailbox cache file.
+
+   The cache file is a sequence of NUL-terminated key/value pairs.  The
+   key is "UID.K", where K is the item kind (see enum fcache_kind).  The
+   value is "SIZE.LINES TEXT", where SIZE and LINES are the message size
+   and number of lines at the time TEXT was rendered.  A special key
+   "uidvalidity" keeps the UIDVALIDITY of the mailbox.  When it changes,
+   the cache is discarded.
+
+   The cache is loaded when a mailbox is selected and written back when
+   it is closed.  Writing is done to a temporary file, which is then
+   renamed over the cache file, so that concurrent sessions never see a
+   partially written cache. */
+
+char *fetch_cache_dir;
+
+static mu_assoc_t fcache;         /* Cached items */
+static char *fcache_file;         /* Name of the cache file */
+static int fcache_modified;       /* Cache was modified since loading */
+
+static char const fcache_kind_chr[] = "EBS";
+
+int
+fcache_enabled (void)
+{
+  return fcache != NULL;
+}
+
+static void
+fcache_load (void)
+{
+  mu_stream_t str;
+  char *buf[2] = { NULL, NULL };
+  size_t size[2] = { 0, 0 }, n;
+  int state = 0;
+  int rc;
+
+  rc = mu_file_stream_create (&str, fcache_file, MU_STREAM_READ);
+  if (rc)
+    {
+      if (rc != ENOENT)
+	mu_diag_funcall (MU_DIAG_ERROR, "mu_file_stream_create",
+			 fcache_file, rc);
+      return;
+    }
+
+  while ((rc = mu_stream_getdelim (str, &buf[state], &size[state], 0, &n))
+	 == 0 && n > 0)
+    {
+      if (state == 1)
+	{
+	  char *val = mu_strdup (buf[1]);
+	  if (mu_assoc_install (fcache, buf[0], val))
+	    free (val);
+	}
+      state = !state;
+    }
+  if (rc)
+    mu_diag_funcall (MU_DIAG_ERROR, "mu_stream_getdelim", fcache_file, rc);
+  free (buf[0]);
+  free (buf[1]);
+  mu_stream_destroy (&str);
+}
+
+/* Open the cache for the mailbox MBX. */
+void
+fcache_open (mu_mailbox_t mbx)
+{
+  unsigned long uidvalidity;
+  char *p, uvbuf[64];
+  int rc;
+
+  fcache_close ();
+  if (!fetch_cache_dir)
+    return;
+
+  if (util_uidvalidity (mbx, &uidvalidity))
+    return;
+  fcache_file = util_state_file_name (mbx, fetch_cache_dir);
+  if (!fcache_file)
+    return;
+
+  rc = mu_assoc_create (&fcache, MU_ASSOC_COPY_KEY);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_assoc_create", NULL, rc);
+      free (fcache_file);
+      fcache_file = NULL;
+      return;
+    }
+  mu_assoc_set_destroy_item (fcache, mu_list_free_item);
+  fcache_load ();
+  fcache_modified = 0;
+
+  snprintf (uvbuf, sizeof uvbuf, "%lu", uidvalidity);
+  p = mu_assoc_get (fcache, "uidvalidity");
+  if (!p || strcmp (p, uvbuf))
+    {
+      mu_assoc_clear (fcache);
+      mu_assoc_install (fcache, "uidvalidity", mu_strdup (uvbuf));
+      fcache_modified = 1;
+    }
+}
+
+static int
+uid_cmp (const void *a, const void *b)
+{
+  size_t ua = *(size_t const *)a;
+  size_t ub = *(size_t const *)b;
+  if (ua < ub)
+    return -1;
+  if (ua > ub)
+    return 1;
+  return 0;
+}
+
+/* Return a sorted array of the UIDs of the messages in the current
+   mailbox.  Store its size in *PCOUNT. */
+static size_t *
+fcache_live_uids (size_t *pcount)
+{
+  size_t total, i, n = 0;
+  size_t *uids;
+
+  if (mu_mailbox_messages_count (mbox, &total))
+    return NULL;
+  uids = mu_calloc (total + 1, sizeof (uids[0]));
+  for (i = 1; i <= total; i++)
+    {
+      mu_message_t msg;
+
+      if (mu_mailbox_get_message (mbox, i, &msg) == 0
+	  && mu_message_get_uid (msg, &uids[n]) == 0)
+	n++;
+    }
+  qsort (uids, n, sizeof (uids[0]), uid_cmp);
+  *pcount = n;
+  return uids;
+}
+
+static int
+fcache_key_live (char const *key, size_t *uids, size_t count)
+{
+  char *p;
+  size_t uid = strtoul (key, &p, 10);
+
+  if (*p != '.')
+    return 1;
+  return bsearch (&uid, uids, count, sizeof (uids[0]), uid_cmp) != NULL;
+}
+
+/* Drop entries for the messages that have been expunged. */
+static void
+fcache_prune (void)
+{
+  mu_iterator_t itr;
+  size_t *uids, count;
+  int rc;
+
+  uids = fcache_live_uids (&count);
+  if (!uids)
+    return;
+  rc = mu_assoc_get_iterator (fcache, &itr);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_assoc_get_iterator", NULL, rc);
+      free (uids);
+      return;
+    }
+  for (mu_iterator_first (itr); !mu_iterator_is_done (itr);
+       mu_iterator_next (itr))
+    {
+      const char *name;
+      void *val;
+
+      mu_iterator_current_kv (itr, (const void **)&name, &val);
+      if (!fcache_key_live (name, uids, count))
+	{
+	  mu_iterator_ctl (itr, mu_itrctl_delete, NULL);
+	  fcache_modified = 1;
+	}
+    }
+  mu_iterator_destroy (&itr);
+  free (uids);
+}
+
+static void
+fcache_save (void)
+{
+  struct mu_tempfile_hints hints;
+  char *dir, *tmpname;
+  mu_stream_t str;
+  mu_iterator_t itr;
+  int fd, rc;
+
+  dir = mu_strdup (fcache_file);
+  *strrchr (dir, '/') = 0;
+  hints.tmpdir = dir;
+  rc = mu_tempfile (&hints, MU_TEMPFILE_TMPDIR, &fd, &tmpname);
+  free (dir);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_tempfile", fcache_file, rc);
+      return;
+    }
+  rc = mu_fd_stream_create (&str, tmpname, fd,
+			    MU_STREAM_WRITE | MU_STREAM_SEEK);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_fd_stream_create", tmpname, rc);
+      close (fd);
+      unlink (tmpname);
+      free (tmpname);
+      return;
+    }
+  mu_stream_set_buffer (str, mu_buffer_full, 0);
+
+  rc = mu_assoc_get_iterator (fcache, &itr);
+  if (rc == 0)
+    {
+      for (mu_iterator_first (itr); rc == 0 && !mu_iterator_is_done (itr);
+	   mu_iterator_next (itr))
+	{
+	  const char *name, *val;
+
+	  mu_iterator_current_kv (itr, (const void **)&name, (void**)&val);
+	  rc = mu_stream_write (str, name, strlen (name) + 1, NULL);
+	  if (rc == 0)
+	    rc = mu_stream_write (str, val, strlen (val) + 1, NULL);
+	}
+      mu_iterator_destroy (&itr);
+    }
+  if (rc == 0)
+    rc = mu_stream_close (str);
+  mu_stream_destroy (&str);
+
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "fcache_save", tmpname, rc);
+      unlink (tmpname);
+    }
+  else if (rename (tmpname, fcache_file))
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "rename", fcache_file, errno);
+      unlink (tmpname);
+    }
+  free (tmpname);
+}
+
+/* Write back and release the cache.  Must be called after the current
+   mailbox has been expunged and before it is closed. */
+void
+fcache_close (void)
+{
+  if (!fcache)
+    return;
+  if (mbox)
+    fcache_prune ();
+  if (fcache_modified)
+    fcache_save ();
+  mu_assoc_destroy (&fcache);
+  free (fcache_file);
+  fcache_file = NULL;
+  fcache_modified = 0;
+}
+
+static int
+fcache_make_key (mu_message_t msg, enum fcache_kind kind,
+		 char *keybuf, size_t keysize,
+		 char *stampbuf, size_t stampsize)
+{
+  size_t uid, size, lines;
+
+  if (mu_message_get_uid (msg, &uid)
+      || mu_message_size (msg, &size)
+      || mu_message_lines (msg, &lines))
+    return 1;
+  snprintf (keybuf, keysize, "%lu.%c", (unsigned long) uid,
+	    fcache_kind_chr[kind]);
+  snprintf (stampbuf, stampsize, "%lu.%lu",
+	    (unsigned long) size, (unsigned long) lines);
+  return 0;
+}
+
+/* Look up the item KIND for message MSG.  On success, store the
+   pointer to the cached text in PTEXT and return 0. */
+int
+fcache_lookup (mu_message_t msg, enum fcache_kind kind, char const **ptext)
+{
+  char key[64], stamp[64];
+  char *val;
+  size_t len;
+
+  if (!fcache || fcache_make_key (msg, kind, key, sizeof key,
+				  stamp, sizeof stamp))
+    return MU_ERR_NOENT;
+  val = mu_assoc_get (fcache, key);
+  if (!val)
+    return MU_ERR_NOENT;
+  len = strlen (stamp);
+  if (strncmp (val, stamp, len) || val[len] != ' ')
+    {
+      /* Message has changed since the item was cached. */
+      mu_assoc_remove (fcache, key);
+      fcache_modified = 1;
+      return MU_ERR_NOENT;
+    }
+  *ptext = val + len + 1;
+  return 0;
+}
+
+/* Store TEXT as the item KIND for message MSG. */
+void
+fcache_store (mu_message_t msg, enum fcache_kind kind, char const *text)
+{
+  char key[64], stamp[64];
+  char *val;
+
+  if (!fcache || fcache_make_key (msg, kind, key, sizeof key,
+				  stamp, sizeof stamp))
+    return;
+  val = mu_alloc (strlen (stamp) + strlen (text) + 2);
+  strcat (strcat (strcpy (val, stamp), " "), text);
+  mu_assoc_remove (fcache, key);
+  if (mu_assoc_install (fcache, key, val))
+    free (val);
+  else
+    fcache_modified = 1;
+}
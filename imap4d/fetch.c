@@ -15,6 +15,7 @@
    along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "imap4d.h"
+#include <inttypes.h>
 #include <ctype.h>
 #include <mailutils/assoc.h>
 
@@ -32,6 +33,8 @@
 struct fetch_runtime_closure
 {
   int eltno;           /* Serial number of the last output FETCH element */
+  uintmax_t changedsince; /* Output only messages modified after this
+			     mod-sequence */
   size_t msgno;        /* Sequence number of the message being processed */
   mu_message_t msg;    /* The message itself */
   mu_list_t msglist;   /* A list of referenced messages.  See KLUDGE below. */
@@ -64,6 +67,10 @@ struct fetch_parse_closure
   int isuid;
   mu_list_t fnlist;
   mu_msgset_t msgset;
+  mu_msgset_t uidset;         /* UIDs, as given in the request */
+  uintmax_t changedsince;     /* CHANGEDSINCE modifier */
+  int vanished;               /* VANISHED modifier */
+  int modseq;                 /* MODSEQ item requested */
 };
 
 
@@ -574,6 +581,7 @@ set_seen (struct fetch_function_closure *ffc,
 	{
 	  io_sendf ("FLAGS (\\Seen) ");
 	  mu_attribute_set_read (attr);
+	  modseq_touch (frt->msgno);
 	}
     }
 }
@@ -814,12 +822,75 @@ _frt_uid (struct fetch_function_closure *ffc,
   return RESP_OK;
 }
 
+/* MODSEQ (RFC 7162) */
+static int
+_frt_modseq (struct fetch_function_closure *ffc,
+	     struct fetch_runtime_closure *frt)
+{
+  io_sendf ("%s (%s)", ffc->name, mu_umaxtostr (0, modseq_get (frt->msgno)));
+  return RESP_OK;
+}
+
+/* Send the item KIND of the message MSG.  If the item is found in the
+   fetch cache, send it from there.  Otherwise, call RENDER to produce it.
+   If the cache is enabled, the output of RENDER is captured and stored
+   in the cache before sending. */
+static int
+fetch_send_cached (mu_message_t msg, enum fcache_kind kind,
+		   int (*render) (mu_message_t, int), int extension)
+{
+  char const *text;
+  mu_stream_t str, ostr;
+  mu_off_t size;
+  char *buf;
+  int rc;
+  
+  if (fcache_lookup (msg, kind, &text) == 0)
+    return io_send_bytes (text, strlen (text));
+
+  if (!fcache_enabled ()
+      || mu_memory_stream_create (&str, MU_STREAM_RDWR))
+    return render (msg, extension);
+
+  ostr = io_redirect (str);
+  rc = render (msg, extension);
+  io_redirect (ostr);
+
+  if (rc == RESP_OK
+      && mu_stream_size (str, &size) == 0
+      && mu_stream_seek (str, 0, MU_SEEK_SET, NULL) == 0)
+    {
+      buf = mu_alloc (size + 1);
+      rc = mu_stream_read (str, buf, size, NULL);
+      if (rc == 0)
+	{
+	  buf[size] = 0;
+	  fcache_store (msg, kind, buf);
+	  io_send_bytes (buf, size);
+	}
+      free (buf);
+    }
+  else
+    rc = 1;
+  mu_stream_destroy (&str);
+  if (rc)
+    /* Capturing failed: render directly to the output. */
+    rc = render (msg, extension);
+  return rc;
+}
+
+static int
+render_envelope (mu_message_t msg, int extension)
+{
+  return fetch_envelope0 (msg);
+}
+
 static int
 _frt_envelope (struct fetch_function_closure *ffc,
 	       struct fetch_runtime_closure *frt)
 {
   io_sendf ("%s (", ffc->name);
-  fetch_envelope0 (frt->msg);
+  fetch_send_cached (frt->msg, FCACHE_ENVELOPE, render_envelope, 0);
   io_sendf (")");
   return RESP_OK;
 }
@@ -903,7 +974,8 @@ _frt_bodystructure (struct fetch_function_closure *ffc,
 		    struct fetch_runtime_closure *frt)
 {
   io_sendf ("%s (", ffc->name);
-  fetch_bodystructure0 (frt->msg, 1); /* 1 means with extension data.  */
+  /* 1 means with extension data.  */
+  fetch_send_cached (frt->msg, FCACHE_BODYSTRUCTURE, fetch_bodystructure0, 1);
   io_sendf (")");
   return RESP_OK;
 }
@@ -913,7 +985,7 @@ _frt_bodystructure0 (struct fetch_function_closure *ffc,
 		     struct fetch_runtime_closure *frt)
 {
   io_sendf ("%s (", ffc->name);
-  fetch_bodystructure0 (frt->msg, 0);
+  fetch_send_cached (frt->msg, FCACHE_BODY, fetch_bodystructure0, 0);
   io_sendf (")");
   return RESP_OK;
 }
@@ -1260,6 +1332,7 @@ static struct fetch_att_tab fetch_att_tab[] = {
   { "ENVELOPE", _frt_envelope },
   { "FLAGS", _frt_flags },
   { "INTERNALDATE", _frt_internaldate },
+  { "MODSEQ", _frt_modseq },
   { "UID", _frt_uid },
   { NULL }
 };
@@ -1594,7 +1667,19 @@ parse_fetch_att (imap4d_parsebuf_t p)
   ent = find_fetch_att_tab (p->token);
   if (ent)
     {
-      if (!(ent->fun == _frt_uid && pclos->isuid))
+      if (ent->fun == _frt_modseq)
+	{
+	  if (!modseq_enabled ())
+	    imap4d_parsebuf_exit (p, "Mailbox does not support mod-sequences");
+	  /* FETCH MODSEQ is a CONDSTORE enabling command. */
+	  enabled_extensions |= IMAP4D_ENABLE_CONDSTORE;
+	  if (!pclos->modseq)
+	    {
+	      pclos->modseq = 1;
+	      append_simple_function (pclos, ent->name, ent->fun);
+	    }
+	}
+      else if (!(ent->fun == _frt_uid && pclos->isuid))
 	append_simple_function (pclos, ent->name, ent->fun);
       imap4d_parsebuf_next (p, 0);
     }
@@ -1620,6 +1705,59 @@ parse_fetch_att_list (imap4d_parsebuf_t p)
     ;
 }
 
+/* fetch-modifiers = SP "(" fetch-modifier *(SP fetch-modifier) ")"
+   fetch-modifier  = "CHANGEDSINCE" SP mod-sequence-valzer / "VANISHED"
+   (RFC 4466, RFC 7162) */
+static void
+parse_fetch_modifiers (imap4d_parsebuf_t p)
+{
+  struct fetch_parse_closure *pclos = imap4d_parsebuf_data (p);
+  int changedsince = 0;
+
+  if (!p->token)
+    return;
+  if (p->token[0] != '(')
+    imap4d_parsebuf_exit (p, "Too many arguments");
+  if (!modseq_enabled ())
+    imap4d_parsebuf_exit (p, "Mailbox does not support mod-sequences");
+  while (imap4d_parsebuf_next (p, 1)[0] != ')')
+    {
+      if (mu_c_strcasecmp (p->token, "CHANGEDSINCE") == 0)
+	{
+	  char *end;
+
+	  imap4d_parsebuf_next (p, 1);
+	  errno = 0;
+	  pclos->changedsince = strtoumax (p->token, &end, 10);
+	  if (!mu_isdigit (p->token[0]) || *end || errno)
+	    imap4d_parsebuf_exit (p, "Invalid mod-sequence");
+	  changedsince = 1;
+	}
+      else if (mu_c_strcasecmp (p->token, "VANISHED") == 0)
+	{
+	  if (!pclos->isuid
+	      || !(enabled_extensions & IMAP4D_ENABLE_QRESYNC))
+	    imap4d_parsebuf_exit (p, "VANISHED not allowed");
+	  pclos->vanished = 1;
+	}
+      else
+	imap4d_parsebuf_exit (p, "Unknown FETCH modifier");
+    }
+  if (imap4d_parsebuf_next (p, 0))
+    imap4d_parsebuf_exit (p, "Too many arguments");
+  if (pclos->vanished && !changedsince)
+    imap4d_parsebuf_exit (p, "VANISHED requires CHANGEDSINCE");
+
+  /* CHANGEDSINCE is a CONDSTORE enabling modifier, which implies
+     MODSEQ. */
+  enabled_extensions |= IMAP4D_ENABLE_CONDSTORE;
+  if (!pclos->modseq)
+    {
+      pclos->modseq = 1;
+      append_simple_function (pclos, "MODSEQ", _frt_modseq);
+    }
+}
+
 /* "ALL" / "FULL" / "FAST" / fetch-att / "(" */
 static void
 parse_macro (imap4d_parsebuf_t p)
@@ -1633,6 +1771,8 @@ parse_macro (imap4d_parsebuf_t p)
       parse_fetch_att_list (p);
       if (!(p->token && p->token[0] == ')'))
 	imap4d_parsebuf_exit (p, "Unknown token or missing closing parenthesis");
+      imap4d_parsebuf_next (p, 0);
+      parse_fetch_modifiers (p);
     }
   else if ((exp = find_macro (p->token))) 
     {
@@ -1647,14 +1787,13 @@ parse_macro (imap4d_parsebuf_t p)
       p->arg = save_arg;
       p->tok = save_tok;
 
-      if (imap4d_parsebuf_peek (p))
-	imap4d_parsebuf_exit (p, "Too many arguments");
+      imap4d_parsebuf_next (p, 0);
+      parse_fetch_modifiers (p);
     }     
   else
     {
       parse_fetch_att (p);
-      if (p->token)
-	imap4d_parsebuf_exit (p, "Too many arguments");
+      parse_fetch_modifiers (p);
     }
 }
     
@@ -1679,6 +1818,14 @@ fetch_thunk (imap4d_parsebuf_t pb)
 				 mstr, &end);
   if (status)
     imap4d_parsebuf_exit (pb, "Failed to parse message set");
+
+  if (pclos->isuid)
+    {
+      /* Keep the requested UIDs for computing the VANISHED response. */
+      if (mu_msgset_create (&pclos->uidset, NULL, MU_MSGSET_NUM)
+	  || mu_msgset_parse_imap (pclos->uidset, MU_MSGSET_NUM, mstr, &end))
+	imap4d_parsebuf_exit (pb, "Failed to parse message set");
+    }
   
   /* Compile the expression */
 
@@ -1699,6 +1846,9 @@ _fetch_from_message (size_t msgno, mu_message_t msg, void *data)
   int rc = 0;
   struct fetch_runtime_closure *frc = data;
 
+  if (frc->changedsince && modseq_get (msgno) <= frc->changedsince)
+    return 0;
+
   frc->msgno = msgno;
   frc->msg = msg;
 
@@ -1743,6 +1893,23 @@ imap4d_fetch0 (imap4d_tokbuf_t tok, int isuid, char **err_text)
       /* Prepare status code. It will be replaced if an error occurs in the
 	 loop below */
       frc.err_text = "Completed";
+      frc.changedsince = pclos.changedsince;
+
+      if (pclos.vanished)
+	{
+	  mu_msgset_t vset;
+
+	  if (modseq_vanished (pclos.changedsince, pclos.uidset, &vset) == 0)
+	    {
+	      if (!mu_msgset_is_empty (vset))
+		{
+		  io_sendf ("* VANISHED (EARLIER) ");
+		  mu_msgset_imap_print (iostream, vset);
+		  io_sendf ("\n");
+		}
+	      mu_msgset_free (vset);
+	    }
+	}
 
       mu_msgset_foreach_message (pclos.msgset, _fetch_from_message, &frc);
       mu_list_destroy (&frc.msglist);
@@ -1750,6 +1917,7 @@ imap4d_fetch0 (imap4d_tokbuf_t tok, int isuid, char **err_text)
   
   mu_list_destroy (&pclos.fnlist);
   mu_msgset_free (pclos.msgset);
+  mu_msgset_free (pclos.uidset);
   return rc;
 }
 
@@ -30,6 +30,10 @@ imap4d_idle (struct imap4d_session *session,
   if (mu_stream_ioctl (iostream, MU_IOCTL_TIMEOUT, MU_IOCTL_OP_GET, &tv))
     return io_completion_response (command, RESP_NO, "Cannot idle");
 
+  /* The client may idle for a long time.  Write back pending attribute
+     changes, so that other clients can see them meanwhile. */
+  imap4d_checkpoint ();
+
   io_sendf ("+ idling\n");
   io_flush ();
 
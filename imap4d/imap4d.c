@@ -220,6 +220,30 @@ cb_preauth (void *data, mu_config_value_t *val)
   return 0;
 }
 
+static int
+cb_compression_level (void *data, mu_config_value_t *val)
+{
+  char *p;
+  unsigned long n;
+  
+  if (mu_cfg_assert_value_type (val, MU_CFG_STRING))
+    return 1;
+  n = strtoul (val->v.string, &p, 10);
+  if (*p || n > 9)
+    {
+      mu_error (_("invalid compression level: %s"), val->v.string);
+      return 1;
+    }
+#ifndef WITH_ZLIB
+  if (n)
+    mu_error (_("compression is not supported; "
+		"statement ignored"));
+#else
+  *(int*)data = n;
+#endif
+  return 0;
+}
+
 static int
 cb_mailbox_mode (void *data, mu_config_value_t *val)
 {
@@ -558,6 +582,32 @@ static struct mu_cfg_param imap4d_cfg_param[] = {
     N_("Server configuration.") },
   { "transcript", mu_c_bool, &imap4d_transcript, 0, NULL,
     N_("Set global transcript mode.") },
+  { "fetch-cache-dir", mu_c_string, &fetch_cache_dir, 0, NULL,
+    N_("Keep rendered ENVELOPE and BODYSTRUCTURE responses in this "
+       "directory.  Relative names are taken relative to the user's home "
+       "directory."),
+    N_("dir: string") },
+  { "modseq-dir", mu_c_string, &modseq_dir, 0, NULL,
+    N_("Keep message modification sequences in this directory and "
+       "enable the CONDSTORE and QRESYNC extensions.  Relative names are "
+       "taken relative to the user's home directory."),
+    N_("dir: string") },
+  { "literal-spool-threshold", mu_c_size, &literal_spool_threshold, 0, NULL,
+    N_("Spool APPEND literals larger than this number of octets to "
+       "temporary files instead of keeping them in memory.  0 disables "
+       "spooling."),
+    N_("size: number") },
+  { "checkpoint-interval", mu_c_uint, &checkpoint_interval, 0, NULL,
+    N_("Write back modified message attributes of MH and maildir "
+       "mailboxes at most this many seconds after they were changed.  "
+       "0 disables the timed write-back."),
+    N_("seconds: number") },
+  { "compression-level", mu_cfg_callback, &compression_level, 0,
+    cb_compression_level,
+    N_("Enable the COMPRESS=DEFLATE extension and set the compression "
+       "level: 1 gives best speed, 9 gives best compression.  0 (the "
+       "default) disables the extension."),
+    N_("level: number") },
   TCP_WRAPPERS_CONFIG
   { NULL }
 };
@@ -815,6 +865,7 @@ imap4d_mainloop (int ifd, int ofd, struct imap4d_srv_config *cfg)
       imap4d_sync ();
       util_do_command (&session, tokp);
       imap4d_sync ();
+      imap4d_checkpoint_schedule ();
       io_flush ();
     }
 
@@ -939,6 +990,16 @@ main (int argc, char **argv)
   if (login_disabled)
     imap4d_capability_add (IMAP_CAPA_LOGINDISABLED);
 
+  if (modseq_dir)
+    {
+      imap4d_capability_add (IMAP_CAPA_ENABLE);
+      imap4d_capability_add (IMAP_CAPA_CONDSTORE);
+      imap4d_capability_add (IMAP_CAPA_QRESYNC);
+    }
+
+  if (compression_level)
+    imap4d_capability_add (IMAP_CAPA_COMPRESS);
+
 #ifdef USE_LIBPAM
   if (!mu_pam_service)
     mu_pam_service = "gnu-imap4d";
@@ -1013,6 +1074,13 @@ main (int argc, char **argv)
 	}
 
       mu_m_server_begin (server);
+      if (mu_m_server_srvstat (server))
+	{
+	  struct imap4d_command *cmd;
+	  
+	  for (cmd = imap4d_command_table; cmd->name; cmd++)
+	    mu_srvstat_register (mu_m_server_srvstat (server), cmd->name);
+	}
       status = mu_m_server_run (server);
       mu_m_server_end (server);
       mu_m_server_destroy (&server);
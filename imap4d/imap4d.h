@@ -169,6 +169,10 @@ struct imap4d_command
 #define IMAP_CAPA_STARTTLS       "STARTTLS"
 #define IMAP_CAPA_LOGINDISABLED  "LOGINDISABLED"
 #define IMAP_CAPA_XTLSREQUIRED   "XTLSREQUIRED"  
+#define IMAP_CAPA_ENABLE         "ENABLE"
+#define IMAP_CAPA_CONDSTORE      "CONDSTORE"
+#define IMAP_CAPA_QRESYNC        "QRESYNC"
+#define IMAP_CAPA_COMPRESS       "COMPRESS=DEFLATE"
 
 /* Preauth types */  
 enum imap4d_preauth
@@ -220,6 +224,9 @@ extern char *ident_keyfile;
 extern int ident_encrypt_only;
 extern unsigned int idle_timeout;
 extern int imap4d_transcript;
+extern int compression_level;
+extern size_t literal_spool_threshold;
+extern unsigned checkpoint_interval;
 extern mu_list_t imap4d_id_list;
 extern int imap4d_argc;                 
 extern char **imap4d_argv;
@@ -249,12 +256,18 @@ extern int io_stream_completion_response (mu_stream_t str,
 void io_getline (char **pbuf, size_t *psize, size_t *pnbytes);
 void io_setio (int, int, struct mu_tls_config *);
 void io_flush (void);
+int io_compress (int level);
+int io_compression_active (void);
+void io_get_stat (mu_off_t *pin, mu_off_t *pout);
+void io_close (void);
 void io_enable_crlf (int);
+mu_stream_t io_redirect (mu_stream_t);
 
 imap4d_tokbuf_t imap4d_tokbuf_init (void);
 void imap4d_tokbuf_destroy (imap4d_tokbuf_t *tok);
 int imap4d_tokbuf_argc (imap4d_tokbuf_t tok);
 char *imap4d_tokbuf_getarg (imap4d_tokbuf_t tok, int n);
+int imap4d_tokbuf_getliteral (imap4d_tokbuf_t tok, int n, mu_stream_t *pstr);
 void imap4d_readline (imap4d_tokbuf_t tok);
 imap4d_tokbuf_t imap4d_tokbuf_from_string (char *str);
 
@@ -304,6 +317,9 @@ extern int  imap4d_capability (struct imap4d_session *,
 			       struct imap4d_command *, imap4d_tokbuf_t);
 extern int  imap4d_check (struct imap4d_session *,
 			  struct imap4d_command *, imap4d_tokbuf_t);
+extern void imap4d_checkpoint (void);
+extern void imap4d_checkpoint_schedule (void);
+extern int imap4d_checkpoint_time (struct timeval *tv);
 extern int  imap4d_close (struct imap4d_session *,
 			  struct imap4d_command *, imap4d_tokbuf_t);
 extern int  imap4d_unselect (struct imap4d_session *,
@@ -311,14 +327,22 @@ extern int  imap4d_unselect (struct imap4d_session *,
 extern int  imap4d_copy (struct imap4d_session *,
 			 struct imap4d_command *, imap4d_tokbuf_t);
 extern int  imap4d_copy0 (imap4d_tokbuf_t, int isuid, char **err_text);
+extern void imap4d_uidlist_format (mu_opool_t pool, size_t *uids,
+				   size_t count);
+extern int  imap4d_compress (struct imap4d_session *,
+			     struct imap4d_command *, imap4d_tokbuf_t);
 extern int  imap4d_create (struct imap4d_session *,
 			   struct imap4d_command *, imap4d_tokbuf_t);
 extern int  imap4d_delete (struct imap4d_session *,
 			   struct imap4d_command *, imap4d_tokbuf_t);
+extern int  imap4d_enable (struct imap4d_session *,
+			   struct imap4d_command *, imap4d_tokbuf_t);
 extern int  imap4d_examine (struct imap4d_session *,
 			    struct imap4d_command *, imap4d_tokbuf_t);
 extern int  imap4d_expunge (struct imap4d_session *,
 			    struct imap4d_command *, imap4d_tokbuf_t);
+extern int  imap4d_expunge0 (imap4d_tokbuf_t, int isuid, char **err_text);
+extern int  imap4d_expunge_msgset (mu_msgset_t msgset, int force);
 extern int  imap4d_fetch (struct imap4d_session *,
 			  struct imap4d_command *, imap4d_tokbuf_t);
 extern int  imap4d_fetch0 (imap4d_tokbuf_t tok, int isuid, char **err_text);
@@ -328,6 +352,9 @@ extern int  imap4d_login (struct imap4d_session *,
 			  struct imap4d_command *, imap4d_tokbuf_t);
 extern int  imap4d_logout (struct imap4d_session *,
 			   struct imap4d_command *, imap4d_tokbuf_t);
+extern int  imap4d_move (struct imap4d_session *,
+			 struct imap4d_command *, imap4d_tokbuf_t);
+extern int  imap4d_move0 (imap4d_tokbuf_t, int isuid, char **err_text);
 extern int  imap4d_noop (struct imap4d_session *,
 			 struct imap4d_command *, imap4d_tokbuf_t);
 extern int  imap4d_rename (struct imap4d_session *,
@@ -336,9 +363,12 @@ extern int  imap4d_preauth_setup (int fd);
 extern int  imap4d_search (struct imap4d_session *,
 			     struct imap4d_command *, imap4d_tokbuf_t);
 extern int  imap4d_search0 (imap4d_tokbuf_t, int isuid, char **repyptr);
+typedef void (*imap4d_search_fn) (size_t, mu_message_t, void *);
+extern int  imap4d_search_select (imap4d_tokbuf_t, int, int,
+				  imap4d_search_fn, void *, char **);
 extern int  imap4d_select (struct imap4d_session *,
 			   struct imap4d_command *, imap4d_tokbuf_t);
-extern int  imap4d_select0 (struct imap4d_command *, const char *, int);
+extern int  imap4d_select0 (struct imap4d_command *, imap4d_tokbuf_t, int);
 extern int  imap4d_select_status (void);
 extern int  imap4d_starttls (struct imap4d_session *,
 			     struct imap4d_command *, imap4d_tokbuf_t);
@@ -350,6 +380,12 @@ extern int  imap4d_status (struct imap4d_session *,
 extern int  imap4d_store (struct imap4d_session *,
 			  struct imap4d_command *, imap4d_tokbuf_t);
 extern int  imap4d_store0 (imap4d_tokbuf_t, int, char **);
+extern int  imap4d_sort (struct imap4d_session *,
+			 struct imap4d_command *, imap4d_tokbuf_t);
+extern int  imap4d_sort0 (imap4d_tokbuf_t, int, char **);
+extern int  imap4d_thread (struct imap4d_session *,
+			   struct imap4d_command *, imap4d_tokbuf_t);
+extern int  imap4d_thread0 (imap4d_tokbuf_t, int, char **);
 
 mu_property_t open_subscription (void);
 extern int  imap4d_subscribe (struct imap4d_session *,
@@ -375,6 +411,86 @@ extern int imap4d_check_home_dir (const char *dir, uid_t uid, gid_t gid);
 /* Shared between fetch and store */  
 extern void fetch_flags0 (const char *prefix, mu_message_t msg, int isuid);
 
+/* Persistent cache of rendered FETCH items */
+enum fcache_kind
+  {
+    FCACHE_ENVELOPE,         /* ENVELOPE */
+    FCACHE_BODY,             /* BODY (non-extensible BODYSTRUCTURE) */
+    FCACHE_BODYSTRUCTURE     /* BODYSTRUCTURE */
+  };
+
+extern char *fetch_cache_dir;
+int fcache_enabled (void);
+void fcache_open (mu_mailbox_t mbx);
+void fcache_close (void);
+int fcache_lookup (mu_message_t msg, enum fcache_kind kind,
+		   char const **ptext);
+void fcache_store (mu_message_t msg, enum fcache_kind kind,
+		   char const *text);
+
+/* Mod-sequences */
+extern char *modseq_dir;
+int modseq_enabled (void);
+void modseq_open (mu_mailbox_t mbx);
+void modseq_close (void);
+void modseq_update (void);
+void modseq_touch (size_t msgno);
+uintmax_t modseq_get (size_t msgno);
+uintmax_t modseq_highest (void);
+int modseq_msgno_to_uid (size_t msgno, size_t *uid);
+int modseq_vanished (uintmax_t since, mu_msgset_t uidset, mu_msgset_t *pret);
+int modseq_mailbox_highest (mu_mailbox_t smbox, uintmax_t *ret);
+
+/* Sort keys (RFC 5256) */
+enum
+  {
+    SORT_ARRIVAL,
+    SORT_CC,
+    SORT_DATE,
+    SORT_FROM,
+    SORT_SIZE,
+    SORT_SUBJECT,
+    SORT_TO
+  };
+#define SORT_REVERSE 0x100   /* Reverse the order of the criterion */
+#define SORT_MAX     16      /* Maximum number of sort criteria */
+
+struct sort_key
+{
+  size_t uid;                /* Message UID */
+  size_t msgno;              /* Message sequence number */
+  int flags;                 /* Internal flags */
+  time_t arrival;            /* Internal date */
+  time_t date;               /* Sent date */
+  size_t size;               /* RFC822.SIZE */
+  char *from;                /* Mailbox of the first From address */
+  char *to;                  /* Mailbox of the first To address */
+  char *cc;                  /* Mailbox of the first Cc address */
+  char *subject;             /* Base subject */
+  int reply;                 /* Subject indicates reply or forward */
+  char *msgid;               /* Message-ID */
+  char **refs;               /* References (or In-Reply-To) */
+  size_t nrefs;              /* Number of elements in refs */
+};
+
+char *sort_base_subject (char const *subj, int *reply);
+int sort_key_sync (struct sort_key ***ptab, size_t *pcount);
+void sort_key_close (void);
+
+/* Set of messages matched by the search criteria of SORT and THREAD */
+struct sort_match
+{
+  char *tab;                 /* tab[msgno] is 1 if the message matched */
+  size_t count;              /* Number of messages */
+};
+
+void sort_mark_message (size_t msgno, mu_message_t msg, void *data);
+
+/* Extensions enabled by the client */
+#define IMAP4D_ENABLE_CONDSTORE 0x01
+#define IMAP4D_ENABLE_QRESYNC   0x02
+extern int enabled_extensions;
+
 /* Permissions for creating intermediate directories.
    FIXME: These should better be configurable. */
 #define MKDIR_PERMISSIONS 0700
@@ -462,6 +578,8 @@ extern char *util_localname (void);
 void util_print_flags (mu_attribute_t attr);
 int util_attribute_matches_flag (mu_attribute_t attr, const char *item);
 int util_uidvalidity (mu_mailbox_t smbox, unsigned long *uidvp);
+char *util_state_file_name (mu_mailbox_t mbx, const char *dir);
+int util_msgset_contains (mu_msgset_t set, size_t n);
 
   
 void util_bye (void);  
@@ -17,9 +17,18 @@
 #include "imap4d.h"
 #include <mailutils/property.h>
 #include <mailutils/datetime.h>
+#include <sys/resource.h>
 
 mu_stream_t iostream;
 
+/* Compression layer (COMPRESS=DEFLATE), if active */
+static mu_stream_t zstream;
+/* Statistics of the compressed session: uncompressed data as seen by
+   the protocol layer, and compressed data sent over the wire. */
+static mu_stream_stat_buffer zstat_plain, zstat_wire;
+/* Statistics of the protocol stream, for server statistics */
+static mu_stream_stat_buffer io_stat;
+
 static void
 log_cipher (mu_stream_t stream)
 {
@@ -98,6 +107,13 @@ io_setio (int ifd, int ofd, struct mu_tls_config *tls_conf)
     imap4d_bye (ERR_STREAM_CREATE);
   /* Change buffering scheme: filter streams are fully buffered by default. */
   mu_stream_set_buffer (iostream, mu_buffer_line, 0);
+  /* Count the protocol traffic if server statistics are enabled.  The
+     CRLF filter stays in place when TLS or compression are started. */
+  if (mu_srvstat_get_default ())
+    mu_stream_set_stat (iostream,
+			MU_STREAM_STAT_MASK (MU_STREAM_STAT_IN) |
+			MU_STREAM_STAT_MASK (MU_STREAM_STAT_OUT),
+			io_stat);
   
   if (imap4d_transcript)
     {
@@ -140,6 +156,81 @@ imap4d_init_tls_server (struct mu_tls_config *tls_conf)
   return rc;
 }
 
+/* Start compressing the session (RFC 4978) */
+int
+io_compress (int level)
+{
+  int rc;
+  mu_stream_t str[2];
+
+  rc = mu_deflate_stream_install (iostream, level, &zstream);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_deflate_stream_install", NULL, rc);
+      return rc;
+    }
+  mu_stream_set_stat (zstream,
+		      MU_STREAM_STAT_MASK (MU_STREAM_STAT_IN) |
+		      MU_STREAM_STAT_MASK (MU_STREAM_STAT_OUT),
+		      zstat_plain);
+  if (mu_stream_ioctl (zstream, MU_IOCTL_TOPSTREAM, MU_IOCTL_OP_GET, str)
+      == 0)
+    {
+      mu_stream_set_stat (str[0],
+			  MU_STREAM_STAT_MASK (MU_STREAM_STAT_IN) |
+			  MU_STREAM_STAT_MASK (MU_STREAM_STAT_OUT),
+			  zstat_wire);
+      mu_stream_unref (str[0]);
+    }
+  mu_diag_output (MU_DIAG_INFO, _("compression enabled (level %d)"), level);
+  return 0;
+}
+
+int
+io_compression_active (void)
+{
+  return zstream != NULL;
+}
+
+/* Return the number of bytes received and sent so far */
+void
+io_get_stat (mu_off_t *pin, mu_off_t *pout)
+{
+  *pin = io_stat[MU_STREAM_STAT_IN];
+  *pout = io_stat[MU_STREAM_STAT_OUT];
+}
+
+/* Log the compression statistics at the end of the session */
+static void
+io_log_compression (void)
+{
+  struct rusage ru;
+
+  if (!zstream)
+    return;
+  getrusage (RUSAGE_SELF, &ru);
+  ru.ru_utime = mu_timeval_add (&ru.ru_utime, &ru.ru_stime);
+  mu_diag_output (MU_DIAG_INFO,
+		  _("compression: received %ju bytes (%ju uncompressed), "
+		    "sent %ju bytes (%ju uncompressed), CPU time %lu.%06lu"),
+		  (uintmax_t) zstat_wire[MU_STREAM_STAT_IN],
+		  (uintmax_t) zstat_plain[MU_STREAM_STAT_IN],
+		  (uintmax_t) zstat_wire[MU_STREAM_STAT_OUT],
+		  (uintmax_t) zstat_plain[MU_STREAM_STAT_OUT],
+		  (unsigned long) ru.ru_utime.tv_sec,
+		  (unsigned long) ru.ru_utime.tv_usec);
+  zstream = NULL;
+}
+
+/* Close the I/O stream at the end of the session */
+void
+io_close (void)
+{
+  mu_stream_close (iostream);
+  io_log_compression ();
+  mu_stream_destroy (&iostream);
+}
+
 /* Status Code to String.  */
 static const char *
 sc2string (int rc)
@@ -425,6 +516,20 @@ unquote (char *line, size_t len)
   return rlen;
 }
 
+/* Literals of APPEND commands longer than this number of octets are
+   spooled to temporary files, instead of being kept in memory.  0 means
+   never spool. */
+size_t literal_spool_threshold = 1048576;
+
+#define LITERAL_SPOOL_BUFSIZE 16384
+
+struct imap4d_literal
+{
+  int argn;                /* Argument number */
+  mu_stream_t stream;      /* Spooled contents or NULL */
+  int status;              /* Spooling status */
+};
+
 struct imap4d_tokbuf
 {
   char *buffer;
@@ -433,6 +538,9 @@ struct imap4d_tokbuf
   int argc;
   int argmax;
   size_t *argp;
+  struct imap4d_literal *litv; /* Literal arguments */
+  size_t litc;
+  size_t litmax;
 };
 
 struct imap4d_tokbuf *
@@ -443,16 +551,62 @@ imap4d_tokbuf_init ()
   return tok;
 }
 
+static void
+imap4d_tokbuf_free_literals (struct imap4d_tokbuf *tok)
+{
+  size_t i;
+
+  for (i = 0; i < tok->litc; i++)
+    mu_stream_destroy (&tok->litv[i].stream);
+  tok->litc = 0;
+}
+
 void
 imap4d_tokbuf_destroy (struct imap4d_tokbuf **ptok)
 {
   struct imap4d_tokbuf *tok = *ptok;
+  imap4d_tokbuf_free_literals (tok);
+  free (tok->litv);
   free (tok->buffer);
   free (tok->argp);
   free (tok);
   *ptok = NULL;
 }
 
+static void
+imap4d_tokbuf_add_literal (struct imap4d_tokbuf *tok, int argn,
+			   mu_stream_t str, int status)
+{
+  if (tok->litc == tok->litmax)
+    tok->litv = mu_2nrealloc (tok->litv, &tok->litmax, sizeof (tok->litv[0]));
+  tok->litv[tok->litc].argn = argn;
+  tok->litv[tok->litc].stream = str;
+  tok->litv[tok->litc].status = status;
+  tok->litc++;
+}
+
+/* Check whether Nth argument was supplied as a literal.  If so, return
+   0 and store in *PSTR the stream with its contents, if the literal was
+   spooled to disk, or NULL if it is kept in memory (in which case the
+   argument itself is the literal).  Return MU_ERR_NOENT if the argument
+   is not a literal.  Otherwise, spooling failed and the error code is
+   returned. */
+int
+imap4d_tokbuf_getliteral (struct imap4d_tokbuf *tok, int n,
+			  mu_stream_t *pstr)
+{
+  size_t i;
+
+  for (i = 0; i < tok->litc; i++)
+    if (tok->litv[i].argn == n)
+      {
+	if (pstr)
+	  *pstr = tok->litv[i].stream;
+	return tok->litv[i].status;
+      }
+  return MU_ERR_NOENT;
+}
+
 int
 imap4d_tokbuf_argc (struct imap4d_tokbuf *tok)
 {
@@ -478,11 +632,10 @@ imap4d_tokbuf_unquote (struct imap4d_tokbuf *tok, size_t *poff, size_t *plen)
     }
 }
 
-static void
-imap4d_tokbuf_decrlf (struct imap4d_tokbuf *tok, size_t off, size_t *plen)
+/* Convert CRLF to LF in the LEN bytes of BUF.  Return the new length. */
+static size_t
+decrlf (char *buf, size_t len)
 {
-  char *buf = tok->buffer + off;
-  size_t len = *plen;
   char *p, *end = buf + len;
 
   for (p = buf; p < end; )
@@ -495,7 +648,13 @@ imap4d_tokbuf_decrlf (struct imap4d_tokbuf *tok, size_t off, size_t *plen)
       else
 	*buf++ = *p++;
     }
-  *plen = len;
+  return len;
+}
+
+static void
+imap4d_tokbuf_decrlf (struct imap4d_tokbuf *tok, size_t off, size_t *plen)
+{
+  *plen = decrlf (tok->buffer + off, *plen);
 }	  
 
 static void
@@ -639,29 +798,47 @@ imap4d_tokbuf_getline (struct imap4d_tokbuf *tok)
     {
       size_t len;
       int rc;
-
+      struct timeval d, ckpt_time, ckpt_tv, *tmo = to;
+      
+      gettimeofday (&d, NULL);
       if (to)
 	{
-	  struct timeval d;
-
-	  gettimeofday (&d, NULL);
 	  if (mu_timeval_cmp (&d, &stop_time) >= 0)
+	    check_input_err (MU_ERR_TIMEOUT, 0);
+	  *to = mu_timeval_sub (&stop_time, &d);
+	}
+
+      /* Wake up in time for the scheduled checkpoint */
+      if (imap4d_checkpoint_time (&ckpt_time) == 0)
+	{
+	  if (mu_timeval_cmp (&d, &ckpt_time) >= 0)
 	    {
-	      rc = MU_ERR_TIMEOUT;
-	      break;
+	      imap4d_checkpoint ();
+	      continue;
 	    }
-	  *to = mu_timeval_sub (&stop_time, &d);
+	  ckpt_tv = mu_timeval_sub (&ckpt_time, &d);
+	  if (!to || mu_timeval_cmp (&ckpt_tv, to) < 0)
+	    tmo = &ckpt_tv;
 	}
       
       rc = mu_stream_timed_readline (iostream, buffer, sizeof (buffer),
-				     to, &len);
-      check_input_err (rc, len);
+				     tmo, &len);
+      if (rc == MU_ERR_TIMEOUT && tmo == &ckpt_tv)
+	{
+	  /* Keep the data read so far.  The checkpoint is done on the
+	     next iteration. */
+	  if (len == 0)
+	    continue;
+	}
+      else
+	check_input_err (rc, len);
       imap4d_tokbuf_expand (tok, len);
       
       memcpy (tok->buffer + tok->level, buffer, len);
       tok->level += len;
     }
-  while (tok->level && tok->buffer[tok->level - 1] != '\n');
+  while (tok->level == level
+	 || (tok->level && tok->buffer[tok->level - 1] != '\n'));
   tok->buffer[--tok->level] = 0;
   if (tok->level > 0 && tok->buffer[tok->level - 1] == '\r')
     tok->buffer[--tok->level] = 0;
@@ -670,11 +847,69 @@ imap4d_tokbuf_getline (struct imap4d_tokbuf *tok)
   return level;
 }
 
+/* Return true if the literal of SIZE octets, which is about to be read
+   into TOK, must be spooled to disk. */
+static int
+literal_spool_p (struct imap4d_tokbuf *tok, unsigned long size)
+{
+  return literal_spool_threshold
+         && size > literal_spool_threshold
+         && tok->argc > IMAP4_ARG_2
+         && mu_c_strcasecmp (imap4d_tokbuf_getarg (tok, IMAP4_ARG_COMMAND),
+			     "APPEND") == 0;
+}
+
+/* Read the literal of SIZE octets from the input into the stream STR,
+   converting CRLF to LF on the fly.  The CR of a CRLF split between two
+   reads is held back until the next read.  The input is consumed even
+   if writing to STR fails. */
+static int
+imap4d_spool_literal (mu_stream_t str, unsigned long size)
+{
+  char buffer[LITERAL_SPOOL_BUFSIZE + 1];
+  unsigned long len = 0;
+  int cr = 0;
+  int rc = 0, status = 0;
+
+  while (len < size)
+    {
+      char *p = buffer + 1;
+      size_t sz;
+
+      rc = mu_stream_read (iostream, p,
+			   size - len < LITERAL_SPOOL_BUFSIZE
+			     ? size - len : LITERAL_SPOOL_BUFSIZE,
+			   &sz);
+      if (rc || sz == 0)
+	break;
+      len += sz;
+      if (status)
+	continue;
+      if (cr)
+	{
+	  *--p = '\r';
+	  sz++;
+	}
+      cr = len < size && p[sz - 1] == '\r';
+      if (cr)
+	sz--;
+      status = mu_stream_write (str, p, decrlf (p, sz), NULL);
+      if (status)
+	mu_diag_funcall (MU_DIAG_ERROR, "mu_stream_write", "literal spool",
+			 status);
+    }
+  check_input_err (rc, len);
+  if (status == 0)
+    status = mu_stream_seek (str, 0, MU_SEEK_SET, NULL);
+  return status;
+}
+
 void
 imap4d_readline (struct imap4d_tokbuf *tok)
 {
   tok->argc = 0;
   tok->level = 0;
+  imap4d_tokbuf_free_literals (tok);
   for (;;)
     {
       char *last_arg;
@@ -699,6 +934,28 @@ imap4d_readline (struct imap4d_tokbuf *tok)
 	  else if (*sp != '+')
 	    break;
 	  xscript_declare_client_payload (number);
+	  if (literal_spool_p (tok, number))
+	    {
+	      mu_stream_t str;
+	      
+	      rc = mu_temp_file_stream_create (&str, NULL, 0);
+	      if (rc == 0)
+		{
+		  rc = imap4d_spool_literal (str, number);
+		  if (rc)
+		    mu_stream_destroy (&str);
+		  /* The argument itself is empty. */
+		  imap4d_tokbuf_expand (tok, 1);
+		  off = tok->level;
+		  tok->buffer[tok->level++] = 0;
+		  tok->argp[tok->argc - 1] = off;
+		  imap4d_tokbuf_add_literal (tok, tok->argc - 1, str, rc);
+		  continue;
+		}
+	      mu_diag_funcall (MU_DIAG_ERROR, "mu_temp_file_stream_create",
+			       NULL, rc);
+	      /* Fall back to reading the literal into memory. */
+	    }
 	  imap4d_tokbuf_expand (tok, number + 1);
 	  off = tok->level;
 	  buf = tok->buffer + off;
@@ -717,6 +974,7 @@ imap4d_readline (struct imap4d_tokbuf *tok)
 	  tok->level += len;
 	  tok->buffer[tok->level++] = 0;
 	  tok->argp[tok->argc - 1] = off;
+	  imap4d_tokbuf_add_literal (tok, tok->argc - 1, NULL, 0);
 	}
       else
 	break;
@@ -736,6 +994,15 @@ imap4d_tokbuf_from_string (char *str)
   return tok;
 }
 
+/* Redirect output to the stream STR.  Return the previous output stream. */
+mu_stream_t
+io_redirect (mu_stream_t str)
+{
+  mu_stream_t old = iostream;
+  iostream = str;
+  return old;
+}
+
 void
 io_enable_crlf (int enable)
 {
@@ -0,0 +1,759 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   GNU Mailutils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Mailutils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "imap4d.h"
+#include <mailutils/locker.h>
+#include <signal.h>
+#include <inttypes.h>
+
+/* Mod-sequences (RFC 7162).
+
+   None of the mailbox formats supported by mailutils keeps per-message
+   modification sequences, so they are maintained by imap4d itself, in
+   a per-mailbox state file.  The state file lists, for each message, its
+   UID, the mod-sequence of its last modification and the flags it had at
+   that time.  When a mailbox is selected, the flags recorded in the state
+   file are compared with the actual ones, so that modifications made by
+   other programs are noticed and get new mod-sequences as well.  UIDs of
+   expunged messages are kept in the state file, along with the
+   mod-sequence of their removal, so that the VANISHED responses can be
+   computed.
+
+   The state file is a text file.  Its lines are:
+
+     uidvalidity N        UIDVALIDITY of the mailbox
+     highestmodseq N      Highest mod-sequence assigned so far
+     vanished N           Expunged UIDs with mod-sequences <= N are
+                          not recorded
+     session PID          PID of an imap4d session that has the mailbox
+                          selected
+     UID MODSEQ FLAGS     Message record
+     -UID MODSEQ          Expunged message record
+
+   If a session terminates abnormally, the changes it made are not saved.
+   A session that finds a stale "session" line assigns new mod-sequences
+   to all messages, thereby forcing clients to resynchronize. */
+
+char *modseq_dir;
+int enabled_extensions;
+
+struct modseq_entry
+{
+  size_t uid;            /* Message UID */
+  uintmax_t modseq;      /* Mod-sequence of the last modification */
+  int flags;             /* Message flags at that time */
+  int touched;           /* Modified during this session */
+};
+
+struct modseq_state
+{
+  unsigned long uidvalidity;
+  uintmax_t highest;     /* Highest mod-sequence */
+  uintmax_t floor;       /* Highest discarded expunge mod-sequence */
+  struct modseq_entry *tab;   /* Messages, ordered by UID */
+  size_t count;
+  size_t max;
+  struct modseq_entry *exp;   /* Expunged messages, ordered by UID */
+  size_t ecount;
+  size_t emax;
+  pid_t *sess;           /* Sessions */
+  size_t scount;
+  size_t smax;
+  size_t *msguid;        /* UIDs of messages, indexed by msgno - 1,
+			    0 if unknown */
+  size_t msgcount;
+};
+
+/* Maximum number of expunged messages to remember. */
+#define MODSEQ_EXPUNGED_MAX 4096
+
+#define FLAGS_MASK (~MU_ATTRIBUTE_MODIFIED)
+
+static struct modseq_state ms;   /* State of the selected mailbox */
+static char *ms_file;            /* State file name */
+static uintmax_t ms_base;        /* ms.highest when the state was loaded */
+static int ms_active;
+
+int
+modseq_enabled (void)
+{
+  return ms_active;
+}
+
+static void
+state_free (struct modseq_state *st)
+{
+  free (st->tab);
+  free (st->exp);
+  free (st->sess);
+  free (st->msguid);
+  memset (st, 0, sizeof *st);
+}
+
+static struct modseq_entry *
+entry_append (struct modseq_entry **ptab, size_t *pcount, size_t *pmax)
+{
+  struct modseq_entry *ent;
+
+  if (*pcount == *pmax)
+    *ptab = mu_2nrealloc (*ptab, pmax, sizeof (**ptab));
+  ent = *ptab + (*pcount)++;
+  memset (ent, 0, sizeof *ent);
+  return ent;
+}
+
+static void
+session_add (struct modseq_state *st, pid_t pid)
+{
+  if (st->scount == st->smax)
+    st->sess = mu_2nrealloc (st->sess, &st->smax, sizeof (st->sess[0]));
+  st->sess[st->scount++] = pid;
+}
+
+static int
+entry_cmp (const void *a, const void *b)
+{
+  struct modseq_entry const *ea = a;
+  struct modseq_entry const *eb = b;
+  if (ea->uid < eb->uid)
+    return -1;
+  if (ea->uid > eb->uid)
+    return 1;
+  return 0;
+}
+
+static int
+entry_modseq_cmp (const void *a, const void *b)
+{
+  struct modseq_entry const *ea = a;
+  struct modseq_entry const *eb = b;
+  if (ea->modseq < eb->modseq)
+    return -1;
+  if (ea->modseq > eb->modseq)
+    return 1;
+  return 0;
+}
+
+static int
+state_load (struct modseq_state *st, char const *file)
+{
+  mu_stream_t str;
+  char *buf = NULL;
+  size_t size = 0, n;
+  int rc;
+
+  memset (st, 0, sizeof *st);
+  rc = mu_file_stream_create (&str, file, MU_STREAM_READ);
+  if (rc)
+    return rc;
+  while ((rc = mu_stream_getline (str, &buf, &size, &n)) == 0 && n > 0)
+    {
+      char *p;
+      struct modseq_entry *ent;
+
+      mu_rtrim_class (buf, MU_CTYPE_ENDLN);
+      if (strncmp (buf, "uidvalidity ", 12) == 0)
+	st->uidvalidity = strtoul (buf + 12, NULL, 10);
+      else if (strncmp (buf, "highestmodseq ", 14) == 0)
+	st->highest = strtoumax (buf + 14, NULL, 10);
+      else if (strncmp (buf, "vanished ", 9) == 0)
+	st->floor = strtoumax (buf + 9, NULL, 10);
+      else if (strncmp (buf, "session ", 8) == 0)
+	session_add (st, strtoul (buf + 8, NULL, 10));
+      else if (buf[0] == '-')
+	{
+	  ent = entry_append (&st->exp, &st->ecount, &st->emax);
+	  ent->uid = strtoul (buf + 1, &p, 10);
+	  ent->modseq = strtoumax (p, NULL, 10);
+	}
+      else if (mu_isdigit (buf[0]))
+	{
+	  ent = entry_append (&st->tab, &st->count, &st->max);
+	  ent->uid = strtoul (buf, &p, 10);
+	  ent->modseq = strtoumax (p, &p, 10);
+	  ent->flags = strtol (p, NULL, 10);
+	}
+    }
+  free (buf);
+  mu_stream_destroy (&str);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_stream_getline", file, rc);
+      state_free (st);
+      return rc;
+    }
+  qsort (st->tab, st->count, sizeof (st->tab[0]), entry_cmp);
+  qsort (st->exp, st->ecount, sizeof (st->exp[0]), entry_cmp);
+  return 0;
+}
+
+static int
+state_save (struct modseq_state *st, char const *file)
+{
+  struct mu_tempfile_hints hints;
+  char *dir, *tmpname;
+  mu_stream_t str;
+  size_t i;
+  int fd, rc;
+
+  dir = mu_strdup (file);
+  *strrchr (dir, '/') = 0;
+  hints.tmpdir = dir;
+  rc = mu_tempfile (&hints, MU_TEMPFILE_TMPDIR, &fd, &tmpname);
+  free (dir);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_tempfile", file, rc);
+      return rc;
+    }
+  rc = mu_fd_stream_create (&str, tmpname, fd,
+			    MU_STREAM_WRITE | MU_STREAM_SEEK);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_fd_stream_create", tmpname, rc);
+      close (fd);
+      unlink (tmpname);
+      free (tmpname);
+      return rc;
+    }
+  mu_stream_set_buffer (str, mu_buffer_full, 0);
+
+  rc = mu_stream_printf (str, "uidvalidity %lu\n"
+			 "highestmodseq %s\n"
+			 "vanished %s\n",
+			 st->uidvalidity,
+			 mu_umaxtostr (0, st->highest),
+			 mu_umaxtostr (1, st->floor));
+  for (i = 0; rc == 0 && i < st->scount; i++)
+    rc = mu_stream_printf (str, "session %lu\n", (unsigned long) st->sess[i]);
+  for (i = 0; rc == 0 && i < st->count; i++)
+    rc = mu_stream_printf (str, "%lu %s %d\n",
+			   (unsigned long) st->tab[i].uid,
+			   mu_umaxtostr (0, st->tab[i].modseq),
+			   st->tab[i].flags);
+  for (i = 0; rc == 0 && i < st->ecount; i++)
+    rc = mu_stream_printf (str, "-%lu %s\n",
+			   (unsigned long) st->exp[i].uid,
+			   mu_umaxtostr (0, st->exp[i].modseq));
+  if (rc == 0)
+    rc = mu_stream_close (str);
+  mu_stream_destroy (&str);
+
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "modseq_save", tmpname, rc);
+      unlink (tmpname);
+    }
+  else if (rename (tmpname, file))
+    {
+      rc = errno;
+      mu_diag_funcall (MU_DIAG_ERROR, "rename", file, rc);
+      unlink (tmpname);
+    }
+  free (tmpname);
+  return rc;
+}
+
+static int
+state_lock (mu_locker_t *plck)
+{
+  int rc = mu_locker_create_ext (plck, ms_file, NULL);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_locker_create_ext", ms_file, rc);
+      return rc;
+    }
+  rc = mu_locker_lock (*plck);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_locker_lock", ms_file, rc);
+      mu_locker_destroy (plck);
+    }
+  return rc;
+}
+
+static void
+state_unlock (mu_locker_t *plck)
+{
+  mu_locker_unlock (*plck);
+  mu_locker_destroy (plck);
+}
+
+/* Remove dead sessions from ST.  Return number of sessions removed. */
+static size_t
+state_reap_sessions (struct modseq_state *st)
+{
+  size_t i, j, n = 0;
+
+  for (i = j = 0; i < st->scount; i++)
+    {
+      if (st->sess[i] == getpid ())
+	continue;
+      if (kill (st->sess[i], 0) && errno == ESRCH)
+	{
+	  n++;
+	  continue;
+	}
+      st->sess[j++] = st->sess[i];
+    }
+  st->scount = j;
+  return n;
+}
+
+/* Assign new mod-sequence to the entry ENT. */
+static void
+entry_bump (struct modseq_entry *ent)
+{
+  ent->modseq = ++ms.highest;
+  ent->touched = 1;
+}
+
+static void
+expunged_add (size_t uid)
+{
+  struct modseq_entry *ent = entry_append (&ms.exp, &ms.ecount, &ms.emax);
+  ent->uid = uid;
+  entry_bump (ent);
+}
+
+/* Bring the state in sync with the mailbox: assign new mod-sequences
+   to new messages and to those whose flags have changed, and record
+   the expunged ones.  If RESYNC is true, assign new mod-sequences to
+   all messages. */
+static void
+modseq_reconcile (int resync)
+{
+  struct modseq_entry *tab = ms.tab;
+  size_t count = ms.count;
+  size_t total = 0, msgno, i;
+  size_t ecount = ms.ecount;
+
+  mu_mailbox_messages_count (mbox, &total);
+  ms.tab = NULL;
+  ms.count = ms.max = 0;
+  ms.msguid = mu_realloc (ms.msguid,
+			  (total ? total : 1) * sizeof (ms.msguid[0]));
+  ms.msgcount = total;
+
+  for (msgno = 1, i = 0; msgno <= total; msgno++)
+    {
+      mu_message_t msg;
+      mu_attribute_t attr;
+      struct modseq_entry *ent;
+      size_t uid;
+      int flags = 0;
+
+      if (mu_mailbox_get_message (mbox, msgno, &msg)
+	  || mu_message_get_uid (msg, &uid))
+	{
+	  ms.msguid[msgno-1] = 0;
+	  continue;
+	}
+      ms.msguid[msgno-1] = uid;
+      mu_message_get_attribute (msg, &attr);
+      mu_attribute_get_flags (attr, &flags);
+      flags &= FLAGS_MASK;
+
+      for (; i < count && tab[i].uid < uid; i++)
+	expunged_add (tab[i].uid);
+
+      ent = entry_append (&ms.tab, &ms.count, &ms.max);
+      if (i < count && tab[i].uid == uid)
+	{
+	  *ent = tab[i++];
+	  if (ent->flags != flags || resync)
+	    {
+	      ent->flags = flags;
+	      entry_bump (ent);
+	    }
+	}
+      else
+	{
+	  ent->uid = uid;
+	  ent->flags = flags;
+	  entry_bump (ent);
+	}
+    }
+  for (; i < count; i++)
+    expunged_add (tab[i].uid);
+  free (tab);
+
+  if (ms.ecount != ecount)
+    qsort (ms.exp, ms.ecount, sizeof (ms.exp[0]), entry_cmp);
+}
+
+void
+modseq_update (void)
+{
+  if (ms_active)
+    modseq_reconcile (0);
+}
+
+static struct modseq_entry *
+modseq_lookup (size_t msgno)
+{
+  size_t uid;
+  struct modseq_entry key;
+
+  if (mu_mailbox_translate (mbox, MU_MAILBOX_MSGNO_TO_UID, msgno, &uid))
+    return NULL;
+  if (msgno <= ms.count && ms.tab[msgno-1].uid == uid)
+    return &ms.tab[msgno-1];
+  key.uid = uid;
+  return bsearch (&key, ms.tab, ms.count, sizeof (ms.tab[0]), entry_cmp);
+}
+
+/* Flags of the message MSGNO might have changed.  Update its mod-sequence
+   accordingly. */
+void
+modseq_touch (size_t msgno)
+{
+  struct modseq_entry *ent;
+  mu_message_t msg;
+  mu_attribute_t attr;
+  int flags = 0;
+
+  if (!ms_active)
+    return;
+  ent = modseq_lookup (msgno);
+  if (!ent)
+    {
+      /* A new message. */
+      modseq_reconcile (0);
+      return;
+    }
+  if (mu_mailbox_get_message (mbox, msgno, &msg))
+    return;
+  mu_message_get_attribute (msg, &attr);
+  mu_attribute_get_flags (attr, &flags);
+  flags &= FLAGS_MASK;
+  if (flags != ent->flags)
+    {
+      ent->flags = flags;
+      entry_bump (ent);
+    }
+}
+
+/* Return mod-sequence of the message MSGNO. */
+uintmax_t
+modseq_get (size_t msgno)
+{
+  struct modseq_entry *ent;
+
+  if (!ms_active)
+    return 0;
+  ent = modseq_lookup (msgno);
+  if (!ent)
+    {
+      modseq_reconcile (0);
+      ent = modseq_lookup (msgno);
+      if (!ent)
+	return 0;
+    }
+  return ent->modseq;
+}
+
+uintmax_t
+modseq_highest (void)
+{
+  return ms.highest;
+}
+
+/* Return UID of the message MSGNO as of the last synchronization.  This
+   is used while the mailbox is being expunged, when the message itself
+   is no longer accessible. */
+int
+modseq_msgno_to_uid (size_t msgno, size_t *uid)
+{
+  if (!ms_active || msgno == 0 || msgno > ms.msgcount
+      || ms.msguid[msgno-1] == 0)
+    return MU_ERR_NOENT;
+  *uid = ms.msguid[msgno-1];
+  return 0;
+}
+
+/* Add to RET the ranges from UIDSET, limited to MAXUID. */
+static int
+uidset_add_clamped (mu_msgset_t ret, mu_msgset_t uidset, size_t maxuid)
+{
+  mu_list_t list;
+  mu_iterator_t itr;
+  int rc;
+
+  rc = mu_msgset_get_list (uidset, &list);
+  if (rc == 0)
+    rc = mu_list_get_iterator (list, &itr);
+  if (rc)
+    return rc;
+  for (mu_iterator_first (itr); rc == 0 && !mu_iterator_is_done (itr);
+       mu_iterator_next (itr))
+    {
+      struct mu_msgrange *r;
+      size_t end;
+
+      mu_iterator_current (itr, (void**)&r);
+      end = r->msg_end;
+      if (end == MU_MSGNO_LAST || end > maxuid)
+	end = maxuid;
+      if (r->msg_beg <= end)
+	rc = mu_msgset_add_range (ret, r->msg_beg, end, MU_MSGSET_NUM);
+    }
+  mu_iterator_destroy (&itr);
+  return rc;
+}
+
+/* Compute the set of UIDs from UIDSET (NULL meaning all UIDs) that have
+   been expunged after mod-sequence SINCE.  If the information about some
+   of them has been discarded, the result includes all UIDs from UIDSET
+   that are not present in the mailbox. */
+int
+modseq_vanished (uintmax_t since, mu_msgset_t uidset, mu_msgset_t *pret)
+{
+  mu_msgset_t ret;
+  size_t i;
+  int rc;
+
+  rc = mu_msgset_create (&ret, NULL, MU_MSGSET_NUM);
+  if (rc)
+    return rc;
+
+  if (since < ms.floor)
+    {
+      size_t uidnext = 1;
+
+      mu_mailbox_uidnext (mbox, &uidnext);
+      if (uidnext > 1)
+	{
+	  if (uidset)
+	    rc = uidset_add_clamped (ret, uidset, uidnext - 1);
+	  else
+	    rc = mu_msgset_add_range (ret, 1, uidnext - 1, MU_MSGSET_NUM);
+	  for (i = 0; rc == 0 && i < ms.count; i++)
+	    rc = mu_msgset_sub_range (ret, ms.tab[i].uid, ms.tab[i].uid,
+				      MU_MSGSET_NUM);
+	}
+    }
+  else
+    {
+      for (i = 0; rc == 0 && i < ms.ecount; i++)
+	if (ms.exp[i].modseq > since && (!uidset || util_msgset_contains (uidset, ms.exp[i].uid)))
+	  rc = mu_msgset_add_range (ret, ms.exp[i].uid, ms.exp[i].uid,
+				    MU_MSGSET_NUM);
+    }
+
+  if (rc)
+    mu_msgset_free (ret);
+  else
+    *pret = ret;
+  return rc;
+}
+
+/* Open the mod-sequence state for the mailbox MBX. */
+void
+modseq_open (mu_mailbox_t mbx)
+{
+  unsigned long uidvalidity;
+  mu_locker_t lck;
+  int resync = 0;
+  int rc;
+
+  modseq_close ();
+  if (!modseq_dir)
+    return;
+
+  if (util_uidvalidity (mbx, &uidvalidity))
+    return;
+  ms_file = util_state_file_name (mbx, modseq_dir);
+  if (!ms_file)
+    return;
+  if (state_lock (&lck))
+    {
+      free (ms_file);
+      ms_file = NULL;
+      return;
+    }
+
+  rc = state_load (&ms, ms_file);
+  if (rc && rc != ENOENT)
+    mu_diag_funcall (MU_DIAG_ERROR, "mu_file_stream_create", ms_file, rc);
+
+  if (rc || ms.uidvalidity != uidvalidity)
+    {
+      state_free (&ms);
+      ms.uidvalidity = uidvalidity;
+    }
+  else if (state_reap_sessions (&ms))
+    resync = 1;
+
+  session_add (&ms, getpid ());
+  rc = state_save (&ms, ms_file);
+  state_unlock (&lck);
+  if (rc)
+    {
+      state_free (&ms);
+      free (ms_file);
+      ms_file = NULL;
+      return;
+    }
+  ms_base = ms.highest;
+  ms_active = 1;
+  modseq_reconcile (resync);
+}
+
+/* Merge the state of this session into the state DISK read from the state
+   file.  If another session has saved its state since this one was
+   loaded, the mod-sequences assigned by this session may collide with
+   the ones assigned by it, so the entries modified by this session get
+   new mod-sequences, higher than any of the saved ones. */
+static void
+state_merge (struct modseq_state *disk)
+{
+  int restamp = disk->highest != ms_base;
+  uintmax_t highest = disk->highest > ms.highest ? disk->highest : ms.highest;
+  size_t i, j;
+
+#define STAMP(e) if (restamp && (e)->touched) (e)->modseq = ++highest
+
+  /* Messages */
+  for (i = j = 0; i < ms.count; i++)
+    {
+      struct modseq_entry *ent = &ms.tab[i];
+      while (j < disk->count && disk->tab[j].uid < ent->uid)
+	j++;
+      if (!ent->touched && j < disk->count && disk->tab[j].uid == ent->uid
+	  && disk->tab[j].modseq > ent->modseq)
+	*ent = disk->tab[j];
+      else
+	STAMP (ent);
+    }
+
+  /* Expunged messages */
+  for (i = 0; i < ms.ecount; i++)
+    STAMP (&ms.exp[i]);
+  for (j = 0; j < disk->ecount; j++)
+    {
+      struct modseq_entry *ent = bsearch (&disk->exp[j], ms.exp, ms.ecount,
+					  sizeof (ms.exp[0]), entry_cmp);
+      if (!ent)
+	*entry_append (&ms.exp, &ms.ecount, &ms.emax) = disk->exp[j];
+      else if (ent->modseq < disk->exp[j].modseq)
+	ent->modseq = disk->exp[j].modseq;
+    }
+  qsort (ms.exp, ms.ecount, sizeof (ms.exp[0]), entry_cmp);
+#undef STAMP
+
+  ms.highest = highest;
+  if (disk->floor > ms.floor)
+    ms.floor = disk->floor;
+
+  /* Sessions */
+  free (ms.sess);
+  ms.sess = disk->sess;
+  ms.scount = disk->scount;
+  ms.smax = disk->smax;
+  disk->sess = NULL;
+  for (i = j = 0; i < ms.scount; i++)
+    if (ms.sess[i] != getpid ())
+      ms.sess[j++] = ms.sess[i];
+  ms.scount = j;
+}
+
+/* Limit the number of expunged messages kept in the state file. */
+static void
+expunged_trim (void)
+{
+  size_t n;
+
+  if (ms.ecount <= MODSEQ_EXPUNGED_MAX)
+    return;
+  qsort (ms.exp, ms.ecount, sizeof (ms.exp[0]), entry_modseq_cmp);
+  n = ms.ecount - MODSEQ_EXPUNGED_MAX;
+  ms.floor = ms.exp[n-1].modseq;
+  memmove (ms.exp, ms.exp + n, MODSEQ_EXPUNGED_MAX * sizeof (ms.exp[0]));
+  ms.ecount = MODSEQ_EXPUNGED_MAX;
+  qsort (ms.exp, ms.ecount, sizeof (ms.exp[0]), entry_cmp);
+}
+
+/* Save and release the mod-sequence state.  Must be called before the
+   current mailbox is closed. */
+void
+modseq_close (void)
+{
+  mu_locker_t lck;
+
+  if (!ms_active)
+    return;
+  modseq_reconcile (0);
+  if (state_lock (&lck) == 0)
+    {
+      struct modseq_state disk;
+
+      if (state_load (&disk, ms_file) == 0)
+	{
+	  if (disk.uidvalidity == ms.uidvalidity)
+	    state_merge (&disk);
+	  state_free (&disk);
+	}
+      expunged_trim ();
+      state_save (&ms, ms_file);
+      state_unlock (&lck);
+    }
+  state_free (&ms);
+  free (ms_file);
+  ms_file = NULL;
+  ms_active = 0;
+}
+
+/* Return the highest mod-sequence of the mailbox SMBOX, as recorded in
+   its state file. */
+int
+modseq_mailbox_highest (mu_mailbox_t smbox, uintmax_t *ret)
+{
+  unsigned long uidvalidity;
+  struct modseq_state st;
+  char *file;
+  int rc;
+
+  if (!modseq_dir)
+    return MU_ERR_NOENT;
+  if (ms_active)
+    {
+      mu_url_t url, surl;
+
+      mu_mailbox_get_url (mbox, &url);
+      mu_mailbox_get_url (smbox, &surl);
+      if (strcmp (mu_url_to_string (url), mu_url_to_string (surl)) == 0)
+	{
+	  *ret = ms.highest;
+	  return 0;
+	}
+    }
+
+  *ret = 0;
+  if ((rc = util_uidvalidity (smbox, &uidvalidity)) != 0)
+    return rc;
+  file = util_state_file_name (smbox, modseq_dir);
+  if (!file)
+    return 0;
+  if (state_load (&st, file) == 0)
+    {
+      if (st.uidvalidity == uidvalidity)
+	*ret = st.highest;
+      state_free (&st);
+    }
+  free (file);
+  return 0;
+}
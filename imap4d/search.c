@@ -129,6 +129,8 @@ static void cond_to (struct parsebuf *, struct search_node *,
 		     struct value *, struct value *);
 static void cond_uid (struct parsebuf *, struct search_node *,
 		      struct value *, struct value *);
+static void cond_modseq (struct parsebuf *, struct search_node *,
+			 struct value *, struct value *);
 
 /* A basic condition structure */
 struct cond
@@ -156,6 +158,7 @@ struct cond condlist[] =
   { "HEADER",     "ss", cond_header },
   { "KEYWORD",    "s",  cond_keyword },
   { "LARGER",     "n",  cond_larger },
+  { "MODSEQ",     "n",  cond_modseq },
   { "ON",         "d",  cond_on },
   { "SENTBEFORE", "d",  cond_sentbefore },
   { "SENTON",     "d",  cond_senton },
@@ -233,6 +236,9 @@ struct parsebuf
 				/* Execution time only: */
   size_t msgno;                 /* Number of current message */
   mu_message_t msg;             /* Current message */
+  int modseq_used;              /* MODSEQ criterion was used */
+  uintmax_t modseq;             /* Highest mod-sequence of the matching
+				   messages */
 };
 
 static void parse_free_mem (struct parsebuf *pb);
@@ -271,67 +277,86 @@ imap4d_search (struct imap4d_session *session,
   return io_completion_response (command, rc, "%s", err_text);
 }
 
-int
-imap4d_search0 (imap4d_tokbuf_t tok, int isuid, char **err_text)
+/* Compile the search program starting at argument ARG of TOK.  If
+   CHARSET_REQUIRED is true, the first argument is the name of the
+   charset (as in SORT and THREAD commands), otherwise an optional
+   CHARSET keyword is recognized. */
+static int
+search_compile (struct parsebuf *pb, imap4d_tokbuf_t tok, int arg, int isuid,
+		int charset_required, char **err_text)
 {
-  struct parsebuf parsebuf;
-
-  memset (&parsebuf, 0, sizeof(parsebuf));
-  parsebuf.tok = tok;
-  parsebuf.arg = IMAP4_ARG_1 + !!isuid;
-  parsebuf.err_mesg = NULL;
-  parsebuf.alloc = NULL;
-  parsebuf.isuid = isuid;
-
-  if (!parse_gettoken (&parsebuf, 0))
+  memset (pb, 0, sizeof (*pb));
+  pb->tok = tok;
+  pb->arg = arg;
+  pb->err_mesg = NULL;
+  pb->alloc = NULL;
+  pb->isuid = isuid;
+
+  if (!parse_gettoken (pb, 0) || !pb->token)
     {
       *err_text = "Too few args";
       return RESP_BAD;
     }
 
-  if (mu_c_strcasecmp (parsebuf.token, "CHARSET") == 0)
+  if (charset_required || mu_c_strcasecmp (pb->token, "CHARSET") == 0)
     {
-      if (!parse_gettoken (&parsebuf, 0))
+      if (!charset_required && (!parse_gettoken (pb, 0) || !pb->token))
 	{
 	  *err_text = "Too few args";
 	  return RESP_BAD;
 	}
 
-      if (mu_c_strcasecmp (parsebuf.token, "US-ASCII"))
+      if (mu_c_strcasecmp (pb->token, "US-ASCII"))
 	{
-	  parsebuf.charset = parse_strdup (&parsebuf, parsebuf.token);
-	  if (!available_charset (parsebuf.charset))
+	  pb->charset = parse_strdup (pb, pb->token);
+	  if (!available_charset (pb->charset))
 	    {
+	      parse_free_mem (pb);
 	      *err_text = "[BADCHARSET] Charset not supported";
 	      return RESP_NO;
 	    }
 	}
       else
-	parsebuf.charset = NULL;
+	pb->charset = NULL;
 
-      if (!parse_gettoken (&parsebuf, 0))
+      if (!parse_gettoken (pb, 0) || !pb->token)
 	{
+	  parse_free_mem (pb);
 	  *err_text = "Too few args";
 	  return RESP_BAD;
 	}
     }
 
   /* Compile the expression */
-  parsebuf.tree = parse_search_key_list (&parsebuf);
-  if (!parsebuf.tree)
+  pb->tree = parse_search_key_list (pb);
+  if (!pb->tree)
     {
-      *err_text = parsebuf.err_mesg ? parsebuf.err_mesg : "Parse error";
-      parse_free_mem (&parsebuf);
+      *err_text = pb->err_mesg ? pb->err_mesg : "Parse error";
+      parse_free_mem (pb);
       return RESP_BAD;
     }
 
-  if (parsebuf.token)
+  if (pb->token)
     {
-      parse_free_mem (&parsebuf);
+      parse_free_mem (pb);
       *err_text = "Junk at the end of statement";
       return RESP_BAD;
     }
 
+  return RESP_OK;
+}
+
+int
+imap4d_search0 (imap4d_tokbuf_t tok, int isuid, char **err_text)
+{
+  struct parsebuf parsebuf;
+  int rc;
+
+  rc = search_compile (&parsebuf, tok, IMAP4_ARG_1 + !!isuid, isuid, 0,
+		       err_text);
+  if (rc != RESP_OK)
+    return rc;
+
   /* Execute compiled expression */
   do_search (&parsebuf);
 
@@ -341,6 +366,35 @@ imap4d_search0 (imap4d_tokbuf_t tok, int isuid, char **err_text)
   return RESP_OK;
 }
 
+/* Parse the charset specification and searching criteria starting at
+   argument ARG of TOK and call FUN for each message that matches them. */
+int
+imap4d_search_select (imap4d_tokbuf_t tok, int arg, int isuid,
+		      imap4d_search_fn fun, void *data, char **err_text)
+{
+  struct parsebuf parsebuf;
+  size_t count = 0;
+  int rc;
+
+  rc = search_compile (&parsebuf, tok, arg, isuid, 1, err_text);
+  if (rc != RESP_OK)
+    return rc;
+
+  mu_mailbox_messages_count (mbox, &count);
+  for (parsebuf.msgno = 1; parsebuf.msgno <= count; parsebuf.msgno++)
+    {
+      if (mu_mailbox_get_message (mbox, parsebuf.msgno, &parsebuf.msg) == 0
+	  && search_run (&parsebuf))
+	fun (parsebuf.msgno, parsebuf.msg, data);
+    }
+
+  parse_free_mem (&parsebuf);
+
+  *err_text = "Completed";
+  return RESP_OK;
+}
+
+
 /* For each message from the mailbox execute the query from `pb' and
    output the message number if the query returned 1 */
 void
@@ -356,6 +410,12 @@ do_search (struct parsebuf *pb)
       if (mu_mailbox_get_message (mbox, pb->msgno, &pb->msg) == 0
 	  && search_run (pb))
 	{
+	  if (pb->modseq_used)
+	    {
+	      uintmax_t n = modseq_get (pb->msgno);
+	      if (n > pb->modseq)
+		pb->modseq = n;
+	    }
 	  if (pb->isuid)
 	    {
 	      size_t uid;
@@ -366,6 +426,10 @@ do_search (struct parsebuf *pb)
 	    io_sendf (" %s", mu_umaxtostr (0, pb->msgno));
 	}
     }
+  /* RFC 7162, 3.1.5: the MODSEQ value is included only if some messages
+     matched. */
+  if (pb->modseq_used && pb->modseq)
+    io_sendf (" (MODSEQ %s)", mu_umaxtostr (0, pb->modseq));
   io_sendf ("\n");
 }
 
@@ -656,6 +720,18 @@ parse_simple_key (struct parsebuf *pb)
 	}
     }
 
+  if (condp->inst == cond_modseq)
+    {
+      /* RFC 7162, 3.1.5 */
+      if (!modseq_enabled ())
+	{
+	  pb->err_mesg = "Mailbox does not support mod-sequences";
+	  return NULL;
+	}
+      enabled_extensions |= IMAP4D_ENABLE_CONDSTORE;
+      pb->modseq_used = 1;
+    }
+
   node = parse_alloc (pb, sizeof *node);
   node->type = node_call;
   node->v.key.keyword = condp->name;
@@ -1186,6 +1262,16 @@ cond_larger (struct parsebuf *pb, struct search_node *node, struct value *arg,
   retval->v.number = size > arg[0].v.number;
 }
 
+/* MODSEQ [entry-name entry-type-req] mod-sequence-valzer
+   Entry names are not supported. */
+static void
+cond_modseq (struct parsebuf *pb, struct search_node *node, struct value *arg,
+	     struct value *retval)
+{
+  retval->type = value_number;
+  retval->v.number = modseq_get (pb->msgno) >= (uintmax_t) arg[0].v.number;
+}
+
 static void
 cond_on (struct parsebuf *pb, struct search_node *node, struct value *arg,
 	 struct value *retval)
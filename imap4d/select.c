@@ -15,38 +15,196 @@
    along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "imap4d.h"
+#include <inttypes.h>
 
 static int select_flags;
 
-/* select          ::= "SELECT" SPACE mailbox  */
+/* select          ::= "SELECT" SPACE mailbox [select-params] */
 
 int
 imap4d_select (struct imap4d_session *session,
                struct imap4d_command *command, imap4d_tokbuf_t tok)
 {
-  if (imap4d_tokbuf_argc (tok) != 3)
-    return io_completion_response (command, RESP_BAD, "Invalid arguments");
-  return imap4d_select0 (command, imap4d_tokbuf_getarg (tok, IMAP4_ARG_1),
-			 MU_STREAM_RDWR);
+  return imap4d_select0 (command, tok, MU_STREAM_RDWR);
+}
+
+struct select_params
+{
+  int qresync;               /* QRESYNC parameter given */
+  unsigned long uidvalidity; /* Last known UIDVALIDITY */
+  uintmax_t modseq;          /* Last known mod-sequence */
+  mu_msgset_t known_uids;    /* Known UIDs, or NULL */
+};
+
+static int
+parse_number (char const *arg, uintmax_t *ret)
+{
+  char *p;
+
+  if (!arg || !mu_isdigit (*arg))
+    return 1;
+  errno = 0;
+  *ret = strtoumax (arg, &p, 10);
+  return errno || *p;
+}
+
+/* Parse the optional select parameters (RFC 4466):
+
+   select-params = SP "(" select-param *(SP select-param) ")"
+   select-param  = "CONDSTORE" /
+                   "QRESYNC" SP "(" uidvalidity SP mod-sequence-value
+                                [SP known-uids] [SP seq-match-data] ")"
+
+   The seq-match-data is ignored. */
+static char *
+parse_select_params (imap4d_tokbuf_t tok, struct select_params *params)
+{
+  int argc = imap4d_tokbuf_argc (tok);
+  int i = IMAP4_ARG_2;
+  char *arg;
+
+  memset (params, 0, sizeof *params);
+  if (argc == i)
+    return NULL;
+  if (!modseq_dir || strcmp (imap4d_tokbuf_getarg (tok, i), "("))
+    return "Invalid arguments";
+
+  while ((arg = imap4d_tokbuf_getarg (tok, ++i)) && strcmp (arg, ")"))
+    {
+      if (mu_c_strcasecmp (arg, "CONDSTORE") == 0)
+	enabled_extensions |= IMAP4D_ENABLE_CONDSTORE;
+      else if (mu_c_strcasecmp (arg, "QRESYNC") == 0)
+	{
+	  uintmax_t n;
+	  char *end;
+
+	  if (!(enabled_extensions & IMAP4D_ENABLE_QRESYNC))
+	    return "QRESYNC is not enabled";
+	  if ((arg = imap4d_tokbuf_getarg (tok, ++i)) == NULL
+	      || strcmp (arg, "("))
+	    return "Invalid QRESYNC parameter";
+	  if (parse_number (imap4d_tokbuf_getarg (tok, ++i), &n)
+	      || n == 0 || n > ULONG_MAX)
+	    return "Invalid UIDVALIDITY";
+	  params->uidvalidity = n;
+	  if (parse_number (imap4d_tokbuf_getarg (tok, ++i), &params->modseq)
+	      || params->modseq == 0)
+	    return "Invalid mod-sequence";
+	  params->qresync = 1;
+
+	  arg = imap4d_tokbuf_getarg (tok, ++i);
+	  if (arg && strcmp (arg, "(") && strcmp (arg, ")"))
+	    {
+	      if (mu_msgset_create (&params->known_uids, NULL, MU_MSGSET_NUM)
+		  || mu_msgset_parse_imap (params->known_uids, MU_MSGSET_NUM,
+					   arg, &end))
+		return "Invalid known-uids";
+	      arg = imap4d_tokbuf_getarg (tok, ++i);
+	    }
+	  if (arg && strcmp (arg, "(") == 0)
+	    {
+	      /* Skip seq-match-data */
+	      while ((arg = imap4d_tokbuf_getarg (tok, ++i)) && strcmp (arg, ")"))
+		;
+	      if (arg)
+		arg = imap4d_tokbuf_getarg (tok, ++i);
+	    }
+	  if (!arg || strcmp (arg, ")"))
+	    return "Invalid QRESYNC parameter";
+	}
+      else
+	return "Unknown select parameter";
+    }
+  if (!arg || i + 1 != argc)
+    return "Invalid arguments";
+  return NULL;
+}
+
+static int
+send_changed (size_t msgno, mu_message_t msg, void *data)
+{
+  struct select_params *params = data;
+  uintmax_t modseq = modseq_get (msgno);
+  size_t uid;
+  mu_attribute_t attr;
+
+  if (modseq <= params->modseq)
+    return 0;
+  mu_message_get_uid (msg, &uid);
+  if (params->known_uids && !util_msgset_contains (params->known_uids, uid))
+    return 0;
+  mu_message_get_attribute (msg, &attr);
+  io_sendf ("* %lu FETCH (UID %lu FLAGS (", (unsigned long) msgno,
+	    (unsigned long) uid);
+  util_print_flags (attr);
+  io_sendf (") MODSEQ (%s))\n", mu_umaxtostr (0, modseq));
+  return 0;
+}
+
+/* Quick mailbox resynchronization (RFC 7162, 3.2.5.1). */
+static void
+select_qresync (struct select_params *params)
+{
+  unsigned long uidvalidity;
+  mu_msgset_t vset, mset;
+
+  if (!modseq_enabled ()
+      || util_uidvalidity (mbox, &uidvalidity)
+      || uidvalidity != params->uidvalidity)
+    return;
+
+  if (modseq_vanished (params->modseq, params->known_uids, &vset) == 0)
+    {
+      if (!mu_msgset_is_empty (vset))
+	{
+	  io_sendf ("* VANISHED (EARLIER) ");
+	  mu_msgset_imap_print (iostream, vset);
+	  io_sendf ("\n");
+	}
+      mu_msgset_free (vset);
+    }
+
+  if (mu_msgset_create (&mset, mbox, MU_MSGSET_NUM) == 0)
+    {
+      if (mu_msgset_add_range (mset, 1, MU_MSGNO_LAST, MU_MSGSET_NUM) == 0)
+	mu_msgset_foreach_message (mset, send_changed, params);
+      mu_msgset_free (mset);
+    }
 }
 
 /* This code is shared with EXAMINE.  */
 int
-imap4d_select0 (struct imap4d_command *command, const char *mboxname,
+imap4d_select0 (struct imap4d_command *command, imap4d_tokbuf_t tok,
 		int flags)
 {
   int status;
+  char *mboxname;
   char *mailbox_name;
   mu_record_t record;
+  struct select_params params;
+  char *err_text;
   
   /* FIXME: Check state.  */
 
+  if (imap4d_tokbuf_argc (tok) < 3)
+    return io_completion_response (command, RESP_BAD, "Invalid arguments");
+  mboxname = imap4d_tokbuf_getarg (tok, IMAP4_ARG_1);
+  err_text = parse_select_params (tok, &params);
+  if (err_text)
+    {
+      mu_msgset_free (params.known_uids);
+      return io_completion_response (command, RESP_BAD, "%s", err_text);
+    }
+
   /* Even if a mailbox is selected, a SELECT EXAMINE or LOGOUT
      command MAY be issued without previously issuing a CLOSE command.
      The SELECT, EXAMINE, and LOGOUT commands implicitly close the
      currently selected mailbox without doing an expunge.  */
   if (mbox)
     {
+      fcache_close ();
+      modseq_close ();
+      sort_key_close ();
       imap4d_enter_critical ();
       mu_mailbox_sync (mbox);
       mu_mailbox_close (mbox);
@@ -62,7 +220,11 @@ imap4d_select0 (struct imap4d_command *command, const char *mboxname,
   mailbox_name = namespace_get_name (mboxname, &record, NULL);
 
   if (!mailbox_name)
-    return io_completion_response (command, RESP_NO, "Couldn't open mailbox");
+    {
+      mu_msgset_free (params.known_uids);
+      return io_completion_response (command, RESP_NO,
+				     "Couldn't open mailbox");
+    }
 
   if (flags & MU_STREAM_WRITE)
     {
@@ -99,9 +261,34 @@ imap4d_select0 (struct imap4d_command *command, const char *mboxname,
       state = STATE_SEL;
 
       imap4d_set_observer (mbox);
+      if (mu_srvstat_get_default ())
+	{
+	  struct timeval tv;
+	  size_t count;
+	  
+	  mu_srvstat_start (&tv);
+	  mu_mailbox_messages_count (mbox, &count);
+	  mu_srvstat_finish (MU_SRVSTAT_MAILBOX_SCAN, &tv, 0, 0);
+	}
+      fcache_open (mbox);
+      modseq_open (mbox);
       
       if ((status = imap4d_select_status ()) == 0)
 	{
+	  if (modseq_dir)
+	    {
+	      if (modseq_enabled ())
+		io_untagged_response (RESP_OK,
+				      "[HIGHESTMODSEQ %s] Highest",
+				      mu_umaxtostr (0, modseq_highest ()));
+	      else
+		io_untagged_response (RESP_OK,
+				      "[NOMODSEQ] No permanent "
+				      "modsequences");
+	    }
+	  if (params.qresync)
+	    select_qresync (&params);
+	  mu_msgset_free (params.known_uids);
 	  free (mailbox_name);
 	  /* Need to set the state explicitly for select.  */
 	  return io_sendf ("%s OK [%s] %s Completed\n", command->tag,
@@ -110,7 +297,9 @@ imap4d_select0 (struct imap4d_command *command, const char *mboxname,
 	}
     }
   
+  modseq_close ();
   mu_mailbox_destroy (&mbox);
+  mu_msgset_free (params.known_uids);
   status = io_completion_response (command, RESP_NO, "Could not open %s: %s",
 			mboxname, mu_strerror (status));
   free (mailbox_name);
@@ -0,0 +1,745 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   GNU Mailutils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Mailutils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Implementation of the SORT extension (RFC 5256) */
+
+#include "imap4d.h"
+
+/* Sort key cache.
+
+   Sort keys of a message are computed the first time the message is
+   sorted or threaded and retained until the mailbox is closed.  The keys
+   are kept in an array ordered by UID, which is also the order of message
+   sequence numbers.  Each SORT or THREAD command synchronizes the array
+   with the mailbox: keys of the expunged messages are discarded and keys
+   are computed for new messages only.
+
+   The result of the most recent SORT is cached as well.  If the next
+   SORT command uses the same criteria, keys of the new messages are
+   merged into it using binary search, so that sorting the mailbox again
+   after new mail has arrived takes O(k log n) comparisons, k being the
+   number of new messages. */
+
+#define SORT_KEY_NEW      0x01  /* Key was created by the current sync */
+#define SORT_KEY_EXPUNGED 0x02  /* Message was expunged */
+#define SORT_KEY_ORDERED  0x04  /* Key is present in sort_order */
+
+static struct sort_key **keytab;   /* Keys in UID order */
+static size_t keycount;            /* Number of keys in keytab */
+static unsigned long keyuidvalidity;
+
+/* Cached result of the last SORT */
+static int sort_crit[SORT_MAX];    /* Criteria */
+static size_t sort_ncrit;          /* Number of criteria, 0 if no cache */
+static struct sort_key **sort_order; /* Sorted keys */
+static size_t sort_count;          /* Number of keys in sort_order */
+
+/* Base subject extraction (RFC 5256, section 2.1) */
+
+#define ISWSP(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+
+/* Return the length of subj-blob at the beginning of the LEN bytes
+   pointed to by P, or 0 if there is none. */
+static size_t
+subj_blob_len (char const *p, size_t len)
+{
+  size_t i;
+
+  if (len == 0 || p[0] != '[')
+    return 0;
+  for (i = 1; i < len && p[i] != '[' && p[i] != ']'; i++)
+    ;
+  if (i == len || p[i] != ']')
+    return 0;
+  for (i++; i < len && p[i] == ' '; i++)
+    ;
+  return i;
+}
+
+/* Return the length of subj-leader at the beginning of the LEN bytes
+   pointed to by P, or 0 if there is none.  Set *REFWD if the leader
+   contains a subj-refwd. */
+static size_t
+subj_leader_len (char const *p, size_t len, int *refwd)
+{
+  size_t i = 0, n;
+
+  if (len > 0 && p[0] == ' ')
+    return 1;
+
+  while ((n = subj_blob_len (p + i, len - i)) > 0)
+    i += n;
+
+  if (len - i >= 2 && memcmp (p + i, "RE", 2) == 0)
+    i += 2;
+  else if (len - i >= 3 && memcmp (p + i, "FWD", 3) == 0)
+    i += 3;
+  else if (len - i >= 2 && memcmp (p + i, "FW", 2) == 0)
+    i += 2;
+  else
+    return 0;
+  while (i < len && p[i] == ' ')
+    i++;
+  i += subj_blob_len (p + i, len - i);
+  if (i < len && p[i] == ':')
+    {
+      *refwd = 1;
+      return i + 1;
+    }
+  return 0;
+}
+
+/* Extract the base subject from the decoded subject SUBJ.  The returned
+   string is converted to upper case, so that it can be compared using
+   strcmp.  If REPLY is not NULL, store in it 1 if the subject indicates
+   a reply or forward, and 0 otherwise. */
+char *
+sort_base_subject (char const *subj, int *reply)
+{
+  char *buf, *start, *q;
+  size_t len;
+  int isreply = 0;
+
+  /* (1) Convert tabs and continuations to space and collapse
+     multiple spaces to a single one. */
+  buf = mu_alloc (strlen (subj) + 1);
+  for (q = buf; *subj; subj++)
+    {
+      if (ISWSP (*subj))
+	{
+	  if (q > buf && q[-1] == ' ')
+	    continue;
+	  *q++ = ' ';
+	}
+      else
+	*q++ = mu_toupper (*subj);
+    }
+  start = buf;
+  len = q - buf;
+
+  for (;;)
+    {
+      size_t n;
+      int changed;
+
+      /* (2) Remove subj-trailer ("(fwd)" or whitespace) */
+      for (;;)
+	{
+	  if (len > 0 && start[len-1] == ' ')
+	    len--;
+	  else if (len >= 5 && memcmp (start + len - 5, "(FWD)", 5) == 0)
+	    {
+	      len -= 5;
+	      isreply = 1;
+	    }
+	  else
+	    break;
+	}
+
+      do
+	{
+	  changed = 0;
+	  /* (3) Remove subj-leader */
+	  while ((n = subj_leader_len (start, len, &isreply)) > 0)
+	    {
+	      start += n;
+	      len -= n;
+	      changed = 1;
+	    }
+	  /* (4) Remove subj-blob, unless that leaves an empty subject */
+	  n = subj_blob_len (start, len);
+	  if (n > 0 && n < len)
+	    {
+	      start += n;
+	      len -= n;
+	      changed = 1;
+	    }
+	  /* (5) Repeat until no more changes */
+	}
+      while (changed);
+
+      /* (6) Remove subj-fwd-hdr and subj-fwd-trl */
+      if (len >= 6 && memcmp (start, "[FWD:", 5) == 0 && start[len-1] == ']')
+	{
+	  start += 5;
+	  len -= 6;
+	  isreply = 1;
+	  continue;
+	}
+      break;
+    }
+
+  memmove (buf, start, len);
+  buf[len] = 0;
+  if (reply)
+    *reply = isreply;
+  return buf;
+}
+
+static char *
+upcase (char *s)
+{
+  char *p;
+
+  for (p = s; *p; p++)
+    *p = mu_toupper (*p);
+  return s;
+}
+
+/* Return the mailbox part of the first address in the header NAME,
+   converted to upper case, or NULL if there is none. */
+static char *
+get_addr_mailbox (mu_header_t hdr, char const *name)
+{
+  char const *val;
+  mu_address_t addr;
+  char *ret = NULL;
+
+  if (mu_header_sget_value (hdr, name, &val) == 0
+      && mu_address_create (&addr, val) == 0)
+    {
+      char const *s;
+
+      if (mu_address_sget_local_part (addr, 1, &s) == 0 && s)
+	ret = upcase (mu_strdup (s));
+      mu_address_destroy (&addr);
+    }
+  return ret;
+}
+
+/* Scan the message ids in TEXT.  If PRET is NULL, return the first one.
+   Otherwise, store all ids in *PRET and their number in *PCOUNT. */
+static char *
+scan_msgids (char const *text, char ***pret, size_t *pcount)
+{
+  char **ids = NULL;
+  size_t count = 0, max = 0;
+
+  while ((text = strchr (text, '<')) != NULL)
+    {
+      char const *end = strchr (text, '>');
+      char *id;
+
+      if (!end)
+	break;
+      id = mu_alloc (end - text + 2);
+      memcpy (id, text, end - text + 1);
+      id[end - text + 1] = 0;
+      text = end + 1;
+      if (!pret)
+	return id;
+      if (count == max)
+	ids = mu_2nrealloc (ids, &max, sizeof (ids[0]));
+      ids[count++] = id;
+    }
+  if (pret)
+    {
+      *pret = ids;
+      *pcount = count;
+    }
+  return NULL;
+}
+
+static struct sort_key *
+sort_key_create (mu_message_t msg, size_t uid)
+{
+  struct sort_key *key;
+  mu_envelope_t env;
+  mu_header_t hdr;
+  char const *val;
+  char *subj;
+  size_t size = 0, lines = 0;
+
+  key = mu_zalloc (sizeof (*key));
+  key->uid = uid;
+  key->flags = SORT_KEY_NEW;
+
+  if (mu_message_get_envelope (msg, &env) == 0
+      && mu_envelope_sget_date (env, &val) == 0)
+    util_parse_ctime_date (val, &key->arrival, datetime_default);
+
+  mu_message_size (msg, &size);
+  mu_message_lines (msg, &lines);
+  key->size = size + lines;
+
+  if (mu_message_get_header (msg, &hdr))
+    {
+      key->date = key->arrival;
+      return key;
+    }
+
+  /* RFC 5256, 2.2: if the sent date cannot be determined, the
+     internal date is used. */
+  if (mu_header_sget_value (hdr, MU_HEADER_DATE, &val)
+      || util_parse_822_date (val, &key->date, datetime_default))
+    key->date = key->arrival;
+
+  key->from = get_addr_mailbox (hdr, MU_HEADER_FROM);
+  key->to = get_addr_mailbox (hdr, MU_HEADER_TO);
+  key->cc = get_addr_mailbox (hdr, MU_HEADER_CC);
+
+  if (mu_header_aget_value_unfold (hdr, MU_HEADER_SUBJECT, &subj) == 0)
+    {
+      char *tmp;
+
+      if (mu_rfc2047_decode ("UTF-8", subj, &tmp) == 0)
+	{
+	  free (subj);
+	  subj = tmp;
+	}
+      key->subject = sort_base_subject (subj, &key->reply);
+      free (subj);
+    }
+
+  if (mu_header_sget_value (hdr, MU_HEADER_MESSAGE_ID, &val) == 0)
+    key->msgid = scan_msgids (val, NULL, NULL);
+
+  if (mu_header_sget_value (hdr, MU_HEADER_REFERENCES, &val) == 0)
+    scan_msgids (val, &key->refs, &key->nrefs);
+  if (key->nrefs == 0
+      && mu_header_sget_value (hdr, MU_HEADER_IN_REPLY_TO, &val) == 0)
+    {
+      char *id = scan_msgids (val, NULL, NULL);
+      if (id)
+	{
+	  key->refs = mu_alloc (sizeof (key->refs[0]));
+	  key->refs[0] = id;
+	  key->nrefs = 1;
+	}
+    }
+
+  return key;
+}
+
+static void
+sort_key_free (struct sort_key *key)
+{
+  size_t i;
+
+  free (key->from);
+  free (key->to);
+  free (key->cc);
+  free (key->subject);
+  free (key->msgid);
+  for (i = 0; i < key->nrefs; i++)
+    free (key->refs[i]);
+  free (key->refs);
+  free (key);
+}
+
+static void
+sort_order_free (void)
+{
+  free (sort_order);
+  sort_order = NULL;
+  sort_count = 0;
+  sort_ncrit = 0;
+}
+
+/* Discard the sort key cache */
+void
+sort_key_close (void)
+{
+  size_t i;
+
+  for (i = 0; i < keycount; i++)
+    sort_key_free (keytab[i]);
+  free (keytab);
+  keytab = NULL;
+  keycount = 0;
+  sort_order_free ();
+}
+
+/* Synchronize the sort key cache with the currently selected mailbox.
+   On success, return in *PTAB the array of keys in message sequence
+   number order and its size in *PCOUNT. */
+int
+sort_key_sync (struct sort_key ***ptab, size_t *pcount)
+{
+  size_t count = 0, i, j;
+  unsigned long uidvalidity;
+  struct sort_key **tab;
+  int expunged = 0;
+  int rc;
+
+  rc = mu_mailbox_uidvalidity (mbox, &uidvalidity);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_uidvalidity", NULL, rc);
+      return rc;
+    }
+  if (keytab && uidvalidity != keyuidvalidity)
+    sort_key_close ();
+  keyuidvalidity = uidvalidity;
+
+  rc = mu_mailbox_messages_count (mbox, &count);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_messages_count", NULL, rc);
+      return rc;
+    }
+
+  tab = mu_calloc (count + 1, sizeof (tab[0]));
+  for (i = j = 0; i < count; i++)
+    {
+      mu_message_t msg;
+      size_t uid;
+
+      if ((rc = mu_mailbox_get_message (mbox, i + 1, &msg)) != 0
+	  || (rc = mu_message_get_uid (msg, &uid)) != 0)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_get_message",
+			   mu_umaxtostr (0, i + 1), rc);
+	  while (i-- > 0)
+	    if (tab[i]->flags & SORT_KEY_NEW)
+	      sort_key_free (tab[i]);
+	  free (tab);
+	  sort_key_close ();
+	  return rc;
+	}
+
+      /* Keys of messages that are not in the mailbox any more */
+      for (; j < keycount && keytab[j]->uid < uid; j++)
+	{
+	  keytab[j]->flags |= SORT_KEY_EXPUNGED;
+	  expunged = 1;
+	}
+
+      if (j < keycount && keytab[j]->uid == uid)
+	tab[i] = keytab[j++];
+      else
+	tab[i] = sort_key_create (msg, uid);
+      tab[i]->msgno = i + 1;
+    }
+  for (; j < keycount; j++)
+    {
+      keytab[j]->flags |= SORT_KEY_EXPUNGED;
+      expunged = 1;
+    }
+
+  if (expunged)
+    {
+      if (sort_order)
+	{
+	  for (i = j = 0; i < sort_count; i++)
+	    if (!(sort_order[i]->flags & SORT_KEY_EXPUNGED))
+	      sort_order[j++] = sort_order[i];
+	  sort_count = j;
+	}
+      for (i = 0; i < keycount; i++)
+	if (keytab[i]->flags & SORT_KEY_EXPUNGED)
+	  sort_key_free (keytab[i]);
+    }
+
+  for (i = 0; i < count; i++)
+    tab[i]->flags &= ~SORT_KEY_NEW;
+
+  free (keytab);
+  keytab = tab;
+  keycount = count;
+
+  *ptab = keytab;
+  *pcount = keycount;
+  return 0;
+}
+
+static int
+strkeycmp (char const *a, char const *b)
+{
+  return strcmp (a ? a : "", b ? b : "");
+}
+
+#define NUMCMP(a,b) ((a) < (b) ? -1 : (a) > (b))
+
+static int
+sort_key_compare (struct sort_key const *a, struct sort_key const *b)
+{
+  size_t i;
+
+  for (i = 0; i < sort_ncrit; i++)
+    {
+      int rc;
+
+      switch (sort_crit[i] & ~SORT_REVERSE)
+	{
+	case SORT_ARRIVAL:
+	  rc = NUMCMP (a->arrival, b->arrival);
+	  break;
+
+	case SORT_CC:
+	  rc = strkeycmp (a->cc, b->cc);
+	  break;
+
+	case SORT_DATE:
+	  rc = NUMCMP (a->date, b->date);
+	  break;
+
+	case SORT_FROM:
+	  rc = strkeycmp (a->from, b->from);
+	  break;
+
+	case SORT_SIZE:
+	  rc = NUMCMP (a->size, b->size);
+	  break;
+
+	case SORT_SUBJECT:
+	  rc = strkeycmp (a->subject, b->subject);
+	  break;
+
+	case SORT_TO:
+	  rc = strkeycmp (a->to, b->to);
+	  break;
+
+	default:
+	  abort ();
+	}
+      if (rc)
+	return (sort_crit[i] & SORT_REVERSE) ? -rc : rc;
+    }
+  /* RFC 5256, 3: messages that exactly match are sorted in the order
+     they appear in the mailbox. */
+  return NUMCMP (a->uid, b->uid);
+}
+
+static int
+sort_key_qcmp (const void *a, const void *b)
+{
+  return sort_key_compare (*(struct sort_key **)a, *(struct sort_key **)b);
+}
+
+/* Return the messages of the currently selected mailbox sorted by
+   the given criteria. */
+static int
+sort_messages (int *crit, size_t ncrit,
+	       struct sort_key ***porder, size_t *pcount)
+{
+  struct sort_key **tab;
+  size_t count, i;
+  int rc;
+
+  rc = sort_key_sync (&tab, &count);
+  if (rc)
+    return rc;
+
+  if (sort_ncrit == ncrit
+      && memcmp (sort_crit, crit, ncrit * sizeof (crit[0])) == 0)
+    {
+      /* Merge new messages into the cached result */
+      struct sort_key **newtab, **merged;
+      size_t nnew = 0, j, k;
+
+      newtab = mu_calloc (count + 1, sizeof (newtab[0]));
+      for (i = 0; i < count; i++)
+	if (!(tab[i]->flags & SORT_KEY_ORDERED))
+	  {
+	    newtab[nnew++] = tab[i];
+	    tab[i]->flags |= SORT_KEY_ORDERED;
+	  }
+      if (nnew)
+	{
+	  qsort (newtab, nnew, sizeof (newtab[0]), sort_key_qcmp);
+	  merged = mu_calloc (sort_count + nnew + 1, sizeof (merged[0]));
+	  for (i = j = k = 0; i < sort_count && j < nnew; k++)
+	    {
+	      if (sort_key_compare (sort_order[i], newtab[j]) <= 0)
+		merged[k] = sort_order[i++];
+	      else
+		merged[k] = newtab[j++];
+	    }
+	  while (i < sort_count)
+	    merged[k++] = sort_order[i++];
+	  while (j < nnew)
+	    merged[k++] = newtab[j++];
+	  free (sort_order);
+	  sort_order = merged;
+	  sort_count = k;
+	}
+      free (newtab);
+    }
+  else
+    {
+      sort_order_free ();
+      memcpy (sort_crit, crit, ncrit * sizeof (crit[0]));
+      sort_ncrit = ncrit;
+      sort_order = mu_calloc (count + 1, sizeof (sort_order[0]));
+      memcpy (sort_order, tab, count * sizeof (sort_order[0]));
+      sort_count = count;
+      qsort (sort_order, sort_count, sizeof (sort_order[0]), sort_key_qcmp);
+      for (i = 0; i < count; i++)
+	tab[i]->flags |= SORT_KEY_ORDERED;
+    }
+
+  *porder = sort_order;
+  *pcount = sort_count;
+  return 0;
+}
+
+static struct sort_criterion
+{
+  char *name;
+  int code;
+} sort_criteria[] = {
+  { "ARRIVAL", SORT_ARRIVAL },
+  { "CC",      SORT_CC },
+  { "DATE",    SORT_DATE },
+  { "FROM",    SORT_FROM },
+  { "SIZE",    SORT_SIZE },
+  { "SUBJECT", SORT_SUBJECT },
+  { "TO",      SORT_TO },
+  { NULL }
+};
+
+static int
+find_criterion (char const *name)
+{
+  struct sort_criterion *p;
+
+  for (p = sort_criteria; p->name; p++)
+    if (mu_c_strcasecmp (p->name, name) == 0)
+      return p->code;
+  return -1;
+}
+
+/* Callback for imap4d_search_select: mark matching messages */
+void
+sort_mark_message (size_t msgno, mu_message_t msg, void *data)
+{
+  struct sort_match *match = data;
+  if (msgno <= match->count)
+    match->tab[msgno] = 1;
+}
+
+/*
+3.  Additional Commands
+
+   SORT Command
+
+   Arguments:  sort program
+               charset specification
+               searching criteria (one or more)
+
+   Data:       untagged responses: SORT
+
+   Result:     OK - sort completed
+               NO - sort error: can't sort that charset or
+                    criteria
+               BAD - command unknown or arguments invalid
+*/
+int
+imap4d_sort (struct imap4d_session *session,
+	     struct imap4d_command *command, imap4d_tokbuf_t tok)
+{
+  int rc;
+  char *err_text = "";
+
+  rc = imap4d_sort0 (tok, 0, &err_text);
+  return io_completion_response (command, rc, "%s", err_text);
+}
+
+int
+imap4d_sort0 (imap4d_tokbuf_t tok, int isuid, char **err_text)
+{
+  int argc = imap4d_tokbuf_argc (tok);
+  int arg = IMAP4_ARG_1 + !!isuid;
+  int crit[SORT_MAX];
+  size_t ncrit = 0;
+  int rev = 0;
+  struct sort_match match;
+  size_t count = 0, i;
+  struct sort_key **order;
+  int rc;
+
+  if (arg >= argc || strcmp (imap4d_tokbuf_getarg (tok, arg), "("))
+    {
+      *err_text = "Missing sort criteria";
+      return RESP_BAD;
+    }
+
+  for (arg++; ; arg++)
+    {
+      char *s;
+      int c;
+
+      if (arg >= argc)
+	{
+	  *err_text = "Unexpected end of statement";
+	  return RESP_BAD;
+	}
+      s = imap4d_tokbuf_getarg (tok, arg);
+      if (strcmp (s, ")") == 0)
+	break;
+      if (mu_c_strcasecmp (s, "REVERSE") == 0)
+	{
+	  if (rev)
+	    {
+	      *err_text = "Invalid sort criteria";
+	      return RESP_BAD;
+	    }
+	  rev = SORT_REVERSE;
+	  continue;
+	}
+      if ((c = find_criterion (s)) == -1)
+	{
+	  *err_text = "Invalid sort criteria";
+	  return RESP_BAD;
+	}
+      if (ncrit == SORT_MAX)
+	{
+	  *err_text = "Too many sort criteria";
+	  return RESP_BAD;
+	}
+      crit[ncrit++] = c | rev;
+      rev = 0;
+    }
+
+  if (rev || ncrit == 0)
+    {
+      *err_text = "Invalid sort criteria";
+      return RESP_BAD;
+    }
+
+  /* Sort first: this brings the sort keys in sync with the mailbox, so
+     that the match table covers all messages. */
+  if (sort_messages (crit, ncrit, &order, &count))
+    {
+      *err_text = "Sort failed";
+      return RESP_NO;
+    }
+
+  match.tab = mu_zalloc (count + 1);
+  match.count = count;
+  rc = imap4d_search_select (tok, arg + 1, isuid, sort_mark_message, &match,
+			     err_text);
+  if (rc != RESP_OK)
+    {
+      free (match.tab);
+      return rc;
+    }
+
+  io_sendf ("* SORT");
+  for (i = 0; i < count; i++)
+    {
+      if (!match.tab[order[i]->msgno])
+	continue;
+      io_sendf (" %s",
+		mu_umaxtostr (0, isuid ? order[i]->uid : order[i]->msgno));
+    }
+  io_sendf ("\n");
+  free (match.tab);
+
+  *err_text = "Completed";
+  return RESP_OK;
+}
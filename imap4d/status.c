@@ -27,6 +27,7 @@ static int status_recent      (mu_mailbox_t);
 static int status_uidnext     (mu_mailbox_t);
 static int status_uidvalidity (mu_mailbox_t);
 static int status_unseen      (mu_mailbox_t);
+static int status_highestmodseq (mu_mailbox_t);
 
 struct status_table {
   char *name;
@@ -37,6 +38,7 @@ struct status_table {
   {"UIDNEXT", status_uidnext},
   {"UIDVALIDITY", status_uidvalidity},
   {"UNSEEN", status_unseen},
+  {"HIGHESTMODSEQ", status_highestmodseq},
   { NULL }
 };
 
@@ -117,6 +119,8 @@ imap4d_status (struct imap4d_session *session,
 
 	      item = imap4d_tokbuf_getarg (tok, i);
 	      fun = status_get_handler (item);
+	      if (fun == status_highestmodseq && !modseq_dir)
+		fun = NULL;
 	      if (!fun)
 		{
 		  err_msg = "Invalid flag in list";
@@ -219,3 +223,14 @@ status_unseen (mu_mailbox_t smbox)
   io_sendf ("UNSEEN %lu", (unsigned long) unseen);
   return 0;
 }
+
+/* RFC 7162, 3.1.9.  The highest mod-sequence of a mailbox that has never
+   been selected is reported as 0. */
+static int
+status_highestmodseq (mu_mailbox_t smbox)
+{
+  uintmax_t highest = 0;
+  modseq_mailbox_highest (smbox, &highest);
+  io_sendf ("HIGHESTMODSEQ %s", mu_umaxtostr (0, highest));
+  return 0;
+}
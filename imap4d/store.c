@@ -15,6 +15,7 @@
    along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "imap4d.h"
+#include <inttypes.h>
 
 enum value_type { STORE_SET, STORE_ADD, STORE_UNSET };
 
@@ -25,7 +26,41 @@ struct store_parse_closure
   int type;
   int isuid;
   mu_msgset_t msgset;
+  int unchangedsince_set;     /* UNCHANGEDSINCE modifier given */
+  uintmax_t unchangedsince;   /* Its value */
+  mu_msgset_t modified;       /* Messages that failed the UNCHANGEDSINCE
+				 test */
 };
+
+/* store-modifiers = SP "(" store-modifier *(SP store-modifier) ")"
+   store-modifier  = "UNCHANGEDSINCE" SP mod-sequence-valzer
+   (RFC 4466, RFC 7162) */
+static void
+parse_store_modifiers (imap4d_parsebuf_t p)
+{
+  struct store_parse_closure *pclos = imap4d_parsebuf_data (p);
+
+  if (!modseq_enabled ())
+    imap4d_parsebuf_exit (p, "Mailbox does not support mod-sequences");
+  while (imap4d_parsebuf_next (p, 1)[0] != ')')
+    {
+      if (mu_c_strcasecmp (p->token, "UNCHANGEDSINCE") == 0)
+	{
+	  char *end;
+
+	  imap4d_parsebuf_next (p, 1);
+	  errno = 0;
+	  pclos->unchangedsince = strtoumax (p->token, &end, 10);
+	  if (!mu_isdigit (p->token[0]) || *end || errno)
+	    imap4d_parsebuf_exit (p, "Invalid mod-sequence");
+	  pclos->unchangedsince_set = 1;
+	}
+      else
+	imap4d_parsebuf_exit (p, "Unknown STORE modifier");
+    }
+  /* UNCHANGEDSINCE is a CONDSTORE enabling modifier. */
+  enabled_extensions |= IMAP4D_ENABLE_CONDSTORE;
+}
   
 static int
 store_thunk (imap4d_parsebuf_t p)
@@ -39,6 +74,12 @@ store_thunk (imap4d_parsebuf_t p)
   mstr = imap4d_parsebuf_next (p, 1);
   data = imap4d_parsebuf_next (p, 1);
 
+  if (*data == '(')
+    {
+      parse_store_modifiers (p);
+      data = imap4d_parsebuf_next (p, 1);
+    }
+
   if (*data == '+')
     {
       pclos->how = STORE_ADD;
@@ -95,6 +136,22 @@ _do_store (size_t msgno, mu_message_t msg, void *data)
 {
   struct store_parse_closure *pclos = data;
   mu_attribute_t attr = NULL;
+  size_t uid = 0;
+
+  if (pclos->isuid)
+    mu_mailbox_translate (mbox, MU_MAILBOX_MSGNO_TO_UID, msgno, &uid);
+
+  if (pclos->unchangedsince_set
+      && modseq_get (msgno) > pclos->unchangedsince)
+    {
+      if (!pclos->modified)
+	mu_msgset_create (&pclos->modified, NULL, MU_MSGSET_NUM);
+      mu_msgset_add_range (pclos->modified,
+			   pclos->isuid ? uid : msgno,
+			   pclos->isuid ? uid : msgno,
+			   MU_MSGSET_NUM);
+      return 0;
+    }
       
   mu_message_get_attribute (msg, &attr);
 	      
@@ -114,24 +171,32 @@ _do_store (size_t msgno, mu_message_t msg, void *data)
     }
 
 	  
+  /* Update the flags of uid table.  */
+  imap4d_sync_flags (msgno);
+  modseq_touch (msgno);
+
   if (pclos->ack)
     {
       io_sendf ("* %lu FETCH (", (unsigned long) msgno);
       
-      if (pclos->isuid)
-	{
-	  size_t uid;
-	  int rc = mu_mailbox_translate (mbox, MU_MAILBOX_UID_TO_MSGNO,
-					 msgno, &uid);
-	  if (rc == 0)
-	    io_sendf ("UID %lu ", (unsigned long) uid);
-	}
+      if (pclos->isuid && uid)
+	io_sendf ("UID %lu ", (unsigned long) uid);
       io_sendf ("FLAGS (");
       util_print_flags (attr);
-      io_sendf ("))\n");
+      io_sendf (")");
+      if (enabled_extensions & IMAP4D_ENABLE_CONDSTORE)
+	io_sendf (" MODSEQ (%s)", mu_umaxtostr (0, modseq_get (msgno)));
+      io_sendf (")\n");
+    }
+  else if (pclos->unchangedsince_set)
+    {
+      /* RFC 7162, 3.1.3: report the new mod-sequence even if .SILENT
+	 was given. */
+      io_sendf ("* %lu FETCH (", (unsigned long) msgno);
+      if (pclos->isuid && uid)
+	io_sendf ("UID %lu ", (unsigned long) uid);
+      io_sendf ("MODSEQ (%s))\n", mu_umaxtostr (0, modseq_get (msgno)));
     }
-  /* Update the flags of uid table.  */
-  imap4d_sync_flags (msgno);
   return 0;
 }
 
@@ -155,9 +220,33 @@ imap4d_store0 (imap4d_tokbuf_t tok, int isuid, char **ptext)
       mu_msgset_foreach_message (pclos.msgset, _do_store, &pclos);
     
       *ptext = "Completed";
+      if (pclos.modified)
+	{
+	  static char *modified_text;
+	  mu_stream_t str;
+
+	  free (modified_text);
+	  modified_text = NULL;
+	  if (mu_memory_stream_create (&str, MU_STREAM_RDWR) == 0)
+	    {
+	      mu_off_t size;
+
+	      mu_stream_printf (str, "[MODIFIED ");
+	      mu_msgset_imap_print (str, pclos.modified);
+	      mu_stream_printf (str, "] Conditional STORE failed");
+	      mu_stream_size (str, &size);
+	      modified_text = mu_alloc (size + 1);
+	      mu_stream_seek (str, 0, MU_SEEK_SET, NULL);
+	      mu_stream_read (str, modified_text, size, NULL);
+	      modified_text[size] = 0;
+	      mu_stream_destroy (&str);
+	      *ptext = modified_text;
+	    }
+	}
     }
   
   mu_msgset_free (pclos.msgset);
+  mu_msgset_free (pclos.modified);
   
   return rc;
 }
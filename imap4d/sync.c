@@ -73,6 +73,7 @@ notify (void)
   
   mu_mailbox_messages_count (mbox, &total);
   mu_mailbox_messages_recent (mbox, &recent);
+  modseq_update ();
 
   if (!attr_table_valid)
     {
@@ -98,8 +99,11 @@ notify (void)
 	    {
 	      if (nflags != attr_table[i-1])
 		{
-		  io_sendf ("* %lu FETCH FLAGS (",  (unsigned long) i);
+		  io_sendf ("* %lu FETCH (FLAGS (",  (unsigned long) i);
 		  mu_imap_format_flags (iostream, nflags, 1);
+		  io_sendf (")");
+		  if (enabled_extensions & IMAP4D_ENABLE_CONDSTORE)
+		    io_sendf (" MODSEQ (%s)", mu_umaxtostr (0, modseq_get (i)));
 		  io_sendf (")\n");
 		  attr_table[i-1] = nflags;
 		}
@@ -164,8 +168,17 @@ action (mu_observer_t observer, size_t type, void *data, void *action_data)
       if (!silent_expunge)
 	{
 	  size_t *exp = data;
-	  io_untagged_response (RESP_NONE, "%lu EXPUNGED",
-				(unsigned long) (exp[0] - exp[1]));
+	  size_t uid;
+
+	  /* RFC 7162, 3.2.10: once QRESYNC is enabled, the server MUST use
+	     the VANISHED response to report message sequence removals. */
+	  if ((enabled_extensions & IMAP4D_ENABLE_QRESYNC)
+	      && modseq_msgno_to_uid (exp[0], &uid) == 0)
+	    io_untagged_response (RESP_NONE, "VANISHED %lu",
+				  (unsigned long) uid);
+	  else
+	    io_untagged_response (RESP_NONE, "%lu EXPUNGED",
+				  (unsigned long) (exp[0] - exp[1]));
 	}
     }
   return 0;
@@ -0,0 +1,526 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   GNU Mailutils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Mailutils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Implementation of the THREAD extension (RFC 5256) */
+
+#include "imap4d.h"
+#include <mailutils/assoc.h>
+
+struct thread_node
+{
+  struct sort_key *key;          /* Message sort keys, NULL for dummies */
+  struct thread_node *parent;    /* Parent node */
+  struct thread_node *child;     /* First child */
+  struct thread_node *next;      /* Next sibling */
+  struct thread_node *link;      /* Next allocated node */
+};
+
+struct thread_tree
+{
+  struct thread_node root;       /* Dummy root node */
+  struct thread_node *nodes;     /* List of allocated nodes */
+};
+
+static struct thread_node *
+thread_node_alloc (struct thread_tree *tree, struct sort_key *key)
+{
+  struct thread_node *node = mu_zalloc (sizeof (*node));
+  node->key = key;
+  node->link = tree->nodes;
+  tree->nodes = node;
+  return node;
+}
+
+static void
+thread_tree_free (struct thread_tree *tree)
+{
+  while (tree->nodes)
+    {
+      struct thread_node *next = tree->nodes->link;
+      free (tree->nodes);
+      tree->nodes = next;
+    }
+}
+
+static void
+thread_unlink (struct thread_node *node)
+{
+  struct thread_node **pp;
+
+  if (!node->parent)
+    return;
+  for (pp = &node->parent->child; *pp; pp = &(*pp)->next)
+    if (*pp == node)
+      {
+	*pp = node->next;
+	break;
+      }
+  node->parent = NULL;
+  node->next = NULL;
+}
+
+static void
+thread_add_child (struct thread_node *parent, struct thread_node *node)
+{
+  struct thread_node **pp;
+
+  for (pp = &parent->child; *pp; pp = &(*pp)->next)
+    ;
+  *pp = node;
+  node->parent = parent;
+  node->next = NULL;
+}
+
+/* Return true if A is B or one of its ancestors */
+static int
+thread_is_ancestor (struct thread_node *a, struct thread_node *b)
+{
+  for (; b; b = b->parent)
+    if (a == b)
+      return 1;
+  return 0;
+}
+
+/* Return the sort keys representing the node: for a dummy, those of
+   its first child. */
+static struct sort_key *
+thread_node_key (struct thread_node *node)
+{
+  while (!node->key && node->child)
+    node = node->child;
+  return node->key;
+}
+
+/* Compare two nodes by sent date (RFC 5256, 2.2) */
+static int
+thread_node_cmp (const void *a, const void *b)
+{
+  struct sort_key *ka = thread_node_key (*(struct thread_node **)a);
+  struct sort_key *kb = thread_node_key (*(struct thread_node **)b);
+
+  if (!ka || !kb)
+    return !ka - !kb;
+  if (ka->date != kb->date)
+    return ka->date < kb->date ? -1 : 1;
+  return ka->msgno < kb->msgno ? -1 : ka->msgno > kb->msgno;
+}
+
+/* Sort the children of NODE by sent date.  If RECURSIVE is true, sort
+   all siblings in the subtree, the deepest ones first. */
+static void
+thread_sort_children (struct thread_node *node, int recursive)
+{
+  struct thread_node *p, **tab;
+  size_t i, n = 0;
+
+  for (p = node->child; p; p = p->next)
+    {
+      if (recursive)
+	thread_sort_children (p, 1);
+      n++;
+    }
+  if (n < 2)
+    return;
+  tab = mu_calloc (n, sizeof (tab[0]));
+  for (i = 0, p = node->child; p; p = p->next)
+    tab[i++] = p;
+  qsort (tab, n, sizeof (tab[0]), thread_node_cmp);
+  for (i = 0; i < n - 1; i++)
+    tab[i]->next = tab[i+1];
+  tab[n-1]->next = NULL;
+  node->child = tab[0];
+  free (tab);
+}
+
+/* ORDEREDSUBJECT algorithm (RFC 5256, 4) */
+
+static int
+subject_cmp (const void *a, const void *b)
+{
+  struct sort_key const *ka = *(struct sort_key **)a;
+  struct sort_key const *kb = *(struct sort_key **)b;
+  int rc = strcmp (ka->subject ? ka->subject : "",
+		   kb->subject ? kb->subject : "");
+  if (rc)
+    return rc;
+  if (ka->date != kb->date)
+    return ka->date < kb->date ? -1 : 1;
+  return ka->msgno < kb->msgno ? -1 : ka->msgno > kb->msgno;
+}
+
+static void
+thread_orderedsubject (struct thread_tree *tree,
+		       struct sort_key **keys, size_t count)
+{
+  struct thread_node *head = NULL;
+  size_t i;
+
+  qsort (keys, count, sizeof (keys[0]), subject_cmp);
+  for (i = 0; i < count; i++)
+    {
+      struct thread_node *node = thread_node_alloc (tree, keys[i]);
+
+      if (head && strcmp (head->key->subject ? head->key->subject : "",
+			  keys[i]->subject ? keys[i]->subject : "") == 0)
+	thread_add_child (head, node);
+      else
+	{
+	  thread_add_child (&tree->root, node);
+	  head = node;
+	}
+    }
+  thread_sort_children (&tree->root, 0);
+}
+
+/* REFERENCES algorithm (RFC 5256, 4) */
+
+static struct thread_node *
+thread_lookup_id (struct thread_tree *tree, mu_assoc_t ids, char const *id)
+{
+  struct thread_node *node;
+
+  if (mu_assoc_lookup (ids, id, &node) == 0)
+    return node;
+  node = thread_node_alloc (tree, NULL);
+  mu_assoc_install (ids, id, node);
+  return node;
+}
+
+/* Step 3: prune dummy messages */
+static void
+thread_prune (struct thread_node *parent)
+{
+  struct thread_node **pp = &parent->child;
+  struct thread_node *node;
+
+  while ((node = *pp) != NULL)
+    {
+      if (!node->key)
+	{
+	  if (!node->child)
+	    {
+	      /* Dummy without children: delete it */
+	      *pp = node->next;
+	      continue;
+	    }
+	  /* Promote children of a dummy, unless that would make more
+	     than one message children of the root */
+	  if (parent->parent || !node->child->next)
+	    {
+	      struct thread_node *p, *last = NULL;
+
+	      for (p = node->child; p; p = p->next)
+		{
+		  p->parent = parent;
+		  last = p;
+		}
+	      last->next = node->next;
+	      *pp = node->child;
+	      continue;
+	    }
+	}
+      thread_prune (node);
+      pp = &node->next;
+    }
+}
+
+/* Step 5: gather together messages that have the same base subject */
+static void
+thread_merge_subjects (struct thread_tree *tree)
+{
+  mu_assoc_t subjects;
+  struct thread_node *node, **tab;
+  size_t i, n;
+
+  mu_assoc_create (&subjects, 0);
+
+  /* 5.B: populate the subject table */
+  for (node = tree->root.child; node; node = node->next)
+    {
+      struct sort_key *key = thread_node_key (node);
+      struct thread_node **slot;
+
+      if (!key || !key->subject || !key->subject[0])
+	continue;
+      if (mu_assoc_lookup_ref (subjects, key->subject, &slot))
+	mu_assoc_install (subjects, key->subject, node);
+      else if ((*slot)->key
+	       && (!node->key || ((*slot)->key->reply && !node->key->reply)))
+	*slot = node;
+    }
+
+  /* 5.C: merge threads.  Iterate over a copy of the list, because
+     it is modified by the loop. */
+  for (n = 0, node = tree->root.child; node; node = node->next)
+    n++;
+  tab = mu_calloc (n + 1, sizeof (tab[0]));
+  for (i = 0, node = tree->root.child; node; node = node->next)
+    tab[i++] = node;
+
+  for (i = 0; i < n; i++)
+    {
+      struct sort_key *key;
+      struct thread_node *t;
+
+      node = tab[i];
+      if (node->parent != &tree->root)
+	/* Moved to another thread */
+	continue;
+      key = thread_node_key (node);
+      if (!key || !key->subject || !key->subject[0]
+	  || mu_assoc_lookup (subjects, key->subject, &t) || t == node)
+	continue;
+
+      if (!t->key && !node->key)
+	{
+	  /* Both are dummies: children become siblings */
+	  struct thread_node *p;
+
+	  thread_unlink (node);
+	  while ((p = node->child) != NULL)
+	    {
+	      thread_unlink (p);
+	      thread_add_child (t, p);
+	    }
+	}
+      else if (!t->key || (node->key && node->key->reply && !t->key->reply))
+	{
+	  thread_unlink (node);
+	  thread_add_child (t, node);
+	}
+      else
+	{
+	  /* Create a new dummy, make both messages its children and
+	     put it in place of the message in the table */
+	  struct thread_node *dummy = thread_node_alloc (tree, NULL);
+	  struct thread_node **pp, **slot;
+
+	  thread_unlink (node);
+	  for (pp = &tree->root.child; *pp != t; pp = &(*pp)->next)
+	    ;
+	  *pp = dummy;
+	  dummy->parent = &tree->root;
+	  dummy->next = t->next;
+	  t->next = NULL;
+	  thread_add_child (dummy, t);
+	  thread_add_child (dummy, node);
+	  mu_assoc_lookup_ref (subjects, key->subject, &slot);
+	  *slot = dummy;
+	}
+    }
+  free (tab);
+  mu_assoc_destroy (&subjects);
+}
+
+static void
+thread_references (struct thread_tree *tree,
+		   struct sort_key **keys, size_t count)
+{
+  mu_assoc_t ids;
+  struct thread_node *node;
+  size_t i, j;
+
+  mu_assoc_create (&ids, 0);
+
+  /* Step 1: link messages by their references */
+  for (i = 0; i < count; i++)
+    {
+      struct sort_key *key = keys[i];
+      struct thread_node *prev = NULL;
+
+      node = NULL;
+      if (key->msgid)
+	{
+	  node = thread_lookup_id (tree, ids, key->msgid);
+	  if (node->key)
+	    /* Duplicate message ID: treat it as unique */
+	    node = NULL;
+	  else
+	    node->key = key;
+	}
+      if (!node)
+	node = thread_node_alloc (tree, key);
+
+      /* 1.A */
+      for (j = 0; j < key->nrefs; j++)
+	{
+	  struct thread_node *ref = thread_lookup_id (tree, ids, key->refs[j]);
+	  if (prev && !ref->parent && !thread_is_ancestor (ref, prev))
+	    thread_add_child (prev, ref);
+	  prev = ref;
+	}
+
+      /* 1.B */
+      thread_unlink (node);
+      if (prev && !thread_is_ancestor (node, prev))
+	thread_add_child (prev, node);
+    }
+  mu_assoc_destroy (&ids);
+
+  /* Step 2: gather parentless messages under the root */
+  for (node = tree->nodes; node; node = node->link)
+    if (!node->parent)
+      thread_add_child (&tree->root, node);
+
+  /* Step 3 */
+  thread_prune (&tree->root);
+
+  /* Step 4: sort top-level siblings */
+  for (node = tree->root.child; node; node = node->next)
+    if (!node->key)
+      thread_sort_children (node, 0);
+  thread_sort_children (&tree->root, 0);
+
+  /* Step 5 */
+  thread_merge_subjects (tree);
+
+  /* Step 6 */
+  thread_sort_children (&tree->root, 1);
+}
+
+/* Step 7: output a thread */
+static void
+thread_print (struct thread_node *node, int isuid)
+{
+  int first = 1;
+
+  io_sendf ("(");
+  for (;;)
+    {
+      if (node->key)
+	{
+	  io_sendf ("%s%s", first ? "" : " ",
+		    mu_umaxtostr (0, isuid ? node->key->uid : node->key->msgno));
+	  first = 0;
+	}
+      if (!node->child)
+	break;
+      if (!node->child->next)
+	node = node->child;
+      else
+	{
+	  struct thread_node *p;
+
+	  if (!first)
+	    io_sendf (" ");
+	  for (p = node->child; p; p = p->next)
+	    thread_print (p, isuid);
+	  break;
+	}
+    }
+  io_sendf (")");
+}
+
+static struct thread_algorithm
+{
+  char *name;
+  void (*fun) (struct thread_tree *, struct sort_key **, size_t);
+} thread_algorithms[] = {
+  { "ORDEREDSUBJECT", thread_orderedsubject },
+  { "REFERENCES",     thread_references },
+  { NULL }
+};
+
+/*
+   THREAD Command
+
+   Arguments:  threading algorithm
+               charset specification
+               searching criteria (one or more)
+
+   Data:       untagged responses: THREAD
+
+   Result:     OK - thread completed
+               NO - thread error: can't thread that charset or
+                    criteria
+               BAD - command unknown or arguments invalid
+*/
+int
+imap4d_thread (struct imap4d_session *session,
+	       struct imap4d_command *command, imap4d_tokbuf_t tok)
+{
+  int rc;
+  char *err_text = "";
+
+  rc = imap4d_thread0 (tok, 0, &err_text);
+  return io_completion_response (command, rc, "%s", err_text);
+}
+
+int
+imap4d_thread0 (imap4d_tokbuf_t tok, int isuid, char **err_text)
+{
+  int arg = IMAP4_ARG_1 + !!isuid;
+  char *name;
+  struct thread_algorithm *alg;
+  struct sort_match match;
+  size_t count = 0, i, n;
+  struct sort_key **tab, **keys;
+  struct thread_tree tree;
+  struct thread_node *node;
+  int rc;
+
+  name = imap4d_tokbuf_getarg (tok, arg);
+  if (!name)
+    {
+      *err_text = "Too few args";
+      return RESP_BAD;
+    }
+  for (alg = thread_algorithms; alg->name; alg++)
+    if (mu_c_strcasecmp (alg->name, name) == 0)
+      break;
+  if (!alg->name)
+    {
+      *err_text = "Unsupported threading algorithm";
+      return RESP_BAD;
+    }
+
+  if (sort_key_sync (&tab, &count))
+    {
+      *err_text = "Thread failed";
+      return RESP_NO;
+    }
+
+  match.tab = mu_zalloc (count + 1);
+  match.count = count;
+  rc = imap4d_search_select (tok, arg + 1, isuid, sort_mark_message, &match,
+			     err_text);
+  if (rc != RESP_OK)
+    {
+      free (match.tab);
+      return rc;
+    }
+
+  keys = mu_calloc (count + 1, sizeof (keys[0]));
+  for (i = n = 0; i < count; i++)
+    if (match.tab[tab[i]->msgno])
+      keys[n++] = tab[i];
+  free (match.tab);
+
+  memset (&tree, 0, sizeof (tree));
+  alg->fun (&tree, keys, n);
+  free (keys);
+
+  io_sendf ("* THREAD");
+  if (tree.root.child)
+    io_sendf (" ");
+  for (node = tree.root.child; node; node = node->next)
+    thread_print (node, isuid);
+  io_sendf ("\n");
+  thread_tree_free (&tree);
+
+  *err_text = "Completed";
+  return RESP_OK;
+}
@@ -42,10 +42,18 @@ imap4d_uid (struct imap4d_session *session,
     }
   else if (mu_c_strcasecmp (cmd, "COPY") == 0)
     rc = imap4d_copy0 (tok, 1, &err_text);
+  else if (mu_c_strcasecmp (cmd, "MOVE") == 0)
+    rc = imap4d_move0 (tok, 1, &err_text);
+  else if (mu_c_strcasecmp (cmd, "EXPUNGE") == 0)
+    rc = imap4d_expunge0 (tok, 1, &err_text);
   else if (mu_c_strcasecmp (cmd, "STORE") == 0)
     rc = imap4d_store0 (tok, 1, &err_text);
   else if (mu_c_strcasecmp (cmd, "SEARCH") == 0)
     rc = imap4d_search0 (tok, 1, &err_text);
+  else if (mu_c_strcasecmp (cmd, "SORT") == 0)
+    rc = imap4d_sort0 (tok, 1, &err_text);
+  else if (mu_c_strcasecmp (cmd, "THREAD") == 0)
+    rc = imap4d_thread0 (tok, 1, &err_text);
   else
     {
       err_text = "Unknown uid command";
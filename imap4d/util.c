@@ -15,6 +15,7 @@
    along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "imap4d.h"
+#include <mailutils/md5.h>
 
 int
 util_do_command (struct imap4d_session *session, imap4d_tokbuf_t tok)
@@ -53,6 +54,19 @@ util_do_command (struct imap4d_session *session, imap4d_tokbuf_t tok)
   if (command->states && (command->states & state) == 0)
     return io_completion_response (command, RESP_BAD, "Wrong state");
 
+  if (mu_srvstat_get_default ())
+    {
+      struct timeval tv;
+      mu_off_t in, out, in1, out1;
+      int rc;
+      
+      io_get_stat (&in, &out);
+      mu_srvstat_start (&tv);
+      rc = command->func (session, command, tok);
+      io_get_stat (&in1, &out1);
+      mu_srvstat_finish (command->name, &tv, in1 - in, out1 - out);
+      return rc;
+    }
   return command->func (session, command, tok);
 }
 
@@ -244,11 +258,73 @@ util_uidvalidity (mu_mailbox_t smbox, unsigned long *uidvp)
   return mu_mailbox_uidvalidity (smbox, uidvp);
 }
 
+/* Return true if the message set SET contains N.  Unlike
+   mu_msgset_locate, this works for sets not bound to a mailbox, treating
+   ranges that end with "*" as open. */
+int
+util_msgset_contains (mu_msgset_t set, size_t n)
+{
+  mu_list_t list;
+  mu_iterator_t itr;
+  int found = 0;
+
+  if (mu_msgset_get_list (set, &list) || mu_list_get_iterator (list, &itr))
+    return 0;
+  for (mu_iterator_first (itr); !found && !mu_iterator_is_done (itr);
+       mu_iterator_next (itr))
+    {
+      struct mu_msgrange *r;
+      mu_iterator_current (itr, (void**)&r);
+      found = n >= r->msg_beg
+	       && (r->msg_end == MU_MSGNO_LAST || n <= r->msg_end);
+    }
+  mu_iterator_destroy (&itr);
+  return found;
+}
+
+/* Return the name of the per-mailbox state file for MBX in directory
+   DIR, creating DIR if necessary.  Relative DIR is taken relative to
+   the user's home directory.  The file name is the MD5 sum of the
+   mailbox URL.  Return NULL on error. */
+char *
+util_state_file_name (mu_mailbox_t mbx, const char *dir)
+{
+  mu_url_t url;
+  const char *name;
+  unsigned char digest[MD5_DIGEST_SIZE];
+  char hexbuf[2 * MD5_DIGEST_SIZE + 1];
+  char *dirname, *file;
+  int i;
+
+  if (mu_mailbox_get_url (mbx, &url) || mu_url_sget_name (url, &name))
+    return NULL;
+  mu_md5_buffer (name, strlen (name), digest);
+  for (i = 0; i < MD5_DIGEST_SIZE; i++)
+    sprintf (hexbuf + 2 * i, "%02x", digest[i]);
+
+  if (dir[0] == '/')
+    dirname = mu_strdup (dir);
+  else
+    dirname = mu_make_file_name (real_homedir, dir);
+
+  if (access (dirname, F_OK)
+      && (make_interdir (dirname, '/', MKDIR_PERMISSIONS)
+	  || (mkdir (dirname, MKDIR_PERMISSIONS) && errno != EEXIST)))
+    {
+      mu_error (_("cannot create directory %s"), dirname);
+      free (dirname);
+      return NULL;
+    }
+
+  file = mu_make_file_name (dirname, hexbuf);
+  free (dirname);
+  return file;
+}
+
 void
 util_bye ()
 {
-  mu_stream_close (iostream);
-  mu_stream_destroy (&iostream);
+  io_close ();
 }
 
 void
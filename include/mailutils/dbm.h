@@ -77,4 +77,12 @@ int mu_dbm_get_name (mu_dbm_file_t db, const char **pname);
 
 int mu_dbm_impl_iterator (mu_iterator_t *itr);
 
+#define MU_DBM_CACHE_READ  0x01  /* Keep read descriptors open */
+#define MU_DBM_CACHE_WRITE 0x02  /* Defer writes until exit */
+
+void mu_dbm_cache_set_flags (int flags);
+int mu_dbm_cache_get_flags (void);
+int mu_dbm_cache_flush (void);
+void mu_dbm_cache_release (void);
+
 #endif
@@ -140,6 +140,15 @@ enum mu_iconv_fallback_mode
 extern int mu_linelen_filter_create (mu_stream_t *pstream, mu_stream_t stream,
 				     size_t limit, int flags);
 
+/* Raw deflate (RFC 1951) compression streams */
+#define MU_DEFLATE_LEVEL_DEFAULT (-1)
+
+extern int mu_deflate_stream_create (mu_stream_t *pstream,
+				     mu_stream_t transport,
+				     int level, int flags);
+extern int mu_deflate_stream_install (mu_stream_t stream, int level,
+				      mu_stream_t *pret);
+
   
 #ifdef __cplusplus
 }
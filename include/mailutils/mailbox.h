@@ -69,11 +69,14 @@ extern int  mu_mailbox_append_message  (mu_mailbox_t, mu_message_t);
 extern int  mu_mailbox_append_message_ext (mu_mailbox_t mbox, mu_message_t msg,
 					   mu_envelope_t env,
 					   mu_attribute_t atr);
+extern int  mu_mailbox_append_msgset (mu_mailbox_t dst, mu_mailbox_t src,
+				      mu_msgset_t msgset);
   
 extern int  mu_mailbox_messages_count  (mu_mailbox_t, size_t *);
 extern int  mu_mailbox_messages_recent (mu_mailbox_t, size_t *);
 extern int  mu_mailbox_message_unseen  (mu_mailbox_t, size_t *);
 extern int  mu_mailbox_expunge         (mu_mailbox_t);
+extern int  mu_mailbox_expunge_msgset  (mu_mailbox_t, mu_msgset_t);
 extern int  mu_mailbox_sync            (mu_mailbox_t);  
 
 extern int  mu_mailbox_attach_ticket (mu_mailbox_t mbox);
@@ -93,6 +96,13 @@ extern int  mu_mailbox_get_size        (mu_mailbox_t, mu_off_t *size);
 extern int  mu_mailbox_is_updated      (mu_mailbox_t);
 extern int  mu_mailbox_scan            (mu_mailbox_t, size_t no, size_t *count);
 
+typedef int (*mu_mailbox_header_action_t) (size_t _msgno,
+					   mu_message_qid_t _qid,
+					   mu_header_t _hdr,
+					   void *_data);
+extern int  mu_mailbox_headers_foreach (mu_mailbox_t,
+					mu_mailbox_header_action_t, void *);
+
 /* Lock settings.  */
 extern int  mu_mailbox_get_locker      (mu_mailbox_t, mu_locker_t *);
 extern int  mu_mailbox_set_locker      (mu_mailbox_t, mu_locker_t);
@@ -119,6 +119,8 @@ void mu_m_server_set_app_data_size (mu_m_server_t srv, size_t size);
 int mu_m_server_set_config_size (mu_m_server_t srv, size_t size);
 void mu_m_server_set_preflight (mu_m_server_t srv,
 				mu_m_server_preflight_fp fun);
+const char *mu_m_server_stat_socket (mu_m_server_t srv);
+mu_srvstat_t mu_m_server_srvstat (mu_m_server_t srv);
 
 struct mu_srv_config *mu_m_server_listen (mu_m_server_t msrv,
 					  struct mu_sockaddr *s, int type);
@@ -146,4 +148,31 @@ void mu_m_server_cfg_init (mu_m_server_t msrv, struct mu_cfg_param *app_param);
 
 int mu_sid (char **);
 
+
+/* Server statistics */
+#define MU_SRVSTAT_NAME_MAX 24   /* Max. length of an entry name + 1 */
+#define MU_SRVSTAT_BUCKETS  160  /* Number of histogram buckets */
+#define MU_SRVSTAT_DEFAULT_SIZE 128 /* Default number of entries */
+
+/* Names of the standard entries */
+#define MU_SRVSTAT_MAILBOX_OPEN  "mailbox-open"
+#define MU_SRVSTAT_MAILBOX_SCAN  "mailbox-scan"
+#define MU_SRVSTAT_MAILBOX_FLUSH "mailbox-flush"
+#define MU_SRVSTAT_LOCK_WAIT     "lock-wait"
+
+int mu_srvstat_create (mu_srvstat_t *pst, const char *ident, size_t nmax);
+void mu_srvstat_destroy (mu_srvstat_t *pst);
+int mu_srvstat_register (mu_srvstat_t st, const char *name);
+int mu_srvstat_add (mu_srvstat_t st, const char *name, unsigned long usec,
+		    mu_off_t in, mu_off_t out);
+int mu_srvstat_format (mu_srvstat_t st, mu_stream_t str);
+size_t mu_srvstat_bucket (unsigned long usec);
+unsigned long mu_srvstat_bucket_bound (size_t n);
+
+void mu_srvstat_set_default (mu_srvstat_t st);
+mu_srvstat_t mu_srvstat_get_default (void);
+void mu_srvstat_start (struct timeval *tv);
+void mu_srvstat_finish (const char *name, struct timeval const *tv,
+			mu_off_t in, mu_off_t out);
+
 #endif
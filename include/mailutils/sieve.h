@@ -39,7 +39,7 @@ typedef struct mu_sieve_string
   unsigned changed:1;        /* String value has changed */
   char *orig;                /* String original value */
   char *exp;                 /* Actual string value after expansion */
-  void *rx;                  /* Pointer to the corresponding regular expr */
+  void *rx;                  /* Pointer to the compiled pattern */
 } mu_sieve_string_t;
   
 typedef int (*mu_sieve_handler_t) (mu_sieve_machine_t mach);
@@ -118,6 +118,15 @@ struct mu_sieve_command          /* test or action */
 #define MU_SIEVE_MATCH_EQ        5
 #define MU_SIEVE_MATCH_LAST      6
 
+/* Parts of the message a test or action can access */
+#define MU_SIEVE_ACCESS_HEADER 0x01  /* Header and envelope */
+#define MU_SIEVE_ACCESS_SIZE   0x02  /* Message size */
+#define MU_SIEVE_ACCESS_BODY   0x04  /* Message body */
+#define MU_SIEVE_ACCESS_EXTERNAL 0x08 /* Talks to external programs or
+					services */
+#define MU_SIEVE_ACCESS_ALL \
+  (MU_SIEVE_ACCESS_HEADER|MU_SIEVE_ACCESS_SIZE|MU_SIEVE_ACCESS_BODY)
+
 enum mu_sieve_record
   {
     mu_sieve_record_action,
@@ -131,6 +140,7 @@ typedef struct
   int required;
   void *handle;
   enum mu_sieve_record type;
+  int access;                   /* MU_SIEVE_ACCESS_* bits */
   union
   {
     struct mu_sieve_command command;
@@ -175,6 +185,8 @@ mu_sieve_registry_t *mu_sieve_registry_lookup (mu_sieve_machine_t mach,
 					       enum mu_sieve_record type);
 int mu_sieve_registry_require (mu_sieve_machine_t mach, const char *name,
 			       enum mu_sieve_record type);
+void mu_sieve_registry_set_access (mu_sieve_machine_t mach, const char *name,
+				   enum mu_sieve_record type, int access);
 
 void mu_sieve_register_test_ext (mu_sieve_machine_t mach,
 				 const char *name, mu_sieve_handler_t handler,
@@ -283,6 +295,7 @@ void *mu_sieve_get_data (mu_sieve_machine_t mach);
 void mu_sieve_set_data (mu_sieve_machine_t mach, void *);
 mu_message_t mu_sieve_get_message (mu_sieve_machine_t mach);
 size_t mu_sieve_get_message_num (mu_sieve_machine_t mach);
+int mu_sieve_get_message_access (mu_sieve_machine_t mach);
 
 mu_mailbox_t mu_sieve_get_mailbox (mu_sieve_machine_t mach);
 
@@ -331,6 +344,8 @@ int mu_sieve_compile_text (mu_sieve_machine_t mach,
 			   const char *buf, size_t bufsize,
 			   struct mu_locus_point const *pt);
 int mu_sieve_mailbox (mu_sieve_machine_t mach, mu_mailbox_t mbox);
+int mu_sieve_mailbox_message (mu_sieve_machine_t mach, mu_mailbox_t mbox,
+			      size_t msgno);
 int mu_sieve_message (mu_sieve_machine_t mach, mu_message_t message);
 int mu_sieve_disass (mu_sieve_machine_t mach);
 
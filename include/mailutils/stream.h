@@ -47,7 +47,10 @@ enum mu_buffer_type
 /* Not used                   0x00000040 */
 /* Not used. Intended for mailboxes only. */
 #define MU_STREAM_NONLOCK     0x00000080
-/* Not used as well           0x00000100  */
+/* Mailboxes only: the caller needs only message headers and envelopes.
+   Drivers may skip computing body sizes and line counts until they
+   are requested. */
+#define MU_STREAM_HEADERS_ONLY 0x00000100
 /* FIXME: This one affects only mailboxes */  
 #define MU_STREAM_QACCESS     0x00000200
 
@@ -83,6 +86,8 @@ enum mu_buffer_type
 
 #define MU_IOCTL_TIMEOUT         16 /* Get or set the I/O timeout value
 				       (struct timeval) */
+#define MU_IOCTL_ZEROCOPY        17 /* Zero-copy transfer capabilities
+				       (see below) */
 
   /* Opcodes common for various families */
 #define MU_IOCTL_OP_GET 0
@@ -269,6 +274,18 @@ enum mu_buffer_type
      Arg: struct mu_sockaddr **
   */
 #define MU_IOCTL_TCP_GETSOCKNAME          0
+
+  /* Zero-copy transfers */
+
+  /* Query the zero-copy capabilities of the stream.
+     Arg: struct mu_zerocopy_query *
+     Only streams whose data can be accessed directly via a file
+     descriptor (or a memory mapping of it) answer this request.  Since
+     wrapper streams (filters, in particular) pass unknown requests down
+     to their transport, the caller must make sure the stream member
+     of the returned structure is the stream it asked.
+  */
+#define MU_IOCTL_ZEROCOPY_QUERY           0
   
   
 struct mu_nullstream_pattern
@@ -284,6 +301,19 @@ struct mu_buffer_query
   size_t bufsize;               /* Buffer size */
 };
 
+/* Stream is usable only as the source of a zero-copy transfer. */
+#define MU_ZEROCOPY_RDONLY 0x01
+
+struct mu_zerocopy_query
+{
+  mu_stream_t stream;           /* Stream that answered the request */
+  int flags;                    /* MU_ZEROCOPY_ flags */
+  int fd;                       /* File descriptor */
+  char const *map;              /* Memory-mapped file contents or NULL */
+  mu_off_t base;                /* File offset of the stream origin */
+  mu_off_t limit;               /* Bytes available past base, or -1 */
+};
+
 /* Statistics */
 enum
   {
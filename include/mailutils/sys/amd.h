@@ -63,6 +63,7 @@ struct _amd_message
 			       body_start. */
   size_t header_lines;      /* Number of lines in the header part */
   size_t body_lines;        /* Number of lines in the body */
+  int body_lines_scanned;   /* True if body_lines is initialized */
 
   mu_message_t message;     /* Corresponding mu_message_t */
   struct _amd_data *amd;    /* Back pointer.  */
@@ -104,6 +105,10 @@ struct _amd_data
   int (*remove) (struct _amd_data *);
   int (*delete_msg) (struct _amd_data *, struct _amd_message *);
   int (*chattr_msg) (struct _amd_message *, int);
+  /* Optional functions called before and after a batch of chattr_msg
+     calls. */
+  int (*chattr_begin) (struct _amd_data *);
+  void (*chattr_end) (struct _amd_data *);
   
   /* List of messages: */
   size_t msg_count; /* number of messages in the list */
@@ -32,6 +32,8 @@ struct _mu_dbm_file
   uid_t db_owner;             /* Database owner UID */
   struct mu_dbm_impl *db_sys; /* Pointer to the database implementation */
   union _mu_dbm_errno db_errno;
+  void *db_cache;             /* Handle cache entry, if the descriptor is
+				 owned by the cache */
 };
 
 #endif
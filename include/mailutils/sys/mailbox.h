@@ -58,6 +58,12 @@ struct _mu_mailbox
   /* Back pointer to the specific mailbox */
   void *data;
 
+  /* Restricted expunge (see mu_mailbox_expunge_msgset).  Formats that
+     support it set expunge_set_ok and use _mu_mailbox_expunge_p to
+     decide whether a message is to be removed. */
+  int expunge_set_ok;
+  mu_msgset_t expunge_set;
+
   /* Public methods */
 
   void (*_destroy)         (mu_mailbox_t);
@@ -91,8 +97,11 @@ struct _mu_mailbox
   int  (*_translate) (mu_mailbox_t, int cmd, size_t, size_t *);
   int  (*_copy) (mu_mailbox_t, mu_msgset_t, const char *, int);
   int  (*_get_atime) (mu_mailbox_t, time_t *);
+  int  (*_append_msgset) (mu_mailbox_t, mu_mailbox_t, mu_msgset_t);
 };
 
+int _mu_mailbox_expunge_p (mu_mailbox_t mbox, size_t msgno, int flags);
+
 # ifdef __cplusplus
 }
 # endif
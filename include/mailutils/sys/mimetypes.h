@@ -50,15 +50,24 @@ struct input_file
 {
   char const *name;
   mu_stream_t stream;
+  char *head;          /* Prefetched head of the stream */
+  size_t head_size;    /* Size of the prefetch window */
+  size_t head_len;     /* Number of bytes actually read to head */
+  char *buf;           /* Buffer for data past the prefetch window */
+  size_t bufsize;      /* Size of buf */
 };
  
 typedef int (*builtin_t) (union argument *args, struct input_file *input);
+/* Return offset of the first byte past the input area examined by
+   the builtin. */
+typedef size_t (*builtin_extent_t) (union argument *args);
 
 struct builtin_tab
 {
   char *name;
   char *args;
   builtin_t handler;
+  builtin_extent_t extent;
 };
 
 struct node
@@ -89,14 +98,23 @@ struct rule_tab
   int priority;
   struct mu_locus_range loc;
   struct node *node;
+  int suffix_filter;   /* The rule can match only files with one of the
+			  suffixes that refer to it in suffix_tab */
 };
 
 struct mu_mimetypes
 {
   mu_list_t rule_list;
   mu_opool_t pool;
+  /* Compiled rule set: */
+  struct rule_tab **rulev;  /* Rules in order of preference */
+  size_t rulec;             /* Number of elements in rulev */
+  mu_assoc_t suffix_tab;    /* Suffix -> indices of rules requiring it */
+  size_t head_size;         /* Size of the prefetch window */
 };
 
 struct builtin_tab const *mu_mimetypes_builtin (char const *ident);
+int mu_mimetypes_compile (struct mu_mimetypes *mt);
+void mu_mimetypes_compile_free (struct mu_mimetypes *mt);
 
 #endif
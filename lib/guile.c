@@ -57,5 +57,6 @@ struct mu_script_fun mu_script_scheme = {
   scheme_init,
   NULL,
   scheme_proc,
+  NULL,
   NULL
 };
@@ -33,6 +33,14 @@ int mu_script_process_msg (mu_script_t, mu_script_descr_t, mu_message_t msg);
 void mu_script_log_enable (mu_script_t scr, mu_script_descr_t descr,
 			   const char *name, const char *hdr);
 
+/* Parts of the message a script can access */
+#define MU_SCRIPT_ACCESS_HEADER MU_SIEVE_ACCESS_HEADER
+#define MU_SCRIPT_ACCESS_SIZE   MU_SIEVE_ACCESS_SIZE
+#define MU_SCRIPT_ACCESS_BODY   MU_SIEVE_ACCESS_BODY
+#define MU_SCRIPT_ACCESS_ALL    MU_SIEVE_ACCESS_ALL
+
+int mu_script_message_access (mu_script_t scr, mu_script_descr_t descr);
+
 int mu_script_debug_flags (const char *arg, char **endp);
 
 extern int mu_script_debug_guile;
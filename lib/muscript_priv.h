@@ -7,6 +7,7 @@ struct mu_script_fun
   int (*script_process) (mu_script_descr_t, mu_message_t);
   int (*script_log_enable) (mu_script_descr_t descr, const char *name,
 			    const char *hdr);
+  int (*script_access) (mu_script_descr_t descr);
 };
 
 extern struct mu_script_fun mu_script_python;
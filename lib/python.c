@@ -76,6 +76,7 @@ struct mu_script_fun mu_script_python = {
   python_init,
   python_done,
   python_proc,
+  NULL,
   NULL
 };
 
@@ -127,6 +127,16 @@ mu_script_log_enable (mu_script_t scr, mu_script_descr_t descr,
     scr->script_log_enable (descr, name, hdr);
 }
 
+/* Return the parts of the message the script DESCR can access
+   (MU_SCRIPT_ACCESS_* bits).  Unless the language handler is able
+   to tell, assume the script accesses the entire message. */
+int
+mu_script_message_access (mu_script_t scr, mu_script_descr_t descr)
+{
+  return scr->script_access ? scr->script_access (descr)
+                            : MU_SCRIPT_ACCESS_ALL;
+}
+
 int
 mu_script_process_msg (mu_script_t scr, mu_script_descr_t descr,
 		       mu_message_t msg)
@@ -173,12 +173,19 @@ sieve_proc (mu_script_descr_t descr, mu_message_t msg)
   return mu_sieve_message ((mu_sieve_machine_t) descr, msg);
 }
 
+static int
+sieve_access (mu_script_descr_t descr)
+{
+  return mu_sieve_get_message_access ((mu_sieve_machine_t) descr);
+}
+
 struct mu_script_fun mu_script_sieve = {
   "sieve",
   "sv\0siv\0sieve\0",
   sieve_init,
   sieve_done,
   sieve_proc,
-  sieve_log_enable
+  sieve_log_enable,
+  sieve_access
 };
 
@@ -68,6 +68,7 @@
 #include <mailutils/stream.h>
 #include <mailutils/url.h>
 #include <mailutils/observer.h>
+#include <mailutils/msgset.h>
 #include <mailutils/sys/stream.h>
 #include <mailutils/sys/mailbox.h>
 #include <mailutils/sys/message.h>
@@ -83,6 +84,7 @@ static int amd_quick_get_message (mu_mailbox_t mailbox, mu_message_qid_t qid,
 				  mu_message_t *pmsg);
 static int amd_append_message (mu_mailbox_t, mu_message_t,
 			       mu_envelope_t, mu_attribute_t);
+static int amd_append_msgset (mu_mailbox_t, mu_mailbox_t, mu_msgset_t);
 static int amd_messages_count (mu_mailbox_t, size_t *);
 static int amd_messages_recent (mu_mailbox_t, size_t *);
 static int amd_message_unseen (mu_mailbox_t, size_t *);
@@ -415,10 +417,12 @@ amd_init_mailbox (mu_mailbox_t mailbox, size_t amd_size,
   mailbox->_get_message = amd_get_message;
   mailbox->_quick_get_message = amd_quick_get_message;
   mailbox->_append_message = amd_append_message;
+  mailbox->_append_msgset = amd_append_msgset;
   mailbox->_messages_count = amd_messages_count;
   mailbox->_messages_recent = amd_messages_recent;
   mailbox->_message_unseen = amd_message_unseen;
   mailbox->_expunge = amd_expunge;
+  mailbox->expunge_set_ok = 1;
   mailbox->_sync = amd_sync;
   mailbox->_get_uidvalidity = amd_get_uidvalidity;
   mailbox->_set_uidvalidity = amd_set_uidvalidity;
@@ -943,6 +947,7 @@ _amd_message_save (struct _amd_data *amd, struct _amd_message *mhm,
   mhm->header_size = new_body_start;
   mhm->body_start = new_body_start;
   mhm->body_lines = stat[MU_STREAM_STAT_OUTLN];
+  mhm->body_lines_scanned = 1;
   mhm->body_end = stat[MU_STREAM_STAT_OUT];
   
   mu_stream_destroy (&ostr);  
@@ -997,6 +1002,40 @@ _amd_message_save (struct _amd_data *amd, struct _amd_message *mhm,
   return status;
 }
 
+/* Insert the newly delivered message MHM into the mailbox and notify
+   the observers. */
+static int
+amd_append_finish (struct _amd_data *amd, struct _amd_message *mhm,
+		   mu_message_t msg, mu_attribute_t atr)
+{
+  int status;
+  
+  /* Insert and re-scan the message */
+  status = _amd_message_insert (amd, mhm);
+  if (status)
+    {
+      free (mhm);
+      return status;
+    }
+
+  if (amd->msg_finish_delivery)
+    status = amd->msg_finish_delivery (amd, mhm, msg, atr);
+  
+  if (status == 0 && amd->mailbox->observable)
+    {
+      char *qid;
+      if (amd->cur_msg_file_name (mhm, 0, &qid) == 0)
+	{
+	  mu_observable_notify (amd->mailbox->observable, 
+	                        MU_EVT_MAILBOX_MESSAGE_APPEND,
+				qid);
+	  free (qid);
+	}
+    }
+  
+  return status;
+}
+
 static int
 amd_append_message (mu_mailbox_t mailbox, mu_message_t msg,
 		    mu_envelope_t env, mu_attribute_t atr)
@@ -1049,30 +1088,116 @@ amd_append_message (mu_mailbox_t mailbox, mu_message_t msg,
     }
 
   mhm->message = NULL;
-  /* Insert and re-scan the message */
-  status = _amd_message_insert (amd, mhm);
+  return amd_append_finish (amd, mhm, msg, atr);
+}
+
+/* Bulk append of messages from another mailbox of the same format.
+
+   The message files are never modified in place (see _amd_message_save),
+   so an unmodified source message can be shared with the destination
+   mailbox by creating a hard link to it.  Messages that cannot be linked
+   (e.g. because the two mailboxes reside on different file systems)
+   are appended the usual way. */
+static int
+amd_append_check (size_t n, mu_message_t msg, void *data)
+{
+  struct _amd_data *amd = data;
+  int mod = mu_message_is_modified (msg);
+
+  if (amd->capabilities & MU_AMD_STATUS)
+    /* Attributes are kept outside of the message file. */
+    mod &= ~MU_MSG_ATTRIBUTE_MODIFIED;
+  return mod ? ENOSYS : 0;
+}
+
+static int
+amd_append_link (struct _amd_data *amd, mu_message_t msg)
+{
+  struct _amd_message *src_mhm = mu_message_get_owner (msg);
+  struct _amd_message *mhm;
+  mu_attribute_t atr;
+  char *src_name, *dst_name;
+  int status;
+
+  mhm = calloc (1, amd->msg_size);
+  if (!mhm)
+    return ENOMEM;
+  mhm->amd = amd;
+  if (amd->msg_init_delivery)
+    {
+      status = amd->msg_init_delivery (amd, mhm);
+      if (status)
+	{
+	  free (mhm);
+	  return status;
+	}
+    }
+
+  if (mu_message_get_attribute (msg, &atr) == 0)
+    mu_attribute_get_flags (atr, &mhm->attr_flags);
+
+  status = src_mhm->amd->cur_msg_file_name (src_mhm, 1, &src_name);
+  if (status == 0)
+    {
+      status = amd->new_msg_file_name (mhm, mhm->attr_flags, 0, &dst_name);
+      if (status == 0)
+	{
+	  if (link (src_name, dst_name))
+	    {
+	      mu_debug (MU_DEBCAT_MAILBOX, MU_DEBUG_TRACE1,
+			("can't link %s to %s: %s",
+			 src_name, dst_name, mu_strerror (errno)));
+	      /* Fall back to copying the message. */
+	      mhm->message = msg;
+	      status = _amd_message_save (amd, mhm, NULL, 0);
+	      mhm->message = NULL;
+	    }
+	  free (dst_name);
+	}
+      free (src_name);
+    }
   if (status)
     {
       free (mhm);
       return status;
     }
+  
+  return amd_append_finish (amd, mhm, msg, NULL);
+}
 
-  if (amd->msg_finish_delivery)
-    status = amd->msg_finish_delivery (amd, mhm, msg, atr);
+static int
+amd_append_msgset_action (size_t n, mu_message_t msg, void *data)
+{
+  return amd_append_link (data, msg);
+}
+
+static int
+amd_append_msgset (mu_mailbox_t mailbox, mu_mailbox_t src,
+		   mu_msgset_t msgset)
+{
+  struct _amd_data *amd = mailbox->data;
+  struct _amd_data *src_amd = src->data;
+  int status;
+  
+  /* Both mailboxes must be of the same format. */
+  if (src == mailbox
+      || amd->cur_msg_file_name != src_amd->cur_msg_file_name)
+    return ENOSYS;
+
+  status = mu_msgset_foreach_message (msgset, amd_append_check, amd);
+  if (status)
+    return status;
   
-  if (status == 0 && mailbox->observable)
+  /* If we did not start a scanning yet do it now.  */
+  if (amd->msg_count == 0)
     {
-      char *qid;
-      if (amd->cur_msg_file_name (mhm, 0, &qid) == 0)
-	{
-	  mu_observable_notify (mailbox->observable, 
-	                        MU_EVT_MAILBOX_MESSAGE_APPEND,
-				qid);
-	  free (qid);
-	}
+      status = _amd_scan0 (amd, 1, NULL, 0);
+      if (status != 0)
+	return status;
     }
+  amd->has_new_msg = 1;
   
-  return status;
+  return mu_msgset_foreach_message (msgset, amd_append_msgset_action, amd);
 }
 
 static int
@@ -1313,6 +1438,26 @@ _amd_update_message (struct _amd_data *amd, struct _amd_message *mhm,
   return rc;
 }
 
+/* Prepare for updating attributes of several messages in a row. */
+static void
+amd_chattr_begin (struct _amd_data *amd)
+{
+  if (amd->chattr_begin)
+    {
+      int rc = amd->chattr_begin (amd);
+      if (rc)
+	mu_debug (MU_DEBCAT_MAILBOX, MU_DEBUG_ERROR,
+		  ("amd_chattr_begin: %s", mu_strerror (rc)));
+    }
+}
+
+static void
+amd_chattr_end (struct _amd_data *amd)
+{
+  if (amd->chattr_end)
+    amd->chattr_end (amd);
+}
+
 static int
 amd_expunge (mu_mailbox_t mailbox)
 {
@@ -1329,11 +1474,12 @@ amd_expunge (mu_mailbox_t mailbox)
   if (amd->msg_count == 0)
     return 0;
 
+  amd_chattr_begin (amd);
   for (i = 0; i < amd->msg_count; i++)
     {
       mhm = amd->msg_array[i];
       
-      if (mhm->attr_flags & MU_ATTRIBUTE_DELETED)
+      if (_mu_mailbox_expunge_p (mailbox, i + 1, mhm->attr_flags))
 	{
 	  int rc;
 	  struct _amd_message **pp;
@@ -1342,7 +1488,10 @@ amd_expunge (mu_mailbox_t mailbox)
 	    {
 	      rc = amd->delete_msg (amd, mhm);
 	      if (rc)
-		return rc;
+		{
+		  amd_chattr_end (amd);
+		  return rc;
+		}
 	    }
 	  else
 	    {
@@ -1351,12 +1500,16 @@ amd_expunge (mu_mailbox_t mailbox)
 
 	      rc = amd->cur_msg_file_name (mhm, 1, &old_name);
 	      if (rc)
-		return rc;
+		{
+		  amd_chattr_end (amd);
+		  return rc;
+		}
 	      rc = amd->new_msg_file_name (mhm, mhm->attr_flags, 1,
 					   &new_name);
 	      if (rc)
 		{
 		  free (old_name);
+		  amd_chattr_end (amd);
 		  return rc;
 		}
 
@@ -1413,9 +1566,14 @@ amd_expunge (mu_mailbox_t mailbox)
 	}
       else
 	{
-	  _amd_update_message (amd, mhm, 1, &updated);/*FIXME: Error checking*/
+	  /* A deleted message is kept here only if it is outside the
+	     expunge set.  Keep its deletion mark as well. */
+	  _amd_update_message (amd, mhm,
+			       !(mhm->attr_flags & MU_ATTRIBUTE_DELETED),
+			       &updated);/*FIXME: Error checking*/
 	}
     }
+  amd_chattr_end (amd);
 
   if (expcount)
     {
@@ -1487,10 +1645,15 @@ amd_sync (mu_mailbox_t mailbox)
 	break;
     }
 
-  for ( ; i < amd->msg_count; i++)
+  if (i < amd->msg_count)
     {
-      mhm = amd->msg_array[i];
-      _amd_update_message (amd, mhm, 0, &updated); 
+      amd_chattr_begin (amd);
+      for ( ; i < amd->msg_count; i++)
+	{
+	  mhm = amd->msg_array[i];
+	  _amd_update_message (amd, mhm, 0, &updated); 
+	}
+      amd_chattr_end (amd);
     }
 
   if (updated && !amd->mailbox_size)
@@ -1644,6 +1807,9 @@ amd_sort (struct _amd_data *amd)
 }
 
 /* Scan given message and fill amd_message_t fields.
+   If the mailbox was opened with MU_STREAM_HEADERS_ONLY, stop at the end
+   of the header and take the body end from the file size.  The body
+   lines are then counted on demand by amd_body_lines.
    NOTE: the function assumes mhm->stream != NULL. */
 static int
 amd_scan_message (struct _amd_message *mhm)
@@ -1653,6 +1819,7 @@ amd_scan_message (struct _amd_message *mhm)
   int amd_capa = amd->capabilities;
   char *msg_name;
   struct stat st;
+  int have_stat;
   int status;
   
   /* Check if the message was modified after the last scan */
@@ -1665,7 +1832,8 @@ amd_scan_message (struct _amd_message *mhm)
       return status;
     }
   
-  if (stat (msg_name, &st) == 0 && st.st_mtime == mhm->mtime)
+  have_stat = stat (msg_name, &st) == 0;
+  if (have_stat && st.st_mtime == mhm->mtime)
     {
       /* Nothing to do */
       free (msg_name);
@@ -1698,11 +1866,23 @@ amd_scan_message (struct _amd_message *mhm)
       mhm->mtime = st.st_mtime;
       mhm->header_lines = 0;      
       mhm->body_lines = 0;
+      mhm->body_lines_scanned = 0;
 
       while ((status = mu_stream_read (stream, &cur, 1, &n)) == 0)
 	{
 	  if (n == 0)
-	    break;
+	    {
+	      mhm->body_lines_scanned = 1;
+	      break;
+	    }
+
+	  if (state == amd_scan_body
+	      && have_stat
+	      && (amd->mailbox->flags & MU_STREAM_HEADERS_ONLY))
+	    {
+	      mhm->body_end = st.st_size;
+	      break;
+	    }
 	  
 	  switch (state)
 	    {
@@ -2128,6 +2308,36 @@ amd_body_size (mu_body_t body, size_t *psize)
   return 0;
 }
 
+/* Count lines in the message body, unless it has already been done
+   by amd_scan_message. */
+static int
+amd_scan_body_lines (struct _amd_message *mhm)
+{
+  char buf[512];
+  size_t n, i;
+  size_t lines = 0;
+  int status;
+
+  if (mhm->body_lines_scanned)
+    return 0;
+  status = amd_pool_open (mhm);
+  if (status)
+    return status;
+  status = mu_stream_seek (mhm->stream, mhm->body_start, MU_SEEK_SET, NULL);
+  if (status)
+    return status;
+  while ((status = mu_stream_read (mhm->stream, buf, sizeof buf, &n)) == 0
+	 && n > 0)
+    for (i = 0; i < n; i++)
+      if (buf[i] == '\n')
+	lines++;
+  if (status)
+    return status;
+  mhm->body_lines = lines;
+  mhm->body_lines_scanned = 1;
+  return 0;
+}
+
 static int
 amd_body_lines (mu_body_t body, size_t *plines)
 {
@@ -2137,6 +2347,9 @@ amd_body_lines (mu_body_t body, size_t *plines)
   if (mhm == NULL)
     return EINVAL;
   status = amd_check_message (mhm);
+  if (status)
+    return status;
+  status = amd_scan_body_lines (mhm);
   if (status)
     return status;
   if (plines)
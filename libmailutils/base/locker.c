@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <utime.h>
@@ -40,6 +41,9 @@
 #include <mailutils/locker.h>
 #include <mailutils/util.h>
 #include <mailutils/io.h>
+#include <mailutils/debug.h>
+#include <mailutils/datetime.h>
+#include <mailutils/server.h>
 
 /* First draft by Brian Edmond. */
 /* For subsequent modifications, see the GNU mailutils ChangeLog. */
@@ -62,6 +66,8 @@ struct _mu_locker
     {
       char *dotlock;
       char *nfslock;
+      int fd;          /* Descriptor holding the OFD lock, or -1 */
+      int shared;      /* Only the OFD lock is held */
     } dot;             /* MU_LOCKER_TYPE_DOTLOCK */
     
     struct
@@ -239,6 +245,7 @@ init_dotlock (mu_locker_t lck, mu_locker_hints_t *hints)
     return ENOMEM;
   strcpy (lck->data.dot.dotlock, lck->file);
   strcat (lck->data.dot.dotlock, DOTLOCK_SUFFIX);
+  lck->data.dot.fd = -1;
 
   return 0;
 }
@@ -248,17 +255,21 @@ destroy_dotlock (mu_locker_t lck)
 {
   free (lck->data.dot.dotlock);
   free (lck->data.dot.nfslock);
+  if (lck->data.dot.fd != -1)
+    close (lck->data.dot.fd);
 }
 
+/* Create the dotlock file, using the NFS-safe hitching-post technique.
+   Return EAGAIN if it is held by someone else. */
 static int
-lock_dotlock (mu_locker_t lck, enum mu_locker_mode mode)
+dotlock_create (mu_locker_t lck)
 {
   int rc;
   char *host = NULL;
   time_t now;
   int err = 0;
   int fd;
-    
+
   if (lck->data.dot.nfslock)
     {
       unlink (lck->data.dot.nfslock);
@@ -330,9 +341,202 @@ lock_dotlock (mu_locker_t lck, enum mu_locker_mode mode)
   return 0;
 }
 
+#ifdef F_OFD_SETLK
+/* Open file description locks.
+
+   These are used along with dotlocks to implement reader-writer
+   locking.  Writers create the dotlock and then take an exclusive OFD
+   lock on the mailbox file, so that they wait until all readers are
+   done.  Readers create the dotlock as well, but only for the time
+   needed to take a shared OFD lock; they remove it as soon as the
+   shared lock is held, so that they don't conflict with each other.
+   Thus a reader never starts while a writer (including a program that
+   uses only dotlocks) holds the lock file.  The reverse is not true:
+   a program that knows nothing about OFD locks can create the dotlock
+   and modify the mailbox while readers hold shared locks on it.
+   
+   Unlike traditional POSIX locks, OFD locks are not released when the
+   process closes another descriptor of the same file, which the
+   mailbox drivers do routinely.
+
+   The lock is polled using F_OFD_SETLK.  The total wait is limited by
+   the retry settings of the locker (retry count times retry sleep). */
+
+/* Return the maximum time to wait for a lock, in seconds */
+static unsigned
+lock_timeout (mu_locker_t lck)
+{
+  if (lck->flags & MU_LOCKER_FLAG_RETRY)
+    return lck->retry_count * lck->retry_sleep;
+  return 0;
+}
+
+static int
+ofd_setlk (int fd, int type)
+{
+  struct flock fl;
+  
+  memset (&fl, 0, sizeof fl);
+  fl.l_type = type;
+  fl.l_whence = SEEK_SET;
+  fl.l_start = 0;
+  fl.l_len = 0; /* Lock entire file */
+  if (fcntl (fd, F_OFD_SETLK, &fl) == 0)
+    return 0;
+  if (errno == EAGAIN || errno == EACCES)
+    return MU_ERR_LOCK_CONFLICT;
+  return errno;
+}
+
+/* Lock file FD with the lock of given TYPE (F_RDLCK or F_WRLCK).  If
+   it is not available, poll with exponential backoff, starting at 1ms
+   and not exceeding the retry sleep interval of LCK, until the lock
+   timeout expires. */
+static int
+ofd_lock (mu_locker_t lck, int fd, int type)
+{
+  struct timespec ts = { 0, 1000000 };
+  unsigned long long waited = 0, limit, maxsleep;
+  int rc;
+  
+  rc = ofd_setlk (fd, type);
+  if (rc != MU_ERR_LOCK_CONFLICT)
+    return rc;
+
+  limit = lock_timeout (lck) * 1000000000ULL;
+  maxsleep = (lck->retry_sleep > 0 ? lck->retry_sleep : 1) * 1000000000ULL;
+  while (waited < limit)
+    {
+      unsigned long long ns;
+      
+      nanosleep (&ts, NULL);
+      waited += ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+      rc = ofd_setlk (fd, type);
+      if (rc != MU_ERR_LOCK_CONFLICT || waited >= limit)
+	break;
+      ns = (ts.tv_sec * 1000000000ULL + ts.tv_nsec) * 2;
+      if (ns > maxsleep)
+	ns = maxsleep;
+      if (ns > limit - waited)
+	ns = limit - waited;
+      ts.tv_sec = ns / 1000000000ULL;
+      ts.tv_nsec = ns % 1000000000ULL;
+    }
+  return rc;
+}
+
+/* Take a shared lock on the mailbox file.  The dotlock is held while
+   acquiring it, so that readers don't start while a writer is
+   active. */
+static int
+lock_dotlock_shared (mu_locker_t lck)
+{
+  int fd, rc;
+
+  rc = dotlock_create (lck);
+  if (rc)
+    return rc;
+
+  fd = open (lck->file, O_RDONLY);
+  if (fd == -1)
+    {
+      rc = errno;
+      unlink (lck->data.dot.dotlock);
+      if (rc == ENOENT)
+	{
+	  /* Nothing to protect yet */
+	  lck->data.dot.shared = 1;
+	  return 0;
+	}
+      return rc;
+    }
+
+  /* Writers in this library hold the dotlock as long as the exclusive
+     OFD lock, so normally this succeeds immediately. */
+  rc = ofd_lock (lck, fd, F_RDLCK);
+  unlink (lck->data.dot.dotlock);
+  if (rc)
+    {
+      close (fd);
+      return rc;
+    }
+  
+  lck->data.dot.fd = fd;
+  lck->data.dot.shared = 1;
+  return 0;
+}
+
+/* Take an exclusive lock, upgrading the shared lock, if held.  The
+   dotlock is created first, so that no new readers can come in.  On
+   failure, the shared lock (if any) is retained. */
+static int
+lock_dotlock_exclusive (mu_locker_t lck)
+{
+  int rc;
+  int fd;
+  int shared_fd = lck->data.dot.fd;
+  
+  rc = dotlock_create (lck);
+  if (rc)
+    return rc;
+
+  /* Wait for the readers to finish */
+  fd = open (lck->file, O_RDWR);
+  if (fd != -1)
+    {
+      /* Our own shared lock would conflict with the exclusive one.
+	 Release it, but keep the descriptor to restore it on failure. */
+      if (shared_fd != -1)
+	ofd_setlk (shared_fd, F_UNLCK);
+      rc = ofd_lock (lck, fd, F_WRLCK);
+      if (rc)
+	{
+	  close (fd);
+	  if (shared_fd != -1 && ofd_setlk (shared_fd, F_RDLCK))
+	    {
+	      /* Should not happen: we hold the dotlock, so there can be
+		 no writers. */
+	      close (shared_fd);
+	      lck->data.dot.fd = -1;
+	    }
+	  unlink (lck->data.dot.dotlock);
+	  return rc;
+	}
+    }
+
+  if (shared_fd != -1)
+    close (shared_fd);
+  lck->data.dot.fd = fd;
+  lck->data.dot.shared = 0;
+  return 0;
+}
+#endif
+
+static int
+lock_dotlock (mu_locker_t lck, enum mu_locker_mode mode)
+{
+#ifdef F_OFD_SETLK
+  if (mode != mu_lck_exc)
+    return lock_dotlock_shared (lck);
+  return lock_dotlock_exclusive (lck);
+#else
+  return dotlock_create (lck);
+#endif
+}
+
 static int
 unlock_dotlock (mu_locker_t lck)
 {
+  if (lck->data.dot.fd != -1)
+    {
+      close (lck->data.dot.fd);
+      lck->data.dot.fd = -1;
+    }
+  if (lck->data.dot.shared)
+    {
+      lck->data.dot.shared = 0;
+      return 0;
+    }
   if (unlink (lck->data.dot.dotlock) == -1)
     {
       int err = errno;
@@ -723,21 +927,22 @@ mu_locker_lock_mode (mu_locker_t lck, enum mu_locker_mode mode)
   if (locker_tab[lck->type].prelock && (rc = locker_tab[lck->type].prelock (lck)))
     return rc;
   
-  /* Is the lock already applied? */
-  if (lck->refcnt > 0)
+  /* Is the lock already applied?  An exclusive lock satisfies any
+     request; a shared one needs to be upgraded for exclusive access. */
+  if (lck->refcnt > 0 && (mode == lck->mode || lck->mode == mu_lck_exc))
     {
       lck->refcnt++;
-      if (mode == lck->mode)
-	return 0;
+      return 0;
     }
 
-  lck->mode = mode;
-
   if (lck->flags & MU_LOCKER_FLAG_RETRY)
     retries = lck->retry_count;
 
   if (locker_tab[lck->type].lock)
     {
+      struct timeval start, now;
+
+      gettimeofday (&start, NULL);
       while (retries--)
 	{
 	  rc = locker_tab[lck->type].lock (lck, mode);
@@ -746,6 +951,15 @@ mu_locker_lock_mode (mu_locker_t lck, enum mu_locker_mode mode)
 	  else
 	    break;
 	}
+      gettimeofday (&now, NULL);
+      now = mu_timeval_sub (&now, &start);
+      mu_debug (MU_DEBCAT_LOCKER, MU_DEBUG_TRACE1,
+		("%s: %s lock %s after %lu.%06lu s",
+		 lck->file,
+		 mode == mu_lck_exc ? "exclusive" : "shared",
+		 rc == 0 ? "acquired" : "failed",
+		 (unsigned long) now.tv_sec, (unsigned long) now.tv_usec));
+      mu_srvstat_finish (MU_SRVSTAT_LOCK_WAIT, &start, 0, 0);
 
       if (rc == EAGAIN)
 	rc = MU_ERR_LOCK_CONFLICT;
@@ -754,7 +968,10 @@ mu_locker_lock_mode (mu_locker_t lck, enum mu_locker_mode mode)
     rc = 0;
 
   if (rc == 0)
-    lck->refcnt++;
+    {
+      lck->mode = mode;
+      lck->refcnt++;
+    }
   
   return rc;
 }
@@ -64,6 +64,9 @@ static struct mu_conf_option mu_conf_option[] = {
 #ifdef WITH_KYOTOCABINET
   { "WITH_KYOTOCABINET", N_("Kyoto Cabinet DBM") },
 #endif
+#ifdef WITH_CDB
+  { "WITH_CDB", N_("Built-in constant database") },
+#endif
 #ifdef WITH_GNUTLS
   { "WITH_GNUTLS", N_("TLS support using GNU TLS") },
 #endif
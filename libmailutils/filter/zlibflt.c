@@ -0,0 +1,474 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General
+   Public License along with this library.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+/* Deflate compression stream.
+
+   The stream compresses the data written to it using the raw deflate
+   format (RFC 1951) and writes the result to the transport stream.
+   Data read from the stream are read from the transport and inflated.
+   Both directions can be active at once, which makes the stream
+   suitable for implementing the COMPRESS=DEFLATE extension (RFC 4978)
+   in network servers.
+
+   Compressed output is accumulated by the deflater until the stream is
+   flushed, at which point a sync flush is performed and all pending
+   data are sent to the transport.  The same is done before blocking on
+   the transport for input, so that a peer waiting for our response
+   always gets it before we start waiting for it.
+
+   Reads from the transport return as soon as some decompressed data
+   are available, so the stream can be used on top of sockets and
+   pipes.  The transport itself must be unbuffered on input (see
+   mu_deflate_stream_install).
+
+   The generic filter framework (see fltstream.c) is not used here,
+   because it expects each xcode call to produce bounded output, whereas
+   a sync flush can release an arbitrary amount of compressed data. */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <mailutils/types.h>
+#include <mailutils/stream.h>
+#include <mailutils/sys/stream.h>
+#include <mailutils/filter.h>
+#include <mailutils/errno.h>
+
+#ifdef WITH_ZLIB
+#include <zlib.h>
+
+#define ZBUF_SIZE 16384
+
+struct _mu_deflate_stream
+{
+  struct _mu_stream stream;
+  mu_stream_t transport;     /* Underlying stream */
+  int mode;                  /* MU_STREAM_READ, MU_STREAM_WRITE or both */
+  int eof;                   /* End of compressed input seen */
+  int pending;               /* Deflater holds data that were not flushed */
+  int inmore;                /* Inflater may have more output ready */
+  z_stream zin;              /* Inflater */
+  z_stream zout;             /* Deflater */
+  unsigned char inbuf[ZBUF_SIZE];  /* Compressed input */
+  unsigned char outbuf[ZBUF_SIZE]; /* Compressed output */
+};
+
+/* Run the deflater with the given FLUSH mode, sending the produced
+   output to the transport, until all input is consumed and no more
+   output is pending. */
+static int
+_deflate_run (struct _mu_deflate_stream *sp, int flush)
+{
+  int rc;
+
+  do
+    {
+      size_t n;
+
+      sp->zout.next_out = sp->outbuf;
+      sp->zout.avail_out = sizeof (sp->outbuf);
+      rc = deflate (&sp->zout, flush);
+      if (rc == Z_STREAM_ERROR)
+	return MU_ERR_FAILURE;
+      n = sizeof (sp->outbuf) - sp->zout.avail_out;
+      if (n && (rc = mu_stream_write (sp->transport, sp->outbuf, n, NULL)))
+	return rc;
+    }
+  while (sp->zout.avail_out == 0 || sp->zout.avail_in > 0);
+  return 0;
+}
+
+static int
+_deflate_sync (struct _mu_deflate_stream *sp)
+{
+  int rc;
+
+  if (!sp->pending)
+    return 0;
+  sp->pending = 0;
+  rc = _deflate_run (sp, Z_SYNC_FLUSH);
+  if (rc == 0)
+    rc = mu_stream_flush (sp->transport);
+  return rc;
+}
+
+static int
+_deflate_write (struct _mu_stream *str, const char *buf, size_t size,
+		size_t *pret)
+{
+  struct _mu_deflate_stream *sp = (struct _mu_deflate_stream *)str;
+  int rc;
+
+  if (size == 0)
+    {
+      *pret = 0;
+      return 0;
+    }
+  sp->zout.next_in = (unsigned char *) buf;
+  sp->zout.avail_in = size;
+  rc = _deflate_run (sp, Z_NO_FLUSH);
+  sp->zout.next_in = NULL;
+  if (rc)
+    return rc;
+  sp->pending = 1;
+  *pret = size;
+  return 0;
+}
+
+static int
+_deflate_read (struct _mu_stream *str, char *buf, size_t size, size_t *pret)
+{
+  struct _mu_deflate_stream *sp = (struct _mu_deflate_stream *)str;
+  int rc;
+
+  sp->zin.next_out = (unsigned char *) buf;
+  sp->zin.avail_out = size;
+  while (!sp->eof && sp->zin.avail_out == size)
+    {
+      if (sp->zin.avail_in == 0 && !sp->inmore)
+	{
+	  size_t n;
+
+	  /* Make sure the peer has got everything before waiting for it */
+	  if ((rc = _deflate_sync (sp)) != 0)
+	    return rc;
+	  rc = mu_stream_read (sp->transport, sp->inbuf, sizeof (sp->inbuf),
+			       &n);
+	  if (rc)
+	    return rc;
+	  if (n == 0)
+	    break;
+	  sp->zin.next_in = sp->inbuf;
+	  sp->zin.avail_in = n;
+	}
+      rc = inflate (&sp->zin, Z_SYNC_FLUSH);
+      switch (rc)
+	{
+	case Z_STREAM_END:
+	  sp->eof = 1;
+	  break;
+
+	case Z_OK:
+	  break;
+
+	case Z_BUF_ERROR:
+	  /* No progress possible: need more input */
+	  sp->inmore = 0;
+	  continue;
+
+	case Z_MEM_ERROR:
+	  return ENOMEM;
+
+	default:
+	  return MU_ERR_FAILURE;
+	}
+      sp->inmore = sp->zin.avail_out == 0;
+    }
+  *pret = size - sp->zin.avail_out;
+  return 0;
+}
+
+static int
+_deflate_flush (struct _mu_stream *str)
+{
+  struct _mu_deflate_stream *sp = (struct _mu_deflate_stream *)str;
+  int rc = 0;
+
+  if (sp->mode & MU_STREAM_WRITE)
+    rc = _deflate_sync (sp);
+  return rc;
+}
+
+static int
+_deflate_close (struct _mu_stream *str)
+{
+  struct _mu_deflate_stream *sp = (struct _mu_deflate_stream *)str;
+  int rc = 0;
+
+  if (sp->mode & MU_STREAM_WRITE)
+    {
+      rc = _deflate_run (sp, Z_FINISH);
+      if (rc == 0)
+	rc = mu_stream_flush (sp->transport);
+      sp->pending = 0;
+    }
+  if (rc == 0)
+    rc = mu_stream_close (sp->transport);
+  return rc;
+}
+
+static void
+_deflate_done (struct _mu_stream *str)
+{
+  struct _mu_deflate_stream *sp = (struct _mu_deflate_stream *)str;
+
+  if (sp->mode & MU_STREAM_READ)
+    inflateEnd (&sp->zin);
+  if (sp->mode & MU_STREAM_WRITE)
+    deflateEnd (&sp->zout);
+  mu_stream_unref (sp->transport);
+}
+
+static int
+_deflate_wait (struct _mu_stream *str, int *pflags, struct timeval *tvp)
+{
+  struct _mu_deflate_stream *sp = (struct _mu_deflate_stream *)str;
+
+  if ((*pflags & MU_STREAM_READY_RD) && (sp->zin.avail_in || sp->inmore))
+    {
+      *pflags = MU_STREAM_READY_RD;
+      return 0;
+    }
+  if (*pflags & MU_STREAM_READY_RD)
+    {
+      int rc = _deflate_sync (sp);
+      if (rc)
+	return rc;
+    }
+  return mu_stream_wait (sp->transport, pflags, tvp);
+}
+
+static int
+_deflate_shutdown (struct _mu_stream *str, int how)
+{
+  struct _mu_deflate_stream *sp = (struct _mu_deflate_stream *)str;
+  return mu_stream_shutdown (sp->transport, how);
+}
+
+static int
+_deflate_ctl (struct _mu_stream *str, int code, int opcode, void *arg)
+{
+  struct _mu_deflate_stream *sp = (struct _mu_deflate_stream *)str;
+
+  switch (code)
+    {
+    case MU_IOCTL_TOPSTREAM:
+      if (!arg)
+	return EINVAL;
+      else
+	{
+	  mu_stream_t *pstr = arg;
+	  switch (opcode)
+	    {
+	    case MU_IOCTL_OP_GET:
+	      pstr[0] = sp->transport;
+	      mu_stream_ref (pstr[0]);
+	      pstr[1] = NULL;
+	      break;
+
+	    case MU_IOCTL_OP_SET:
+	      mu_stream_unref (sp->transport);
+	      sp->transport = pstr[0];
+	      mu_stream_ref (sp->transport);
+	      break;
+
+	    default:
+	      return EINVAL;
+	    }
+	}
+      break;
+
+    case MU_IOCTL_TRANSPORT:
+      switch (opcode)
+	{
+	case MU_IOCTL_OP_GET:
+	  if (!arg)
+	    return EINVAL;
+	  else
+	    {
+	      mu_transport_t *ptrans = arg;
+	      ptrans[0] = (mu_transport_t) sp->transport;
+	      ptrans[1] = NULL;
+	    }
+	  break;
+
+	default:
+	  return ENOSYS;
+	}
+      break;
+
+    default:
+      return mu_stream_ioctl (sp->transport, code, opcode, arg);
+    }
+  return 0;
+}
+
+static const char *
+_deflate_error_string (struct _mu_stream *str, int rc)
+{
+  struct _mu_deflate_stream *sp = (struct _mu_deflate_stream *)str;
+
+  if (rc == MU_ERR_FAILURE)
+    {
+      if (sp->zin.msg)
+	return sp->zin.msg;
+      if (sp->zout.msg)
+	return sp->zout.msg;
+    }
+  return mu_stream_strerror (sp->transport, rc);
+}
+
+/* Create a deflate stream on top of TRANSPORT.  FLAGS is MU_STREAM_READ,
+   MU_STREAM_WRITE or MU_STREAM_RDWR.  Data written to the stream are
+   compressed using LEVEL (0 to 9, or MU_DEFLATE_LEVEL_DEFAULT), data
+   read from it are decompressed. */
+int
+mu_deflate_stream_create (mu_stream_t *pstream, mu_stream_t transport,
+			  int level, int flags)
+{
+  struct _mu_deflate_stream *sp;
+  int rc;
+
+  flags &= MU_STREAM_RDWR;
+  if (!pstream || !transport || !flags)
+    return EINVAL;
+  if (level != MU_DEFLATE_LEVEL_DEFAULT && (level < 0 || level > 9))
+    return EINVAL;
+
+  sp = (struct _mu_deflate_stream *)
+         _mu_stream_create (sizeof (*sp), flags | _MU_STR_OPEN);
+  if (!sp)
+    return ENOMEM;
+
+  sp->mode = flags;
+  if (flags & MU_STREAM_READ)
+    {
+      /* Negative window bits select raw deflate */
+      rc = inflateInit2 (&sp->zin, -MAX_WBITS);
+      if (rc != Z_OK)
+	{
+	  free (sp);
+	  return rc == Z_MEM_ERROR ? ENOMEM : MU_ERR_FAILURE;
+	}
+      sp->stream.read = _deflate_read;
+    }
+  if (flags & MU_STREAM_WRITE)
+    {
+      rc = deflateInit2 (&sp->zout,
+			 level == MU_DEFLATE_LEVEL_DEFAULT
+			   ? Z_DEFAULT_COMPRESSION : level,
+			 Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+      if (rc != Z_OK)
+	{
+	  if (flags & MU_STREAM_READ)
+	    inflateEnd (&sp->zin);
+	  free (sp);
+	  return rc == Z_MEM_ERROR ? ENOMEM : MU_ERR_FAILURE;
+	}
+      sp->stream.write = _deflate_write;
+    }
+
+  sp->stream.flush = _deflate_flush;
+  sp->stream.close = _deflate_close;
+  sp->stream.done = _deflate_done;
+  sp->stream.wait = _deflate_wait;
+  sp->stream.shutdown = _deflate_shutdown;
+  sp->stream.ctl = _deflate_ctl;
+  sp->stream.error_string = _deflate_error_string;
+
+  mu_stream_ref (transport);
+  sp->transport = transport;
+  mu_stream_set_buffer ((mu_stream_t) sp, mu_buffer_none, 0);
+
+  *pstream = (mu_stream_t) sp;
+  return 0;
+}
+
+/* Insert a bidirectional deflate stream into the stream stack of STREAM,
+   right above the bottommost transport (the I/O stream or TLS stream).
+   Any filters and transcript streams stacked on top of it stay in place,
+   so that the protocol layer keeps working with uncompressed data.
+
+   On success, if PRET is not NULL, the created deflate stream is stored
+   there.  The reference is borrowed from the stack. */
+int
+mu_deflate_stream_install (mu_stream_t stream, int level, mu_stream_t *pret)
+{
+  mu_stream_t tstr, transport, zstr, sub[2], pair[2];
+  struct mu_buffer_query bq;
+  int rc;
+
+  if (!stream)
+    return EINVAL;
+  rc = mu_stream_flush (stream);
+  if (rc)
+    return rc;
+
+  /* Descend to the stream whose transport has no substreams of its own,
+     or is a stream combining separate input and output channels. */
+  tstr = stream;
+  if (mu_stream_ioctl (tstr, MU_IOCTL_TOPSTREAM, MU_IOCTL_OP_GET, sub)
+      || sub[1] != NULL)
+    return MU_ERR_TRANSPORT_GET;
+  for (;;)
+    {
+      transport = sub[0];
+      if (mu_stream_ioctl (transport, MU_IOCTL_TOPSTREAM, MU_IOCTL_OP_GET,
+			   pair))
+	break;
+      if (pair[1] != NULL)
+	{
+	  mu_stream_unref (pair[0]);
+	  mu_stream_unref (pair[1]);
+	  break;
+	}
+      tstr = transport;
+      mu_stream_unref (transport);
+      sub[0] = pair[0];
+    }
+
+  /* Compressed input must be read as soon as it arrives */
+  mu_stream_set_buffer (transport, mu_buffer_none, 0);
+  bq.type = MU_TRANSPORT_INPUT;
+  bq.buftype = mu_buffer_none;
+  bq.bufsize = 0;
+  mu_stream_ioctl (transport, MU_IOCTL_TRANSPORT_BUFFER, MU_IOCTL_OP_SET,
+		   &bq);
+
+  rc = mu_deflate_stream_create (&zstr, transport, level, MU_STREAM_RDWR);
+  mu_stream_unref (transport);
+  if (rc)
+    return rc;
+
+  sub[0] = zstr;
+  sub[1] = NULL;
+  rc = mu_stream_ioctl (tstr, MU_IOCTL_TOPSTREAM, MU_IOCTL_OP_SET, sub);
+  mu_stream_unref (zstr);
+  if (rc)
+    return rc;
+  if (pret)
+    *pret = zstr;
+  return 0;
+}
+
+#else
+int
+mu_deflate_stream_create (mu_stream_t *pstream, mu_stream_t transport,
+			  int level, int flags)
+{
+  return ENOSYS;
+}
+
+int
+mu_deflate_stream_install (mu_stream_t stream, int level, mu_stream_t *pret)
+{
+  return ENOSYS;
+}
+#endif
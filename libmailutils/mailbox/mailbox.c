@@ -23,6 +23,7 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/time.h>
 
 #include <mailutils/debug.h>
 #include <mailutils/errno.h>
@@ -38,7 +39,9 @@
 #include <mailutils/url.h>
 #include <mailutils/attribute.h>
 #include <mailutils/message.h>
+#include <mailutils/msgset.h>
 #include <mailutils/util.h>
+#include <mailutils/server.h>
 
 #include <mailutils/sys/mailbox.h>
 #include <mailutils/sys/folder.h>
@@ -330,6 +333,7 @@ int
 mu_mailbox_open (mu_mailbox_t mbox, int flag)
 {
   int rc;
+  struct timeval tv;
   
   if (!mbox)
     return EINVAL;
@@ -344,7 +348,12 @@ mu_mailbox_open (mu_mailbox_t mbox, int flag)
 		  | MU_STREAM_APPEND | MU_STREAM_CREAT))
 	return EACCES;
     }
+  if (flag & (MU_STREAM_WRITE | MU_STREAM_APPEND | MU_STREAM_CREAT))
+    /* Header-only access is a hint meaningful for read-only mailboxes */
+    flag &= ~MU_STREAM_HEADERS_ONLY;
+  mu_srvstat_start (&tv);
   rc = mbox->_open (mbox, flag);
+  mu_srvstat_finish (MU_SRVSTAT_MAILBOX_OPEN, &tv, 0, 0);
   if (rc == 0)
     mbox->flags |= _MU_MAILBOX_OPEN;
   return rc;
@@ -469,6 +478,35 @@ mu_mailbox_append_message_ext (mu_mailbox_t mbox, mu_message_t msg,
   return mbox->_append_message (mbox, msg, env, atr);
 }
 
+static int
+append_msgset_fallback (size_t n, mu_message_t msg, void *data)
+{
+  return mu_mailbox_append_message ((mu_mailbox_t) data, msg);
+}
+
+/* Append messages from MSGSET (a set of messages in SRC) to DST.
+   If both mailboxes are served by the same driver and it provides a
+   bulk append method, it is used.  Otherwise, or if the driver declines
+   the request by returning ENOSYS, messages are appended one by one. */
+int
+mu_mailbox_append_msgset (mu_mailbox_t dst, mu_mailbox_t src,
+			  mu_msgset_t msgset)
+{
+  int rc;
+  
+  _MBOX_CHECK_Q (dst, _append_message);
+  _MBOX_CHECK_FLAGS (src);
+  if (!(dst->flags & (MU_STREAM_WRITE|MU_STREAM_APPEND)))
+    return EACCES;
+  if (dst->_append_msgset && dst->_append_msgset == src->_append_msgset)
+    {
+      rc = dst->_append_msgset (dst, src, msgset);
+      if (rc != ENOSYS)
+	return rc;
+    }
+  return mu_msgset_foreach_message (msgset, append_msgset_fallback, dst);
+}
+
 int
 mu_mailbox_get_message (mu_mailbox_t mbox, size_t msgno,  mu_message_t *pmsg)
 {
@@ -568,20 +606,60 @@ mu_mailbox_message_unseen (mu_mailbox_t mbox, size_t *num)
 int
 mu_mailbox_sync (mu_mailbox_t mbox)
 {
+  int rc;
+  struct timeval tv;
+  
   _MBOX_CHECK_Q (mbox, _sync);
   if (!(mbox->flags & (MU_STREAM_WRITE|MU_STREAM_APPEND)))
     return 0;
-  return mbox->_sync (mbox);
+  mu_srvstat_start (&tv);
+  rc = mbox->_sync (mbox);
+  mu_srvstat_finish (MU_SRVSTAT_MAILBOX_FLUSH, &tv, 0, 0);
+  return rc;
 }
 
 /* Historic alias: */
 int
 mu_mailbox_expunge (mu_mailbox_t mbox)
 {
+  int rc;
+  struct timeval tv;
+  
   _MBOX_CHECK_Q (mbox, _expunge);
   if (!(mbox->flags & (MU_STREAM_WRITE|MU_STREAM_APPEND)))
     return EACCES;
-  return mbox->_expunge (mbox);
+  mu_srvstat_start (&tv);
+  rc = mbox->_expunge (mbox);
+  mu_srvstat_finish (MU_SRVSTAT_MAILBOX_FLUSH, &tv, 0, 0);
+  return rc;
+}
+
+/* Remove those messages from MSGSET that are marked as deleted.  Other
+   deleted messages are left intact.  Returns ENOSYS if the mailbox
+   format does not support restricted expunges. */
+int
+mu_mailbox_expunge_msgset (mu_mailbox_t mbox, mu_msgset_t msgset)
+{
+  int rc;
+
+  _MBOX_CHECK_Q (mbox, _expunge);
+  if (!mbox->expunge_set_ok)
+    return ENOSYS;
+  mbox->expunge_set = msgset;
+  rc = mu_mailbox_expunge (mbox);
+  mbox->expunge_set = NULL;
+  return rc;
+}
+
+/* Return true if the message MSGNO, whose attribute flags are FLAGS,
+   must be removed by the expunge in progress. */
+int
+_mu_mailbox_expunge_p (mu_mailbox_t mbox, size_t msgno, int flags)
+{
+  if (!(flags & MU_ATTRIBUTE_DELETED))
+    return 0;
+  return !mbox->expunge_set
+         || mu_msgset_locate (mbox->expunge_set, msgno, NULL) == 0;
 }
 
 int
@@ -604,6 +682,42 @@ mu_mailbox_scan (mu_mailbox_t mbox, size_t msgno, size_t *pcount)
   return mbox->_scan (mbox, msgno, pcount);
 }
 
+/* Call FUN for each message in MBOX, passing it the message number,
+   queue ID (NULL if the driver does not support them) and header.
+   Iteration stops if FUN returns non-zero, and its return value is
+   returned.  Open the mailbox with MU_STREAM_HEADERS_ONLY to make it
+   as fast as possible. */
+int
+mu_mailbox_headers_foreach (mu_mailbox_t mbox,
+			    mu_mailbox_header_action_t fun, void *data)
+{
+  size_t i, count;
+  int rc;
+
+  if (!fun)
+    return EINVAL;
+  rc = mu_mailbox_messages_count (mbox, &count);
+  if (rc)
+    return rc;
+  for (i = 1; i <= count; i++)
+    {
+      mu_message_t msg;
+      mu_header_t hdr;
+      mu_message_qid_t qid;
+
+      if ((rc = mu_mailbox_get_message (mbox, i, &msg)) != 0
+	  || (rc = mu_message_get_header (msg, &hdr)) != 0)
+	return rc;
+      if (mu_message_get_qid (msg, &qid))
+	qid = NULL;
+      rc = fun (i, qid, hdr, data);
+      free (qid);
+      if (rc)
+	return rc;
+    }
+  return 0;
+}
+
 int
 mu_mailbox_get_size (mu_mailbox_t mbox, mu_off_t *psize)
 {
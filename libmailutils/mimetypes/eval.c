@@ -17,6 +17,7 @@
 #include <config.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 #include <string.h>
 #include <fnmatch.h>
 #include <regex.h>
@@ -28,11 +29,64 @@
 #include <mailutils/cstr.h>
 #include <mailutils/stdstream.h>
 #include <mailutils/list.h>
+#include <mailutils/assoc.h>
 #include <mailutils/nls.h>
 #include <mailutils/errno.h>
 #include <mailutils/sys/mimetypes.h>
 #include <mailutils/mimetypes.h>
 
+#define MIME_MAX_BUFFER 4096
+/* Maximal size of the prefetch window */
+#define MIME_HEAD_MAX 16384
+
+/* Get SIZE bytes at offset OFF from the input.  Return pointer to the
+   data and store the number of bytes actually available in *PN.  Data
+   within the prefetch window are served from the head buffer.
+   Return NULL on error. */
+static char const *
+input_get (struct input_file *input, size_t off, size_t size, size_t *pn)
+{
+  int rc;
+  
+  if (off + size <= input->head_size)
+    {
+      if (off < input->head_len)
+	*pn = input->head_len - off < size ? input->head_len - off : size;
+      else
+	*pn = 0;
+      return input->head + off;
+    }
+
+  if (size > input->bufsize)
+    {
+      char *p = realloc (input->buf, size);
+      if (!p)
+	{
+	  mu_debug (MU_DEBCAT_MIMETYPES, MU_DEBUG_ERROR,
+		    ("realloc: %s", mu_strerror (errno)));
+	  return NULL;
+	}
+      input->buf = p;
+      input->bufsize = size;
+    }
+  
+  rc = mu_stream_seek (input->stream, off, MU_SEEK_SET, NULL);
+  if (rc)
+    {
+      mu_debug (MU_DEBCAT_MIMETYPES, MU_DEBUG_ERROR,
+		("mu_stream_seek: %s", mu_strerror (rc)));
+      return NULL;
+    }
+  rc = mu_stream_read (input->stream, input->buf, size, pn);
+  if (rc)
+    {
+      mu_debug (MU_DEBCAT_MIMETYPES, MU_DEBUG_ERROR,
+		("mu_stream_read: %s", mu_strerror (rc)));
+      return NULL;
+    }
+  return input->buf;
+}
+
 /*
  * match("pattern")
  *        Pattern match on filename
@@ -54,29 +108,16 @@ b_match (union argument *args, struct input_file *input)
 static int
 b_ascii (union argument *args, struct input_file *input)
 {
-  int i;
-  int rc;
+  unsigned char const *p;
+  size_t i, n;
 
-  rc = mu_stream_seek (input->stream, args[0].number, MU_SEEK_SET, NULL);
-  if (rc)
-    {
-      mu_debug (MU_DEBCAT_MIMETYPES, MU_DEBUG_ERROR,
-		("mu_stream_seek: %s", mu_strerror (rc)));
+  p = (unsigned char const *) input_get (input, args[0].number,
+					 args[1].number, &n);
+  if (!p)
+    return 0;
+  for (i = 0; i < n; i++)
+    if (!ISASCII (p[i]))
       return 0;
-    }
-
-  for (i = 0; i < args[1].number; i++)
-    {
-      unsigned char c;
-      size_t n;
-
-      rc = mu_stream_read (input->stream, &c, 1, &n);
-      if (rc || n == 0)
-	break;
-      if (!ISASCII (c))
-	return 0;
-    }
-      
   return 1;
 }
 
@@ -90,31 +131,25 @@ b_ascii (union argument *args, struct input_file *input)
 static int
 b_printable (union argument *args, struct input_file *input)
 {
-  int i;
-  int rc;
+  unsigned char const *p;
+  size_t i, n;
 
-  rc = mu_stream_seek (input->stream, args[0].number, MU_SEEK_SET, NULL);
-  if (rc)
-    {
-      mu_debug (MU_DEBCAT_MIMETYPES, MU_DEBUG_ERROR,
-		("mu_stream_seek: %s", mu_strerror (rc)));
+  p = (unsigned char const *) input_get (input, args[0].number,
+					 args[1].number, &n);
+  if (!p)
+    return 0;
+  for (i = 0; i < n; i++)
+    if (!ISPRINT (p[i]))
       return 0;
-    }
-
-  for (i = 0; i < args[1].number; i++)
-    {
-      unsigned char c;
-      size_t n;
-
-      rc = mu_stream_read (input->stream, &c, 1, &n);
-      if (rc || n == 0)
-	break;
-      if (!ISPRINT (c))
-	return 0;
-    }
   return 1;
 }
 
+static size_t
+x_length (union argument *args)
+{
+  return args[0].number + args[1].number;
+}
+
 /*
  * string(offset,"string")
  *        True if bytes are identical to string
@@ -123,27 +158,11 @@ static int
 b_string (union argument *args, struct input_file *input)
 {
   struct mimetypes_string *str = args[1].string;
-  int i;
-  int rc;
-  
-  rc = mu_stream_seek (input->stream, args[0].number, MU_SEEK_SET, NULL);
-  if (rc)
-    {
-      mu_debug (MU_DEBCAT_MIMETYPES, MU_DEBUG_ERROR,
-		("mu_stream_seek: %s", mu_strerror (rc)));
-      return 0;
-    }
-
-  for (i = 0; i < str->len; i++)
-    {
-      char c;
-      size_t n;
+  char const *p;
+  size_t n;
 
-      rc = mu_stream_read (input->stream, &c, 1, &n);
-      if (rc || n == 0 || c != str->ptr[i])
-	return 0;
-    }
-  return 1;
+  p = input_get (input, args[0].number, str->len, &n);
+  return p && n == str->len && memcmp (p, str->ptr, n) == 0;
 }
 
 /*
@@ -154,56 +173,34 @@ b_string (union argument *args, struct input_file *input)
 static int
 b_istring (union argument *args, struct input_file *input)
 {
-  int i;
   struct mimetypes_string *str = args[1].string;
-  
-  int rc;
+  char const *p;
+  size_t i, n;
 
-  rc = mu_stream_seek (input->stream, args[0].number, MU_SEEK_SET, NULL);
-  if (rc)
-    {
-      mu_debug (MU_DEBCAT_MIMETYPES, MU_DEBUG_ERROR,
-		("mu_stream_seek: %s", mu_strerror (rc)));
+  p = input_get (input, args[0].number, str->len, &n);
+  if (!p || n != str->len)
+    return 0;
+  for (i = 0; i < n; i++)
+    if (mu_tolower (p[i]) != mu_tolower (str->ptr[i]))
       return 0;
-    }
-
-  for (i = 0; i < str->len; i++)
-    {
-      char c;
-      size_t n;
-
-      rc = mu_stream_read (input->stream, &c, 1, &n);
-      if (rc || n == 0 || mu_tolower (c) != mu_tolower (str->ptr[i]))
-	return 0;
-    }
   return 1;
 }
 
-int
+static size_t
+x_string (union argument *args)
+{
+  return args[0].number + args[1].string->len;
+}
+
+static int
 compare_bytes (union argument *args, struct input_file *input,
-	       void *sample, void *buf, size_t size)
+	       void *sample, size_t size)
 {
-  int rc;
+  char const *p;
   size_t n;
-  
-  rc = mu_stream_seek (input->stream, args[0].number, MU_SEEK_SET, NULL);
-  if (rc)
-    {
-      mu_debug (MU_DEBCAT_MIMETYPES, MU_DEBUG_ERROR,
-		("mu_stream_seek: %s", mu_strerror (rc)));
-      return 0;
-    }
-  
-  rc = mu_stream_read (input->stream, buf, size, &n);
-  if (rc)
-    {
-      mu_debug (MU_DEBCAT_MIMETYPES, MU_DEBUG_ERROR,
-		("mu_stream_read: %s", mu_strerror (rc)));
-      return 0;
-    }
-  else if (n != size)
-    return 0;
-  return memcmp (sample, buf, size) == 0;
+
+  p = input_get (input, args[0].number, size, &n);
+  return p && n == size && memcmp (sample, p, size) == 0;
 }
 
 /*
@@ -214,8 +211,13 @@ static int
 b_char (union argument *args, struct input_file *input)
 {
   char val = args[1].number;
-  char buf;
-  return compare_bytes (args, input, &val, &buf, sizeof (buf));
+  return compare_bytes (args, input, &val, sizeof (val));
+}
+
+static size_t
+x_char (union argument *args)
+{
+  return args[0].number + sizeof (char);
 }
 
 /*
@@ -227,8 +229,13 @@ static int
 b_short (union argument *args, struct input_file *input)
 {
   uint16_t val = args[1].number;
-  uint16_t buf;
-  return compare_bytes (args, input, &val, &buf, sizeof (buf));
+  return compare_bytes (args, input, &val, sizeof (val));
+}
+
+static size_t
+x_short (union argument *args)
+{
+  return args[0].number + sizeof (uint16_t);
 }
 
 /*
@@ -240,8 +247,13 @@ static int
 b_int (union argument *args, struct input_file *input)
 {
   uint32_t val = args[1].number;
-  uint32_t buf;
-  return compare_bytes (args, input, &val, &buf, sizeof (buf));
+  return compare_bytes (args, input, &val, sizeof (val));
+}
+
+static size_t
+x_int (union argument *args)
+{
+  return args[0].number + sizeof (uint32_t);
 }
 
 /*
@@ -263,44 +275,17 @@ static int
 b_contains (union argument *args, struct input_file *input)
 {
   size_t i, count;
-  char *buf;
+  char const *buf;
   struct mimetypes_string *str = args[2].string;
-  int rc;
 
-  rc = mu_stream_seek (input->stream, args[0].number, MU_SEEK_SET, NULL);
-  if (rc)
-    {
-      mu_debug (MU_DEBCAT_MIMETYPES, MU_DEBUG_ERROR,
-		("mu_stream_seek: %s", mu_strerror (rc)));
-      return 0;
-    }
-
-  if ((buf = malloc (args[1].number)) == NULL)
-    {
-      mu_debug (MU_DEBCAT_MIMETYPES, MU_DEBUG_ERROR,
-		("malloc: %s", mu_strerror (rc)));
-      return 0;
-    }
-  
-  rc = mu_stream_read (input->stream, buf, args[1].number, &count);
-  if (rc)
-    {
-      mu_debug (MU_DEBCAT_MIMETYPES, MU_DEBUG_ERROR,
-		("mu_stream_read: %s", mu_strerror (rc)));
-    }
-  else if (count > str->len)
+  buf = input_get (input, args[0].number, args[1].number, &count);
+  if (buf && count > str->len)
     for (i = 0; i <= count - str->len; i++)
       if (buf[i] == str->ptr[0] && memcmp (buf + i, str->ptr, str->len) == 0)
-	{
-	  free (buf);
-	  return 1;
-	}
-  free (buf);
+	return 1;
   return 0;
 }
 
-#define MIME_MAX_BUFFER 4096
-
 /*
  * regex(offset,"regex")
  *        True if bytes match regular expression
@@ -309,42 +294,36 @@ static int
 b_regex (union argument *args, struct input_file *input)
 {
   size_t count;
-  int rc;
+  char const *p;
   char buf[MIME_MAX_BUFFER];
-  
-  rc = mu_stream_seek (input->stream, args[0].number, MU_SEEK_SET, NULL);
-  if (rc)
-    {
-      mu_debug (MU_DEBCAT_MIMETYPES, MU_DEBUG_ERROR,
-		("mu_stream_seek: %s", mu_strerror (rc)));
-      return 0;
-    }
 
-  rc = mu_stream_read (input->stream, buf, sizeof buf - 1, &count);
-  if (rc)
-    {
-      mu_debug (MU_DEBCAT_MIMETYPES, MU_DEBUG_ERROR,
-		("mu_stream_read: %s", mu_strerror (rc)));
-      return 0;
-    }
+  p = input_get (input, args[0].number, sizeof buf - 1, &count);
+  if (!p)
+    return 0;
+  memcpy (buf, p, count);
   buf[count] = 0;
 
   return regexec (&args[1].rx, buf, 0, NULL, 0) == 0;
 } 
-  
+
+static size_t
+x_regex (union argument *args)
+{
+  return args[0].number + MIME_MAX_BUFFER - 1;
+}
 
 static struct builtin_tab builtin_tab[] = {
   { "match", "s", b_match },
-  { "ascii", "dd", b_ascii },
-  { "printable", "dd", b_printable },
-  { "regex", "dx", b_regex },
-  { "string", "ds", b_string },
-  { "istring", "ds", b_istring },
-  { "char", "dc", b_char },
-  { "short", "dd", b_short },
-  { "int", "dd", b_int },
+  { "ascii", "dd", b_ascii, x_length },
+  { "printable", "dd", b_printable, x_length },
+  { "regex", "dx", b_regex, x_regex },
+  { "string", "ds", b_string, x_string },
+  { "istring", "ds", b_istring, x_string },
+  { "char", "dc", b_char, x_char },
+  { "short", "dd", b_short, x_short },
+  { "int", "dd", b_int, x_int },
   { "locale", "s", b_locale },
-  { "contains", "dds", b_contains },
+  { "contains", "dds", b_contains, x_length },
   { NULL }
 };
   
@@ -455,19 +434,6 @@ eval_rule (struct node *root, struct input_file *input)
   return result;
 }
 
-static int
-evaluate (void **itmv, size_t itmc, void *call_data)
-{
-  struct rule_tab *p = itmv[0];
-  if (eval_rule (p->node, call_data))
-    {
-      itmv[0] = p;
-      mime_debug (MU_DEBUG_TRACE1, &p->loc, "rule %s matches", p->type);
-      return MU_LIST_MAP_OK;
-    }
-  return MU_LIST_MAP_SKIP;
-}
-
 static int
 rule_cmp (const void *a, const void *b)
 {
@@ -488,27 +454,297 @@ rule_cmp (const void *a, const void *b)
   return arule->priority - brule->priority;
 }
 
+static int
+rule_ptr_cmp (const void *a, const void *b)
+{
+  return rule_cmp (*(struct rule_tab * const *) a,
+		   *(struct rule_tab * const *) b);
+}
+
+/* Rule compilation.
+
+   The rules are sorted in the order of preference, so that evaluation
+   can stop at the first matching rule.
+
+   Rules that can match only files with certain suffixes (e.g. "bar baz",
+   or "bar + string(0,BAR)") are indexed in the suffix table, which maps
+   each suffix to the ordered list of indices of such rules.  When
+   evaluating, these rules are skipped unless listed under the suffix of
+   the input file.
+
+   Finally, the maximal offset examined by any byte test is computed.
+   The evaluator reads that many bytes (but no more than MIME_HEAD_MAX)
+   from the start of the input at once, and serves the byte tests from
+   that buffer. */
+
+struct suffix_rules
+{
+  size_t count;    /* Number of rule indices */
+  size_t max;      /* Capacity of idx */
+  size_t *idx;     /* Indices of the rules in rulev, in ascending order */
+};
+
+static void
+suffix_rules_free (void *data)
+{
+  struct suffix_rules *sr = data;
+  free (sr->idx);
+  free (sr);
+}
+
+/* Return true if NODE can be true only for files with certain
+   suffixes */
+static int
+suffix_filter (struct node *node)
+{
+  switch (node->type)
+    {
+    case suffix_node:
+      return 1;
+
+    case binary_node:
+      if (node->v.bin.op == L_OR)
+	return suffix_filter (node->v.bin.arg1)
+	       && suffix_filter (node->v.bin.arg2);
+      return suffix_filter (node->v.bin.arg1)
+	     || suffix_filter (node->v.bin.arg2);
+
+    default:
+      return 0;
+    }
+}
+
+static int
+suffix_add (mu_assoc_t tab, struct mimetypes_string const *suffix,
+	    size_t idx)
+{
+  struct suffix_rules *sr;
+  char *suf;
+  int rc;
+
+  suf = malloc (suffix->len + 1);
+  if (!suf)
+    return errno;
+  memcpy (suf, suffix->ptr, suffix->len);
+  suf[suffix->len] = 0;
+  
+  sr = mu_assoc_get (tab, suf);
+  if (!sr)
+    {
+      sr = calloc (1, sizeof (*sr));
+      if (!sr)
+	rc = errno;
+      else if ((rc = mu_assoc_install (tab, suf, sr)) != 0)
+	free (sr);
+      if (rc)
+	{
+	  free (suf);
+	  return rc;
+	}
+    }
+  free (suf);
+
+  if (sr->count > 0 && sr->idx[sr->count - 1] == idx)
+    return 0;
+  if (sr->count == sr->max)
+    {
+      size_t n = sr->max ? 2 * sr->max : 4;
+      size_t *p = realloc (sr->idx, n * sizeof (sr->idx[0]));
+      if (!p)
+	return errno;
+      sr->idx = p;
+      sr->max = n;
+    }
+  sr->idx[sr->count++] = idx;
+  return 0;
+}
+
+/* Add to TAB the suffixes that NODE requires.  NODE must satisfy
+   suffix_filter. */
+static int
+suffix_collect (mu_assoc_t tab, struct node *node, size_t idx)
+{
+  int rc;
+  
+  switch (node->type)
+    {
+    case suffix_node:
+      return suffix_add (tab, &node->v.suffix, idx);
+
+    case binary_node:
+      if (node->v.bin.op == L_OR)
+	{
+	  rc = suffix_collect (tab, node->v.bin.arg1, idx);
+	  if (rc == 0)
+	    rc = suffix_collect (tab, node->v.bin.arg2, idx);
+	  return rc;
+	}
+      if (suffix_filter (node->v.bin.arg1))
+	return suffix_collect (tab, node->v.bin.arg1, idx);
+      return suffix_collect (tab, node->v.bin.arg2, idx);
+
+    default:
+      abort ();
+    }
+}
+
+/* Return offset of the first byte past the input area examined by
+   NODE */
+static size_t
+node_extent (struct node *node)
+{
+  size_t a, b;
+  
+  switch (node->type)
+    {
+    case functional_node:
+      if (node->v.function.builtin->extent)
+	return node->v.function.builtin->extent (node->v.function.args);
+      break;
+
+    case binary_node:
+      a = node_extent (node->v.bin.arg1);
+      b = node_extent (node->v.bin.arg2);
+      return a > b ? a : b;
+
+    case negation_node:
+      return node_extent (node->v.arg);
+
+    default:
+      break;
+    }
+  return 0;
+}
+
+int
+mu_mimetypes_compile (struct mu_mimetypes *mt)
+{
+  size_t i;
+  int rc;
+  
+  rc = mu_list_count (mt->rule_list, &mt->rulec);
+  if (rc)
+    return rc;
+  if (mt->rulec == 0)
+    return 0;
+  mt->rulev = calloc (mt->rulec, sizeof (mt->rulev[0]));
+  if (!mt->rulev)
+    return errno;
+  mu_list_to_array (mt->rule_list, (void **) mt->rulev, mt->rulec, NULL);
+  qsort (mt->rulev, mt->rulec, sizeof (mt->rulev[0]), rule_ptr_cmp);
+
+  rc = mu_assoc_create (&mt->suffix_tab, 0);
+  if (rc)
+    return rc;
+  mu_assoc_set_destroy_item (mt->suffix_tab, suffix_rules_free);
+
+  mt->head_size = 0;
+  for (i = 0; i < mt->rulec; i++)
+    {
+      struct rule_tab *rule = mt->rulev[i];
+      size_t n;
+
+      rule->suffix_filter = suffix_filter (rule->node);
+      if (rule->suffix_filter)
+	{
+	  rc = suffix_collect (mt->suffix_tab, rule->node, i);
+	  if (rc)
+	    return rc;
+	}
+      n = node_extent (rule->node);
+      if (n > mt->head_size)
+	mt->head_size = n;
+    }
+  if (mt->head_size > MIME_HEAD_MAX)
+    mt->head_size = MIME_HEAD_MAX;
+  return 0;
+}
+
+void
+mu_mimetypes_compile_free (struct mu_mimetypes *mt)
+{
+  free (mt->rulev);
+  mt->rulev = NULL;
+  mt->rulec = 0;
+  mu_assoc_destroy (&mt->suffix_tab);
+}
+
+static void
+input_init (struct input_file *input, mu_mimetypes_t mt,
+	    char const *name, mu_stream_t str)
+{
+  int rc;
+  
+  memset (input, 0, sizeof (*input));
+  input->name = name;
+  input->stream = str;
+
+  mu_stream_seek (str, 0, MU_SEEK_SET, NULL);
+  if (mt->head_size == 0 || (input->head = malloc (mt->head_size)) == NULL)
+    return;
+  while (input->head_len < mt->head_size)
+    {
+      size_t n;
+      
+      rc = mu_stream_read (str, input->head + input->head_len,
+			   mt->head_size - input->head_len, &n);
+      if (rc)
+	{
+	  mu_debug (MU_DEBCAT_MIMETYPES, MU_DEBUG_ERROR,
+		    ("mu_stream_read: %s", mu_strerror (rc)));
+	  /* Disable the prefetch window */
+	  return;
+	}
+      if (n == 0)
+	break;
+      input->head_len += n;
+    }
+  input->head_size = mt->head_size;
+}
+
+static void
+input_free (struct input_file *input)
+{
+  free (input->head);
+  free (input->buf);
+}
+
 const char *
 mu_mimetypes_stream_type (mu_mimetypes_t mt, char const *name, mu_stream_t str)
 {
-  mu_list_t res = NULL;
   const char *type = NULL;
   struct input_file input;
+  struct suffix_rules *sr = NULL;
+  char const *p;
+  size_t i, j = 0;
 
-  input.name = name;
-  input.stream = str;
-  
-  mu_stream_seek (str, 0, MU_SEEK_SET, NULL);
-  mu_list_map (mt->rule_list, evaluate, &input, 1, &res);
-  if (!mu_list_is_empty (res))
+  p = strrchr (name, '.');
+  if (p && mt->suffix_tab)
+    sr = mu_assoc_get (mt->suffix_tab, p + 1);
+
+  input_init (&input, mt, name, str);
+  for (i = 0; i < mt->rulec; i++)
     {
-      struct rule_tab *rule;
-      mu_list_sort (res, rule_cmp);
-      mu_list_head (res, (void**) &rule);
-      mime_debug (MU_DEBUG_TRACE0, &rule->loc, "selected rule %s", rule->type);
-      type = rule->type;
+      struct rule_tab *rule = mt->rulev[i];
+
+      if (rule->suffix_filter)
+	{
+	  if (!sr)
+	    continue;
+	  while (j < sr->count && sr->idx[j] < i)
+	    j++;
+	  if (j == sr->count || sr->idx[j] != i)
+	    continue;
+	}
+      if (eval_rule (rule->node, &input))
+	{
+	  mime_debug (MU_DEBUG_TRACE0, &rule->loc, "selected rule %s",
+		      rule->type);
+	  type = rule->type;
+	  break;
+	}
     }
-  mu_list_destroy (&res);
+  input_free (&input);
   return type;
 }
     
@@ -403,6 +403,9 @@ mu_mimetypes_open (const char *name)
       mimetypes_yylex_destroy (scanner);
     }
   
+  if (rc == 0 && ctl.errors == 0 && mu_mimetypes_compile (mtp))
+    rc = 1;
+  
   if (rc || ctl.errors)
     {
       mu_mimetypes_close (mtp);
@@ -418,6 +421,7 @@ mu_mimetypes_close (mu_mimetypes_t mt)
 {
   if (mt)
     {
+      mu_mimetypes_compile_free (mt);
       mu_list_destroy (&mt->rule_list);
       mu_opool_destroy (&mt->pool);
       free (mt);
@@ -45,6 +45,8 @@
 #include <mailutils/sockaddr.h>
 #include <mailutils/url.h>
 #include <mailutils/util.h>
+#include <mailutils/stream.h>
+#include <mailutils/diag.h>
 
 typedef RETSIGTYPE (*mu_sig_handler_t) (int);
 
@@ -99,6 +101,8 @@ struct _mu_m_server
   mu_sig_handler_t sigtab[NSIG]; /* Keeps old signal handlers. */
   const char *(*strexit) (int);  /* Convert integer exit code to textual
 				    description. */
+  char *stat_socket;             /* Name of the statistics socket. */
+  mu_srvstat_t srvstat;          /* Statistics table. */
 };
 
 
@@ -379,6 +383,18 @@ mu_m_server_get_srvlist (mu_m_server_t srv, mu_list_t *plist)
   return 0;
 }
 
+const char *
+mu_m_server_stat_socket (mu_m_server_t srv)
+{
+  return srv->stat_socket;
+}
+
+mu_srvstat_t
+mu_m_server_srvstat (mu_m_server_t srv)
+{
+  return srv->srvstat;
+}
+
 const char *
 mu_m_server_pidfile (mu_m_server_t srv)
 {
@@ -545,6 +561,22 @@ mu_m_server_begin (mu_m_server_t msrv)
 		  mu_strerror (rc));
       }
 
+  if (msrv->stat_socket)
+    {
+      rc = mu_srvstat_create (&msrv->srvstat, msrv->ident,
+			      MU_SRVSTAT_DEFAULT_SIZE);
+      if (rc)
+	mu_diag_funcall (MU_DIAG_ERROR, "mu_srvstat_create", NULL, rc);
+      else
+	{
+	  mu_srvstat_register (msrv->srvstat, MU_SRVSTAT_MAILBOX_OPEN);
+	  mu_srvstat_register (msrv->srvstat, MU_SRVSTAT_MAILBOX_SCAN);
+	  mu_srvstat_register (msrv->srvstat, MU_SRVSTAT_MAILBOX_FLUSH);
+	  mu_srvstat_register (msrv->srvstat, MU_SRVSTAT_LOCK_WAIT);
+	  mu_srvstat_set_default (msrv->srvstat);
+	}
+    }
+  
   for (i = 0; i < NSIG; i++)
     if (sigismember (&msrv->sigmask, i))
       msrv->sigtab[i] = set_signal (i, m_srv_signal);
@@ -575,6 +607,8 @@ mu_m_server_destroy (mu_m_server_t *pmsrv)
   mu_server_destroy (&msrv->server);
   free (msrv->child_pid);
   /* FIXME: Send processes the TERM signal here?*/
+  mu_srvstat_destroy (&msrv->srvstat);
+  free (msrv->stat_socket);
   free (msrv->ident);
   free (msrv);
   *pmsrv = NULL;
@@ -624,6 +658,86 @@ open_connection (mu_ip_server_t tcpsrv, mu_m_server_t msrv)
   return rc;
 }  
 
+static int
+stat_conn_handler (int fd, void *conn_data, void *server_data)
+{
+  mu_m_server_t msrv = conn_data;
+  mu_stream_t str;
+  int sfd, rc;
+  
+  sfd = accept (fd, NULL, NULL);
+  if (sfd == -1)
+    {
+      if (errno == EINTR)
+	return stop ? MU_SERVER_SHUTDOWN : MU_SERVER_SUCCESS;
+      mu_diag_funcall (MU_DIAG_ERROR, "accept", msrv->stat_socket, errno);
+      return MU_SERVER_CLOSE_CONN;
+    }
+  rc = mu_fd_stream_create (&str, NULL, sfd, MU_STREAM_WRITE);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_fd_stream_create", NULL, rc);
+      close (sfd);
+    }
+  else
+    {
+      mu_srvstat_format (msrv->srvstat, str);
+      mu_stream_destroy (&str);
+    }
+  return stop ? MU_SERVER_SHUTDOWN : MU_SERVER_SUCCESS;
+}
+
+static void
+stat_conn_free (void *conn_data, void *server_data)
+{
+  mu_m_server_t msrv = conn_data;
+  unlink (msrv->stat_socket);
+}
+
+/* Open the statistics socket */
+static int
+open_stat_socket (mu_m_server_t msrv)
+{
+  struct sockaddr_un addr;
+  int fd, rc;
+  
+  if (strlen (msrv->stat_socket) >= sizeof addr.sun_path)
+    {
+      mu_error (_("%s: socket name too long"), msrv->stat_socket);
+      return ENAMETOOLONG;
+    }
+  fd = socket (PF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    {
+      rc = errno;
+      mu_diag_funcall (MU_DIAG_ERROR, "socket", NULL, rc);
+      return rc;
+    }
+  memset (&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, msrv->stat_socket);
+  unlink (msrv->stat_socket);
+  if (bind (fd, (struct sockaddr *) &addr, sizeof addr) == -1
+      || listen (fd, 8) == -1)
+    {
+      rc = errno;
+      mu_error (_("cannot open statistics socket %s: %s"),
+		msrv->stat_socket, mu_strerror (rc));
+      close (fd);
+      return rc;
+    }
+  rc = mu_server_add_connection (msrv->server, fd, msrv,
+				 stat_conn_handler, stat_conn_free);
+  if (rc)
+    {
+      mu_error (_("cannot add connection %s: %s"),
+		msrv->stat_socket, mu_strerror (rc));
+      close (fd);
+      unlink (msrv->stat_socket);
+    }
+  return rc;
+}
+
 int
 mu_m_server_run (mu_m_server_t msrv)
 {
@@ -653,6 +767,12 @@ mu_m_server_run (mu_m_server_t msrv)
       mu_error (_("no servers configured: exiting"));
       exit (1);
     }
+  if (msrv->srvstat)
+    {
+      saved_umask = umask (0117);
+      open_stat_socket (msrv);
+      umask (saved_umask);
+    }
   if (msrv->preflight && msrv->preflight (msrv))
     {
       mu_error (_("%s: preflight check failed"), msrv->ident);
@@ -934,6 +1054,11 @@ static struct mu_cfg_param dot_server_cfg_param[] = {
   { "timeout", mu_c_time,
     NULL, mu_offsetof (struct _mu_m_server,timeout), NULL,
     N_("Set idle timeout.") },
+  { "stat-socket", mu_c_string,
+    NULL, mu_offsetof (struct _mu_m_server,stat_socket), NULL,
+    N_("Collect server statistics and make them available via this "
+       "UNIX socket."),
+    N_("file") },
   { "server", mu_cfg_section, NULL, 0, NULL,
     N_("Server configuration.") },
   { "acl", mu_cfg_section, NULL, mu_offsetof (struct _mu_m_server,acl), NULL,
@@ -0,0 +1,281 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General
+   Public License along with this library; If not, see
+   <http://www.gnu.org/licenses/>.  */
+
+/* Server statistics.
+
+   The statistics table keeps a set of named entries.  Each entry counts
+   the number of operations of a given kind, their total and maximal
+   duration in microseconds, the number of bytes they received and sent,
+   and a histogram of durations.
+
+   The histogram is log-linear: durations are grouped by their binary
+   order of magnitude, and each group is split into four equal buckets.
+   Thus, each bucket is at most 25% wide, which is enough to estimate
+   percentiles.
+
+   The table lives in an anonymous shared memory segment, so that child
+   processes of an m-server update the same table as their master.  All
+   entries must be registered before the children are created.  Counters
+   are updated using atomic operations, when available. */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <mailutils/types.h>
+#include <mailutils/server.h>
+#include <mailutils/stream.h>
+#include <mailutils/cstr.h>
+#include <mailutils/errno.h>
+#include <mailutils/util.h>
+
+#ifndef MAP_ANONYMOUS
+# define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#ifdef HAVE_SYNC_BUILTINS
+# define ATOMIC_ADD(p, v) __sync_fetch_and_add (p, v)
+#else
+# define ATOMIC_ADD(p, v) (*(p) += (v))
+#endif
+
+struct srvstat_entry
+{
+  char name[MU_SRVSTAT_NAME_MAX];
+  unsigned long count;                  /* Number of operations */
+  unsigned long sum;                    /* Total duration */
+  unsigned long max;                    /* Maximal duration */
+  unsigned long in;                     /* Bytes received */
+  unsigned long out;                    /* Bytes sent */
+  unsigned long hist[MU_SRVSTAT_BUCKETS];
+};
+
+struct _mu_srvstat
+{
+  size_t size;                          /* Size of the mapping */
+  char ident[MU_SRVSTAT_NAME_MAX];      /* Server identifier */
+  time_t start;                         /* Creation time */
+  size_t nmax;                          /* Capacity */
+  size_t count;                         /* Number of registered entries */
+  struct srvstat_entry entry[1];
+};
+
+static mu_srvstat_t default_srvstat;
+
+int
+mu_srvstat_create (mu_srvstat_t *pst, const char *ident, size_t nmax)
+{
+  mu_srvstat_t st;
+  size_t size;
+  void *p;
+
+  if (!pst || nmax == 0)
+    return EINVAL;
+  size = sizeof (*st) + (nmax - 1) * sizeof (st->entry[0]);
+  p = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+	    -1, 0);
+  if (p == MAP_FAILED)
+    return errno;
+  st = p;
+  memset (st, 0, size);
+  st->size = size;
+  if (ident)
+    mu_cpystr (st->ident, ident, sizeof (st->ident));
+  st->start = time (NULL);
+  st->nmax = nmax;
+  *pst = st;
+  return 0;
+}
+
+void
+mu_srvstat_destroy (mu_srvstat_t *pst)
+{
+  if (pst && *pst)
+    {
+      if (*pst == default_srvstat)
+	default_srvstat = NULL;
+      munmap (*pst, (*pst)->size);
+      *pst = NULL;
+    }
+}
+
+static struct srvstat_entry *
+srvstat_lookup (mu_srvstat_t st, const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < st->count; i++)
+    if (mu_c_strcasecmp (st->entry[i].name, name) == 0)
+      return &st->entry[i];
+  return NULL;
+}
+
+int
+mu_srvstat_register (mu_srvstat_t st, const char *name)
+{
+  struct srvstat_entry *ent;
+
+  if (!st || !name)
+    return EINVAL;
+  if (strlen (name) >= MU_SRVSTAT_NAME_MAX)
+    return ENAMETOOLONG;
+  if (srvstat_lookup (st, name))
+    return EEXIST;
+  if (st->count == st->nmax)
+    return ENOSPC;
+  ent = &st->entry[st->count++];
+  strcpy (ent->name, name);
+  return 0;
+}
+
+size_t
+mu_srvstat_bucket (unsigned long usec)
+{
+  unsigned e;
+  size_t n;
+
+  if (usec < 4)
+    return usec;
+  for (e = 2; (usec >> (e + 1)) != 0; e++)
+    ;
+  n = 4 * (e - 1) + ((usec >> (e - 2)) & 3);
+  if (n >= MU_SRVSTAT_BUCKETS)
+    n = MU_SRVSTAT_BUCKETS - 1;
+  return n;
+}
+
+unsigned long
+mu_srvstat_bucket_bound (size_t n)
+{
+  unsigned e;
+
+  if (n < 4)
+    return n;
+  e = n / 4 + 1;
+  return ((unsigned long)(4 + n % 4 + 1) << (e - 2)) - 1;
+}
+
+static void
+update_max (unsigned long *p, unsigned long v)
+{
+#ifdef HAVE_SYNC_BUILTINS
+  unsigned long old;
+
+  while ((old = *p) < v && !__sync_bool_compare_and_swap (p, old, v))
+    ;
+#else
+  if (*p < v)
+    *p = v;
+#endif
+}
+
+int
+mu_srvstat_add (mu_srvstat_t st, const char *name, unsigned long usec,
+		mu_off_t in, mu_off_t out)
+{
+  struct srvstat_entry *ent;
+
+  if (!st || !name)
+    return EINVAL;
+  ent = srvstat_lookup (st, name);
+  if (!ent)
+    return MU_ERR_NOENT;
+  ATOMIC_ADD (&ent->count, 1);
+  ATOMIC_ADD (&ent->sum, usec);
+  update_max (&ent->max, usec);
+  if (in > 0)
+    ATOMIC_ADD (&ent->in, in);
+  if (out > 0)
+    ATOMIC_ADD (&ent->out, out);
+  ATOMIC_ADD (&ent->hist[mu_srvstat_bucket (usec)], 1);
+  return 0;
+}
+
+int
+mu_srvstat_format (mu_srvstat_t st, mu_stream_t str)
+{
+  size_t i, j;
+
+  if (!st || !str)
+    return EINVAL;
+
+  mu_stream_printf (str, "ident %s\n", st->ident);
+  mu_stream_printf (str, "uptime %lu\n",
+		    (unsigned long) (time (NULL) - st->start));
+  for (i = 0; i < st->count; i++)
+    {
+      struct srvstat_entry *ent = &st->entry[i];
+      int delim = '=';
+
+      mu_stream_printf (str,
+			"stat %s count=%lu sum=%lu max=%lu in=%lu out=%lu hist",
+			ent->name, ent->count, ent->sum, ent->max,
+			ent->in, ent->out);
+      for (j = 0; j < MU_SRVSTAT_BUCKETS; j++)
+	if (ent->hist[j])
+	  {
+	    mu_stream_printf (str, "%c%lu:%lu", delim,
+			      mu_srvstat_bucket_bound (j), ent->hist[j]);
+	    delim = ',';
+	  }
+      if (delim == '=')
+	mu_stream_printf (str, "=");
+      mu_stream_printf (str, "\n");
+    }
+  return mu_stream_flush (str);
+}
+
+void
+mu_srvstat_set_default (mu_srvstat_t st)
+{
+  default_srvstat = st;
+}
+
+mu_srvstat_t
+mu_srvstat_get_default (void)
+{
+  return default_srvstat;
+}
+
+void
+mu_srvstat_start (struct timeval *tv)
+{
+  if (default_srvstat)
+    gettimeofday (tv, NULL);
+}
+
+void
+mu_srvstat_finish (const char *name, struct timeval const *tv,
+		   mu_off_t in, mu_off_t out)
+{
+  struct timeval now;
+  long usec;
+
+  if (!default_srvstat)
+    return;
+  gettimeofday (&now, NULL);
+  usec = (now.tv_sec - tv->tv_sec) * 1000000L + now.tv_usec - tv->tv_usec;
+  if (usec < 0)
+    usec = 0;
+  mu_srvstat_add (default_srvstat, name, usec, in, out);
+}
@@ -365,6 +365,26 @@ fd_ioctl (struct _mu_stream *str, int code, int opcode, void *ptr)
 	}
       break;
 
+    case MU_IOCTL_ZEROCOPY:
+      if (!ptr)
+	return EINVAL;
+      else if (opcode != MU_IOCTL_ZEROCOPY_QUERY)
+	return EINVAL;
+      else if (fstr->io_timeout > 0 || fstr->fd == -1)
+	/* The timeout is enforced by fd_read and fd_write. */
+	return ENOSYS;
+      else
+	{
+	  struct mu_zerocopy_query *qp = ptr;
+	  qp->stream = str;
+	  qp->flags = 0;
+	  qp->fd = fstr->fd;
+	  qp->map = NULL;
+	  qp->base = 0;
+	  qp->limit = -1;
+	}
+      break;
+      
     case MU_IOCTL_TIMEOUT:
       if (!ptr)
 	return EINVAL;
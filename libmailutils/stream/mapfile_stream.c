@@ -249,6 +249,25 @@ _mapfile_ioctl (struct _mu_stream *str, int code, int opcode, void *ptr)
 	    }
 	}
       break;
+
+    case MU_IOCTL_ZEROCOPY:
+      if (!ptr || opcode != MU_IOCTL_ZEROCOPY_QUERY)
+	return EINVAL;
+      else if (mfs->ptr == MAP_FAILED || mfs->ptr == NULL)
+	return ENOSYS;
+      else
+	{
+	  struct mu_zerocopy_query *qp = ptr;
+	  /* Writing behind the mapping would leave it stale, so the
+	     stream can only be used as a source. */
+	  qp->stream = str;
+	  qp->flags = MU_ZEROCOPY_RDONLY;
+	  qp->fd = mfs->fd;
+	  qp->map = mfs->ptr;
+	  qp->base = 0;
+	  qp->limit = mfs->size;
+	}
+      break;
       
     default:
       return ENOSYS;
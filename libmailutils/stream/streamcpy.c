@@ -18,6 +18,14 @@
 # include <config.h>
 #endif
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
 #include <mailutils/types.h>
 #include <mailutils/alloc.h>
 #include <mailutils/error.h>
@@ -28,17 +36,262 @@
 #define STREAMCPY_MIN_BUF_SIZE 2
 #define STREAMCPY_MAX_BUF_SIZE 16384
 
-/* Copy SIZE bytes from SRC to DST.  If SIZE is 0, copy everything up to
-   EOF.
-   If the callback function CBF is not NULL, it will be called for
-   each buffer-full of data read with the following arguments: pointer to
-   the buffer, length of the data portion in buffer, pointer to the user-
-   supplied callback data (CBD).
-*/
-int
-mu_stream_copy_wcb (mu_stream_t dst, mu_stream_t src, mu_off_t size,
-		    void (*cbf) (char *, size_t, void *), void *cbd,
-		    mu_off_t *pcsz)
+/* Zero-copy transfers.
+
+   If both streams are raw descriptor-backed streams (i.e. no filter
+   or transcript sits in between), the data are moved by the kernel
+   using copy_file_range or sendfile, or written directly from the
+   memory mapping of the source file.  Whatever is buffered in either
+   stream (or in the transport of a stream reference) is flushed first
+   and the stream positions are updated afterwards, so that the effect
+   is the same as that of the copying loop below.  If the kernel
+   transfers less data than requested (e.g. because the source file has
+   been truncated), the rest is handled by that loop as well.  Any other
+   combination of streams uses that loop. */
+
+/* Errors indicating that a particular transfer method is not applicable
+   to the given pair of descriptors. */
+#define ZEROCOPY_UNSUPPORTED(e)						\
+  ((e) == ENOSYS || (e) == EINVAL || (e) == EXDEV || (e) == EBADF	\
+   || (e) == EOPNOTSUPP)
+
+#define ZEROCOPY_CHUNK(s) ((s) > SSIZE_MAX ? SSIZE_MAX : (size_t) (s))
+
+static int
+zerocopy_query (mu_stream_t str, struct mu_zerocopy_query *qp)
+{
+  if (mu_stream_ioctl (str, MU_IOCTL_ZEROCOPY, MU_IOCTL_ZEROCOPY_QUERY, qp)
+      || qp->stream != str)
+    return ENOSYS;
+  /* Statistics and event handlers must see the data. */
+  if (str->statmask || str->event_cb)
+    return ENOSYS;
+  return 0;
+}
+
+/* Write SIZE bytes from the memory-mapped source SQ, starting at its
+   offset SPOS, to DFD at offset DPOS, or at the current position if DPOS
+   is -1. */
+static int
+zerocopy_map (struct mu_zerocopy_query *sq, mu_off_t spos,
+	      int dfd, mu_off_t dpos, mu_off_t size, mu_off_t *pn)
+{
+  char const *p = sq->map + sq->base + spos;
+  mu_off_t total = 0;
+
+  while (total < size)
+    {
+      ssize_t n;
+
+      if (dpos == -1)
+	n = write (dfd, p + total, ZEROCOPY_CHUNK (size - total));
+      else
+	n = pwrite (dfd, p + total, ZEROCOPY_CHUNK (size - total),
+		    dpos + total);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  *pn = total;
+	  return errno;
+	}
+      if (n == 0)
+	break;
+      total += n;
+    }
+  *pn = total;
+  return 0;
+}
+
+#ifdef HAVE_COPY_FILE_RANGE
+static int
+zerocopy_file_range (struct mu_zerocopy_query *sq, mu_off_t spos,
+		     int dfd, mu_off_t dpos, mu_off_t size, mu_off_t *pn)
+{
+  off_t ioff = sq->base + spos;
+  off_t ooff = dpos;
+  mu_off_t total = 0;
+
+  while (total < size)
+    {
+      ssize_t n = copy_file_range (sq->fd, &ioff, dfd, &ooff,
+				   ZEROCOPY_CHUNK (size - total), 0);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  *pn = total;
+	  return errno;
+	}
+      if (n == 0)
+	break;
+      total += n;
+    }
+  *pn = total;
+  return 0;
+}
+#endif
+
+#if defined HAVE_SENDFILE && defined HAVE_SYS_SENDFILE_H
+static int
+zerocopy_sendfile (struct mu_zerocopy_query *sq, mu_off_t spos,
+		   int dfd, mu_off_t dpos, mu_off_t size, mu_off_t *pn)
+{
+  off_t ioff = sq->base + spos;
+  mu_off_t total = 0;
+
+  *pn = 0;
+  if (dpos != -1 && lseek (dfd, dpos, SEEK_SET) == -1)
+    return errno;
+  while (total < size)
+    {
+      ssize_t n = sendfile (dfd, sq->fd, &ioff,
+			    ZEROCOPY_CHUNK (size - total));
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  *pn = total;
+	  return errno;
+	}
+      if (n == 0)
+	break;
+      total += n;
+    }
+  *pn = total;
+  return 0;
+}
+#endif
+
+typedef int (*zerocopy_fn) (struct mu_zerocopy_query *, mu_off_t,
+			    int, mu_off_t, mu_off_t, mu_off_t *);
+
+/* Copy SIZE bytes from SRC to DST without intermediate buffering.
+   Return ENOSYS if this is not possible, in which case neither stream
+   has been modified.  Otherwise, store the number of bytes copied in
+   *PCSZ.
+
+   If TAIL is not NULL, store there up to two last bytes copied and
+   their number in *PTAILN. */
+static int
+stream_copy_zerocopy (mu_stream_t dst, mu_stream_t src, mu_off_t size,
+		      mu_off_t *pcsz, char *tail, size_t *ptailn)
+{
+  struct mu_zerocopy_query sq, dq;
+  struct stat sst, dstst;
+  mu_off_t spos, dpos, n = 0;
+  zerocopy_fn fntab[3];
+  int i, nfn = 0;
+  int rc;
+
+  if (size == 0
+      || !(src->flags & MU_STREAM_SEEK)
+      || (dst->flags & MU_STREAM_APPEND))
+    return ENOSYS;
+
+  if (zerocopy_query (src, &sq)
+      || zerocopy_query (dst, &dq)
+      || (dq.flags & MU_ZEROCOPY_RDONLY))
+    return ENOSYS;
+
+  if (fstat (sq.fd, &sst) || fstat (dq.fd, &dstst))
+    return ENOSYS;
+  /* Source data must not change under the source buffer. */
+  if (sst.st_dev == dstst.st_dev && sst.st_ino == dstst.st_ino)
+    return ENOSYS;
+
+  if (mu_stream_seek (src, 0, MU_SEEK_CUR, &spos))
+    return ENOSYS;
+  if (sq.limit != -1)
+    {
+      if (spos >= sq.limit)
+	return ENOSYS;
+      if (size > sq.limit - spos)
+	size = sq.limit - spos;
+    }
+
+  if (S_ISREG (dstst.st_mode) && (dst->flags & MU_STREAM_SEEK))
+    {
+      if (mu_stream_seek (dst, 0, MU_SEEK_CUR, &dpos))
+	return ENOSYS;
+    }
+  else
+    dpos = -1;
+
+  if (sq.map)
+    fntab[nfn++] = zerocopy_map;
+  else if (S_ISREG (sst.st_mode))
+    {
+#ifdef HAVE_COPY_FILE_RANGE
+      if (dpos != -1)
+	fntab[nfn++] = zerocopy_file_range;
+#endif
+#if defined HAVE_SENDFILE && defined HAVE_SYS_SENDFILE_H
+      fntab[nfn++] = zerocopy_sendfile;
+#endif
+    }
+  if (nfn == 0)
+    return ENOSYS;
+
+  /* Write out pending data.  Flushing the source discards its read
+     buffer, so its position is restored below in any case. */
+  rc = mu_stream_flush (src);
+  if (rc)
+    return rc;
+  rc = mu_stream_flush (dst);
+  if (rc)
+    return rc;
+
+  for (i = 0; i < nfn; i++)
+    {
+      rc = fntab[i] (&sq, spos, dq.fd, dpos, size, &n);
+      if (n > 0 || !ZEROCOPY_UNSUPPORTED (rc))
+	break;
+    }
+
+  if (n == 0 && ZEROCOPY_UNSUPPORTED (rc))
+    {
+      /* Nothing was transferred.  Fall back to the copying loop.
+	 Both streams are flushed, which does no harm.  */
+      mu_stream_seek (src, spos, MU_SEEK_SET, NULL);
+      if (dpos != -1)
+	mu_stream_seek (dst, dpos, MU_SEEK_SET, NULL);
+      return ENOSYS;
+    }
+
+  if (tail)
+    {
+      size_t k = n < 2 ? n : 2;
+
+      if (sq.map)
+	memcpy (tail, sq.map + sq.base + spos + n - k, k);
+      else if (pread (sq.fd, tail, k, sq.base + spos + n - k) != k)
+	k = 0;
+      *ptailn = k;
+    }
+
+  /* Update stream positions */
+  mu_stream_seek (src, spos + n, MU_SEEK_SET, NULL);
+  if (dpos != -1)
+    {
+      int res = mu_stream_seek (dst, dpos + n, MU_SEEK_SET, NULL);
+      if (rc == 0)
+	rc = res;
+    }
+  else
+    dst->offset += n;
+
+  *pcsz = n;
+  return rc;
+}
+
+/* Worker function for mu_stream_copy_wcb.  Non-zero TAILCB means that
+   CBF only needs to see the last two bytes of data (see
+   capture_last_char below), which permits zero-copy transfers. */
+static int
+stream_copy (mu_stream_t dst, mu_stream_t src, mu_off_t size,
+	     void (*cbf) (char *, size_t, void *), void *cbd, int tailcb,
+	     mu_off_t *pcsz)
 {
   int status;
   size_t bufsize, n;
@@ -87,6 +340,31 @@ mu_stream_copy_wcb (mu_stream_t dst, mu_stream_t src, mu_off_t size,
 	}
     }
 
+  if (!cbf || tailcb)
+    {
+      char tail[2];
+      size_t tailn = 0;
+
+      status = stream_copy_zerocopy (dst, src, size, &total,
+				     cbf ? tail : NULL, &tailn);
+      if (status != ENOSYS)
+	{
+	  if (cbf && tailn)
+	    cbf (tail, tailn, cbd);
+	  if (status || total == size)
+	    {
+	      if (pcsz)
+		*pcsz = total;
+	      return status;
+	    }
+	  /* Short transfer: copy the rest in the loop below, which
+	     reads through the stream. */
+	  size -= total;
+	}
+      else
+	total = 0;
+    }
+
   bufsize = size;
   if (!bufsize)
     bufsize = STREAMCPY_MAX_BUF_SIZE;
@@ -142,6 +420,21 @@ mu_stream_copy_wcb (mu_stream_t dst, mu_stream_t src, mu_off_t size,
   return status;
 }
 
+/* Copy SIZE bytes from SRC to DST.  If SIZE is 0, copy everything up to
+   EOF.
+   If the callback function CBF is not NULL, it will be called for
+   each buffer-full of data read with the following arguments: pointer to
+   the buffer, length of the data portion in buffer, pointer to the user-
+   supplied callback data (CBD).
+*/
+int
+mu_stream_copy_wcb (mu_stream_t dst, mu_stream_t src, mu_off_t size,
+		    void (*cbf) (char *, size_t, void *), void *cbd,
+		    mu_off_t *pcsz)
+{
+  return stream_copy (dst, src, size, cbf, cbd, 0, pcsz);
+}
+
 /* Copy SIZE bytes from SRC to DST.  If SIZE is 0, copy everything up to
    EOF. */
 int
@@ -177,8 +470,8 @@ mu_stream_copy_nl (mu_stream_t dst, mu_stream_t src, mu_off_t size,
 		   mu_off_t *pcsz)
 {
   int lc = 0;
-  int status = mu_stream_copy_wcb (dst, src, size, capture_last_char, &lc,
-				   pcsz);
+  int status = stream_copy (dst, src, size, capture_last_char, &lc, 1,
+			    pcsz);
   if (status == 0 && lc < 2)
     {
       status = mu_stream_write (dst, "\n\n", 2 - lc, NULL);
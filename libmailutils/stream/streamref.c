@@ -184,6 +184,43 @@ _streamref_ctl (struct _mu_stream *str, int code, int opcode, void *arg)
 	      return EINVAL;
 	    }
 	}
+
+    case MU_IOCTL_ZEROCOPY:
+      if (!arg || opcode != MU_IOCTL_ZEROCOPY_QUERY)
+	return EINVAL;
+      else
+	{
+	  struct mu_zerocopy_query *qp = arg;
+	  int rc;
+
+	  /* The caller is going to read the file directly, so the data
+	     buffered in the transport must reach it first. */
+	  rc = mu_stream_flush (sp->transport);
+	  if (rc)
+	    return rc;
+	  rc = mu_stream_ioctl (sp->transport, code, opcode, arg);
+	  if (rc)
+	    return rc;
+	  if (qp->stream != sp->transport
+	      || sp->transport->statmask || sp->transport->event_cb)
+	    /* Transport is not a raw stream. */
+	    return ENOSYS;
+	  /* Translate the answer to our window of the transport.  Writes
+	     would bypass the transport buffer, hence MU_ZEROCOPY_RDONLY. */
+	  qp->stream = str;
+	  qp->flags |= MU_ZEROCOPY_RDONLY;
+	  qp->base += sp->start;
+	  if (qp->limit != -1)
+	    {
+	      qp->limit -= sp->start;
+	      if (qp->limit < 0)
+		qp->limit = 0;
+	    }
+	  if (sp->end
+	      && (qp->limit == -1 || qp->limit > sp->end - sp->start + 1))
+	    qp->limit = sp->end - sp->start + 1;
+	  return 0;
+	}
     }
   return mu_stream_ioctl (sp->transport, code, opcode, arg);
 }
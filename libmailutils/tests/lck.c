@@ -3,10 +3,11 @@
      lck - mailutils locking test
      
    SYNOPSIS
-     lck [-akpuv?] [-eCOMMAND] [-f SECONDS] [-H SECONDS] [-r N] [-t SECONDS]
-         [--abandon] [--delay=SECONDS] [--expire=SECONDS]
-         [--external[=COMMAND]] [--help] [--hold=SECONDS] [--kernel]
-         [--pid-check] [--retry=N] [--show-config-options] [--unlock]
+     lck [-akpsSuv?] [-eCOMMAND] [-f SECONDS] [-H SECONDS] [-r N]
+         [-t SECONDS] [--abandon] [--child-shared] [--delay=SECONDS]
+         [--expire=SECONDS] [--external[=COMMAND]] [--help]
+         [--hold=SECONDS] [--kernel] [--ofd-check] [--pid-check]
+         [--retry=N] [--shared] [--show-config-options] [--unlock]
          [--usage] [--verbose] FILE
 
    DESCRIPTION
@@ -65,11 +66,22 @@
       -H, --hold=SECONDS
           Hold the lock for that many seconds.
 
+      -S, --child-shared
+          Child takes a shared lock.
+
       Operation modifiers
 
+      -s, --shared
+          Take a shared lock.
+
       -u, --unlock
           Release the existing lock.
 
+      --ofd-check
+          Exit with status 0 if the dotlock locker implements shared
+	  locks using open file description locks, and with status 77
+	  otherwise.
+
       -v, --verbose
           If the lock (or unlock) operation fails, print the error
 	  message on the stderr in addition to exiting with the error
@@ -110,6 +122,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <fcntl.h>
 #include <mailutils/mailutils.h>
 
 static mu_locker_hints_t hints = { .flags = 0 };
@@ -118,6 +131,9 @@ static int pid_check;
 static unsigned hold_time;
 static int abandon_lock;
 static int verbose;
+static int shared_lock;
+static int child_shared_lock;
+static int ofd_check;
 
 static void
 cli_type (struct mu_parseopt *po, struct mu_option *opt, char const *arg)
@@ -173,10 +189,18 @@ struct mu_option options[] = {
   { "abandon",'a', NULL, MU_OPTION_DEFAULT,
     "abandon lock in child",
     mu_c_bool, &abandon_lock },
+  { "child-shared", 'S', NULL, MU_OPTION_DEFAULT,
+    "child takes a shared lock",
+    mu_c_bool, &child_shared_lock },
 
   MU_OPTION_GROUP ("Operation modifiers"),
+  { "shared", 's', NULL, MU_OPTION_DEFAULT,
+    "take a shared lock", mu_c_bool, &shared_lock },
   { "unlock", 'u', NULL, MU_OPTION_DEFAULT,
     "unlock", mu_c_bool, &unlock },
+  { "ofd-check", 0, NULL, MU_OPTION_DEFAULT,
+    "check if shared locks are supported",
+    mu_c_bool, &ofd_check },
   
   { "verbose", 'v', NULL, MU_OPTION_DEFAULT,
     "verbosely list errors", mu_c_bool, &verbose },
@@ -247,6 +271,15 @@ main (int argc, char **argv)
       return MU_DL_EX_ERROR;
     }
   file = argv[0];
+
+  if (ofd_check)
+    {
+#ifdef F_OFD_SETLKW
+      return 0;
+#else
+      return 77;
+#endif
+    }
   
   if (hints.expire_time)
     hints.flags |= MU_LOCKER_FLAG_EXPIRE_TIME;
@@ -284,7 +317,8 @@ main (int argc, char **argv)
 	  fp = fdopen (p[1], "w");
 	  close (p[0]);
 	  
-	  rc = mu_locker_lock (lck);
+	  rc = mu_locker_lock_mode (lck,
+				    child_shared_lock ? mu_lck_shr : mu_lck_exc);
 	  fprintf (fp, "L%d\n", rc);
 	  fclose (fp);
 	  errcheck (rc);
@@ -327,7 +361,7 @@ main (int argc, char **argv)
   if (unlock)
     rc = mu_locker_remove_lock (lck);
   else
-    rc = mu_locker_lock (lck);
+    rc = mu_locker_lock_mode (lck, shared_lock ? mu_lck_shr : mu_lck_exc);
   if (rc && verbose)
     mu_diag_funcall (MU_DIAG_ERROR,
 		     unlock ? "mu_locker_remove_lock" : "mu_locker_lock",
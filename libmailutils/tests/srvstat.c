@@ -0,0 +1,159 @@
+/*
+NAME
+  srvstat - test server statistics
+
+SYNOPSIS
+  srvstat [-fork] ITEM...
+
+DESCRIPTION
+  Creates a statistics table with a single entry "test" and updates
+  it with each ITEM in turn.  Each ITEM has the form USEC[,IN,OUT],
+  where USEC is the duration of the operation in microseconds, and
+  IN and OUT give the number of bytes received and sent.  When all
+  items are processed, the table is formatted on standard output,
+  omitting the "uptime" line.
+
+OPTIONS
+  -fork
+      Update the table from a child process.  This checks that the
+      table is shared between processes.
+
+EXIT CODES
+  0   Success
+  1   Usage error
+  2   Failure
+
+LICENSE
+  GNU Mailutils -- a suite of utilities for electronic mail
+  Copyright (C) 2021 Free Software Foundation, Inc.
+
+  GNU Mailutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3, or (at your option)
+  any later version.
+
+  GNU Mailutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <mailutils/mailutils.h>
+#include <mailutils/server.h>
+
+static void
+update (mu_srvstat_t st, char *arg)
+{
+  unsigned long usec, in = 0, out = 0;
+  char *p;
+
+  usec = strtoul (arg, &p, 10);
+  if (*p == ',')
+    {
+      in = strtoul (p + 1, &p, 10);
+      if (*p != ',')
+	{
+	  mu_error ("malformed item: %s", arg);
+	  exit (1);
+	}
+      out = strtoul (p + 1, &p, 10);
+    }
+  if (*p)
+    {
+      mu_error ("malformed item: %s", arg);
+      exit (1);
+    }
+  MU_ASSERT (mu_srvstat_add (st, "test", usec, in, out));
+}
+
+int
+main (int argc, char **argv)
+{
+  mu_srvstat_t st;
+  mu_stream_t str;
+  char *buf = NULL;
+  size_t size = 0, n;
+  int fork_option = 0;
+  int i;
+
+  mu_set_program_name (argv[0]);
+  mu_stdstream_setup (MU_STDSTREAM_RESET_NONE);
+
+  for (i = 1; i < argc; i++)
+    {
+      if (strcmp (argv[i], "-fork") == 0)
+	fork_option = 1;
+      else if (argv[i][0] == '-')
+	{
+	  mu_error ("unrecognized argument: %s", argv[i]);
+	  return 1;
+	}
+      else
+	break;
+    }
+
+  MU_ASSERT (mu_srvstat_create (&st, "test", 2));
+  MU_ASSERT (mu_srvstat_register (st, "test"));
+  if (mu_srvstat_register (st, "TEST") != EEXIST)
+    {
+      mu_error ("duplicate entry registered");
+      return 2;
+    }
+  if (mu_srvstat_add (st, "none", 1, 0, 0) != MU_ERR_NOENT)
+    {
+      mu_error ("unregistered entry updated");
+      return 2;
+    }
+
+  if (fork_option)
+    {
+      pid_t pid = fork ();
+      int status;
+
+      if (pid == -1)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "fork", NULL, errno);
+	  return 2;
+	}
+      if (pid == 0)
+	{
+	  for (; i < argc; i++)
+	    update (st, argv[i]);
+	  _exit (0);
+	}
+      if (waitpid (pid, &status, 0) != pid
+	  || !WIFEXITED (status) || WEXITSTATUS (status))
+	{
+	  mu_error ("child process failed");
+	  return 2;
+	}
+    }
+  else
+    for (; i < argc; i++)
+      update (st, argv[i]);
+
+  MU_ASSERT (mu_memory_stream_create (&str, MU_STREAM_RDWR));
+  MU_ASSERT (mu_srvstat_format (st, str));
+  MU_ASSERT (mu_stream_seek (str, 0, MU_SEEK_SET, NULL));
+  while (mu_stream_getline (str, &buf, &size, &n) == 0 && n > 0)
+    {
+      if (strncmp (buf, "uptime ", 7))
+	mu_printf ("%s", buf);
+    }
+  free (buf);
+  mu_stream_destroy (&str);
+  mu_srvstat_destroy (&st);
+  return 0;
+}
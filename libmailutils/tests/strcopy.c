@@ -0,0 +1,204 @@
+/*
+NAME
+  strcopy - test mu_stream_copy
+
+SYNOPSIS
+  strcopy [-map] [-nl] [-stat] [-ref=START,END] [-seek=N] [-size=N]
+          [-write=FILE] INPUT [OUTPUT]
+
+DESCRIPTION
+  Copies the contents of INPUT to OUTPUT (by default, to standard
+  output) using mu_stream_copy.  The output file is created if it does
+  not exist.
+
+  The string "<" is written to the output before the copy, and the
+  string ">\n" after it.  These go to the output stream buffer, so that
+  they check that the buffer is flushed before the copy and the stream
+  position is properly updated after it.
+
+  Before copying, the first character of the input is read.  This checks
+  that data read ahead into the input stream buffer are taken into
+  account.
+
+  On success, the number of bytes copied is printed on standard error.
+
+  When both streams are file descriptors, the copy is done by the kernel
+  (zero-copy transfer).  Otherwise, the usual copying loop is used.  The
+  output must be the same in both cases.
+
+OPTIONS
+  -map
+      Open INPUT as a memory-mapped stream.
+
+  -nl
+      Use mu_stream_copy_nl instead of mu_stream_copy.
+
+  -stat
+      Enable statistics on the input stream.  This disables zero-copy
+      transfers.
+
+  -ref=START,END
+      Copy from the abridged stream reference to INPUT, delimited by
+      offsets START and END (inclusive).
+
+  -seek=N
+      Before copying, seek input to offset N.
+
+  -size=N
+      Copy at most N bytes.  By default, everything up to the end of the
+      input is copied.
+
+  -write=FILE
+      Write the contents of INPUT to FILE opened for reading and writing,
+      rewind it and use it as the input.  Data that fit into the stream
+      buffer are not flushed before the copy.
+
+EXIT CODES
+  0   Success
+  1   Usage error
+  2   Failure
+
+LICENSE
+  GNU Mailutils -- a suite of utilities for electronic mail
+  Copyright (C) 2021 Free Software Foundation, Inc.
+
+  GNU Mailutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3, or (at your option)
+  any later version.
+
+  GNU Mailutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mailutils/mailutils.h>
+
+int
+main (int argc, char **argv)
+{
+  int map = 0, nl = 0, stat = 0;
+  mu_off_t start = -1, end = 0, seek = -1, size = 0;
+  mu_off_t n;
+  char *infile, *outfile = NULL, *wrfile = NULL;
+  mu_stream_t in, out;
+  mu_stream_stat_buffer statbuf;
+  char c;
+  int i;
+
+  mu_set_program_name (argv[0]);
+  mu_stdstream_setup (MU_STDSTREAM_RESET_NONE);
+
+  for (i = 1; i < argc; i++)
+    {
+      char *arg = argv[i];
+
+      if (arg[0] != '-')
+	break;
+      if (strcmp (arg, "-map") == 0)
+	map = 1;
+      else if (strcmp (arg, "-nl") == 0)
+	nl = 1;
+      else if (strcmp (arg, "-stat") == 0)
+	stat = 1;
+      else if (strncmp (arg, "-ref=", 5) == 0)
+	{
+	  char *p;
+	  start = strtoul (arg + 5, &p, 10);
+	  if (*p != ',')
+	    {
+	      mu_error ("bad reference: %s", arg);
+	      return 1;
+	    }
+	  end = strtoul (p + 1, NULL, 10);
+	}
+      else if (strncmp (arg, "-seek=", 6) == 0)
+	seek = strtoul (arg + 6, NULL, 10);
+      else if (strncmp (arg, "-size=", 6) == 0)
+	size = strtoul (arg + 6, NULL, 10);
+      else if (strncmp (arg, "-write=", 7) == 0)
+	wrfile = arg + 7;
+      else
+	{
+	  mu_error ("unrecognized argument: %s", arg);
+	  return 1;
+	}
+    }
+
+  switch (argc - i)
+    {
+    case 2:
+      outfile = argv[i+1];
+    case 1:
+      infile = argv[i];
+      break;
+
+    default:
+      mu_error ("usage: %s [options] INPUT [OUTPUT]", mu_program_name);
+      return 1;
+    }
+
+  if (map)
+    MU_ASSERT (mu_mapfile_stream_create (&in, infile, MU_STREAM_READ));
+  else
+    MU_ASSERT (mu_file_stream_create (&in, infile, MU_STREAM_READ));
+  if (wrfile)
+    {
+      mu_stream_t wr;
+      char buf[512];
+      size_t rdn;
+
+      MU_ASSERT (mu_file_stream_create (&wr, wrfile,
+					MU_STREAM_RDWR|MU_STREAM_CREAT));
+      /* Not mu_stream_copy: the data must go through the buffer. */
+      while (mu_stream_read (in, buf, sizeof buf, &rdn) == 0 && rdn > 0)
+	MU_ASSERT (mu_stream_write (wr, buf, rdn, NULL));
+      MU_ASSERT (mu_stream_seek (wr, 0, MU_SEEK_SET, NULL));
+      mu_stream_destroy (&in);
+      in = wr;
+    }
+  if (stat)
+    MU_ASSERT (mu_stream_set_stat (in,
+				   MU_STREAM_STAT_MASK (MU_STREAM_STAT_IN),
+				   statbuf));
+  MU_ASSERT (mu_stream_read (in, &c, 1, NULL));
+
+  if (start != -1)
+    {
+      mu_stream_t ref;
+      MU_ASSERT (mu_streamref_create_abridged (&ref, in, start, end));
+      mu_stream_unref (in);
+      in = ref;
+    }
+  if (seek != -1)
+    MU_ASSERT (mu_stream_seek (in, seek, MU_SEEK_SET, NULL));
+
+  if (outfile)
+    MU_ASSERT (mu_file_stream_create (&out, outfile,
+				      MU_STREAM_WRITE|MU_STREAM_CREAT));
+  else
+    MU_ASSERT (mu_fd_stream_create (&out, NULL, 1, MU_STREAM_WRITE));
+
+  MU_ASSERT (mu_stream_write (out, "<", 1, NULL));
+  if (nl)
+    MU_ASSERT (mu_stream_copy_nl (out, in, size, &n));
+  else
+    MU_ASSERT (mu_stream_copy (out, in, size, &n));
+  MU_ASSERT (mu_stream_write (out, ">\n", 2, NULL));
+  MU_ASSERT (mu_stream_close (out));
+  mu_stream_destroy (&out);
+  mu_stream_destroy (&in);
+
+  fprintf (stderr, "%lu\n", (unsigned long) n);
+  return 0;
+}
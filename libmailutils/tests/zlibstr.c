@@ -0,0 +1,146 @@
+/*
+NAME
+  zlibstr - test deflate compression streams
+
+SYNOPSIS
+  zlibstr [-level=N] [-sync]
+
+DESCRIPTION
+  Reads lines from standard input, compresses them using a write-only
+  deflate stream and decompresses the result using a read-only deflate
+  stream connected to the former via a pipe.  The decompressed data are
+  written to standard output.
+
+  By default, the whole input is compressed and the compressed stream is
+  closed before decompressing it.  When the -sync option is given, the
+  write stream is flushed after each input line and the line is read back
+  from the pipe with a single read call.  This checks that a flush emits
+  all compressed data that are necessary to decode the output written so
+  far, and that read returns as soon as some decompressed data are
+  available.
+
+  Unless -sync is given, the program then prints "smaller" if the
+  compressed size was less than the size of the input.
+
+OPTIONS
+  -level=N
+      Set compression level (0 to 9).
+
+  -sync
+      Flush after each line.
+
+EXIT CODES
+  0   Success
+  1   Usage error
+  2   Failure
+  77  Deflate compression is not supported
+
+LICENSE
+  GNU Mailutils -- a suite of utilities for electronic mail
+  Copyright (C) 2021 Free Software Foundation, Inc.
+
+  GNU Mailutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3, or (at your option)
+  any later version.
+
+  GNU Mailutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <mailutils/mailutils.h>
+
+int
+main (int argc, char **argv)
+{
+  int level = MU_DEFLATE_LEVEL_DEFAULT;
+  int sync = 0;
+  int i, rc;
+  int fd[2];
+  mu_stream_t wr, rd, zwr, zrd;
+  mu_stream_stat_buffer instat, outstat;
+  char *buf = NULL;
+  size_t size = 0, n;
+
+  mu_set_program_name (argv[0]);
+  mu_stdstream_setup (MU_STDSTREAM_RESET_NONE);
+
+  for (i = 1; i < argc; i++)
+    {
+      char *arg = argv[i];
+      if (strncmp (arg, "-level=", 7) == 0)
+	level = atoi (arg + 7);
+      else if (strcmp (arg, "-sync") == 0)
+	sync = 1;
+      else
+	{
+	  mu_error ("unrecognized argument: %s", arg);
+	  return 1;
+	}
+    }
+
+  if (pipe (fd))
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "pipe", NULL, errno);
+      return 2;
+    }
+  MU_ASSERT (mu_fd_stream_create (&wr, NULL, fd[1], MU_STREAM_WRITE));
+  MU_ASSERT (mu_fd_stream_create (&rd, NULL, fd[0], MU_STREAM_READ));
+  mu_stream_set_buffer (rd, mu_buffer_none, 0);
+
+  rc = mu_deflate_stream_create (&zwr, wr, level, MU_STREAM_WRITE);
+  if (rc == ENOSYS)
+    return 77;
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_deflate_stream_create", NULL, rc);
+      return 2;
+    }
+  MU_ASSERT (mu_deflate_stream_create (&zrd, rd, level, MU_STREAM_READ));
+
+  mu_stream_set_stat (zwr, MU_STREAM_STAT_MASK (MU_STREAM_STAT_OUT), instat);
+  mu_stream_set_stat (wr, MU_STREAM_STAT_MASK (MU_STREAM_STAT_OUT), outstat);
+
+  if (sync)
+    {
+      char rbuf[1024];
+
+      while (mu_stream_getline (mu_strin, &buf, &size, &n) == 0 && n > 0)
+	{
+	  MU_ASSERT (mu_stream_write (zwr, buf, n, NULL));
+	  MU_ASSERT (mu_stream_flush (zwr));
+	  MU_ASSERT (mu_stream_read (zrd, rbuf, sizeof rbuf, &n));
+	  MU_ASSERT (mu_stream_write (mu_strout, rbuf, n, NULL));
+	}
+      mu_stream_destroy (&zwr);
+    }
+  else
+    {
+      /* Compress everything first.  The pipe buffer must be large enough
+	 to hold the compressed input. */
+      while (mu_stream_getline (mu_strin, &buf, &size, &n) == 0 && n > 0)
+	MU_ASSERT (mu_stream_write (zwr, buf, n, NULL));
+      MU_ASSERT (mu_stream_close (zwr));
+      mu_stream_destroy (&zwr);
+      MU_ASSERT (mu_stream_copy (mu_strout, zrd, 0, NULL));
+      if (outstat[MU_STREAM_STAT_OUT] < instat[MU_STREAM_STAT_OUT])
+	mu_printf ("smaller\n");
+    }
+  free (buf);
+  mu_stream_destroy (&zrd);
+  mu_stream_destroy (&wr);
+  mu_stream_destroy (&rd);
+  return 0;
+}
@@ -0,0 +1,563 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General
+   Public License along with this library.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+/* Handle cache.
+
+   When MU_DBM_CACHE_READ is set, a database opened for reading is not
+   closed by mu_dbm_close.  Its descriptor is kept in the cache and
+   handed over to the next mu_dbm_open of the same database, unless the
+   database file has been changed or replaced in the meantime (as
+   determined by its device, inode, modification time and size).
+
+   When MU_DBM_CACHE_WRITE is set, a database opened in MU_STREAM_RDWR
+   mode is not opened at all.  Instead, stores and deletes are queued
+   and applied in a single write transaction by mu_dbm_cache_flush,
+   which is called automatically upon exit.  Fetches from such a handle
+   see the queued modifications.
+
+   The cache is per-process: entries inherited from the parent process
+   are abandoned. */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mailutils/types.h>
+#include <mailutils/dbm.h>
+#include <mailutils/errno.h>
+#include <mailutils/error.h>
+#include <mailutils/nls.h>
+#include <mailutils/stream.h>
+#include <mailutils/util.h>
+#include "mudbm.h"
+
+enum cache_opcode
+  {
+    CACHE_STORE,
+    CACHE_DELETE
+  };
+
+struct cache_op
+{
+  struct cache_op *next;
+  enum cache_opcode code;
+  struct mu_dbm_datum key;
+  struct mu_dbm_datum content;
+};
+
+struct cache_entry
+{
+  struct cache_entry *next;
+  struct _mu_dbm_file file;  /* Real database; file.db_descr is the cached
+				read descriptor, if any */
+  int in_use;                /* The descriptor is lent to a handle */
+  int by_fd;                 /* Validate by fstat, because the database
+				name cannot be stat'ed */
+  dev_t dev;                 /* Attributes of the database file at */
+  ino_t ino;                 /* the time the descriptor was opened */
+  time_t mtime;
+  off_t size;
+  int mode;                  /* Mode for deferred write open */
+  struct cache_op *op_head, *op_tail; /* Deferred modifications */
+};
+
+static int cache_flags;
+static pid_t cache_pid;
+static struct cache_entry *cache_head;
+static int cache_onexit_set;
+
+static struct mu_dbm_impl _mu_dbm_deferred;
+
+void
+mu_dbm_cache_set_flags (int flags)
+{
+  cache_flags = flags;
+}
+
+int
+mu_dbm_cache_get_flags (void)
+{
+  return cache_flags;
+}
+
+/* Abandon entries inherited from the parent process.  Descriptors are
+   not closed, because closing them can release locks held by the
+   parent. */
+static void
+cache_check_pid (void)
+{
+  pid_t pid = getpid ();
+
+  if (cache_pid != pid)
+    {
+      struct cache_entry *ent;
+
+      for (ent = cache_head; ent; ent = ent->next)
+	{
+	  ent->file.db_descr = NULL;
+	  ent->in_use = 0;
+	  ent->op_head = ent->op_tail = NULL;
+	}
+      cache_pid = pid;
+    }
+}
+
+static struct cache_entry *
+cache_lookup (mu_dbm_file_t db)
+{
+  struct cache_entry *ent;
+
+  for (ent = cache_head; ent; ent = ent->next)
+    if (ent->file.db_sys == db->db_sys
+	&& strcmp (ent->file.db_name, db->db_name) == 0)
+      return ent;
+
+  ent = calloc (1, sizeof (*ent));
+  if (!ent)
+    return NULL;
+  ent->file = *db;
+  ent->file.db_name = strdup (db->db_name);
+  if (!ent->file.db_name)
+    {
+      free (ent);
+      return NULL;
+    }
+  ent->file.db_descr = NULL;
+  ent->file.db_cache = NULL;
+  ent->next = cache_head;
+  cache_head = ent;
+  return ent;
+}
+
+static void
+cache_close_descr (struct cache_entry *ent)
+{
+  if (ent->file.db_descr && !ent->in_use)
+    ent->file.db_sys->_dbm_close (&ent->file);
+}
+
+/* Record attributes of the database file just opened. Return 0 on
+   success, and -1 if the descriptor cannot be cached. */
+static int
+cache_stat (struct cache_entry *ent)
+{
+  struct stat st;
+  int fd;
+
+  if (stat (ent->file.db_name, &st) == 0)
+    ent->by_fd = 0;
+  else if (ent->file.db_sys->_dbm_get_fd
+	   && ent->file.db_sys->_dbm_get_fd (&ent->file, &fd, NULL) == 0
+	   && fstat (fd, &st) == 0)
+    ent->by_fd = 1;
+  else
+    return -1;
+  ent->dev = st.st_dev;
+  ent->ino = st.st_ino;
+  ent->mtime = st.st_mtime;
+  ent->size = st.st_size;
+  return 0;
+}
+
+/* Return true if the database file has not changed since its
+   descriptor was cached. */
+static int
+cache_valid (struct cache_entry *ent)
+{
+  struct stat st;
+  int fd;
+
+  if (ent->by_fd)
+    {
+      if (ent->file.db_sys->_dbm_get_fd (&ent->file, &fd, NULL)
+	  || fstat (fd, &st))
+	return 0;
+    }
+  else if (stat (ent->file.db_name, &st))
+    return 0;
+  return ent->dev == st.st_dev
+         && ent->ino == st.st_ino
+         && ent->mtime == st.st_mtime
+         && ent->size == st.st_size;
+}
+
+/* Make sure ENT has a valid read descriptor.  Return 0 on success,
+   and -1 if it has been opened, but cannot be cached.  In the latter
+   case, the descriptor is left in ENT->file.db_descr. */
+static int
+cache_read_descr (struct cache_entry *ent, int mode)
+{
+  int rc;
+
+  if (ent->file.db_descr)
+    {
+      /* A descriptor lent to a handle cannot be replaced */
+      if (ent->in_use || cache_valid (ent))
+	return 0;
+      cache_close_descr (ent);
+    }
+  rc = ent->file.db_sys->_dbm_open (&ent->file, MU_STREAM_READ, mode);
+  if (rc)
+    return rc;
+  if (cache_stat (ent))
+    return -1;
+  return 0;
+}
+
+static void
+cache_op_free (struct cache_op *op)
+{
+  free (op->key.mu_dptr);
+  free (op->content.mu_dptr);
+  free (op);
+}
+
+static int
+cache_flush_entry (struct cache_entry *ent)
+{
+  struct cache_op *op;
+  struct mu_dbm_impl *sys = ent->file.db_sys;
+  int rc;
+
+  if (!ent->op_head)
+    return 0;
+  if (ent->in_use)
+    return EBUSY;
+  /* Drop the read descriptor: the database is about to be modified,
+     and some engines won't open a writer while a reader is active. */
+  cache_close_descr (ent);
+
+  rc = sys->_dbm_open (&ent->file, MU_STREAM_RDWR, ent->mode);
+  if (rc)
+    mu_error (_("cannot open database %s: %s"), ent->file.db_name,
+	      rc == MU_ERR_FAILURE ? sys->_dbm_strerror (&ent->file)
+	                           : mu_strerror (rc));
+
+  while ((op = ent->op_head) != NULL)
+    {
+      ent->op_head = op->next;
+      if (rc == 0)
+	{
+	  int res;
+
+	  if (op->code == CACHE_STORE)
+	    res = sys->_dbm_store (&ent->file, &op->key, &op->content, 1);
+	  else
+	    {
+	      res = sys->_dbm_delete (&ent->file, &op->key);
+	      if (res == MU_ERR_NOENT)
+		res = 0;
+	    }
+	  if (res)
+	    mu_error (_("%s: cannot apply deferred update: %s"),
+		      ent->file.db_name,
+		      res == MU_ERR_FAILURE ? sys->_dbm_strerror (&ent->file)
+		                            : mu_strerror (res));
+	}
+      cache_op_free (op);
+    }
+  ent->op_tail = NULL;
+
+  if (rc == 0)
+    sys->_dbm_close (&ent->file);
+  return rc;
+}
+
+int
+mu_dbm_cache_flush (void)
+{
+  struct cache_entry *ent;
+  int status = 0;
+
+  cache_check_pid ();
+  for (ent = cache_head; ent; ent = ent->next)
+    {
+      int rc = cache_flush_entry (ent);
+      if (rc && !status)
+	status = rc;
+    }
+  return status;
+}
+
+void
+mu_dbm_cache_release (void)
+{
+  struct cache_entry *ent;
+
+  cache_check_pid ();
+  for (ent = cache_head; ent; ent = ent->next)
+    cache_close_descr (ent);
+}
+
+static void
+cache_onexit (void *data)
+{
+  mu_dbm_cache_flush ();
+  mu_dbm_cache_release ();
+}
+
+int
+_mu_dbm_cache_open (mu_dbm_file_t db, int flags, int mode)
+{
+  struct cache_entry *ent;
+  int rc;
+
+  cache_check_pid ();
+
+  if (flags == MU_STREAM_RDWR && (cache_flags & MU_DBM_CACHE_WRITE)
+      && db->db_sys->_dbm_store && db->db_sys->_dbm_delete)
+    {
+      ent = cache_lookup (db);
+      if (!ent)
+	return ENOMEM;
+      ent->mode = mode;
+      db->db_cache = ent;
+      db->db_descr = ent;
+      db->db_sys = &_mu_dbm_deferred;
+      return 0;
+    }
+
+  if (flags != MU_STREAM_READ || !(cache_flags & MU_DBM_CACHE_READ))
+    {
+      /* Uncached open.  Apply any deferred modifications and close
+	 the read descriptor first, so that they don't interfere with
+	 it. */
+      for (ent = cache_head; ent; ent = ent->next)
+	if (ent->file.db_sys == db->db_sys
+	    && strcmp (ent->file.db_name, db->db_name) == 0)
+	  {
+	    cache_flush_entry (ent);
+	    cache_close_descr (ent);
+	    break;
+	  }
+      return db->db_sys->_dbm_open (db, flags, mode);
+    }
+
+  ent = cache_lookup (db);
+  if (!ent || ent->in_use)
+    return db->db_sys->_dbm_open (db, flags, mode);
+  cache_flush_entry (ent);
+
+  rc = cache_read_descr (ent, mode);
+  if (rc == -1)
+    {
+      /* Pass the descriptor to the caller as if it were opened
+	 directly. */
+      db->db_descr = ent->file.db_descr;
+      ent->file.db_descr = NULL;
+      return 0;
+    }
+  else if (rc)
+    {
+      db->db_errno = ent->file.db_errno;
+      return rc;
+    }
+
+  ent->in_use = 1;
+  db->db_descr = ent->file.db_descr;
+  db->db_cache = ent;
+  return 0;
+}
+
+int
+_mu_dbm_cache_close (mu_dbm_file_t db)
+{
+  struct cache_entry *ent = db->db_cache;
+
+  if (db->db_sys == &_mu_dbm_deferred)
+    db->db_sys = ent->file.db_sys;
+  else
+    ent->in_use = 0;
+  db->db_descr = NULL;
+  db->db_cache = NULL;
+  return 0;
+}
+
+/* Deferred write implementation */
+
+static struct cache_op *
+deferred_lookup (struct cache_entry *ent, struct mu_dbm_datum const *key)
+{
+  struct cache_op *op, *found = NULL;
+
+  for (op = ent->op_head; op; op = op->next)
+    if (op->key.mu_dsize == key->mu_dsize
+	&& memcmp (op->key.mu_dptr, key->mu_dptr, key->mu_dsize) == 0)
+      found = op;
+  return found;
+}
+
+static int
+_deferred_fetch (mu_dbm_file_t db, struct mu_dbm_datum const *key,
+		 struct mu_dbm_datum *ret)
+{
+  struct cache_entry *ent = db->db_descr;
+  struct cache_op *op;
+  int rc;
+
+  op = deferred_lookup (ent, key);
+  if (op)
+    {
+      char *p;
+
+      if (op->code == CACHE_DELETE)
+	return MU_ERR_NOENT;
+      p = malloc (op->content.mu_dsize);
+      if (!p)
+	return ENOMEM;
+      memcpy (p, op->content.mu_dptr, op->content.mu_dsize);
+      mu_dbm_datum_free (ret);
+      ret->mu_dptr = p;
+      ret->mu_dsize = op->content.mu_dsize;
+      ret->mu_data = p;
+      ret->mu_sys = &_mu_dbm_deferred;
+      return 0;
+    }
+
+  rc = cache_read_descr (ent, ent->mode);
+  if (rc == -1)
+    {
+      rc = ent->file.db_sys->_dbm_fetch (&ent->file, key, ret);
+      ent->file.db_sys->_dbm_close (&ent->file);
+      return rc;
+    }
+  else if (rc)
+    {
+      /* A database that does not exist yet has no keys */
+      if (access (ent->file.db_name, F_OK))
+	return MU_ERR_NOENT;
+      return rc;
+    }
+  return ent->file.db_sys->_dbm_fetch (&ent->file, key, ret);
+}
+
+static int
+deferred_exists (mu_dbm_file_t db, struct mu_dbm_datum const *key)
+{
+  struct mu_dbm_datum data;
+  int rc;
+
+  memset (&data, 0, sizeof data);
+  rc = _deferred_fetch (db, key, &data);
+  if (rc == 0)
+    mu_dbm_datum_free (&data);
+  return rc;
+}
+
+static int
+deferred_add (struct cache_entry *ent, enum cache_opcode code,
+	      struct mu_dbm_datum const *key,
+	      struct mu_dbm_datum const *contents)
+{
+  struct cache_op *op;
+
+  op = calloc (1, sizeof (*op));
+  if (!op)
+    return ENOMEM;
+  op->code = code;
+  op->key.mu_dptr = malloc (key->mu_dsize);
+  if (!op->key.mu_dptr)
+    {
+      cache_op_free (op);
+      return ENOMEM;
+    }
+  memcpy (op->key.mu_dptr, key->mu_dptr, key->mu_dsize);
+  op->key.mu_dsize = key->mu_dsize;
+  if (contents)
+    {
+      op->content.mu_dptr = malloc (contents->mu_dsize);
+      if (!op->content.mu_dptr)
+	{
+	  cache_op_free (op);
+	  return ENOMEM;
+	}
+      memcpy (op->content.mu_dptr, contents->mu_dptr, contents->mu_dsize);
+      op->content.mu_dsize = contents->mu_dsize;
+    }
+
+  if (ent->op_tail)
+    ent->op_tail->next = op;
+  else
+    ent->op_head = op;
+  ent->op_tail = op;
+
+  if (!cache_onexit_set)
+    {
+      mu_onexit (cache_onexit, NULL);
+      cache_onexit_set = 1;
+    }
+  return 0;
+}
+
+static int
+_deferred_store (mu_dbm_file_t db,
+		 struct mu_dbm_datum const *key,
+		 struct mu_dbm_datum const *contents,
+		 int replace)
+{
+  if (!replace)
+    {
+      int rc = deferred_exists (db, key);
+      if (rc == 0)
+	return MU_ERR_EXISTS;
+      else if (rc != MU_ERR_NOENT)
+	return rc;
+    }
+  return deferred_add (db->db_descr, CACHE_STORE, key, contents);
+}
+
+static int
+_deferred_delete (mu_dbm_file_t db, struct mu_dbm_datum const *key)
+{
+  int rc = deferred_exists (db, key);
+  if (rc)
+    return rc;
+  return deferred_add (db->db_descr, CACHE_DELETE, key, NULL);
+}
+
+static void
+_deferred_datum_free (struct mu_dbm_datum *datum)
+{
+  free (datum->mu_data);
+  datum->mu_dptr = NULL;
+}
+
+static char const *
+_deferred_strerror (mu_dbm_file_t db)
+{
+  struct cache_entry *ent = db->db_descr;
+  return ent->file.db_sys->_dbm_strerror (&ent->file);
+}
+
+static struct mu_dbm_impl _mu_dbm_deferred = {
+  "deferred",
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  _deferred_fetch,
+  _deferred_store,
+  _deferred_delete,
+  NULL,
+  NULL,
+  _deferred_datum_free,
+  _deferred_strerror
+};
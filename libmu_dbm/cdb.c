@@ -0,0 +1,949 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General
+   Public License along with this library.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <mailutils/types.h>
+#include <mailutils/dbm.h>
+#include <mailutils/util.h>
+#include <mailutils/errno.h>
+#include <mailutils/error.h>
+#include <mailutils/stream.h>
+#include <mailutils/io.h>
+#include <mailutils/nls.h>
+#include <mailutils/locker.h>
+#include "mudbm.h"
+
+#if defined(WITH_CDB)
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+
+/* Constant database.
+
+   The database file is never modified in place.  Readers map it into
+   memory, so that lookups require neither locking nor system calls,
+   and the pages are shared among all processes using the file.
+
+   The file layout follows that of D. J. Bernstein's cdb:
+
+     header   CDB_MAGIC followed by CDB_NTAB table references, each
+              being a pair of 32-bit numbers: offset of the table and
+              number of slots in it;
+     records  each record consists of 32-bit key length, 32-bit data
+              length, key and data;
+     tables   each slot is a pair of 32-bit numbers: hash value of
+              the key and offset of the record.  Zero offset marks an
+              empty slot.
+
+   All numbers are stored in little-endian byte order.  A key with
+   hash value H is looked up in the table number H % CDB_NTAB,
+   starting from the slot (H / CDB_NTAB) % NSLOTS and proceeding
+   until an empty slot is found.
+
+   When the database is opened for writing, it is locked exclusively,
+   so that concurrent writers don't lose each other's updates, and its
+   records are kept in memory.  When it is closed, they are written to
+   a temporary file, which is then atomically renamed to the database
+   name.  Thus readers always see a consistent version of the database
+   and need no locking. */
+
+#define CDB_MAGIC      "MUCDB01\n"
+#define CDB_MAGIC_LEN  (sizeof (CDB_MAGIC) - 1)
+#define CDB_NTAB       256
+#define CDB_HDRSIZE    (CDB_MAGIC_LEN + CDB_NTAB * 8)
+#define CDB_RECHDR     8
+
+#define CDB_EBADFILE   (-1)     /* db_errno value: malformed database */
+
+struct cdb_record
+{
+  uint32_t hash;            /* Hash value of the key */
+  int deleted;              /* Record is deleted */
+  size_t klen;              /* Key length */
+  size_t dlen;              /* Data length */
+  char *buf;                /* Key immediately followed by data */
+};
+
+struct cdb_writer
+{
+  struct cdb_record *recv;  /* Records */
+  size_t recc;              /* Number of records used */
+  size_t recmax;            /* Number of records allocated */
+  size_t *slotv;            /* Hash table: indices in recv plus 1 */
+  size_t slotc;             /* Size of slotv (power of 2) */
+  char *tmpname;            /* Name of the temporary file */
+  int dirty;                /* Database was modified */
+};
+
+struct cdb_descr
+{
+  int fd;                   /* Database file, or temporary file for writer */
+  unsigned char *map;       /* Mapped database (reader) */
+  size_t size;              /* Size of the mapping */
+  size_t iter;              /* Iterator: record offset or index */
+  struct cdb_writer *wr;    /* Writer, if the database is writable */
+  int dbfd;                 /* Database file (writer) */
+  mu_locker_t locker;       /* Database lock (writer) */
+};
+
+static uint32_t
+cdb_hash (const char *p, size_t len)
+{
+  uint32_t h = 5381;
+
+  while (len--)
+    h = ((h << 5) + h) ^ (unsigned char) *p++;
+  return h;
+}
+
+static inline uint32_t
+cdb_get32 (unsigned char const *p)
+{
+  return (uint32_t) p[0]
+         | ((uint32_t) p[1] << 8)
+         | ((uint32_t) p[2] << 16)
+         | ((uint32_t) p[3] << 24);
+}
+
+static inline void
+cdb_put32 (unsigned char *p, uint32_t v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = (v >> 24) & 0xff;
+}
+
+static int
+_cdb_file_safety (mu_dbm_file_t db, int mode, uid_t owner)
+{
+  return mu_file_safety_check (db->db_name, mode, owner, NULL);
+}
+
+int
+_cdb_get_fd (mu_dbm_file_t db, int *pag, int *dir)
+{
+  struct cdb_descr *cd = db->db_descr;
+  int fd = cd->wr ? cd->dbfd : cd->fd;
+
+  if (fd == -1)
+    return MU_ERR_NOENT;
+  *pag = fd;
+  if (dir)
+    *dir = *pag;
+  return 0;
+}
+
+/* Reader */
+
+/* Offset of the first byte past the records */
+static size_t
+cdb_records_end (struct cdb_descr *cd)
+{
+  return cdb_get32 (cd->map + CDB_MAGIC_LEN);
+}
+
+static int
+cdb_map (mu_dbm_file_t db, struct cdb_descr *cd)
+{
+  struct stat st;
+  size_t i;
+
+  if (fstat (cd->fd, &st))
+    {
+      db->db_errno.n = errno;
+      return MU_ERR_FAILURE;
+    }
+  if (st.st_size < (off_t) CDB_HDRSIZE
+      || (uint64_t) st.st_size > UINT32_MAX)
+    {
+      db->db_errno.n = CDB_EBADFILE;
+      return MU_ERR_FAILURE;
+    }
+  cd->size = st.st_size;
+  cd->map = mmap (NULL, cd->size, PROT_READ, MAP_SHARED, cd->fd, 0);
+  if (cd->map == MAP_FAILED)
+    {
+      cd->map = NULL;
+      db->db_errno.n = errno;
+      return MU_ERR_FAILURE;
+    }
+
+  if (memcmp (cd->map, CDB_MAGIC, CDB_MAGIC_LEN))
+    goto bad;
+  if (cdb_records_end (cd) < CDB_HDRSIZE || cdb_records_end (cd) > cd->size)
+    goto bad;
+  for (i = 0; i < CDB_NTAB; i++)
+    {
+      unsigned char *p = cd->map + CDB_MAGIC_LEN + i * 8;
+      uint64_t pos = cdb_get32 (p);
+      uint64_t n = cdb_get32 (p + 4);
+
+      if (pos + n * 8 > cd->size)
+	goto bad;
+    }
+  return 0;
+
+ bad:
+  munmap (cd->map, cd->size);
+  cd->map = NULL;
+  db->db_errno.n = CDB_EBADFILE;
+  return MU_ERR_FAILURE;
+}
+
+static void
+cdb_unmap (struct cdb_descr *cd)
+{
+  if (cd->map)
+    {
+      munmap (cd->map, cd->size);
+      cd->map = NULL;
+    }
+}
+
+/* Get the record at offset POS.  Return 0 on success and -1 if
+   the record does not fit in the file. */
+static int
+cdb_record_at (struct cdb_descr *cd, size_t pos,
+	       struct cdb_record *rec)
+{
+  size_t avail;
+
+  if (pos > cd->size || cd->size - pos < CDB_RECHDR)
+    return -1;
+  avail = cd->size - pos - CDB_RECHDR;
+  rec->klen = cdb_get32 (cd->map + pos);
+  rec->dlen = cdb_get32 (cd->map + pos + 4);
+  if (rec->klen > avail || rec->dlen > avail - rec->klen)
+    return -1;
+  rec->buf = (char *) cd->map + pos + CDB_RECHDR;
+  return 0;
+}
+
+static int
+cdb_map_lookup (mu_dbm_file_t db, struct cdb_descr *cd,
+		char const *key, size_t klen, struct cdb_record *rec)
+{
+  uint32_t h = cdb_hash (key, klen);
+  unsigned char *tab = cd->map + CDB_MAGIC_LEN + (h % CDB_NTAB) * 8;
+  size_t pos = cdb_get32 (tab);
+  size_t nslots = cdb_get32 (tab + 4);
+  size_t i, slot;
+
+  if (nslots == 0)
+    return MU_ERR_NOENT;
+  slot = (h / CDB_NTAB) % nslots;
+  for (i = 0; i < nslots; i++)
+    {
+      unsigned char *p = cd->map + pos + slot * 8;
+      size_t rpos = cdb_get32 (p + 4);
+
+      if (rpos == 0)
+	break;
+      if (cdb_get32 (p) == h)
+	{
+	  if (cdb_record_at (cd, rpos, rec))
+	    {
+	      db->db_errno.n = CDB_EBADFILE;
+	      return MU_ERR_FAILURE;
+	    }
+	  if (rec->klen == klen && memcmp (rec->buf, key, klen) == 0)
+	    return 0;
+	}
+      if (++slot == nslots)
+	slot = 0;
+    }
+  return MU_ERR_NOENT;
+}
+
+/* Writer */
+
+static int
+cdb_writer_rehash (struct cdb_writer *wr)
+{
+  size_t n = wr->slotc ? wr->slotc * 2 : 64;
+  size_t *slotv;
+  size_t i;
+
+  slotv = calloc (n, sizeof (slotv[0]));
+  if (!slotv)
+    return ENOMEM;
+  for (i = 0; i < wr->recc; i++)
+    {
+      size_t slot = wr->recv[i].hash & (n - 1);
+      while (slotv[slot])
+	slot = (slot + 1) & (n - 1);
+      slotv[slot] = i + 1;
+    }
+  free (wr->slotv);
+  wr->slotv = slotv;
+  wr->slotc = n;
+  return 0;
+}
+
+/* Look up KEY in the writer.  Return pointer to the hash table slot
+   holding it, or to the empty slot where it should be placed. */
+static size_t *
+cdb_writer_slot (struct cdb_writer *wr, char const *key, size_t klen,
+		 uint32_t h)
+{
+  size_t slot = h & (wr->slotc - 1);
+
+  while (wr->slotv[slot])
+    {
+      struct cdb_record *rec = &wr->recv[wr->slotv[slot] - 1];
+      if (rec->hash == h && rec->klen == klen
+	  && memcmp (rec->buf, key, klen) == 0)
+	break;
+      slot = (slot + 1) & (wr->slotc - 1);
+    }
+  return &wr->slotv[slot];
+}
+
+static struct cdb_record *
+cdb_writer_lookup (struct cdb_writer *wr, char const *key, size_t klen)
+{
+  size_t *slot;
+
+  if (wr->slotc == 0)
+    return NULL;
+  slot = cdb_writer_slot (wr, key, klen, cdb_hash (key, klen));
+  if (*slot == 0 || wr->recv[*slot - 1].deleted)
+    return NULL;
+  return &wr->recv[*slot - 1];
+}
+
+static int
+cdb_writer_store (struct cdb_writer *wr,
+		  char const *key, size_t klen,
+		  char const *data, size_t dlen,
+		  int replace)
+{
+  uint32_t h = cdb_hash (key, klen);
+  size_t *slot;
+  struct cdb_record *rec;
+  char *buf;
+
+  if (wr->recc * 2 >= wr->slotc)
+    {
+      int rc = cdb_writer_rehash (wr);
+      if (rc)
+	return rc;
+    }
+
+  slot = cdb_writer_slot (wr, key, klen, h);
+  if (*slot)
+    {
+      rec = &wr->recv[*slot - 1];
+      if (!rec->deleted && !replace)
+	return MU_ERR_EXISTS;
+      buf = realloc (rec->buf, klen + dlen);
+      if (!buf)
+	return ENOMEM;
+    }
+  else
+    {
+      if (wr->recc == wr->recmax)
+	{
+	  size_t n = wr->recmax ? wr->recmax * 2 : 64;
+	  struct cdb_record *p = realloc (wr->recv, n * sizeof (p[0]));
+	  if (!p)
+	    return ENOMEM;
+	  wr->recv = p;
+	  wr->recmax = n;
+	}
+      buf = malloc (klen + dlen);
+      if (!buf)
+	return ENOMEM;
+      memcpy (buf, key, klen);
+      rec = &wr->recv[wr->recc];
+      rec->hash = h;
+      rec->klen = klen;
+      *slot = ++wr->recc;
+    }
+  memcpy (buf + klen, data, dlen);
+  rec->buf = buf;
+  rec->dlen = dlen;
+  rec->deleted = 0;
+  wr->dirty = 1;
+  return 0;
+}
+
+static void
+cdb_writer_free (struct cdb_writer *wr)
+{
+  size_t i;
+
+  for (i = 0; i < wr->recc; i++)
+    free (wr->recv[i].buf);
+  free (wr->recv);
+  free (wr->slotv);
+  free (wr->tmpname);
+  free (wr);
+}
+
+/* Load records from the existing database file into the writer */
+static int
+cdb_writer_load (mu_dbm_file_t db, struct cdb_descr *cd)
+{
+  struct cdb_descr rd;
+  size_t pos, end;
+  int rc;
+
+  rd.fd = cd->dbfd;
+  rc = cdb_map (db, &rd);
+  if (rc == 0)
+    {
+      end = cdb_records_end (&rd);
+      for (pos = CDB_HDRSIZE; pos < end; )
+	{
+	  struct cdb_record rec;
+
+	  if (cdb_record_at (&rd, pos, &rec))
+	    {
+	      db->db_errno.n = CDB_EBADFILE;
+	      rc = MU_ERR_FAILURE;
+	      break;
+	    }
+	  rc = cdb_writer_store (cd->wr, rec.buf, rec.klen,
+				 rec.buf + rec.klen, rec.dlen, 1);
+	  if (rc)
+	    break;
+	  pos += CDB_RECHDR + rec.klen + rec.dlen;
+	}
+      cdb_unmap (&rd);
+      cd->wr->dirty = 0;
+    }
+  return rc;
+}
+
+/* Create an empty database DB, unless it already exists. */
+static int
+cdb_create_empty (mu_dbm_file_t db, int mode)
+{
+  char *tmpname;
+  unsigned char hdr[CDB_HDRSIZE];
+  size_t i;
+  mode_t um;
+  ssize_t n;
+  int fd, rc;
+
+  rc = mu_asprintf (&tmpname, "%s.XXXXXX", db->db_name);
+  if (rc)
+    return rc;
+  fd = mkstemp (tmpname);
+  if (fd == -1)
+    {
+      db->db_errno.n = errno;
+      free (tmpname);
+      return MU_ERR_FAILURE;
+    }
+  um = umask (0);
+  umask (um);
+  fchmod (fd, mode & ~um);
+  
+  memcpy (hdr, CDB_MAGIC, CDB_MAGIC_LEN);
+  for (i = 0; i < CDB_NTAB; i++)
+    {
+      cdb_put32 (hdr + CDB_MAGIC_LEN + i * 8, CDB_HDRSIZE);
+      cdb_put32 (hdr + CDB_MAGIC_LEN + i * 8 + 4, 0);
+    }
+  n = write (fd, hdr, sizeof hdr);
+  if (n == -1)
+    rc = errno;
+  else if (n != sizeof hdr)
+    rc = EIO; /* Short write does not set errno */
+  else if (fsync (fd))
+    rc = errno;
+  /* Use link, so that a database created in the meantime by another
+     process is not overwritten. */
+  else if (link (tmpname, db->db_name) && errno != EEXIST)
+    rc = errno;
+  unlink (tmpname);
+  close (fd);
+  free (tmpname);
+  if (rc)
+    {
+      db->db_errno.n = rc;
+      rc = MU_ERR_FAILURE;
+    }
+  return rc;
+}
+
+/* Write the database to the temporary file and rename it to the
+   database name. */
+static int
+cdb_writer_commit (mu_dbm_file_t db, struct cdb_descr *cd)
+{
+  struct cdb_writer *wr = cd->wr;
+  unsigned char hdr[CDB_HDRSIZE];
+  unsigned char buf[CDB_RECHDR];
+  size_t count[CDB_NTAB], start[CDB_NTAB];
+  uint32_t *offv = NULL;
+  size_t *order = NULL;
+  uint32_t *slots = NULL;
+  size_t maxslots = 0;
+  uint64_t pos;
+  size_t i, t, n;
+  mu_stream_t str = NULL;
+  int fd = cd->fd;
+  struct stat st;
+  int rc;
+
+  /* Group records by tables and compute their offsets */
+  memset (count, 0, sizeof count);
+  pos = CDB_HDRSIZE;
+  for (i = 0; i < wr->recc; i++)
+    if (!wr->recv[i].deleted)
+      {
+	count[wr->recv[i].hash % CDB_NTAB]++;
+	pos += CDB_RECHDR + wr->recv[i].klen + wr->recv[i].dlen;
+      }
+  n = 0;
+  for (t = 0; t < CDB_NTAB; t++)
+    {
+      start[t] = n;
+      n += count[t];
+      pos += count[t] * 2 * 8;
+      if (count[t] * 2 > maxslots)
+	maxslots = count[t] * 2;
+    }
+  if (pos > UINT32_MAX)
+    {
+      db->db_errno.n = EFBIG;
+      return MU_ERR_FAILURE;
+    }
+
+  offv = calloc (wr->recc + 1, sizeof (offv[0]));
+  order = calloc (n + 1, sizeof (order[0]));
+  slots = calloc (maxslots * 2 + 1, sizeof (slots[0]));
+  if (!offv || !order || !slots)
+    {
+      rc = ENOMEM;
+      goto end;
+    }
+
+  rc = mu_fd_stream_create (&str, wr->tmpname, fd,
+			    MU_STREAM_WRITE | MU_STREAM_SEEK);
+  if (rc)
+    goto end;
+  cd->fd = -1;
+
+  /* Records */
+  memset (hdr, 0, sizeof hdr);
+  rc = mu_stream_write (str, hdr, sizeof hdr, NULL);
+  pos = CDB_HDRSIZE;
+  for (i = 0; rc == 0 && i < wr->recc; i++)
+    {
+      struct cdb_record *rec = &wr->recv[i];
+
+      if (rec->deleted)
+	continue;
+      t = rec->hash % CDB_NTAB;
+      order[start[t]++] = i;
+      offv[i] = pos;
+      cdb_put32 (buf, rec->klen);
+      cdb_put32 (buf + 4, rec->dlen);
+      rc = mu_stream_write (str, buf, CDB_RECHDR, NULL);
+      if (rc == 0)
+	rc = mu_stream_write (str, rec->buf, rec->klen + rec->dlen, NULL);
+      pos += CDB_RECHDR + rec->klen + rec->dlen;
+    }
+
+  /* Hash tables */
+  memcpy (hdr, CDB_MAGIC, CDB_MAGIC_LEN);
+  for (t = 0, n = 0; rc == 0 && t < CDB_NTAB; t++)
+    {
+      size_t nslots = count[t] * 2;
+
+      cdb_put32 (hdr + CDB_MAGIC_LEN + t * 8, pos);
+      cdb_put32 (hdr + CDB_MAGIC_LEN + t * 8 + 4, nslots);
+      if (nslots == 0)
+	continue;
+      memset (slots, 0, nslots * 2 * sizeof (slots[0]));
+      for (i = 0; i < count[t]; i++, n++)
+	{
+	  struct cdb_record *rec = &wr->recv[order[n]];
+	  size_t slot = (rec->hash / CDB_NTAB) % nslots;
+
+	  while (slots[2 * slot + 1])
+	    if (++slot == nslots)
+	      slot = 0;
+	  slots[2 * slot] = rec->hash;
+	  slots[2 * slot + 1] = offv[order[n]];
+	}
+      for (i = 0; rc == 0 && i < nslots; i++)
+	{
+	  cdb_put32 (buf, slots[2 * i]);
+	  cdb_put32 (buf + 4, slots[2 * i + 1]);
+	  rc = mu_stream_write (str, buf, 8, NULL);
+	}
+      pos += nslots * 8;
+    }
+
+  /* Header */
+  if (rc == 0)
+    rc = mu_stream_seek (str, 0, MU_SEEK_SET, NULL);
+  if (rc == 0)
+    rc = mu_stream_write (str, hdr, sizeof hdr, NULL);
+  if (rc == 0)
+    rc = mu_stream_flush (str);
+  if (rc == 0 && fstat (cd->dbfd, &st) == 0)
+    {
+      /* Preserve the ownership and mode of the database.  Failure to
+	 do so is not fatal. */
+      if (fchown (fd, st.st_uid, st.st_gid))
+	{
+	  /* Most probably we are not privileged. */
+	}
+      fchmod (fd, st.st_mode & 07777);
+    }
+  if (rc == 0 && fsync (fd))
+    rc = errno;
+  if (rc == 0 && rename (wr->tmpname, db->db_name))
+    rc = errno;
+
+ end:
+  mu_stream_destroy (&str);
+  free (offv);
+  free (order);
+  free (slots);
+  if (rc && rc != MU_ERR_FAILURE)
+    {
+      db->db_errno.n = rc;
+      rc = MU_ERR_FAILURE;
+    }
+  return rc;
+}
+
+static void
+cdb_unlock (struct cdb_descr *cd)
+{
+  if (cd->dbfd != -1)
+    {
+      close (cd->dbfd);
+      cd->dbfd = -1;
+    }
+  if (cd->locker)
+    {
+      mu_locker_unlock (cd->locker);
+      mu_locker_destroy (&cd->locker);
+    }
+}
+
+/* Lock the database and prepare the writer. */
+static int
+cdb_open_writer (mu_dbm_file_t db, struct cdb_descr *cd, int flags, int mode)
+{
+  mu_locker_hints_t hints = { .flags = MU_LOCKER_FLAG_RETRY };
+  int rc;
+
+  if (access (db->db_name, F_OK) && errno == ENOENT)
+    {
+      rc = cdb_create_empty (db, mode);
+      if (rc)
+	return rc;
+    }
+  
+  rc = mu_locker_create_ext (&cd->locker, db->db_name, &hints);
+  if (rc)
+    return rc;
+  rc = mu_locker_lock_mode (cd->locker, mu_lck_exc);
+  switch (rc)
+    {
+    case 0:
+      break;
+
+    case EACCES:
+      mu_locker_destroy (&cd->locker);
+      break;
+      
+    default:
+      mu_locker_destroy (&cd->locker);
+      return rc;
+    }
+
+  cd->dbfd = open (db->db_name, O_RDONLY);
+  if (cd->dbfd == -1)
+    {
+      db->db_errno.n = errno;
+      return MU_ERR_FAILURE;
+    }
+  
+  cd->wr = calloc (1, sizeof (*cd->wr));
+  if (!cd->wr)
+    return ENOMEM;
+  rc = mu_asprintf (&cd->wr->tmpname, "%s.XXXXXX", db->db_name);
+  if (rc)
+    return rc;
+  cd->fd = mkstemp (cd->wr->tmpname);
+  if (cd->fd == -1)
+    {
+      db->db_errno.n = errno;
+      return MU_ERR_FAILURE;
+    }
+  if (flags == MU_STREAM_RDWR)
+    return cdb_writer_load (db, cd);
+  cd->wr->dirty = 1;
+  return 0;
+}
+
+static int
+_cdb_open (mu_dbm_file_t db, int flags, int mode)
+{
+  struct cdb_descr *cd;
+  int rc;
+
+  switch (flags)
+    {
+    case MU_STREAM_CREAT:
+    case MU_STREAM_READ:
+    case MU_STREAM_RDWR:
+      break;
+
+    default:
+      return EINVAL;
+    }
+
+  cd = calloc (1, sizeof (*cd));
+  if (!cd)
+    return ENOMEM;
+  cd->fd = -1;
+  cd->dbfd = -1;
+
+  if (flags == MU_STREAM_READ)
+    {
+      cd->fd = open (db->db_name, O_RDONLY);
+      if (cd->fd == -1)
+	{
+	  db->db_errno.n = errno;
+	  rc = MU_ERR_FAILURE;
+	}
+      else
+	rc = cdb_map (db, cd);
+    }
+  else
+    rc = cdb_open_writer (db, cd, flags, mode);
+
+  if (rc)
+    {
+      if (cd->fd != -1)
+	{
+	  if (cd->wr)
+	    unlink (cd->wr->tmpname);
+	  close (cd->fd);
+	}
+      cdb_unmap (cd);
+      if (cd->wr)
+	cdb_writer_free (cd->wr);
+      cdb_unlock (cd);
+      free (cd);
+      return rc;
+    }
+
+  db->db_descr = cd;
+  return 0;
+}
+
+static int
+_cdb_close (mu_dbm_file_t db)
+{
+  int rc = 0;
+
+  if (db->db_descr)
+    {
+      struct cdb_descr *cd = db->db_descr;
+
+      cdb_unmap (cd);
+      if (cd->wr)
+	{
+	  if (cd->wr->dirty)
+	    rc = cdb_writer_commit (db, cd);
+	  if (!cd->wr->dirty || rc)
+	    unlink (cd->wr->tmpname);
+	  cdb_writer_free (cd->wr);
+	}
+      if (cd->fd != -1)
+	close (cd->fd);
+      cdb_unlock (cd);
+      free (cd);
+      db->db_descr = NULL;
+    }
+  return rc;
+}
+
+static int
+_cdb_conv_datum (mu_dbm_file_t db, struct mu_dbm_datum *ret,
+		 char const *ptr, size_t size)
+{
+  ret->mu_dptr = malloc (size ? size : 1);
+  if (!ret->mu_dptr)
+    return errno;
+  memcpy (ret->mu_dptr, ptr, size);
+  ret->mu_dsize = size;
+  ret->mu_sys = db->db_sys;
+  return 0;
+}
+
+static int
+_cdb_fetch (mu_dbm_file_t db, struct mu_dbm_datum const *key,
+	    struct mu_dbm_datum *ret)
+{
+  struct cdb_descr *cd = db->db_descr;
+  struct cdb_record rec, *rp;
+  int rc;
+
+  if (cd->wr)
+    {
+      rp = cdb_writer_lookup (cd->wr, key->mu_dptr, key->mu_dsize);
+      if (!rp)
+	return MU_ERR_NOENT;
+    }
+  else
+    {
+      rc = cdb_map_lookup (db, cd, key->mu_dptr, key->mu_dsize, &rec);
+      if (rc)
+	return rc;
+      rp = &rec;
+    }
+  mu_dbm_datum_free (ret);
+  return _cdb_conv_datum (db, ret, rp->buf + rp->klen, rp->dlen);
+}
+
+static int
+_cdb_store (mu_dbm_file_t db,
+	    struct mu_dbm_datum const *key,
+	    struct mu_dbm_datum const *contents,
+	    int replace)
+{
+  struct cdb_descr *cd = db->db_descr;
+  int rc;
+
+  if (!cd->wr)
+    return MU_ERR_BADOP;
+  rc = cdb_writer_store (cd->wr, key->mu_dptr, key->mu_dsize,
+			 contents->mu_dptr, contents->mu_dsize, replace);
+  if (rc == ENOMEM)
+    {
+      db->db_errno.n = rc;
+      rc = MU_ERR_FAILURE;
+    }
+  return rc;
+}
+
+static int
+_cdb_delete (mu_dbm_file_t db, struct mu_dbm_datum const *key)
+{
+  struct cdb_descr *cd = db->db_descr;
+  struct cdb_record *rec;
+
+  if (!cd->wr)
+    return MU_ERR_BADOP;
+  rec = cdb_writer_lookup (cd->wr, key->mu_dptr, key->mu_dsize);
+  if (!rec)
+    return MU_ERR_NOENT;
+  rec->deleted = 1;
+  cd->wr->dirty = 1;
+  return 0;
+}
+
+/* Return the next key in iteration order */
+static int
+cdb_iterate (mu_dbm_file_t db, struct mu_dbm_datum *ret)
+{
+  struct cdb_descr *cd = db->db_descr;
+  struct cdb_record rec, *rp;
+
+  if (cd->wr)
+    {
+      do
+	{
+	  if (cd->iter >= cd->wr->recc)
+	    return MU_ERR_NOENT;
+	  rp = &cd->wr->recv[cd->iter++];
+	}
+      while (rp->deleted);
+    }
+  else
+    {
+      if (cd->iter >= cdb_records_end (cd))
+	return MU_ERR_NOENT;
+      if (cdb_record_at (cd, cd->iter, &rec))
+	{
+	  db->db_errno.n = CDB_EBADFILE;
+	  return MU_ERR_FAILURE;
+	}
+      cd->iter += CDB_RECHDR + rec.klen + rec.dlen;
+      rp = &rec;
+    }
+  mu_dbm_datum_free (ret);
+  return _cdb_conv_datum (db, ret, rp->buf, rp->klen);
+}
+
+static int
+_cdb_firstkey (mu_dbm_file_t db, struct mu_dbm_datum *ret)
+{
+  struct cdb_descr *cd = db->db_descr;
+
+  cd->iter = cd->wr ? 0 : CDB_HDRSIZE;
+  return cdb_iterate (db, ret);
+}
+
+static int
+_cdb_nextkey (mu_dbm_file_t db, struct mu_dbm_datum *ret)
+{
+  return cdb_iterate (db, ret);
+}
+
+static void
+_cdb_datum_free (struct mu_dbm_datum *datum)
+{
+  free (datum->mu_dptr);
+}
+
+static char const *
+_cdb_strerror (mu_dbm_file_t db)
+{
+  if (db->db_errno.n == CDB_EBADFILE)
+    return _("malformed constant database file");
+  return strerror (db->db_errno.n);
+}
+
+struct mu_dbm_impl _mu_dbm_cdb = {
+  "cdb",
+  _cdb_file_safety,
+  _cdb_get_fd,
+  _cdb_open,
+  _cdb_close,
+  _cdb_fetch,
+  _cdb_store,
+  _cdb_delete,
+  _cdb_firstkey,
+  _cdb_nextkey,
+  _cdb_datum_free,
+  _cdb_strerror
+};
+#endif
@@ -27,6 +27,8 @@
 int
 mu_dbm_close (mu_dbm_file_t db)
 {
+  if (db && db->db_cache)
+    return _mu_dbm_cache_close (db);
   DBMSYSCK (db, _dbm_close);
   if (!db->db_descr)
     return 0;
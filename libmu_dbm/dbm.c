@@ -85,6 +85,9 @@ mu_dbm_init ()
 #endif
 #ifdef WITH_KYOTOCABINET
   mu_dbm_register (&_mu_dbm_kyotocabinet);
+#endif
+#ifdef WITH_CDB
+  mu_dbm_register (&_mu_dbm_cdb);
 #endif
   if (!mu_dbm_hint)
     {
@@ -43,7 +43,13 @@ extern struct mu_dbm_impl _mu_dbm_tokyocabinet;
 #ifdef WITH_KYOTOCABINET
 extern struct mu_dbm_impl _mu_dbm_kyotocabinet;
 #endif
+#ifdef WITH_CDB
+extern struct mu_dbm_impl _mu_dbm_cdb;
+#endif
 
 void _mu_dbm_init (void);
 
+int _mu_dbm_cache_open (mu_dbm_file_t db, int flags, int mode);
+int _mu_dbm_cache_close (mu_dbm_file_t db);
+
 
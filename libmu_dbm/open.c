@@ -31,6 +31,8 @@ mu_dbm_open (mu_dbm_file_t db, int flags, int mode)
     return EINVAL;
   if (!db->db_sys || !db->db_sys->_dbm_open)
     return ENOSYS;
+  if (mu_dbm_cache_get_flags ())
+    return _mu_dbm_cache_open (db, flags, mode);
   return db->db_sys->_dbm_open (db, flags, mode);
 }
 
@@ -0,0 +1,307 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   This library is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Test tool for DBM databases.
+
+   Usage: dbmop [-d URL] [--cache=read|write|all] CMD [; CMD...]
+
+   Exits with code 77 if the database type is not supported. */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <mailutils/mailutils.h>
+#include <mailutils/dbm.h>
+#include "tesh.h"
+
+struct interp_env
+{
+  char *dbname;
+  mu_dbm_file_t db;
+};
+
+static void
+dbmop_error (struct interp_env *ienv, char const *func, int rc)
+{
+  mu_error ("%s: %s", func,
+	    rc == MU_ERR_FAILURE ? mu_dbm_strerror (ienv->db)
+	                         : mu_strerror (rc));
+}
+
+static void
+datum_init (struct mu_dbm_datum *d, char *str)
+{
+  memset (d, 0, sizeof *d);
+  if (str)
+    {
+      d->mu_dptr = str;
+      d->mu_dsize = strlen (str);
+    }
+}
+
+static void
+datum_print (struct mu_dbm_datum *d)
+{
+  mu_stream_write (mu_strout, d->mu_dptr, d->mu_dsize, NULL);
+}
+
+/* open [MODE] */
+static int
+dbmop_open (int argc, char **argv, mu_assoc_t options, void *env)
+{
+  struct interp_env *ienv = env;
+  int flags = MU_STREAM_READ;
+  int rc;
+
+  if (argc > 1)
+    {
+      if (strcmp (argv[1], "read") == 0)
+	flags = MU_STREAM_READ;
+      else if (strcmp (argv[1], "rdwr") == 0)
+	flags = MU_STREAM_RDWR;
+      else if (strcmp (argv[1], "create") == 0)
+	flags = MU_STREAM_CREAT;
+      else
+	{
+	  mu_error ("unknown mode: %s", argv[1]);
+	  return 0;
+	}
+    }
+  rc = mu_dbm_open (ienv->db, flags, 0644);
+  if (rc)
+    dbmop_error (ienv, "mu_dbm_open", rc);
+  return 0;
+}
+
+static int
+dbmop_close (int argc, char **argv, mu_assoc_t options, void *env)
+{
+  struct interp_env *ienv = env;
+  int rc = mu_dbm_close (ienv->db);
+  if (rc)
+    dbmop_error (ienv, "mu_dbm_close", rc);
+  return 0;
+}
+
+/* store [-replace] KEY VALUE */
+static int
+dbmop_store (int argc, char **argv, mu_assoc_t options, void *env)
+{
+  struct interp_env *ienv = env;
+  struct mu_dbm_datum key, content;
+  int rc;
+
+  datum_init (&key, argv[1]);
+  datum_init (&content, argv[2]);
+  rc = mu_dbm_store (ienv->db, &key, &content,
+		     mu_assoc_lookup (options, "replace", NULL) == 0);
+  if (rc)
+    dbmop_error (ienv, "mu_dbm_store", rc);
+  return 0;
+}
+
+static int
+dbmop_fetch (int argc, char **argv, mu_assoc_t options, void *env)
+{
+  struct interp_env *ienv = env;
+  struct mu_dbm_datum key, content;
+  int rc;
+
+  datum_init (&key, argv[1]);
+  datum_init (&content, NULL);
+  rc = mu_dbm_fetch (ienv->db, &key, &content);
+  if (rc)
+    dbmop_error (ienv, "mu_dbm_fetch", rc);
+  else
+    {
+      datum_print (&content);
+      mu_printf ("\n");
+      mu_dbm_datum_free (&content);
+    }
+  return 0;
+}
+
+static int
+dbmop_delete (int argc, char **argv, mu_assoc_t options, void *env)
+{
+  struct interp_env *ienv = env;
+  struct mu_dbm_datum key;
+  int rc;
+
+  datum_init (&key, argv[1]);
+  rc = mu_dbm_delete (ienv->db, &key);
+  if (rc)
+    dbmop_error (ienv, "mu_dbm_delete", rc);
+  return 0;
+}
+
+/* Print all records in iteration order */
+static int
+dbmop_list (int argc, char **argv, mu_assoc_t options, void *env)
+{
+  struct interp_env *ienv = env;
+  struct mu_dbm_datum key, content;
+  int rc;
+
+  datum_init (&key, NULL);
+  for (rc = mu_dbm_firstkey (ienv->db, &key); rc == 0;
+       rc = mu_dbm_nextkey (ienv->db, &key))
+    {
+      datum_init (&content, NULL);
+      rc = mu_dbm_fetch (ienv->db, &key, &content);
+      if (rc)
+	{
+	  dbmop_error (ienv, "mu_dbm_fetch", rc);
+	  break;
+	}
+      datum_print (&key);
+      mu_printf (": ");
+      datum_print (&content);
+      mu_printf ("\n");
+      mu_dbm_datum_free (&content);
+    }
+  if (rc != MU_ERR_NOENT)
+    dbmop_error (ienv, "mu_dbm_nextkey", rc);
+  mu_dbm_datum_free (&key);
+  return 0;
+}
+
+/* xstore KEY VALUE
+   Store the record from a separate process, bypassing the cache. */
+static int
+dbmop_xstore (int argc, char **argv, mu_assoc_t options, void *env)
+{
+  struct interp_env *ienv = env;
+  pid_t pid;
+  int status;
+
+  mu_stream_flush (mu_strout);
+  pid = fork ();
+  if (pid == -1)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "fork", NULL, errno);
+      return 0;
+    }
+  if (pid == 0)
+    {
+      mu_dbm_file_t db;
+      struct mu_dbm_datum key, content;
+      int rc;
+
+      mu_dbm_cache_set_flags (0);
+      MU_ASSERT (mu_dbm_create (ienv->dbname, &db, MU_FILE_SAFETY_NONE));
+      MU_ASSERT (mu_dbm_open (db, MU_STREAM_RDWR, 0644));
+      datum_init (&key, argv[1]);
+      datum_init (&content, argv[2]);
+      rc = mu_dbm_store (db, &key, &content, 1);
+      if (rc == 0)
+	rc = mu_dbm_close (db);
+      _exit (rc != 0);
+    }
+  if (waitpid (pid, &status, 0) != pid
+      || !WIFEXITED (status) || WEXITSTATUS (status))
+    mu_error ("writer process failed");
+  return 0;
+}
+
+static int
+dbmop_flush (int argc, char **argv, mu_assoc_t options, void *env)
+{
+  int rc = mu_dbm_cache_flush ();
+  if (rc)
+    mu_diag_funcall (MU_DIAG_ERROR, "mu_dbm_cache_flush", NULL, rc);
+  return 0;
+}
+
+static int
+dbmop_release (int argc, char **argv, mu_assoc_t options, void *env)
+{
+  mu_dbm_cache_release ();
+  return 0;
+}
+
+static struct mu_tesh_command commands[] = {
+  { "open",    "[read|rdwr|create]", dbmop_open },
+  { "close",   "", dbmop_close },
+  { "store",   "[-replace] KEY VALUE", dbmop_store },
+  { "fetch",   "KEY", dbmop_fetch },
+  { "delete",  "KEY", dbmop_delete },
+  { "list",    "", dbmop_list },
+  { "xstore",  "KEY VALUE", dbmop_xstore },
+  { "flush",   "", dbmop_flush },
+  { "release", "", dbmop_release },
+  { NULL }
+};
+
+int
+main (int argc, char **argv)
+{
+  struct interp_env env = { "test.db", NULL };
+  char *cache = NULL;
+  int rc;
+  struct mu_option options[] = {
+    { "database", 'd', "URL", MU_OPTION_DEFAULT,
+      "use this database",
+      mu_c_string, &env.dbname },
+    { "cache", 'c', "read|write|all", MU_OPTION_DEFAULT,
+      "enable DBM cache",
+      mu_c_string, &cache },
+    MU_OPTION_END
+  };
+
+  mu_tesh_init (argv[0]);
+  mu_cli_simple (argc, argv,
+                 MU_CLI_OPTION_OPTIONS, options,
+		 MU_CLI_OPTION_PROG_DOC, "test tool for DBM databases",
+		 MU_CLI_OPTION_PROG_ARGS, "CMD [; CMD ;...]",
+		 MU_CLI_OPTION_EX_USAGE, 2,
+		 MU_CLI_OPTION_RETURN_ARGC, &argc,
+                 MU_CLI_OPTION_RETURN_ARGV, &argv,
+		 MU_CLI_OPTION_END);
+
+  if (cache)
+    {
+      if (strcmp (cache, "read") == 0)
+	mu_dbm_cache_set_flags (MU_DBM_CACHE_READ);
+      else if (strcmp (cache, "write") == 0)
+	mu_dbm_cache_set_flags (MU_DBM_CACHE_WRITE);
+      else if (strcmp (cache, "all") == 0)
+	mu_dbm_cache_set_flags (MU_DBM_CACHE_READ|MU_DBM_CACHE_WRITE);
+      else
+	{
+	  mu_error ("bad cache mode: %s", cache);
+	  return 2;
+	}
+    }
+
+  rc = mu_dbm_create (env.dbname, &env.db, MU_FILE_SAFETY_NONE);
+  if (rc == MU_ERR_NOENT)
+    return 77;
+  else if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_dbm_create", env.dbname, rc);
+      return 1;
+    }
+
+  mu_tesh_read_and_eval (argc, argv, commands, &env);
+  mu_dbm_close (env.db);
+  mu_dbm_destroy (&env.db);
+  return 0;
+}
@@ -564,5 +564,13 @@ mu_i_sv_register_standard_actions (mu_sieve_machine_t mach)
 			    NULL, 0);
   mu_sieve_register_action (mach, "redirect", sieve_action_redirect, 
 			    fileinto_args, NULL, 0);
+
+  /* Fileinto, reject and redirect need the entire message.  The rest
+     don't access it at all. */
+  mu_sieve_registry_set_access (mach, "stop", mu_sieve_record_action, 0);
+  mu_sieve_registry_set_access (mach, "keep", mu_sieve_record_action, 0);
+  mu_sieve_registry_set_access (mach, "discard", mu_sieve_record_action, 0);
+  mu_sieve_registry_set_access (mach, "fileinto", mu_sieve_record_action,
+				MU_SIEVE_ACCESS_ALL);
 }
 
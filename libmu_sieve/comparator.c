@@ -61,8 +61,15 @@ mu_sieve_comparator_lookup (mu_sieve_machine_t mach, const char *name,
   return NULL;
 }
 
+static int i_octet_is (mu_sieve_machine_t mach,
+		       mu_sieve_string_t *pattern, const char *text);
+static int i_octet_contains (mu_sieve_machine_t mach,
+			     mu_sieve_string_t *pattern, const char *text);
 static int i_ascii_casemap_is (mu_sieve_machine_t mach,
 			       mu_sieve_string_t *pattern, const char *text);
+static int i_ascii_casemap_contains (mu_sieve_machine_t mach,
+				     mu_sieve_string_t *pattern,
+				     const char *text);
 
 mu_sieve_comparator_t
 mu_sieve_get_comparator (mu_sieve_machine_t mach)
@@ -72,41 +79,293 @@ mu_sieve_get_comparator (mu_sieve_machine_t mach)
   return mach->comparator;
 }
 
+/* Compiled patterns */
+
+/* A wildcard pattern is split at each '*' into segments.  The first
+   segment is anchored at the beginning of the text, the last one at its
+   end, and the ones in between are searched for left to right. */
+struct glob_segment
+{
+  char *str;         /* Segment text (case-folded, if necessary) */
+  char *any;         /* If not NULL, any[i] is 1 if str[i] stands for '?' */
+  size_t len;        /* Segment length */
+};
+
+struct glob
+{
+  int icase;                    /* Ignore case */
+  size_t segc;                  /* Number of segments */
+  struct glob_segment *segv;    /* Segments */
+};
+
+/* Aho-Corasick automaton state */
+struct ac_state
+{
+  size_t child;      /* First child state, 0 if none */
+  size_t sibling;    /* Next sibling state, 0 if none */
+  size_t fail;       /* Failure transition */
+  unsigned char c;   /* Input character leading to this state */
+  int final;         /* This state or one of its suffixes ends a key */
+};
+
+/* Precompiled list of keys for :is and :contains */
+struct mu_i_sv_keyset
+{
+  mu_sieve_comparator_t comp;   /* Comparator this set was built for */
+  int icase;                    /* Ignore case */
+  /* :is - open-addressed hash table */
+  char **tab;
+  size_t size;                  /* Table size (a power of two) */
+  /* :contains - Aho-Corasick automaton */
+  struct ac_state *state;       /* States; 0 is the root */
+  size_t nstates;
+};
+
+enum pattern_type
+  {
+    pattern_regex,
+    pattern_glob,
+    pattern_keyset
+  };
+
+struct pattern
+{
+  enum pattern_type type;
+  union
+  {
+    regex_t rx;
+    struct glob glob;
+    struct mu_i_sv_keyset keyset;
+  } v;
+};
+
+void
+mu_i_sv_pattern_free (void *ptr)
+{
+  struct pattern *pat = ptr;
+  /* Everything except the regex internals is allocated in the memory
+     pool of the machine */
+  if (pat->type == pattern_regex)
+    regfree (&pat->v.rx);
+}
+
+static struct pattern *
+pattern_alloc (mu_sieve_machine_t mach, mu_sieve_string_t *string,
+	       enum pattern_type type)
+{
+  struct pattern *pat = string->rx;
+
+  if (pat)
+    {
+      mu_i_sv_pattern_free (pat);
+      memset (pat, 0, sizeof (*pat));
+    }
+  else
+    pat = mu_sieve_calloc (mach, 1, sizeof (*pat));
+  pat->type = type;
+  string->rx = pat;
+  return pat;
+}
+
 /* Compile time support */
 static void
 compile_pattern (mu_sieve_machine_t mach, mu_sieve_string_t *pattern, int flags)
 {
   int rc;
-  regex_t *preg;
+  struct pattern *pat;
   char *str;
 
   str = mu_sieve_string_get (mach, pattern);
   
-  if (pattern->rx)
-    {
-      if (!pattern->changed)
-	return;
-      preg = pattern->rx;
-      regfree (preg);
-    }
-  else
-    preg = mu_sieve_malloc (mach, sizeof (*preg));
-  rc = regcomp (preg, str, REG_EXTENDED | flags);
+  if (pattern->rx && !pattern->changed)
+    return;
+  pat = pattern_alloc (mach, pattern, pattern_regex);
+  rc = regcomp (&pat->v.rx, str, REG_EXTENDED | flags);
   if (rc)
     {
-      size_t size = regerror (rc, preg, NULL, 0);
+      size_t size = regerror (rc, &pat->v.rx, NULL, 0);
       char *errbuf = malloc (size + 1);
       if (errbuf)
 	{
-	  regerror (rc, preg, errbuf, size);
+	  regerror (rc, &pat->v.rx, errbuf, size);
 	  mu_sieve_error (mach, _("regex error: %s"), errbuf);
 	  free (errbuf);
 	}
       else
 	mu_sieve_error (mach, _("regex error"));
+      pattern->rx = NULL;
       mu_sieve_abort (mach);
     }
-  pattern->rx = preg;
+}
+
+/* Return the length of the UTF-8 character starting at S.  Invalid
+   sequences are treated as single octets. */
+static size_t
+glob_charlen (char const *s)
+{
+  unsigned char c = *s;
+  size_t len, i;
+  
+  if (c < 0xc2)
+    return 1;
+  else if (c < 0xe0)
+    len = 2;
+  else if (c < 0xf0)
+    len = 3;
+  else if (c < 0xf8)
+    len = 4;
+  else
+    return 1;
+  for (i = 1; i < len && s[i]; i++)
+    ;
+  return i;
+}
+
+/* Try to compile STR into a native wildcard matcher.  Return 0 on
+   success and 1 if the pattern uses character classes, which are only
+   supported by the regex-based implementation. */
+static int
+glob_compile (mu_sieve_machine_t mach, struct glob *glob, char const *str,
+	      int icase)
+{
+  size_t len = strlen (str);
+  char *text, *any;
+  size_t i, n, segc;
+  struct glob_segment *seg;
+  
+  /* Count segments and check for unsupported constructs */
+  segc = 1;
+  for (i = 0; str[i]; i++)
+    {
+      if (str[i] == '\\')
+	{
+	  if (str[i+1] && strchr ("?*[", str[i+1]))
+	    i++;
+	}
+      else if (str[i] == '[')
+	return 1;
+      else if (str[i] == '*')
+	{
+	  while (str[i+1] == '*')
+	    i++;
+	  segc++;
+	}
+    }
+
+  glob->icase = icase;
+  glob->segc = segc;
+  glob->segv = mu_sieve_calloc (mach, segc, sizeof (glob->segv[0]));
+  text = mu_sieve_malloc (mach, len + 1);
+  any = mu_sieve_calloc (mach, len + 1, 1);
+
+  seg = glob->segv;
+  seg->str = text;
+  seg->any = NULL;
+  n = 0;
+  for (i = 0; str[i]; i++)
+    {
+      int c = (unsigned char) str[i];
+      
+      switch (c)
+	{
+	case '\\':
+	  if (str[i+1] && strchr ("?*[", str[i+1]))
+	    c = (unsigned char) str[++i];
+	  break;
+
+	case '?':
+	  seg->any = any;
+	  any[n] = 1;
+	  break;
+	  
+	case '*':
+	  while (str[i+1] == '*')
+	    i++;
+	  seg->len = n;
+	  text += n;
+	  any += n;
+	  n = 0;
+	  seg++;
+	  seg->str = text;
+	  seg->any = NULL;
+	  continue;
+	}
+      text[n++] = icase ? mu_tolower (c) : c;
+    }
+  seg->len = n;
+  return 0;
+}
+
+/* Match segment SEG against the beginning of TEXT.  On success, store
+   the pointer past the matched part in *ENDP. */
+static int
+glob_segment_match (struct glob_segment *seg, int icase, char const *text,
+		    char const **endp)
+{
+  size_t i;
+
+  for (i = 0; i < seg->len; i++)
+    {
+      if (seg->any && seg->any[i])
+	{
+	  if (*text == 0)
+	    return 0;
+	  text += glob_charlen (text);
+	}
+      else
+	{
+	  int c = (unsigned char) *text;
+	  if ((icase ? mu_tolower (c) : c) != (unsigned char) seg->str[i])
+	    return 0;
+	  text++;
+	}
+    }
+  *endp = text;
+  return 1;
+}
+
+static int
+glob_match (struct glob *glob, char const *text)
+{
+  struct glob_segment *seg;
+  char const *end;
+  size_t i;
+
+  if (!glob_segment_match (&glob->segv[0], glob->icase, text, &text))
+    return 0;
+  if (glob->segc == 1)
+    return *text == 0;
+
+  for (i = 1; i < glob->segc - 1; i++)
+    {
+      seg = &glob->segv[i];
+      while (!glob_segment_match (seg, glob->icase, text, &end))
+	{
+	  if (*text == 0)
+	    return 0;
+	  text += glob_charlen (text);
+	}
+      text = end;
+    }
+
+  seg = &glob->segv[glob->segc - 1];
+  if (!seg->any)
+    {
+      /* Fixed-length segment: compare with the tail of the text */
+      size_t len = strlen (text);
+      if (len < seg->len)
+	return 0;
+      return glob_segment_match (seg, glob->icase, text + len - seg->len,
+				 &end);
+    }
+  for (;;)
+    {
+      if (glob_segment_match (seg, glob->icase, text, &end) && *end == 0)
+	return 1;
+      if (*text == 0)
+	return 0;
+      text += glob_charlen (text);
+    }
 }
 
 static void
@@ -114,30 +373,219 @@ compile_wildcard (mu_sieve_machine_t mach, mu_sieve_string_t *pattern,
 		  int flags)
 {
   int rc;
-  regex_t *preg;
+  struct pattern *pat;
   char *str;
 
   str = mu_sieve_string_get (mach, pattern);
   
-  if (pattern->rx)
+  if (pattern->rx && !pattern->changed)
+    return;
+
+  /* Match variables require the positions of the wildcards, which are
+     provided only by the regex-based implementation */
+  if (!mu_sieve_has_variables (mach))
     {
-      if (!pattern->changed)
+      pat = pattern_alloc (mach, pattern, pattern_glob);
+      if (glob_compile (mach, &pat->v.glob, str, flags & MU_GLOBF_ICASE) == 0)
 	return;
-      preg = pattern->rx;
-      regfree (preg);
     }
   else
-    preg = mu_sieve_malloc (mach, sizeof (*preg));
-
-  if (mu_sieve_has_variables (mach))
     flags |= MU_GLOBF_SUB;
-  rc = mu_glob_compile (preg, str, flags);
+  
+  pat = pattern_alloc (mach, pattern, pattern_regex);
+  rc = mu_glob_compile (&pat->v.rx, str, flags);
   if (rc)
     {
+      pattern->rx = NULL;
       mu_sieve_error (mach, _("can't compile pattern"));
       mu_sieve_abort (mach);
     }
-  pattern->rx = preg;
+}
+
+/* Key sets */
+
+static size_t
+keyset_hash (char const *str, int icase)
+{
+  size_t h = 2166136261u;
+
+  for (; *str; str++)
+    {
+      int c = (unsigned char) *str;
+      h ^= icase ? mu_tolower (c) : c;
+      h *= 16777619;
+    }
+  return h;
+}
+
+static char **
+keyset_lookup (struct mu_i_sv_keyset *ks, char const *str)
+{
+  size_t i;
+
+  for (i = keyset_hash (str, ks->icase) & (ks->size - 1);
+       ks->tab[i];
+       i = (i + 1) & (ks->size - 1))
+    {
+      if ((ks->icase ? mu_c_strcasecmp (ks->tab[i], str)
+	             : strcmp (ks->tab[i], str)) == 0)
+	break;
+    }
+  return &ks->tab[i];
+}
+
+static size_t
+ac_goto (struct mu_i_sv_keyset *ks, size_t s, int c)
+{
+  for (s = ks->state[s].child; s; s = ks->state[s].sibling)
+    if (ks->state[s].c == c)
+      break;
+  return s;
+}
+
+static void
+ac_build (mu_sieve_machine_t mach, struct mu_i_sv_keyset *ks,
+	  mu_sieve_slice_t keys)
+{
+  size_t i, n, max = 1;
+  size_t *queue;
+  size_t head, tail;
+  
+  for (i = 0; i < keys->count; i++)
+    max += strlen (mu_sieve_string (mach, keys, i));
+  ks->state = mu_sieve_calloc (mach, max, sizeof (ks->state[0]));
+  ks->nstates = 1;
+
+  /* Build the trie */
+  for (i = 0; i < keys->count; i++)
+    {
+      unsigned char const *p =
+	(unsigned char const *) mu_sieve_string (mach, keys, i);
+      size_t s = 0;
+
+      for (; *p; p++)
+	{
+	  int c = ks->icase ? mu_tolower (*p) : *p;
+	  size_t t = ac_goto (ks, s, c);
+	  if (!t)
+	    {
+	      t = ks->nstates++;
+	      ks->state[t].c = c;
+	      ks->state[t].sibling = ks->state[s].child;
+	      ks->state[s].child = t;
+	    }
+	  s = t;
+	}
+      ks->state[s].final = 1;
+    }
+
+  /* Compute failure transitions in breadth-first order */
+  queue = mu_sieve_calloc (mach, ks->nstates, sizeof (queue[0]));
+  head = tail = 0;
+  for (n = ks->state[0].child; n; n = ks->state[n].sibling)
+    {
+      ks->state[n].fail = 0;
+      queue[tail++] = n;
+    }
+  while (head < tail)
+    {
+      size_t s = queue[head++];
+      
+      for (n = ks->state[s].child; n; n = ks->state[n].sibling)
+	{
+	  size_t f = ks->state[s].fail;
+	  size_t t;
+	  
+	  while ((t = ac_goto (ks, f, ks->state[n].c)) == 0 && f)
+	    f = ks->state[f].fail;
+	  ks->state[n].fail = t;
+	  if (ks->state[t].final)
+	    ks->state[n].final = 1;
+	  queue[tail++] = n;
+	}
+    }
+  mu_sieve_free (mach, queue);
+}
+
+/* Return the precompiled set of KEYS for use with comparator COMP, or
+   NULL if COMP is not an :is or :contains comparator of i;octet or
+   i;ascii-casemap, or if the key list is not worth precompiling.  The
+   set is built on the first call and cached with the first key. */
+struct mu_i_sv_keyset *
+mu_i_sv_keyset_get (mu_sieve_machine_t mach, mu_sieve_comparator_t comp,
+		    mu_sieve_slice_t keys)
+{
+  mu_sieve_string_t *first;
+  struct pattern *pat;
+  struct mu_i_sv_keyset *ks;
+  size_t i;
+  
+  if (!(comp == i_octet_is || comp == i_ascii_casemap_is
+	|| comp == i_octet_contains || comp == i_ascii_casemap_contains))
+    return NULL;
+  if (keys->count < 2)
+    return NULL;
+  
+  first = mu_sieve_string_raw (mach, keys, 0);
+  pat = first->rx;
+  if (pat)
+    {
+      if (pat->type == pattern_keyset && pat->v.keyset.comp == comp)
+	return &pat->v.keyset;
+      return NULL;
+    }
+
+  for (i = 0; i < keys->count; i++)
+    if (!mu_sieve_string_raw (mach, keys, i)->constant)
+      return NULL;
+
+  pat = pattern_alloc (mach, first, pattern_keyset);
+  ks = &pat->v.keyset;
+  ks->comp = comp;
+  ks->icase = comp == i_ascii_casemap_is || comp == i_ascii_casemap_contains;
+  if (comp == i_octet_is || comp == i_ascii_casemap_is)
+    {
+      for (ks->size = 4; ks->size < 2 * keys->count; ks->size <<= 1)
+	;
+      ks->tab = mu_sieve_calloc (mach, ks->size, sizeof (ks->tab[0]));
+      for (i = 0; i < keys->count; i++)
+	{
+	  char *key = mu_sieve_string (mach, keys, i);
+	  char **slot = keyset_lookup (ks, key);
+	  if (!*slot)
+	    *slot = key;
+	}
+    }
+  else
+    ac_build (mach, ks, keys);
+  return ks;
+}
+
+/* Return 1 if TEXT matches any key from KS */
+int
+mu_i_sv_keyset_match (struct mu_i_sv_keyset *ks, char const *text)
+{
+  unsigned char const *p;
+  size_t s;
+
+  if (ks->tab)
+    return *keyset_lookup (ks, text) != NULL;
+  
+  s = 0;
+  if (ks->state[s].final)
+    return 1;
+  for (p = (unsigned char const *) text; *p; p++)
+    {
+      int c = ks->icase ? mu_tolower (*p) : *p;
+      size_t t;
+      
+      while ((t = ac_goto (ks, s, c)) == 0 && s)
+	s = ks->state[s].fail;
+      s = t;
+      if (ks->state[s].final)
+	return 1;
+    }
+  return 0;
 }
 
 static int
@@ -300,10 +748,14 @@ mu_sieve_match_part_checker (mu_sieve_machine_t mach)
 static int
 regmatch (mu_sieve_machine_t mach, mu_sieve_string_t *pattern, char const *text)
 {
-  regex_t *reg = pattern->rx;
+  struct pattern *pat = pattern->rx;
+  regex_t *reg = &pat->v.rx;
   regmatch_t *match_buf = NULL;
   size_t match_count = 0; 
 
+  if (pat->type == pattern_glob)
+    return glob_match (&pat->v.glob, text);
+  
   if (mu_sieve_has_variables (mach))
     {
       match_count = reg->re_nsub + 1;
@@ -59,6 +59,7 @@ mu_sieve_require_environment (mu_sieve_machine_t mach)
 {
   mu_sieve_register_test (mach, "environment", sieve_test_environment,
 			  environ_args, environ_tag_groups, 1);
+  mu_sieve_registry_set_access (mach, "environment", mu_sieve_record_test, 0);
   return 0;
 }
 
@@ -280,5 +280,11 @@ SIEVE_EXPORT (editheader, init) (mu_sieve_machine_t mach)
 				deleteheader_args, deleteheader_args,
 				deleteheader_tag_groups,
 				1);
+  mu_sieve_registry_set_access (mach, "editheader", mu_sieve_record_action,
+				0);
+  mu_sieve_registry_set_access (mach, "addheader", mu_sieve_record_action,
+				MU_SIEVE_ACCESS_HEADER);
+  mu_sieve_registry_set_access (mach, "deleteheader", mu_sieve_record_action,
+				MU_SIEVE_ACCESS_HEADER);
   return 0;
 }
@@ -201,6 +201,8 @@ SIEVE_EXPORT(list,init) (mu_sieve_machine_t mach)
 {
   mu_sieve_register_test (mach, "list", list_test,
 			  list_req_args, list_tag_groups, 1);
+  mu_sieve_registry_set_access (mach, "list", mu_sieve_record_test,
+				MU_SIEVE_ACCESS_HEADER);
   return 0;
 }
 
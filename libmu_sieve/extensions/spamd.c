@@ -29,6 +29,8 @@
 #include <sys/un.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
+#include <sys/time.h>
 #include <mailutils/sieve.h>
 #include <mailutils/mu_auth.h>
 #include <mailutils/nls.h>
@@ -72,6 +74,111 @@ spamd_destroy (mu_stream_t *stream)
   mu_stream_destroy (stream);
 }
 
+/* Connection pool */
+
+/* Maximum number of idle connections kept in the pool */
+#define SPAMD_POOL_MAX 4
+
+struct spamd_conn
+{
+  struct spamd_conn *next;
+  char *addr;              /* Server address: HOST:PORT or socket name */
+  mu_stream_t stream;      /* Connection stream */
+  time_t atime;            /* Time when the connection was last used */
+};
+
+static struct spamd_conn *spamd_pool;
+
+/* Check whether an idle connection is still usable.  The server is not
+   supposed to send anything between requests, so if the stream is ready
+   for reading, the server has either closed the connection or is
+   sending garbage. */
+static int
+spamd_conn_alive (mu_stream_t stream)
+{
+  int flags = MU_STREAM_READY_RD;
+  struct timeval tv = { 0, 0 };
+
+  return mu_stream_wait (stream, &flags, &tv) == 0
+         && !(flags & MU_STREAM_READY_RD);
+}
+
+/* Retrieve an idle connection to ADDR from the pool.  Connections that
+   have been idle for more than KEEPALIVE seconds or that fail the health
+   check are closed. */
+static mu_stream_t
+spamd_pool_get (char const *addr, time_t keepalive)
+{
+  struct spamd_conn *conn, *prev = NULL, *next;
+  mu_stream_t stream = NULL;
+  time_t now = time (NULL);
+
+  for (conn = spamd_pool; conn; conn = next)
+    {
+      int match;
+      
+      next = conn->next;
+      match = !stream && strcmp (conn->addr, addr) == 0;
+      if (now - conn->atime > keepalive
+	  || (match && !spamd_conn_alive (conn->stream)))
+	{
+	  spamd_destroy (&conn->stream);
+	  match = 0;
+	}
+      else if (!match)
+	{
+	  prev = conn;
+	  continue;
+	}
+      else
+	stream = conn->stream;
+      
+      if (prev)
+	prev->next = next;
+      else
+	spamd_pool = next;
+      free (conn->addr);
+      free (conn);
+    }
+  return stream;
+}
+
+/* Return the connection STREAM to ADDR to the pool.  If the pool is
+   full, the least recently used connection is closed. */
+static void
+spamd_pool_put (char const *addr, mu_stream_t stream)
+{
+  struct spamd_conn *conn, **pp;
+  size_t n;
+
+  conn = malloc (sizeof (*conn));
+  if (conn)
+    conn->addr = strdup (addr);
+  if (!conn || !conn->addr)
+    {
+      free (conn);
+      spamd_destroy (&stream);
+      return;
+    }
+  conn->stream = stream;
+  conn->atime = time (NULL);
+  conn->next = spamd_pool;
+  spamd_pool = conn;
+
+  for (pp = &spamd_pool, n = 0; *pp; pp = &(*pp)->next, n++)
+    {
+      if (n == SPAMD_POOL_MAX)
+	{
+	  conn = *pp;
+	  *pp = NULL;
+	  spamd_destroy (&conn->stream);
+	  free (conn->addr);
+	  free (conn);
+	  break;
+	}
+    }
+}
+
 static void
 spamd_send_command (mu_stream_t stream, const char *fmt, ...)
 {
@@ -85,8 +192,51 @@ spamd_send_command (mu_stream_t stream, const char *fmt, ...)
   mu_stream_writeline (stream, buf, n);
 }
 
+/* What part of the message to send */
+struct spamd_msgopt
+{
+  int headers_only;        /* Send only the message header */
+  size_t maxsize;          /* Send at most that many octets (0 - no limit) */
+};
+
+static int
+spamd_message_stream (mu_message_t msg, struct spamd_msgopt *opt,
+		      mu_stream_t *pstr)
+{
+  int rc;
+  mu_stream_t str;
+  
+  if (opt->headers_only)
+    {
+      mu_header_t hdr;
+
+      rc = mu_message_get_header (msg, &hdr);
+      if (rc)
+	return rc;
+      rc = mu_header_get_streamref (hdr, &str);
+    }
+  else
+    rc = mu_message_get_streamref (msg, &str);
+  if (rc)
+    return rc;
+
+  if (opt->maxsize)
+    {
+      mu_stream_t ref;
+
+      rc = mu_streamref_create_abridged (&ref, str, 0, opt->maxsize - 1);
+      mu_stream_unref (str);
+      if (rc)
+	return rc;
+      str = ref;
+    }
+  *pstr = str;
+  return 0;
+}
+
 static int
-spamd_send_message (mu_stream_t stream, mu_message_t msg, int dbg)
+spamd_send_message (mu_stream_t stream, mu_message_t msg,
+		    struct spamd_msgopt *opt, int dbg)
 {
   int rc;
   mu_stream_t mstr, flt;
@@ -96,7 +246,7 @@ spamd_send_message (mu_stream_t stream, mu_message_t msg, int dbg)
   int xlev;
   int xlevchg = 0;
   
-  rc = mu_message_get_streamref (msg, &mstr);
+  rc = spamd_message_stream (msg, opt, &mstr);
   if (rc)
     return rc;
   rc = mu_filter_create (&flt, mstr, "CRLF", MU_FILTER_ENCODE,
@@ -308,7 +458,8 @@ parse_response_line (mu_sieve_machine_t mach, const char *buffer)
    libmailutils/mailbox/header.c).
  */
 static int
-get_real_message_size (mu_message_t msg, size_t *psize)
+get_real_message_size (mu_message_t msg, struct spamd_msgopt *opt,
+		       size_t *psize)
 {
   mu_stream_t null;
   mu_stream_stat_buffer stat;
@@ -318,13 +469,48 @@ get_real_message_size (mu_message_t msg, size_t *psize)
   if (rc)
     return rc;
   mu_stream_set_stat (null, MU_STREAM_STAT_MASK (MU_STREAM_STAT_OUT), stat);
-  rc = spamd_send_message (null, msg, 0);
+  rc = spamd_send_message (null, msg, opt, 0);
   mu_stream_destroy (&null);
   if (rc == 0)
     *psize = stat[MU_STREAM_STAT_OUT];
   return rc;
 }
 
+/* Read the reply headers.  Store the value of the Spam header in
+   BUFFER and return the value of Content-length in *PLEN (-1 if not
+   supplied). */
+static void
+spamd_read_headers (mu_sieve_machine_t mach, mu_stream_t stream,
+		    char **pbuffer, size_t *psize,
+		    char **pspam, long *plen)
+{
+  *pspam = NULL;
+  *plen = -1;
+  while (1)
+    {
+      spamd_read_line (mach, stream, pbuffer, psize);
+      if ((*pbuffer)[0] == 0)
+	break;
+      if (mu_c_strncasecmp (*pbuffer, "Spam:", 5) == 0)
+	{
+	  free (*pspam);
+	  *pspam = strdup (*pbuffer);
+	  if (!*pspam)
+	    {
+	      mu_sieve_error (mach, "%s", mu_strerror (ENOMEM));
+	      spamd_abort (mach, &stream, handler);
+	    }
+	}
+      else if (mu_c_strncasecmp (*pbuffer, "Content-length:", 15) == 0)
+	*plen = strtol (*pbuffer + 15, NULL, 10);
+    }
+  if (!*pspam)
+    {
+      mu_sieve_error (mach, _("spamd response lacks Spam header"));
+      spamd_abort (mach, &stream, handler);
+    }
+}
+
 /* The test proper */
 
 /* Syntax: spamd [":host" <tcp-host: string>]
@@ -332,6 +518,10 @@ get_real_message_size (mu_message_t msg, size_t *psize)
                   ":socket" <unix-socket: string>]
 		 [":user" <name: string>] 
 		 [":over" / ":under" <limit: string>]
+		 [":keepalive" <seconds: number>]
+		 [":timeout" <seconds: number>]
+		 [":maxsize" <size: number>]
+		 [":headers"]
 
    The "spamd" test is an interface to "spamd" facility of
    SpamAssassin mail filter. It evaluates to true if SpamAssassin
@@ -349,12 +539,25 @@ get_real_message_size (mu_message_t msg, size_t *psize)
    Spam score is a floating point number. The comparison takes into
    account three decimal digits.
 
+   The ":keepalive" tag instructs the test to keep the connection open
+   after receiving the reply and to reuse it for subsequent messages,
+   provided that it is not idle for more than the given number of
+   seconds and that the server has not closed it meanwhile.  The stock
+   spamd closes the connection after each reply, so with it the tag
+   has no effect.
+
+   The ":timeout" tag sets the maximum time to wait for the reply.
+
+   The ":maxsize" tag limits the number of octets of the message
+   passed to spamd.  The ":headers" tag instructs it to pass only the
+   message header.
 */
 
 static int
 spamd_test (mu_sieve_machine_t mach)
 {
   char *buffer = NULL;
+  size_t bufsize = 0;
   size_t size;
   char spam_str[6], score_str[21], threshold_str[21];
   int rc;
@@ -367,32 +570,70 @@ spamd_test (mu_sieve_machine_t mach)
   char *str;
   mu_header_t hdr;
   mu_debug_handle_t lev = 0;
+  struct spamd_msgopt msgopt;
+  size_t keepalive = 0, timeout = 0;
+  char *addr = NULL;
+  char *sockname;
+  int reused, xscript, eof;
+  char *spam;
+  long length;
   
   if (mu_sieve_is_dry_run (mach))
     return 0;
   
   msg = mu_sieve_get_message (mach);
-  rc = get_real_message_size (msg, &size);
+  msgopt.headers_only = mu_sieve_get_tag (mach, "headers", SVT_VOID, NULL);
+  msgopt.maxsize = 0;
+  mu_sieve_get_tag (mach, "maxsize", SVT_NUMBER, &msgopt.maxsize);
+  rc = get_real_message_size (msg, &msgopt, &size);
   if (rc)
     {
       mu_sieve_error (mach, _("cannot get real message size: %s"),
 		      mu_strerror (rc));
       mu_sieve_abort (mach);
     }
+
+  mu_sieve_get_tag (mach, "keepalive", SVT_NUMBER, &keepalive);
+  mu_sieve_get_tag (mach, "timeout", SVT_NUMBER, &timeout);
   
   if (!mu_sieve_get_tag (mach, "host", SVT_STRING, &host))
     host = "127.0.0.1";
-  
-  if (mu_sieve_get_tag (mach, "port", SVT_NUMBER, &num))
-    result = spamd_connect_tcp (mach, &stream, host, num);
-  else if (mu_sieve_get_tag (mach, "socket", SVT_STRING, &str))
-    result = spamd_connect_socket (mach, &stream, str);
-  else
-    result = spamd_connect_tcp (mach, &stream, host, DEFAULT_SPAMD_PORT);
-  if (result) /* spamd_connect_ already reported error */
-    mu_sieve_abort (mach);
+  if (mu_sieve_get_tag (mach, "socket", SVT_STRING, &sockname))
+    num = 0;
+  else if (!mu_sieve_get_tag (mach, "port", SVT_NUMBER, &num))
+    num = DEFAULT_SPAMD_PORT;
+
+  if (keepalive)
+    {
+      if (num)
+	rc = mu_asprintf (&addr, "%s:%zu", host, num);
+      else
+	rc = mu_asprintf (&addr, "%s", sockname);
+      if (rc)
+	{
+	  mu_sieve_error (mach, "%s", mu_strerror (rc));
+	  mu_sieve_abort (mach);
+	}
+      mu_sieve_register_memory (mach, addr, NULL);
+    }
 
-  mu_stream_set_buffer (stream, mu_buffer_line, 0);
+ again:
+  reused = xscript = eof = 0;
+  if (addr && (stream = spamd_pool_get (addr, keepalive)) != NULL)
+    reused = 1;
+  else
+    {
+      if (num)
+	result = spamd_connect_tcp (mach, &stream, host, num);
+      else
+	result = spamd_connect_socket (mach, &stream, sockname);
+      if (result) /* spamd_connect_ already reported error */
+	mu_sieve_abort (mach);
+      /* Requests are written in full and flushed once, so that the
+	 command and message go out in as few packets as possible */
+      mu_stream_set_buffer (stream, mu_buffer_full, 0);
+    }
+  
   if (mu_debug_category_level ("sieve", 5, &lev) == 0 &&
       (lev & MU_DEBUG_LEVEL_MASK (MU_DEBUG_PROT)))
     {
@@ -413,11 +654,15 @@ spamd_test (mu_sieve_machine_t mach)
 	    {
 	      mu_stream_unref (stream);
 	      stream = xstr;
+	      xscript = 1;
 	    }
 	}
     }
 
-  spamd_send_command (stream, "SYMBOLS SPAMC/1.2");
+  /* Protocol version 1.3 and later provides Content-length in the reply,
+     which allows to read it without waiting for the server to close
+     the connection */
+  spamd_send_command (stream, "SYMBOLS SPAMC/%s", addr ? "1.5" : "1.2");
   
   spamd_send_command (stream, "Content-length: %lu", (u_long) size);
   if (mu_sieve_get_tag (mach, "user", SVT_STRING, &str))
@@ -433,28 +678,68 @@ spamd_test (mu_sieve_machine_t mach)
   handler = set_signal_handler (SIGPIPE, sigpipe_handler);
   
   spamd_send_command (stream, "");
-  spamd_send_message (stream, msg, 1);
-  mu_stream_shutdown (stream, MU_STREAM_WRITE);
+  rc = spamd_send_message (stream, msg, &msgopt, 1);
+  if (rc == 0)
+    rc = mu_stream_flush (stream);
+  if (!addr)
+    mu_stream_shutdown (stream, MU_STREAM_WRITE);
 
-  spamd_read_line (mach, stream, &buffer, &size);
+  if (rc == 0 && timeout)
+    {
+      int flags = MU_STREAM_READY_RD;
+      struct timeval tv;
 
-  if (got_sigpipe)
+      tv.tv_sec = timeout;
+      tv.tv_usec = 0;
+      rc = mu_stream_wait (stream, &flags, &tv);
+      if (rc == 0 && !(flags & MU_STREAM_READY_RD))
+	{
+	  mu_sieve_error (mach, _("timed out waiting for spamd reply"));
+	  spamd_abort (mach, &stream, handler);
+	}
+    }
+
+  if (rc == 0)
+    {
+      size_t n;
+      
+      rc = mu_stream_getline (stream, &buffer, &bufsize, &n);
+      if (rc == 0 && n == 0)
+	eof = 1;
+    }
+  
+  if (rc || eof || got_sigpipe)
     {
-      mu_sieve_error (mach, _("remote side has closed connection"));
+      if (reused)
+	{
+	  /* The server has closed the idle connection.  Retry using a
+	     new one. */
+	  spamd_destroy (&stream);
+	  set_signal_handler (SIGPIPE, handler);
+	  goto again;
+	}
+      if (rc)
+	mu_sieve_error (mach, "%s", mu_strerror (rc));
+      else
+	mu_sieve_error (mach, _("remote side has closed connection"));
+      free (buffer);
       spamd_abort (mach, &stream, handler);
     }
-
+  mu_rtrim_class (buffer, MU_CTYPE_ENDLN);
+  
   if (parse_response_line (mach, buffer))
     spamd_abort (mach, &stream, handler);
-  
-  spamd_read_line (mach, stream, &buffer, &size);
-  if (sscanf (buffer, "Spam: %5s ; %20s / %20s",
+
+  spamd_read_headers (mach, stream, &buffer, &bufsize, &spam, &length);
+  if (sscanf (spam, "Spam: %5s ; %20s / %20s",
 	      spam_str, score_str, threshold_str) != 3)
     {
       mu_sieve_error (mach, _("spamd responded with bad Spam header '%s'"), 
-                      buffer);
+                      spam);
+      free (spam);
       spamd_abort (mach, &stream, handler);
     }
+  free (spam);
 
   result = decode_boolean (spam_str);
   score = strtoul (score_str, NULL, 10);
@@ -474,11 +759,33 @@ spamd_test (mu_sieve_machine_t mach)
 	  result = score <= limit;	  
 	}
     }
-  
-  /* Skip newline */
-  spamd_read_line (mach, stream, &buffer, &size);
+
   /* Read symbol list */
-  spamd_read_line (mach, stream, &buffer, &size);
+  if (length >= 0)
+    {
+      if ((size_t) length + 1 > bufsize)
+	{
+	  char *p = realloc (buffer, length + 1);
+	  if (!p)
+	    {
+	      mu_sieve_error (mach, "%s", mu_strerror (ENOMEM));
+	      spamd_abort (mach, &stream, handler);
+	    }
+	  buffer = p;
+	  bufsize = length + 1;
+	}
+      rc = mu_stream_read (stream, buffer, length, NULL);
+      if (rc)
+	{
+	  free (buffer);
+	  mu_sieve_error (mach, "read error: %s", mu_strerror (rc));
+	  spamd_abort (mach, &stream, handler);
+	}
+      buffer[length] = 0;
+      mu_rtrim_class (buffer, MU_CTYPE_ENDLN);
+    }
+  else
+    spamd_read_line (mach, stream, &buffer, &bufsize);
 
   rc = mu_message_get_header (msg, &hdr);
   if (rc)
@@ -495,26 +802,47 @@ spamd_test (mu_sieve_machine_t mach)
 
   free (buffer);
 
-  /* Create a data sink */
-  mu_nullstream_create (&null, MU_STREAM_WRITE);
-
-  /* Mark out the following data as payload */
-  if (!(lev & MU_DEBUG_LEVEL_MASK (MU_DEBUG_TRACE9)))
+  if (addr && length >= 0)
     {
-      int xlev = MU_XSCRIPT_PAYLOAD;
-      mu_stream_ioctl (stream, MU_IOCTL_XSCRIPTSTREAM,
-		       MU_IOCTL_XSCRIPTSTREAM_LEVEL, &xlev);
+      /* Return the connection to the pool */
+      mu_transport_t trans[2];
+
+      if (xscript
+	  && mu_stream_ioctl (stream, MU_IOCTL_TRANSPORT, MU_IOCTL_OP_GET,
+			      trans) == 0)
+	{
+	  /* Strip off the transcript stream */
+	  mu_stream_t str = (mu_stream_t) trans[0];
+	  mu_stream_ref (str);
+	  mu_stream_destroy (&stream);
+	  stream = str;
+	}
+      spamd_pool_put (addr, stream);
     }
-  mu_stream_copy (null, stream, 0, NULL);
-  mu_stream_destroy (&null);
-  mu_stream_destroy (&stream);
+  else
+    {
+      /* Create a data sink */
+      mu_nullstream_create (&null, MU_STREAM_WRITE);
 
+      /* Mark out the following data as payload */
+      if (!(lev & MU_DEBUG_LEVEL_MASK (MU_DEBUG_TRACE9)))
+	{
+	  int xlev = MU_XSCRIPT_PAYLOAD;
+	  mu_stream_ioctl (stream, MU_IOCTL_XSCRIPTSTREAM,
+			   MU_IOCTL_XSCRIPTSTREAM_LEVEL, &xlev);
+	}
+      mu_stream_copy (null, stream, 0, NULL);
+      mu_stream_destroy (&null);
+      mu_stream_destroy (&stream);
+    }
+  
   set_signal_handler (SIGPIPE, handler);
+  mu_sieve_free (mach, addr);
 
   return result;
 }
 
-
+
 /* Initialization */
    
 /* Required arguments: */
@@ -530,6 +858,10 @@ static mu_sieve_tag_def_t spamd_tags[] = {
   { "user", SVT_STRING },
   { "over", SVT_STRING },
   { "under", SVT_STRING },
+  { "keepalive", SVT_NUMBER },
+  { "timeout", SVT_NUMBER },
+  { "maxsize", SVT_NUMBER },
+  { "headers", SVT_VOID },
   { NULL }
 };
 
@@ -124,5 +124,7 @@ SIEVE_EXPORT(timestamp,init) (mu_sieve_machine_t mach)
 {
   mu_sieve_register_test (mach, "timestamp", timestamp_test,
 			  timestamp_req_args, timestamp_tag_groups, 1);
+  mu_sieve_registry_set_access (mach, "timestamp", mu_sieve_record_test,
+				MU_SIEVE_ACCESS_HEADER);
   return 0;
 }
@@ -307,6 +307,7 @@ mu_i_sv_lint_command (struct mu_sieve_machine *mach,
     }
 
   node->v.command.argcount -= node->v.command.tagcount;
+  mach->access |= reg->access;
   
   if (chk_list)
     {
@@ -86,6 +86,7 @@ mu_sieve_registry_add (mu_sieve_machine_t mach, const char *name)
   reg->name = name;
   reg->handle = NULL;
   reg->required = 0;
+  reg->access = MU_SIEVE_ACCESS_ALL | MU_SIEVE_ACCESS_EXTERNAL;
   memset (&reg->v, 0, sizeof reg->v);
   rc = mu_list_append (mach->registry, reg);
   if (rc)
@@ -117,6 +118,17 @@ mu_sieve_registry_lookup (mu_sieve_machine_t mach, const char *name,
   return reg;
 }
 
+/* Declare which parts of the message the test or action NAME can access.
+   By default, any command is assumed to access the entire message. */
+void
+mu_sieve_registry_set_access (mu_sieve_machine_t mach, const char *name,
+			      enum mu_sieve_record type, int access)
+{
+  mu_sieve_registry_t *reg = mu_sieve_registry_lookup (mach, name, type);
+  if (reg)
+    reg->access = access;
+}
+
 void
 mu_sieve_register_test_ext (mu_sieve_machine_t mach,
 			    const char *name, mu_sieve_handler_t handler,
@@ -191,6 +191,16 @@ mu_sieve_get_message_num (mu_sieve_machine_t mach)
   return mach->msgno;
 }
 
+/* Return the parts of the message the compiled program can access, as a
+   bitmask of MU_SIEVE_ACCESS_* constants.  If the result does not include
+   MU_SIEVE_ACCESS_BODY (or MU_SIEVE_ACCESS_SIZE), the program can be
+   safely run on a message whose body has not been read yet. */
+int
+mu_sieve_get_message_access (mu_sieve_machine_t mach)
+{
+  return mach->access;
+}
+
 const char *
 mu_sieve_get_identifier (mu_sieve_machine_t mach)
 {
@@ -312,6 +322,36 @@ mu_sieve_mailbox (mu_sieve_machine_t mach, mu_mailbox_t mbox)
   return rc;
 }
 
+/* Run the machine over the message MSGNO from the mailbox MBOX.  This
+   is equivalent to one step of mu_sieve_mailbox, which allows the caller
+   to process the messages in arbitrary order, or only a subset of them. */
+int
+mu_sieve_mailbox_message (mu_sieve_machine_t mach, mu_mailbox_t mbox,
+			  size_t msgno)
+{
+  int rc;
+  
+  if (!mach || !mbox)
+    return EINVAL;
+
+  if (mach->state != mu_sieve_state_compiled)
+    return EINVAL; /* FIXME: Error code */
+
+  rc = mu_mailbox_get_message (mbox, msgno, &mach->msg);
+  if (rc)
+    return rc;
+  
+  mach->state = mu_sieve_state_running;
+  mach->mailbox = mbox;
+  mach->msgno = msgno;
+  rc = sieve_run (mach);
+  mach->state = mu_sieve_state_compiled;
+  mach->mailbox = NULL;
+  mach->msg = NULL;
+  
+  return rc;
+}
+
 int
 mu_sieve_message (mu_sieve_machine_t mach, mu_message_t msg)
 {
@@ -1003,10 +1003,7 @@ mu_i_sv_free_stringspace (mu_sieve_machine_t mach)
   for (i = 0; i < mach->stringcount; i++)
     {
       if (mach->stringspace[i].rx)
-	{
-	  regex_t *rx = mach->stringspace[i].rx;
-	  regfree (rx);
-	}
+	mu_i_sv_pattern_free (mach->stringspace[i].rx);
       /* There's no need to free mach->stringspace[i].exp, because
 	 it is allocated in mach's memory pool */
     }
@@ -1157,6 +1154,7 @@ mu_sieve_machine_clone (mu_sieve_machine_t const parent,
 				     sizeof child->prog[0]);
       memcpy (child->prog, parent->prog,
 	      parent->progsize * sizeof (child->prog[0]));
+      child->access = parent->access;
 
       /* Copy variables */
       if (mu_sieve_has_variables (parent))
@@ -1209,6 +1207,7 @@ mu_sieve_machine_dup (mu_sieve_machine_t const in, mu_sieve_machine_t *out)
 
   mach->progsize = in->progsize;
   mach->prog = in->prog;
+  mach->access = in->access;
 
   switch (in->state)
     {
@@ -82,6 +82,8 @@ struct mu_sieve_machine
   
   size_t progsize;           /* Number of allocated program cells */
   sieve_op_t *prog;          /* Compiled program */
+  int access;                /* Message parts accessed by the program
+				(MU_SIEVE_ACCESS_* bits) */
 
   /* Runtime data */
   enum mu_sieve_state state; /* Machine state */
@@ -214,6 +216,13 @@ void mu_i_sv_register_standard_actions (mu_sieve_machine_t mach);
 void mu_i_sv_register_standard_tests (mu_sieve_machine_t mach);
 void mu_i_sv_register_standard_comparators (mu_sieve_machine_t mach);
 
+struct mu_i_sv_keyset;
+struct mu_i_sv_keyset *mu_i_sv_keyset_get (mu_sieve_machine_t mach,
+					   mu_sieve_comparator_t comp,
+					   mu_sieve_slice_t keys);
+int mu_i_sv_keyset_match (struct mu_i_sv_keyset *ks, char const *text);
+void mu_i_sv_pattern_free (void *ptr);
+
 void mu_i_sv_error (mu_sieve_machine_t mach);
 
 void mu_i_sv_debug (mu_sieve_machine_t mach, size_t pc, const char *fmt, ...)
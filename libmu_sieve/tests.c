@@ -328,8 +328,17 @@ static mu_sieve_tag_def_t mime_tags[] = {
 
 #define SIZE_GROUP { size_tags, NULL }
 
+/* The checker is called only if the :mime tag is present.  Looking into
+   MIME parts requires access to the message body. */
+static int
+mime_tag_checker (mu_sieve_machine_t mach)
+{
+  mach->access |= MU_SIEVE_ACCESS_BODY;
+  return 0;
+}
+
 #define MIME_GROUP \
-  { mime_tags, NULL }
+  { mime_tags, mime_tag_checker }
 
 mu_sieve_tag_group_t address_tag_groups[] = {
   ADDRESS_PART_GROUP,
@@ -384,4 +393,15 @@ mu_i_sv_register_standard_tests (mu_sieve_machine_t mach)
 			  exists_req_args, NULL, 1);
   mu_sieve_register_test (mach, "header", sieve_test_header,
 			  address_req_args, header_tag_groups, 1);
+
+  mu_sieve_registry_set_access (mach, "address", mu_sieve_record_test,
+				MU_SIEVE_ACCESS_HEADER);
+  mu_sieve_registry_set_access (mach, "size", mu_sieve_record_test,
+				MU_SIEVE_ACCESS_SIZE);
+  mu_sieve_registry_set_access (mach, "envelope", mu_sieve_record_test,
+				MU_SIEVE_ACCESS_HEADER);
+  mu_sieve_registry_set_access (mach, "exists", mu_sieve_record_test,
+				MU_SIEVE_ACCESS_HEADER);
+  mu_sieve_registry_set_access (mach, "header", mu_sieve_record_test,
+				MU_SIEVE_ACCESS_HEADER);
 }
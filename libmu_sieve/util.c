@@ -448,6 +448,7 @@ mu_sieve_vlist_compare (mu_sieve_machine_t mach,
   else
     {
       mu_iterator_t itr;
+      struct mu_i_sv_keyset *ks = mu_i_sv_keyset_get (mach, comp, &b->v.list);
       
       mu_list_get_iterator (tmp, &itr);
       rc = 0;
@@ -456,7 +457,12 @@ mu_sieve_vlist_compare (mu_sieve_machine_t mach,
 	{
 	  char const *val;
 	  mu_iterator_current (itr, (void**)&val);
-	  
+
+	  if (ks)
+	    {
+	      rc = mu_i_sv_keyset_match (ks, val);
+	      continue;
+	    }
 	  for (i = 0; i < b->v.list.count; i++)
 	    {
 	      mu_sieve_string_t *s = mu_sieve_string_raw (mach, &b->v.list, i);
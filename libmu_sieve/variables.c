@@ -464,6 +464,8 @@ mu_sieve_require_variables (mu_sieve_machine_t mach)
 				set_args, set_tag_groups, 1);
       mu_sieve_register_test (mach, "string", sieve_test_string,
 			      string_args, string_tag_groups, 1);
+      mu_sieve_registry_set_access (mach, "set", mu_sieve_record_action, 0);
+      mu_sieve_registry_set_access (mach, "string", mu_sieve_record_test, 0);
     }
   return rc;
 }
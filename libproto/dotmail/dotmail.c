@@ -40,6 +40,7 @@
 #include <mailutils/envelope.h>
 #include <mailutils/util.h>
 #include <mailutils/cctype.h>
+#include <mailutils/msgset.h>
 
 static void
 dotmail_destroy (mu_mailbox_t mailbox)
@@ -689,7 +690,7 @@ dotmail_rescan (mu_mailbox_t mailbox, mu_off_t offset)
       return rc;
     }
 
-  if (mailbox->locker && (rc = mu_locker_lock (mailbox->locker)))
+  if (mailbox->locker && (rc = mu_locker_lock_mode (mailbox->locker, mu_lck_shr)))
     {
       mu_monitor_unlock (mailbox->monitor);
       return rc;
@@ -1103,6 +1104,193 @@ dotmail_append_message (mu_mailbox_t mailbox, mu_message_t msg,
   return rc;
 }
 
+/* Bulk append of messages from another dotmail mailbox.
+
+   Messages that have not been modified since the source mailbox was
+   scanned are copied verbatim: their bodies are already dot-stuffed
+   and terminated, so the header and body are transferred as contiguous
+   byte ranges, without decoding and re-encoding them.  Only the
+   UID-related headers are replaced.  The destination mailbox is locked
+   and rescanned once for the entire set. */
+struct append_msgset_closure
+{
+  mu_mailbox_t mailbox;              /* Destination mailbox */
+  struct mu_dotmail_mailbox *src;    /* Source mailbox data */
+  mu_off_t *offtab;                  /* Offsets of the appended messages */
+  size_t offcount;                   /* Number of used entries in offtab */
+};
+
+static int
+append_msgset_check (size_t n, void *data)
+{
+  struct append_msgset_closure *clos = data;
+  struct mu_dotmail_message *dmsg;
+  
+  if (n == 0 || n > clos->src->mesg_count)
+    return MU_ERR_NOENT;
+  dmsg = clos->src->mesg[n-1];
+  if (dmsg->message && mu_message_is_modified (dmsg->message))
+    return ENOSYS;
+  return 0;
+}
+
+static int
+append_msgset_copy (size_t n, void *data)
+{
+  struct append_msgset_closure *clos = data;
+  mu_mailbox_t mailbox = clos->mailbox;
+  struct mu_dotmail_mailbox *dmp = mailbox->data;
+  struct mu_dotmail_message *dmsg = clos->src->mesg[n-1];
+  mu_stream_t src = clos->src->mailbox->stream;
+  mu_stream_t dst = mailbox->stream;
+  mu_off_t off;
+  int rc;
+  static char *exclude_headers[] = {
+    MU_HEADER_X_IMAPBASE,
+    MU_HEADER_X_UID,
+    NULL
+  };
+
+  rc = mu_stream_seek (dst, 0, clos->offcount ? MU_SEEK_CUR : MU_SEEK_END,
+		       &off);
+  if (rc)
+    return rc;
+  clos->offtab[clos->offcount++] = off;
+
+  rc = mu_stream_seek (src, dmsg->message_start, MU_SEEK_SET, NULL);
+  if (rc)
+    return rc;
+  rc = mu_stream_header_copy (dst, src, exclude_headers);
+  if (rc)
+    return rc;
+
+  if (dmp->uidvalidity_scanned)
+    {
+      if (dmp->mesg_count == 0 && clos->offcount == 1)
+	mu_stream_printf (dst, "%s: %*lu %*lu\n",
+			  MU_HEADER_X_IMAPBASE,
+			  UINT_STRWIDTH (dmp->uidvalidity),
+			  dmp->uidvalidity,
+			  UINT_STRWIDTH (dmp->uidnext),
+			  dmp->uidnext);
+      mu_stream_printf (dst, "%s: %lu\n",
+			MU_HEADER_X_UID,
+			dotmail_alloc_next_uid (dmp));
+      if (mu_stream_err (dst))
+	return mu_stream_last_error (dst);
+    }
+
+  rc = mu_stream_write (dst, "\n", 1, NULL);
+  if (rc)
+    return rc;
+
+  /* Copy the body along with the terminating ".\n" */
+  rc = mu_stream_seek (src, dmsg->body_start, MU_SEEK_SET, NULL);
+  if (rc)
+    return rc;
+  return mu_stream_copy (dst, src, dmsg->message_end - dmsg->body_start + 2,
+			 NULL);
+}
+
+static int
+mailbox_append_msgset (mu_mailbox_t mailbox, mu_mailbox_t src,
+		       mu_msgset_t msgset)
+{
+  struct append_msgset_closure clos;
+  size_t count;
+  int rc;
+  
+  rc = mu_msgset_count (msgset, &count);
+  if (rc)
+    return rc;
+  if (count == 0)
+    return 0;
+  
+  clos.mailbox = mailbox;
+  clos.src = src->data;
+  clos.offcount = 0;
+  clos.offtab = calloc (count, sizeof (clos.offtab[0]));
+  if (!clos.offtab)
+    return ENOMEM;
+
+  rc = mu_msgset_foreach_msgno (msgset, append_msgset_copy, &clos);
+  if (rc)
+    {
+      if (clos.offcount)
+	{
+	  int rc1 = mu_stream_truncate (mailbox->stream, clos.offtab[0]);
+	  if (rc1)
+	    mu_error (_("cannot truncate stream after failed append: %s"),
+		      mu_stream_strerror (mailbox->stream, rc1));
+	}
+    }
+  else
+    {
+      rc = dotmail_rescan_unlocked (mailbox, clos.offtab[0]);
+      if (rc == 0 && mailbox->observable)
+	{
+	  size_t i;
+	  
+	  for (i = 0; i < clos.offcount; i++)
+	    {
+	      char *buf = NULL;
+	      mu_asprintf (&buf, "%lu", (unsigned long) clos.offtab[i]);
+	      mu_observable_notify (mailbox->observable,
+				    MU_EVT_MAILBOX_MESSAGE_APPEND, buf);
+	      free (buf);
+	    }
+	}
+    }
+  free (clos.offtab);
+  return rc;
+}
+
+static int
+dotmail_append_msgset (mu_mailbox_t mailbox, mu_mailbox_t src,
+		       mu_msgset_t msgset)
+{
+  struct mu_dotmail_mailbox *dmp = mailbox->data;
+  struct append_msgset_closure clos;
+  int rc;
+
+  if (src == mailbox)
+    return ENOSYS;
+
+  /* Make sure all messages are available and can be copied verbatim. */
+  clos.src = src->data;
+  if (clos.src->mesg_count == 0)
+    {
+      rc = dotmail_scan (src, 1, NULL);
+      if (rc)
+	return rc;
+    }
+  rc = mu_msgset_foreach_msgno (msgset, append_msgset_check, &clos);
+  if (rc)
+    return rc;
+  
+  rc = dotmail_refresh (mailbox);
+  if (rc)
+    return rc;
+  
+  mu_monitor_wrlock (mailbox->monitor);
+  if (mailbox->locker && (rc = mu_locker_lock (mailbox->locker)) != 0)
+    {
+      mu_debug (MU_DEBCAT_MAILBOX, MU_DEBUG_ERROR,
+		("%s(%s):%s: %s",
+		 __func__, dmp->name, "mu_locker_lock",
+		 mu_strerror (rc)));
+    }
+  else
+    {
+      rc = mailbox_append_msgset (mailbox, src, msgset);
+
+      if (mailbox->locker)
+	mu_locker_unlock (mailbox->locker);
+    }
+  mu_monitor_unlock (mailbox->monitor);
+  return rc;
+}
+
 static int
 dotmail_messages_count (mu_mailbox_t mailbox, size_t *pcount)
 {
@@ -1328,7 +1516,8 @@ dotmail_flush_temp (struct mu_dotmail_flush_tracker *trk,
     {
       struct mu_dotmail_message *dmsg = dmp->mesg[i];
 
-      if (expunge && (dmsg->attr_flags & MU_ATTRIBUTE_DELETED))
+      if (expunge && _mu_mailbox_expunge_p (dmp->mailbox, i + 1,
+					     dmsg->attr_flags))
 	{
 	  size_t expevt[2] = { i + 1, expcount };
 
@@ -1781,8 +1970,10 @@ mu_dotmail_mailbox_init (mu_mailbox_t mailbox)
   mailbox->_message_unseen = dotmail_message_unseen;
 
   mailbox->_append_message = dotmail_append_message;
+  mailbox->_append_msgset = dotmail_append_msgset;
 
   mailbox->_expunge = dotmail_expunge;
+  mailbox->expunge_set_ok = 1;
   mailbox->_sync = dotmail_sync;
 
   mailbox->_get_uidvalidity = dotmail_get_uidvalidity;
@@ -78,6 +78,10 @@ struct _maildir_data
 {
   struct _amd_data amd;
   int folder_fd;         /* Descriptor of the top-level maildir directory */
+  int batch_fd[2];       /* Descriptors of cur and new during a batch
+			    attribute update, or -1 */
+  int batch_level;       /* Nesting level of maildir_chattr_begin calls */
+  int batch_close;       /* Close folder_fd at the end of the batch */
   /* Additional data used during scanning: */
   int needs_attribute_fixup; /* The mailbox is created by mailutils 3.10
 				or earlier and needs the attribute fixup
@@ -878,6 +882,9 @@ maildir_message_fixup (struct _maildir_data *md, struct _maildir_message *msg)
     }
 }
 
+static int maildir_chattr_begin (struct _amd_data *amd);
+static void maildir_chattr_end (struct _amd_data *amd);
+
 static int
 maildir_scan_unlocked (mu_mailbox_t mailbox, size_t *pcount, int do_notify)
 {
@@ -914,6 +921,8 @@ maildir_scan_unlocked (mu_mailbox_t mailbox, size_t *pcount, int do_notify)
   amd_sort (&md->amd);
 
   /* Fix up messages and send out dispatch notifications, if necessary. */
+  if (md->amd.mailbox->flags & MU_STREAM_WRITE)
+    maildir_chattr_begin (&md->amd);
   for (i = 1; i <= md->amd.msg_count; i++)
     {
       struct _maildir_message *msg = (struct _maildir_message *)
@@ -940,6 +949,8 @@ maildir_scan_unlocked (mu_mailbox_t mailbox, size_t *pcount, int do_notify)
       if (do_notify)
 	DISPATCH_ADD_MSG (mailbox, &md->amd, i);
     }
+  if (md->amd.mailbox->flags & MU_STREAM_WRITE)
+    maildir_chattr_end (&md->amd);
 
   /* Update predicted next UID either way */
   amd_update_uidnext (&md->amd, &md->next_uid);
@@ -1653,62 +1664,152 @@ maildir_remove (struct _amd_data *amd)
   return rc;
 }
 
+/* Batch attribute updates.
+
+   Attribute changes are kept in memory until the mailbox is
+   synchronized.  At that point, all modified messages are renamed in
+   a row.  To speed this up, descriptors of cur and new are opened once
+   for the whole batch, and the renames are done relative to them, so
+   that the kernel need not resolve full pathnames for each message.
+   Each rename is atomic and is done in the same order as before, so
+   the crash safety is not affected. */
+static int
+maildir_chattr_begin (struct _amd_data *amd)
+{
+  struct _maildir_data *md = (struct _maildir_data *) amd;
+  int rc;
+  
+  if (md->batch_level++ > 0)
+    return 0;
+  md->batch_close = md->folder_fd == -1;
+  rc = maildir_open (md);
+  if (rc == 0)
+    {
+      rc = maildir_subdir_open (md, SUB_CUR, NULL, &md->batch_fd[SUB_CUR]);
+      if (rc == 0)
+	{
+	  rc = maildir_subdir_open (md, SUB_NEW, NULL,
+				    &md->batch_fd[SUB_NEW]);
+	  if (rc)
+	    {
+	      close (md->batch_fd[SUB_CUR]);
+	      md->batch_fd[SUB_CUR] = -1;
+	    }
+	}
+      if (rc && md->batch_close)
+	maildir_close (md);
+    }
+  return rc;
+}
+
+static void
+maildir_chattr_end (struct _amd_data *amd)
+{
+  struct _maildir_data *md = (struct _maildir_data *) amd;
+  int i;
+
+  if (md->batch_level == 0 || --md->batch_level > 0)
+    return;
+  for (i = 0; i < 2; i++)
+    {
+      if (md->batch_fd[i] != -1)
+	{
+	  close (md->batch_fd[i]);
+	  md->batch_fd[i] = -1;
+	}
+    }
+  if (md->batch_close)
+    maildir_close (md);
+}
+
+/* Return true if MSG can be renamed using batch descriptors. */
+static inline int
+maildir_in_batch (struct _maildir_data *md, struct _maildir_message *msg)
+{
+  return md->batch_fd[SUB_CUR] != -1 && msg->subdir != SUB_TMP;
+}
+
 static int
 maildir_chattr_msg (struct _amd_message *amsg, int expunge)
 {
   struct _maildir_message *mp = (struct _maildir_message *) amsg;
+  struct _maildir_data *md = (struct _maildir_data *) amsg->amd;
   struct _amd_data *amd = amsg->amd;
   int rc;
   int old_subdir;
-  char *cur_name, *new_name;
-
-  rc = maildir_cur_message_name (amsg, 1, &cur_name);
-  if (rc)
-    return rc;
+  char *cur_name = NULL, *new_name, *new_base;
 
   old_subdir = mp->subdir; 
   mp->subdir = SUB_CUR;
   rc = amd->new_msg_file_name (amsg, amsg->attr_flags, expunge, &new_name);
-  if (rc == 0)
+  mp->subdir = old_subdir;
+  if (rc)
+    return rc;
+
+  new_base = new_name ? strrchr (new_name, '/') + 1 : NULL;
+  if (new_base && old_subdir == SUB_CUR && strcmp (new_base, mp->file_name) == 0)
+    {
+      /* Flags netted out unchanged.  Nothing to do. */
+      free (new_name);
+      return 0;
+    }
+
+  if (!maildir_in_batch (md, mp))
     {
-      if (!new_name)
+      rc = maildir_cur_message_name (amsg, 1, &cur_name);
+      if (rc)
 	{
-	  if (unlink (mp->file_name))
-	    {
-	      rc = errno;
-	      mu_debug (MU_DEBCAT_MAILBOX, MU_DEBUG_ERROR,
-			("can't unlink %s: %s",
-			 mp->file_name, mu_strerror (rc)));
-	    }
+	  free (new_name);
+	  return rc;
 	}
-      else
+    }
+      
+  if (!new_name)
+    {
+      if (cur_name
+	  ? unlink (cur_name)
+	  : unlinkat (md->batch_fd[old_subdir], mp->file_name, 0))
 	{
-	  if (rename (cur_name, new_name))
+	  rc = errno;
+	  mu_debug (MU_DEBCAT_MAILBOX, MU_DEBUG_ERROR,
+		    ("can't unlink %s/%s/%s: %s",
+		     amd->name, subdir_name[old_subdir], mp->file_name,
+		     mu_strerror (rc)));
+	}
+    }
+  else
+    {
+      if (cur_name
+	  ? rename (cur_name, new_name)
+	  : renameat (md->batch_fd[old_subdir], mp->file_name,
+		      md->batch_fd[SUB_CUR], new_base))
+	{
+	  rc = errno;
+	  if (rc == ENOENT)
+	    mu_observable_notify (amd->mailbox->observable,
+				  MU_EVT_MAILBOX_CORRUPT,
+				  amd->mailbox);
+	  else
 	    {
-	      rc = errno;
-	      if (rc == ENOENT)
-		mu_observable_notify (amd->mailbox->observable,
-				      MU_EVT_MAILBOX_CORRUPT,
-				      amd->mailbox);
-	      else
-		{
-		  mu_debug (MU_DEBCAT_MAILBOX, MU_DEBUG_ERROR,
-			    ("renaming %s to %s failed: %s",
-			     cur_name, new_name, mu_strerror (rc)));
-		}
+	      mu_debug (MU_DEBCAT_MAILBOX, MU_DEBUG_ERROR,
+			("renaming %s/%s/%s to %s failed: %s",
+			 amd->name, subdir_name[old_subdir], mp->file_name,
+			 new_name, mu_strerror (rc)));
 	    }
 	}
-      if (rc)
-	mp->subdir = old_subdir;
       else
 	{
-	  free (mp->file_name);
-	  mp->file_name = strdup (strrchr (new_name, '/') + 1);
-	  if (!mp->file_name)
+	  char *p = strdup (new_base);
+	  if (!p)
 	    rc = errno;
 	  else
-	    mp->uniq_len = maildir_message_name_parse (mp->file_name,
-						       NULL, NULL, NULL);
+	    {
+	      free (mp->file_name);
+	      mp->file_name = p;
+	      mp->subdir = SUB_CUR;
+	      mp->uniq_len = maildir_message_name_parse (mp->file_name,
+							 NULL, NULL, NULL);
+	    }
 	}
       free (new_name);
     }
@@ -1882,6 +1983,8 @@ _mailbox_maildir_init (mu_mailbox_t mailbox)
   amd->message_uid = maildir_message_uid;
   amd->remove = maildir_remove;
   amd->chattr_msg = maildir_chattr_msg;
+  amd->chattr_begin = maildir_chattr_begin;
+  amd->chattr_end = maildir_chattr_end;
   amd->capabilities = MU_AMD_STATUS;
   amd->mailbox_size = maildir_size;
   
@@ -1894,6 +1997,7 @@ _mailbox_maildir_init (mu_mailbox_t mailbox)
 
   md = (struct _maildir_data *) amd;
   md->folder_fd = -1;
+  md->batch_fd[SUB_CUR] = md->batch_fd[SUB_NEW] = -1;
   
   return 0;
 }
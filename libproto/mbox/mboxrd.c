@@ -40,6 +40,7 @@
 #include <mailutils/envelope.h>
 #include <mailutils/util.h>
 #include <mailutils/cctype.h>
+#include <mailutils/msgset.h>
 #include <mailutils/sys/folder.h>
 #include <mailutils/sys/registrar.h>
 
@@ -762,6 +763,12 @@ mboxrd_rescan_unlocked (mu_mailbox_t mailbox, mu_off_t offset)
 	    {
 	      if (scan_message_finalize (dmp, dmsg, stream, n, &force_init_uids))
 		goto err;
+	      if (mailbox->flags & MU_STREAM_QACCESS)
+		{
+		  /* Quick access needs only the requested message */
+		  dmsg = NULL;
+		  goto err;
+		}
 	      if ((dmsg = scan_message_begin (dmp, stream, buf, n, ti, zn)) == NULL)
 		goto err;
 	      state = mboxrd_scan_header;
@@ -820,7 +827,7 @@ mboxrd_rescan (mu_mailbox_t mailbox, mu_off_t offset)
   pthread_cleanup_push (mboxrd_cleanup, (void *)mailbox);
 #endif
 
-  if (mailbox->locker && (rc = mu_locker_lock (mailbox->locker)))
+  if (mailbox->locker && (rc = mu_locker_lock_mode (mailbox->locker, mu_lck_shr)))
     {
       mu_monitor_unlock (mailbox->monitor);
       return rc;
@@ -1065,32 +1072,26 @@ mboxrd_quick_get_message (mu_mailbox_t mailbox, mu_message_qid_t qid,
   return mu_mboxrd_message_get (dmsg, pmsg);
 }
 
+/* Prepare the mailbox stream STREAM for appending a new message.
+   OFF is either 0 or the offset past the last byte of the last message
+   in the mailbox.  Make sure the last message is followed by an empty
+   line, and return the offset of the new message in *PSIZE. */
 static int
-mailbox_append_message (mu_mailbox_t mailbox, mu_message_t msg,
-			mu_envelope_t env, mu_attribute_t atr)
+mboxrd_append_pad (mu_stream_t stream, mu_off_t off, mu_off_t *psize)
 {
   int rc;
-  mu_off_t size;
-  mu_stream_t istr, flt;
-  static char *exclude_headers[] = {
-    MU_HEADER_X_IMAPBASE,
-    MU_HEADER_X_UID,
-    MU_HEADER_STATUS,
-    NULL
-  };
-  struct mu_mboxrd_mailbox *dmp = mailbox->data;
   
-  if (dmp->mesg_count)
+  if (off > 0)
     {
       char nl[2];
       static char pad[] = { '\n', '\n' };
       int n;
       
-      size = dmp->mesg[dmp->mesg_count-1]->message_end - 1;
-      rc = mu_stream_seek (mailbox->stream, size, MU_SEEK_SET, NULL);
+      off -= 2;
+      rc = mu_stream_seek (stream, off, MU_SEEK_SET, NULL);
       if (rc)
 	return rc;
-      rc = mu_stream_read (mailbox->stream, nl, 2, NULL);
+      rc = mu_stream_read (stream, nl, 2, NULL);
       if (rc)
 	return rc;
 
@@ -1103,16 +1104,42 @@ mailbox_append_message (mu_mailbox_t mailbox, mu_message_t msg,
 
       if (n)
 	{
-	  mu_stream_write (mailbox->stream, pad, n, NULL);
+	  rc = mu_stream_write (stream, pad, n, NULL);
+	  if (rc)
+	    return rc;
 	}
-      size += n + 2;
+      off += n + 2;
     }
   else
     {
-      size = 0;
-      rc = mu_stream_seek (mailbox->stream, size, MU_SEEK_SET, NULL);
+      rc = mu_stream_seek (stream, 0, MU_SEEK_SET, NULL);
+      if (rc)
+	return rc;
     }
-  
+  *psize = off;
+  return 0;
+}
+
+static int
+mailbox_append_message (mu_mailbox_t mailbox, mu_message_t msg,
+			mu_envelope_t env, mu_attribute_t atr)
+{
+  int rc;
+  mu_off_t size;
+  mu_stream_t istr, flt;
+  static char *exclude_headers[] = {
+    MU_HEADER_X_IMAPBASE,
+    MU_HEADER_X_UID,
+    MU_HEADER_STATUS,
+    NULL
+  };
+  struct mu_mboxrd_mailbox *dmp = mailbox->data;
+
+  rc = mboxrd_append_pad (mailbox->stream,
+			  dmp->mesg_count
+			    ? dmp->mesg[dmp->mesg_count-1]->message_end + 1
+			    : 0,
+			  &size);
   if (rc)
     return rc;
 
@@ -1278,6 +1305,203 @@ mboxrd_append_message (mu_mailbox_t mailbox, mu_message_t msg,
   return rc;
 }
 
+/* Bulk append of messages from another mboxrd mailbox.
+
+   Messages that have not been modified since the source mailbox was
+   scanned are copied verbatim: their bodies are already properly
+   escaped, so the From_ line, header and body are transferred as
+   contiguous byte ranges, without decoding and re-encoding them.  Only
+   the UID-related headers are replaced.  The destination mailbox is
+   locked and rescanned once for the entire set. */
+struct append_msgset_closure
+{
+  mu_mailbox_t mailbox;              /* Destination mailbox */
+  struct mu_mboxrd_mailbox *src;     /* Source mailbox data */
+  mu_off_t *offtab;                  /* Offsets of the appended messages */
+  size_t offcount;                   /* Number of used entries in offtab */
+};
+
+static int
+append_msgset_check (size_t n, void *data)
+{
+  struct append_msgset_closure *clos = data;
+  struct mu_mboxrd_message *dmsg;
+  
+  if (n == 0 || n > clos->src->mesg_count)
+    return MU_ERR_NOENT;
+  dmsg = clos->src->mesg[n-1];
+  if (dmsg->message && mu_message_is_modified (dmsg->message))
+    return ENOSYS;
+  return 0;
+}
+
+static int
+append_msgset_copy (size_t n, void *data)
+{
+  struct append_msgset_closure *clos = data;
+  mu_mailbox_t mailbox = clos->mailbox;
+  struct mu_mboxrd_mailbox *dmp = mailbox->data;
+  struct mu_mboxrd_message *dmsg = clos->src->mesg[n-1];
+  mu_stream_t src = clos->src->mailbox->stream;
+  mu_stream_t dst = mailbox->stream;
+  mu_off_t off;
+  int rc;
+  static char *exclude_headers[] = {
+    MU_HEADER_X_IMAPBASE,
+    MU_HEADER_X_UID,
+    NULL
+  };
+
+  if (clos->offcount == 0)
+    off = dmp->mesg_count ? dmp->mesg[dmp->mesg_count-1]->message_end + 1 : 0;
+  else
+    {
+      rc = mu_stream_seek (dst, 0, MU_SEEK_CUR, &off);
+      if (rc)
+	return rc;
+    }
+  rc = mboxrd_append_pad (dst, off, &off);
+  if (rc)
+    return rc;
+  clos->offtab[clos->offcount++] = off;
+
+  rc = mu_stream_seek (src, dmsg->message_start, MU_SEEK_SET, NULL);
+  if (rc)
+    return rc;
+  rc = mu_stream_copy (dst, src, dmsg->from_length, NULL);
+  if (rc)
+    return rc;
+  rc = mu_stream_header_copy (dst, src, exclude_headers);
+  if (rc)
+    return rc;
+
+  if (dmp->uidvalidity_scanned)
+    {
+      if (dmp->mesg_count == 0 && clos->offcount == 1)
+	mu_stream_printf (dst, "%s: %*lu %*lu\n",
+			  MU_HEADER_X_IMAPBASE,
+			  UINT_STRWIDTH (dmp->uidvalidity),
+			  dmp->uidvalidity,
+			  UINT_STRWIDTH (dmp->uidnext),
+			  dmp->uidnext);
+      mu_stream_printf (dst, "%s: %lu\n",
+			MU_HEADER_X_UID,
+			mboxrd_alloc_next_uid (dmp));
+      if (mu_stream_err (dst))
+	return mu_stream_last_error (dst);
+    }
+
+  rc = mu_stream_write (dst, "\n", 1, NULL);
+  if (rc)
+    return rc;
+
+  rc = mu_stream_seek (src, dmsg->body_start, MU_SEEK_SET, NULL);
+  if (rc)
+    return rc;
+  return mu_stream_copy_nl (dst, src,
+			    dmsg->message_end - dmsg->body_start + 1,
+			    NULL);
+}
+
+static int
+mailbox_append_msgset (mu_mailbox_t mailbox, mu_mailbox_t src,
+		       mu_msgset_t msgset)
+{
+  struct append_msgset_closure clos;
+  size_t count;
+  int rc;
+  
+  rc = mu_msgset_count (msgset, &count);
+  if (rc)
+    return rc;
+  if (count == 0)
+    return 0;
+  
+  clos.mailbox = mailbox;
+  clos.src = src->data;
+  clos.offcount = 0;
+  clos.offtab = calloc (count, sizeof (clos.offtab[0]));
+  if (!clos.offtab)
+    return ENOMEM;
+
+  rc = mu_msgset_foreach_msgno (msgset, append_msgset_copy, &clos);
+  if (rc)
+    {
+      if (clos.offcount)
+	{
+	  int rc1 = mu_stream_truncate (mailbox->stream, clos.offtab[0]);
+	  if (rc1)
+	    mu_error (_("cannot truncate stream after failed append: %s"),
+		      mu_stream_strerror (mailbox->stream, rc1));
+	}
+    }
+  else
+    {
+      rc = mboxrd_rescan_unlocked (mailbox, clos.offtab[0]);
+      if (rc == 0 && mailbox->observable)
+	{
+	  size_t i;
+	  
+	  for (i = 0; i < clos.offcount; i++)
+	    {
+	      char *buf = NULL;
+	      mu_asprintf (&buf, "%lu", (unsigned long) clos.offtab[i]);
+	      mu_observable_notify (mailbox->observable,
+				    MU_EVT_MAILBOX_MESSAGE_APPEND, buf);
+	      free (buf);
+	    }
+	}
+    }
+  free (clos.offtab);
+  return rc;
+}
+
+static int
+mboxrd_append_msgset (mu_mailbox_t mailbox, mu_mailbox_t src,
+		      mu_msgset_t msgset)
+{
+  struct mu_mboxrd_mailbox *dmp = mailbox->data;
+  struct append_msgset_closure clos;
+  int rc;
+
+  if (src == mailbox)
+    return ENOSYS;
+
+  /* Make sure all messages are available and can be copied verbatim. */
+  clos.src = src->data;
+  if (clos.src->mesg_count == 0)
+    {
+      rc = mboxrd_scan (src, 1, NULL);
+      if (rc)
+	return rc;
+    }
+  rc = mu_msgset_foreach_msgno (msgset, append_msgset_check, &clos);
+  if (rc)
+    return rc;
+  
+  rc = mboxrd_refresh (mailbox);
+  if (rc)
+    return rc;
+  
+  mu_monitor_wrlock (mailbox->monitor);
+  if (mailbox->locker && (rc = mu_locker_lock (mailbox->locker)) != 0)
+    {
+      mu_debug (MU_DEBCAT_MAILBOX, MU_DEBUG_ERROR,
+		("%s(%s):%s: %s",
+		 __func__, dmp->name, "mu_locker_lock",
+		 mu_strerror (rc)));
+    }
+  else
+    {
+      rc = mailbox_append_msgset (mailbox, src, msgset);
+
+      if (mailbox->locker)
+	mu_locker_unlock (mailbox->locker);
+    }
+  mu_monitor_unlock (mailbox->monitor);
+  return rc;
+}
+
 static int
 mboxrd_messages_count (mu_mailbox_t mailbox, size_t *pcount)
 {
@@ -1504,7 +1728,8 @@ mboxrd_flush_temp (struct mu_mboxrd_flush_tracker *trk,
     {
       struct mu_mboxrd_message *dmsg = dmp->mesg[i];
 
-      if (expunge && (dmsg->attr_flags & MU_ATTRIBUTE_DELETED))
+      if (expunge && _mu_mailbox_expunge_p (dmp->mailbox, i + 1,
+					     dmsg->attr_flags))
 	{
 	  size_t expevt[2] = { i + 1, expcount };
 
@@ -1963,8 +2188,10 @@ mu_mboxrd_mailbox_init (mu_mailbox_t mailbox)
   mailbox->_message_unseen = mboxrd_message_unseen;
 
   mailbox->_append_message = mboxrd_append_message;
+  mailbox->_append_msgset = mboxrd_append_msgset;
 
   mailbox->_expunge = mboxrd_expunge;
+  mailbox->expunge_set_ok = 1;
   mailbox->_sync = mboxrd_sync;
 
   mailbox->_get_uidvalidity = mboxrd_get_uidvalidity;
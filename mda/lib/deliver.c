@@ -15,6 +15,7 @@
    along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "libmda.h"
+#include <mailutils/sys/stream.h>
 
 static char *default_domain;
 int multiple_delivery;     /* Don't return errors when delivering to multiple
@@ -61,15 +62,12 @@ struct mu_option mda_deliver_options[] = {
   MU_OPTION_END
 };
 
-static mu_message_t
-make_tmp (const char *from)
+static mu_stream_t
+open_input (void)
 {
   int rc;
-  mu_stream_t in, out;
-  char *buf = NULL;
-  size_t size = 0, n;
-  mu_message_t mesg;
-
+  mu_stream_t in;
+  
   rc = mu_stdio_stream_create (&in, MU_STDIN_FD, MU_STREAM_READ);
   if (rc)
     {
@@ -77,31 +75,32 @@ make_tmp (const char *from)
                        "MU_STDIN_FD", rc);
       exit (EX_TEMPFAIL);
     }
+  return in;
+}
 
-  rc = mu_temp_stream_create (&out, 0);
-  if (rc)
-    {
-      mda_error (_("unable to open temporary stream: %s"), mu_strerror (rc));
-      exit (EX_TEMPFAIL);
-    }
-
-  rc = mu_stream_getline (in, &buf, &size, &n);
+/* Read the first line of the message from IN and copy it to OUT.  If it
+   is not a From_ line, output the envelope line first, using FROM as the
+   sender address.  Return the line in *PBUF (of size *PSIZE). */
+static void
+copy_first_line (mu_stream_t in, mu_stream_t out, const char *from,
+		 char **pbuf, size_t *psize)
+{
+  int rc;
+  size_t n;
+  
+  rc = mu_stream_getline (in, pbuf, psize, &n);
   if (rc)
     {
       mda_error (_("read error: %s"), mu_strerror (rc));
-      mu_stream_destroy (&in);
-      mu_stream_destroy (&out);
       exit (EX_TEMPFAIL);
     }
   if (n == 0)
     {
       mda_error (_("unexpected EOF on input"));
-      mu_stream_destroy (&in);
-      mu_stream_destroy (&out);
       exit (EX_TEMPFAIL);
     }
 
-  if (n >= 5 && memcmp (buf, "From ", 5))
+  if (n >= 5 && memcmp (*pbuf, "From ", 5))
     {
       struct mu_auth_data *auth = NULL;
       if (!from)
@@ -123,26 +122,36 @@ make_tmp (const char *from)
       else
         {
           mda_error (_("cannot determine sender address"));
-          mu_stream_destroy (&in);
-          mu_stream_destroy (&out);
           exit (EX_TEMPFAIL);
         }
       if (auth)
         mu_auth_data_free (auth);
     }
 
-  mu_stream_write (out, buf, n, NULL);
-  free (buf);
+  mu_stream_write (out, *pbuf, n, NULL);
+}
 
-  rc = mu_stream_copy (out, in, 0, NULL);
-  mu_stream_destroy (&in);
+static mu_stream_t
+open_temp (void)
+{
+  int rc;
+  mu_stream_t out;
+
+  rc = mu_temp_stream_create (&out, 0);
   if (rc)
     {
-      mda_error (_("copy error: %s"), mu_strerror (rc));
-      mu_stream_destroy (&out);
+      mda_error (_("unable to open temporary stream: %s"), mu_strerror (rc));
       exit (EX_TEMPFAIL);
     }
+  return out;
+}
 
+static mu_message_t
+temp_to_message (mu_stream_t out)
+{
+  int rc;
+  mu_message_t mesg;
+  
   rc = mu_stream_to_message (out, &mesg);
   mu_stream_destroy (&out);
   if (rc)
@@ -151,14 +160,211 @@ make_tmp (const char *from)
                     mu_strerror (rc));
       exit (EX_TEMPFAIL);
     }
+  return mesg;
+}
+
+static mu_message_t
+make_tmp (const char *from)
+{
+  int rc;
+  mu_stream_t in, out;
+  char *buf = NULL;
+  size_t size = 0;
+
+  in = open_input ();
+  out = open_temp ();
+  copy_first_line (in, out, from, &buf, &size);
+  free (buf);
+
+  rc = mu_stream_copy (out, in, 0, NULL);
+  mu_stream_destroy (&in);
+  if (rc)
+    {
+      mda_error (_("copy error: %s"), mu_strerror (rc));
+      exit (EX_TEMPFAIL);
+    }
+
+  return temp_to_message (out);
+}
+
+/* Deferred body input.
+
+   When delivering to a single recipient, the message body is not read in
+   advance.  Only the header is read and parsed, which is enough for
+   filters that don't look past it.  The body is read from the standard
+   input as the message is being stored in the mailbox, using a stream
+   that supports sequential reading only.  If the message has to be
+   accessed otherwise (a filter needs its body or size, it is forwarded,
+   etc.), mda_spool_body copies the rest of the input to a temporary
+   stream first. */
+
+struct input_body_stream
+{
+  struct _mu_stream stream;
+  mu_stream_t transport;         /* Standard input */
+};
+
+static mu_message_t input_message; /* Message with deferred body */
+static mu_stream_t input_stream;   /* Its input stream */
+
+static int
+ibs_read (struct _mu_stream *str, char *buf, size_t size, size_t *pret)
+{
+  struct input_body_stream *sp = (struct input_body_stream *) str;
+  return mu_stream_read (sp->transport, buf, size, pret);
+}
+
+static int
+ibs_seek (struct _mu_stream *str, mu_off_t off, mu_off_t *presult)
+{
+  /* Seeking to the current position is handled by mu_stream_seek.
+     Anything else is not possible. */
+  return ESPIPE;
+}
+
+static void
+ibs_done (struct _mu_stream *str)
+{
+  struct input_body_stream *sp = (struct input_body_stream *) str;
+  mu_stream_destroy (&sp->transport);
+}
+
+static int
+input_body_stream_create (mu_stream_t *pstream, mu_stream_t in)
+{
+  struct input_body_stream *sp;
+
+  sp = (struct input_body_stream *)
+         _mu_stream_create (sizeof (*sp),
+			    MU_STREAM_READ|MU_STREAM_SEEK|_MU_STR_OPEN);
+  if (!sp)
+    return ENOMEM;
+  sp->stream.read = ibs_read;
+  sp->stream.seek = ibs_seek;
+  sp->stream.done = ibs_done;
+  mu_stream_ref (in);
+  sp->transport = in;
+  *pstream = (mu_stream_t) sp;
+  return 0;
+}
+
+static int
+input_body_size (mu_body_t body, size_t *psize)
+{
+  return ENOSYS;
+}
+
+static int
+is_empty_line (char const *buf)
+{
+  return buf[0] == '\n' || (buf[0] == '\r' && buf[1] == '\n');
+}
+
+static mu_message_t
+make_deferred (const char *from)
+{
+  int rc;
+  mu_stream_t in, out, str;
+  char *buf = NULL;
+  size_t size = 0, n;
+  mu_message_t mesg;
+  mu_body_t body;
+  
+  in = open_input ();
+  out = open_temp ();
+  copy_first_line (in, out, from, &buf, &size);
+
+  while (!is_empty_line (buf))
+    {
+      rc = mu_stream_getline (in, &buf, &size, &n);
+      if (rc)
+	{
+	  mda_error (_("read error: %s"), mu_strerror (rc));
+	  exit (EX_TEMPFAIL);
+	}
+      if (n == 0)
+	break;
+      mu_stream_write (out, buf, n, NULL);
+    }
+  free (buf);
+
+  mesg = temp_to_message (out);
+
+  rc = input_body_stream_create (&str, in);
+  if (rc)
+    {
+      mda_error (_("cannot create input stream: %s"), mu_strerror (rc));
+      exit (EX_TEMPFAIL);
+    }
+  mu_message_get_body (mesg, &body);
+  mu_body_set_stream (body, str, mesg);
+  mu_body_set_size (body, input_body_size, mesg);
 
+  input_message = mesg;
+  input_stream = in;
   return mesg;
 }
 
+/* If the body of MSG has not been read yet, copy it to a temporary
+   stream, so that the message can be accessed randomly. */
+int
+mda_spool_body (mu_message_t msg)
+{
+  int rc;
+  mu_stream_t str;
+  mu_body_t body;
+
+  if (!input_stream || msg != input_message)
+    return 0;
+
+  rc = mu_temp_stream_create (&str, 0);
+  if (rc == 0)
+    {
+      rc = mu_stream_copy (str, input_stream, 0, NULL);
+      if (rc == 0)
+	{
+	  mu_message_get_body (msg, &body);
+	  mu_body_set_stream (body, str, msg);
+	  mu_body_set_size (body, NULL, msg);
+	}
+      else
+	mu_stream_destroy (&str);
+    }
+  mu_stream_destroy (&input_stream);
+  input_message = NULL;
+  if (rc)
+    mda_error (_("cannot spool message body: %s"), mu_strerror (rc));
+  return rc;
+}
+
+/* Discard the part of the input that has not been read.  This happens
+   if the message was discarded by a filter, or the delivery failed
+   before the body was copied.  Exiting with unread input would make
+   the sender (normally the MTA, writing to a pipe) get EPIPE and
+   consider the delivery failed regardless of the exit code. */
+static void
+drain_input (void)
+{
+  char buf[512];
+  size_t n;
+
+  if (!input_stream)
+    return;
+  while (mu_stream_read (input_stream, buf, sizeof buf, &n) == 0 && n > 0)
+    ;
+  mu_stream_destroy (&input_stream);
+  input_message = NULL;
+}
+
 int
 mda_run_delivery (mda_delivery_fn delivery_fun, int argc, char **argv)
 {
-  mu_message_t mesg = make_tmp (sender_address);
+  mu_message_t mesg;
+
+  if (argc == 1)
+    mesg = make_deferred (sender_address);
+  else
+    mesg = make_tmp (sender_address);
 
   if (multiple_delivery)
     multiple_delivery = argc > 1;
@@ -169,6 +375,7 @@ mda_run_delivery (mda_delivery_fn delivery_fun, int argc, char **argv)
       if (multiple_delivery)
         exit_code = EX_OK;
     }
+  drain_input ();
   return exit_code;
 }
 
@@ -244,7 +451,8 @@ deliver_to_mailbox (mu_mailbox_t mbox, mu_message_t msg,
 	  break;
 	  
 	default:
-	  if ((status = mu_message_size (msg, &msg_size)))
+	  if ((status = mda_spool_body (msg))
+	      || (status = mu_message_size (msg, &msg_size)))
 	    {
 	      mda_error (_("cannot get message size (input message %s): %s"),
 			    path, mu_strerror (status));
@@ -378,6 +586,13 @@ do_delivery (mu_url_t url, mu_message_t msg, const char *name, char **errp)
 	}
     }      
 
+  if (is_remote_url (url) && mda_spool_body (msg))
+    {
+      mu_url_destroy (&url);
+      mu_auth_data_free (auth);
+      return exit_code = EX_TEMPFAIL;
+    }
+  
   status = mu_mailbox_create_from_url (&mbox, url);
 
   if (status)
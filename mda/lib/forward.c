@@ -253,7 +253,12 @@ mda_forward (mu_message_t msg, struct mu_auth_data *auth)
   rc = mu_file_safety_check (filename, forward_file_checks,
 			     auth->uid, idlist);
   if (rc == 0)
-    result = process_forward (msg, filename, auth->name);
+    {
+      if (mda_spool_body (msg))
+	result = mda_forward_error;
+      else
+	result = process_forward (msg, filename, auth->name);
+    }
   else if (rc == MU_ERR_EXISTS)
     mu_diag_output (MU_DIAG_NOTICE,
 		    _("skipping forward file %s: already processed"),
@@ -109,6 +109,7 @@ void mda_filter_cfg_init (void);
 typedef int (*mda_delivery_fn) (mu_message_t, char *, char **);
 
 int mda_run_delivery (mda_delivery_fn delivery_fun, int argc, char **argv);
+int mda_spool_body (mu_message_t msg);
 int mda_deliver_to_url (mu_message_t msg, char *dest_id, char **errp);
 int mda_deliver_to_user (mu_message_t msg, char *dest_id, char **errp);
 int mda_check_quota (struct mu_auth_data *auth, mu_off_t size, mu_off_t *rest);
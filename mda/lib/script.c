@@ -232,9 +232,14 @@ apply_script (void *item, void *data)
       if (mu_script_sieve_log)
 	mu_script_log_enable (scr->scr, sd, clos->auth->name,
 			      message_id_header);
-      rc = mu_script_process_msg (scr->scr, sd, clos->msg);
-      if (rc)
-	mu_error (_("script %s failed: %s"), progfile, mu_strerror (rc));
+      if (mu_script_message_access (scr->scr, sd) & ~MU_SCRIPT_ACCESS_HEADER)
+	rc = mda_spool_body (clos->msg);
+      if (rc == 0)
+	{
+	  rc = mu_script_process_msg (scr->scr, sd, clos->msg);
+	  if (rc)
+	    mu_error (_("script %s failed: %s"), progfile, mu_strerror (rc));
+	}
       mu_script_done (scr->scr, sd);
     }
 
@@ -15,6 +15,7 @@
    along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "libmda.h"
+#include <mailutils/dbm.h>
 #include <mailutils/server.h>
 #include <mailutils/daemon.h>
 #include <tcpwrap.h>
@@ -199,6 +200,11 @@ main (int argc, char **argv)
   mu_acl_cfg_init ();
   mda_cli_capa_init ();
 
+#ifdef ENABLE_DBM
+  /* Keep the quota database open between deliveries */
+  mu_dbm_cache_set_flags (MU_DBM_CACHE_READ);
+#endif
+
   mu_m_server_create (&server, program_version);
   mu_m_server_set_conn (server, lmtp_connection);
   mu_m_server_set_prefork (server, mu_tcp_wrapper_prefork);
@@ -723,12 +729,22 @@ lmtp_loop (mu_stream_t iostr, unsigned int timeout)
   enum lmtp_state state = state_init;
 
   lmtp_reply (iostr, "220", NULL, "At your service");
-  while (to_fgets (iostr, &buf, &size, &n, timeout) == 0 && n)
+  while (1)
     {
       char *sp;
-      struct command_tab *cp = getcmd (buf, &sp);
-      enum lmtp_command cmd = cp->cmd_code;
-      enum lmtp_state next_state = transtab[cmd][state];
+      struct command_tab *cp;
+      enum lmtp_command cmd;
+      enum lmtp_state next_state;
+
+#ifdef ENABLE_DBM
+      /* Don't hold database locks while waiting for the client */
+      mu_dbm_cache_release ();
+#endif
+      if (to_fgets (iostr, &buf, &size, &n, timeout) || n == 0)
+	break;
+      cp = getcmd (buf, &sp);
+      cmd = cp->cmd_code;
+      next_state = transtab[cmd][state];
 
       mu_rtrim_class (sp, MU_CTYPE_ENDLN);
 
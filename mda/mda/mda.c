@@ -15,6 +15,7 @@
    along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "libmda.h"
+#include <mailutils/dbm.h>
 
 static void
 set_stderr (struct mu_parseopt *po, struct mu_option *opt, char const *arg)
@@ -115,6 +116,11 @@ main (int argc, char **argv)
   /* Parse command line */
   mda_cli_capa_init ();
 
+#ifdef ENABLE_DBM
+  /* Keep the quota database open between deliveries */
+  mu_dbm_cache_set_flags (MU_DBM_CACHE_READ);
+#endif
+
   pohint.po_flags = 0;
   
   pohint.po_package_name = PACKAGE_NAME;
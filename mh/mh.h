@@ -178,6 +178,15 @@ void mh_fvm_set_format (mh_fvm_t fvm, mh_format_t fmt);
 
 void mh_fvm_run (mh_fvm_t fvm, mu_message_t msg);
 
+#define MH_FVM_FINGERPRINT_SIZE 33
+int mh_fvm_fingerprint (mh_fvm_t fvm, char buf[MH_FVM_FINGERPRINT_SIZE]);
+
+typedef struct mh_scan_cache *mh_scan_cache_t;
+int mh_scan_cache_open (mh_scan_cache_t *pcache, mu_mailbox_t mbox,
+			mh_fvm_t fvm);
+void mh_scan_cache_run (mh_scan_cache_t cache, mu_message_t msg);
+void mh_scan_cache_close (mh_scan_cache_t *pcache, int complete);
+
 int mh_format_str (mh_format_t fmt, char *str, size_t width, char **pret);
 
 void mh_format_dump_code (mh_format_t fmt);
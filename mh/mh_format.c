@@ -20,6 +20,7 @@
 #include <mh_format.h>
 #include <mailutils/mime.h>
 #include <mailutils/opool.h>
+#include <mailutils/md5.h>
 
 #include <string.h>
 #include <ctype.h>
@@ -1835,7 +1836,7 @@ mh_builtin_t builtin_tab[] = {
   { "strlen",   builtin_strlen,   mhtype_num,  mhtype_none },
   { "width",    builtin_width,    mhtype_num,  mhtype_none },
   { "charleft", builtin_charleft, mhtype_num,  mhtype_none },
-  { "timenow",  builtin_timenow,  mhtype_num,  mhtype_none },
+  { "timenow",  builtin_timenow,  mhtype_num,  mhtype_none, MHA_VOLATILE },
   { "me",       builtin_me,       mhtype_str,  mhtype_none },
   { "myhost",   builtin_myhost,   mhtype_str,  mhtype_none },
   { "myname",   builtin_myname,   mhtype_str,  mhtype_none },
@@ -1851,8 +1852,8 @@ mh_builtin_t builtin_tab[] = {
   { "modulo",   builtin_modulo,   mhtype_num,  mhtype_num,  MHA_LITERAL },
   { "num",      NULL,             mhtype_num,  mhtype_num,  MHA_LITERAL|MHA_OPTARG|MHA_OPTARG_NIL|MHA_SPECIAL },
   { "lit",      NULL,             mhtype_str,  mhtype_str,  MHA_LITERAL|MHA_OPTARG|MHA_OPTARG_NIL|MHA_SPECIAL },
-  { "getenv",   builtin_getenv,   mhtype_str,  mhtype_str,  MHA_LITERAL },
-  { "profile",  builtin_profile,  mhtype_str,  mhtype_str,  MHA_LITERAL },
+  { "getenv",   builtin_getenv,   mhtype_str,  mhtype_str,  MHA_LITERAL|MHA_VOLATILE },
+  { "profile",  builtin_profile,  mhtype_str,  mhtype_str,  MHA_LITERAL|MHA_VOLATILE },
   { "nonzero",  builtin_nonzero,  mhtype_num,  mhtype_num,  MHA_OPTARG },
   { "zero",     builtin_zero,     mhtype_num,  mhtype_num,  MHA_OPTARG },
   { "null",     builtin_null,     mhtype_num,  mhtype_str,  MHA_OPTARG },
@@ -1884,7 +1885,7 @@ mh_builtin_t builtin_tab[] = {
   { "date2gmt", builtin_date2gmt, mhtype_none,  mhtype_str },
   { "dst",      builtin_dst,      mhtype_num,  mhtype_str },
   { "clock",    builtin_clock,    mhtype_num,  mhtype_str },
-  { "rclock",   builtin_rclock,   mhtype_num,  mhtype_str },
+  { "rclock",   builtin_rclock,   mhtype_num,  mhtype_str, MHA_VOLATILE },
   { "tws",      builtin_tws,      mhtype_str,  mhtype_str },
   { "pretty",   builtin_pretty,   mhtype_str,  mhtype_str },
   { "nodate",   builtin_nodate,   mhtype_num,  mhtype_str },
@@ -1931,16 +1932,23 @@ mh_lookup_builtin (char *name, size_t len)
   return NULL;
 }
 
-char *
-_get_builtin_name (mh_builtin_fp ptr)
+static mh_builtin_t *
+lookup_builtin_fun (mh_builtin_fp ptr)
 {
   mh_builtin_t *bp;
 
   for (bp = builtin_tab; bp->name; bp++)
     if (bp->fun == ptr)
-      return bp->name;
+      return bp;
   return NULL;
 }
+
+char *
+_get_builtin_name (mh_builtin_fp ptr)
+{
+  mh_builtin_t *bp = lookup_builtin_fun (ptr);
+  return bp ? bp->name : NULL;
+}
 
 /* Label array is used when disassembling the code, in order to create.
    meaningful label names.  The array elements starting from index 1 keep
@@ -2355,6 +2363,132 @@ mh_fvm_set_format (mh_fvm_t fvm, mh_format_t fmt)
   size_t sz = fmt->progcnt * sizeof (fvm->prog[0]);
   fvm->prog = mu_realloc (fvm->prog, sz);
   memcpy (fvm->prog, fmt->prog, sz);
+  fvm->progcnt = fmt->progcnt;
+}
+
+static void
+fp_num (struct mu_md5_ctx *ctx, long n)
+{
+  mu_md5_process_bytes (&n, sizeof n, ctx);
+}
+
+static void
+fp_str (struct mu_md5_ctx *ctx, char const *s)
+{
+  if (!s)
+    s = "";
+  mu_md5_process_bytes (s, strlen (s) + 1, ctx);
+}
+
+/* Profile variables that affect the output of format programs. */
+static char const *fp_profile_vars[] = {
+  "Alternate-Mailboxes",
+  "Charset",
+  "Compress-WS",
+  "Decode-Fallback",
+  "Reply-Regex",
+  NULL
+};
+
+/* Compute a fingerprint of the format program loaded into FVM.
+
+   The fingerprint covers the program code, with builtin function
+   pointers replaced by their names so that it is stable across
+   invocations, the output width and flags, and the parts of the
+   environment that can affect the output: user's email address,
+   relevant profile variables, time zone and character type locale.
+   Messages rendered by two programs with equal fingerprints produce
+   identical output.
+
+   On success, the fingerprint is stored in BUF as a nul-terminated
+   hex string and 0 is returned.  If the program calls a builtin whose
+   result depends on something other than the message itself (such as
+   current time or an environment variable), MU_ERR_NOENT is returned
+   and BUF is not modified. */
+int
+mh_fvm_fingerprint (mh_fvm_t fvm, char buf[MH_FVM_FINGERPRINT_SIZE])
+{
+  struct mu_md5_ctx ctx;
+  unsigned char digest[MD5_DIGEST_SIZE];
+  mh_instr_t *prog = fvm->prog;
+  size_t pc;
+  int i;
+
+  mu_md5_init_ctx (&ctx);
+  for (pc = 1; pc < fvm->progcnt; )
+    {
+      mh_opcode_t opcode = MHI_OPCODE (prog[pc++]);
+      mh_builtin_t *bp;
+      
+      fp_num (&ctx, opcode);
+      switch (opcode)
+	{
+	case mhop_branch:
+	case mhop_brzn:
+	case mhop_brzs:
+	case mhop_ldbody:
+	case mhop_fmtspec:
+	  fp_num (&ctx, MHI_NUM (prog[pc++]));
+	  break;
+
+	case mhop_setn:
+	case mhop_movn:
+	case mhop_movs:
+	  fp_num (&ctx, MHI_NUM (prog[pc++]));
+	  fp_num (&ctx, MHI_NUM (prog[pc++]));
+	  break;
+
+	case mhop_sets:
+	case mhop_ldcomp:
+	  fp_num (&ctx, MHI_NUM (prog[pc]));
+	  fp_str (&ctx, MHI_STR (prog[pc + 2]));
+	  pc += 2 + MHI_NUM (prog[pc + 1]);
+	  break;
+
+	case mhop_printlit:
+	  fp_str (&ctx, MHI_STR (prog[pc + 1]));
+	  pc += 1 + MHI_NUM (prog[pc]);
+	  break;
+
+	case mhop_call:
+	  bp = lookup_builtin_fun (MHI_BUILTIN (prog[pc++]));
+	  if (!bp || (bp->flags & MHA_VOLATILE))
+	    return MU_ERR_NOENT;
+	  fp_str (&ctx, bp->name);
+	  break;
+
+	case mhop_stop:
+	case mhop_atoi:
+	case mhop_itoa:
+	case mhop_printn:
+	case mhop_prints:
+	case mhop_pushn:
+	case mhop_popn:
+	case mhop_xchgn:
+	  break;
+
+	default:
+	  abort ();
+	}
+    }
+
+  fp_num (&ctx, fvm->width);
+  fp_num (&ctx, fvm->flags);
+  fp_str (&ctx, mh_my_email ());
+  for (i = 0; fp_profile_vars[i]; i++)
+    fp_str (&ctx, mh_global_profile_get (fp_profile_vars[i], NULL));
+  fp_str (&ctx, getenv ("TZ"));
+  fp_str (&ctx, setlocale (LC_CTYPE, NULL));
+  mu_md5_finish_ctx (&ctx, digest);
+
+  for (i = 0; i < MD5_DIGEST_SIZE; i++)
+    {
+      static char xdig[] = "0123456789abcdef";
+      *buf++ = xdig[digest[i] >> 4];
+      *buf++ = xdig[digest[i] & 0xf];
+    }
+  *buf = 0;
+  return 0;
 }
 
 
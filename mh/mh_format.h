@@ -145,6 +145,8 @@ struct mh_format
 #define MHA_VOID          0x020
 #define MHA_SPECIAL       0x040
 #define MHA_ACC           0x080
+#define MHA_VOLATILE      0x100  /* Result does not depend on the message
+				    alone */
 
 typedef struct mh_builtin mh_builtin_t;
 
@@ -0,0 +1,424 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   GNU Mailutils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Mailutils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Persistent cache of formatted scan lines.
+
+   The cache is kept in the file MH_SCAN_CACHE_FILE in the folder
+   directory.  Its first line identifies the format:
+
+     MU-SCAN-CACHE 1 FINGERPRINT
+
+   where FINGERPRINT is the value returned by mh_fvm_fingerprint for
+   the format program that produced the cached lines.  It is followed
+   by one record per message:
+
+     MSGNO INODE MTIME SIZE CUR LENGTH\n
+     LENGTH bytes of formatted output
+
+   A record is valid if the message file has the same inode number,
+   modification time and size, and its "current" status is the same.
+   Otherwise, the message is formatted anew and the record is replaced.
+
+   The file is never modified in place: the updated cache is written
+   to a temporary file in the same directory, which is then renamed
+   over the old one.  Concurrent readers thus always see a complete
+   file, and of several concurrent writers the last one wins.  */
+
+#include <mh.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <inttypes.h>
+
+#define MH_SCAN_CACHE_FILE ".mu-scan-cache"
+#define MH_SCAN_CACHE_MAGIC "MU-SCAN-CACHE"
+#define MH_SCAN_CACHE_VERSION 1
+
+struct scan_entry
+{
+  size_t msgno;
+  ino_t ino;
+  time_t mtime;
+  off_t size;
+  int cur;
+  int visited;          /* Entry was used during this run */
+  size_t len;
+  char *line;
+};
+
+struct mh_scan_cache
+{
+  char *dir;            /* Folder directory */
+  char *file_name;      /* Cache file name */
+  char fingerprint[MH_FVM_FINGERPRINT_SIZE];
+  mh_fvm_t fvm;         /* Format machine */
+  mu_stream_t memstr;   /* Rendering buffer */
+  size_t cur;           /* Current message number */
+  struct scan_entry *tab;  /* Entries, sorted by message number */
+  size_t count;
+  size_t max;
+  int dirty;            /* Cache must be saved */
+};
+
+static void
+entry_free (struct scan_entry *ent)
+{
+  free (ent->line);
+}
+
+static struct scan_entry *
+cache_lookup (struct mh_scan_cache *cache, size_t msgno, size_t *ppos)
+{
+  size_t lo = 0, hi = cache->count;
+
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (cache->tab[mid].msgno == msgno)
+	return &cache->tab[mid];
+      if (cache->tab[mid].msgno < msgno)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  if (ppos)
+    *ppos = lo;
+  return NULL;
+}
+
+static struct scan_entry *
+cache_insert (struct mh_scan_cache *cache, size_t msgno)
+{
+  size_t pos;
+  struct scan_entry *ent = cache_lookup (cache, msgno, &pos);
+
+  if (ent)
+    {
+      entry_free (ent);
+      return ent;
+    }
+  if (cache->count == cache->max)
+    cache->tab = mu_2nrealloc (cache->tab, &cache->max,
+			       sizeof (cache->tab[0]));
+  if (pos < cache->count)
+    memmove (cache->tab + pos + 1, cache->tab + pos,
+	     (cache->count - pos) * sizeof (cache->tab[0]));
+  cache->count++;
+  ent = &cache->tab[pos];
+  ent->msgno = msgno;
+  return ent;
+}
+
+static void
+cache_clear (struct mh_scan_cache *cache)
+{
+  size_t i;
+
+  for (i = 0; i < cache->count; i++)
+    entry_free (&cache->tab[i]);
+  cache->count = 0;
+}
+
+/* Load cache entries from the file.  Return 0 if the file was
+   read successfully and was created by the same format program. */
+static int
+cache_load (struct mh_scan_cache *cache)
+{
+  mu_stream_t str;
+  char *buf = NULL;
+  size_t size = 0, n;
+  int rc;
+  char *p;
+
+  rc = mu_file_stream_create (&str, cache->file_name, MU_STREAM_READ);
+  if (rc)
+    return rc;
+
+  rc = mu_stream_getline (str, &buf, &size, &n);
+  if (rc == 0)
+    {
+      size_t len = sizeof (MH_SCAN_CACHE_MAGIC) - 1;
+      unsigned long version;
+
+      if (n == 0 || strncmp (buf, MH_SCAN_CACHE_MAGIC " ", len + 1))
+	rc = MU_ERR_PARSE;
+      else if ((version = strtoul (buf + len + 1, &p, 10))
+	       != MH_SCAN_CACHE_VERSION
+	       || *p != ' '
+	       || strcmp (mu_str_stripws (p + 1), cache->fingerprint))
+	rc = MU_ERR_PARSE;
+    }
+
+  while (rc == 0)
+    {
+      uintmax_t msgno, ino, len;
+      intmax_t mtime, fsize;
+      int cur;
+      struct scan_entry *ent;
+
+      rc = mu_stream_getline (str, &buf, &size, &n);
+      if (rc || n == 0)
+	break;
+      if (sscanf (buf, "%ju %ju %jd %jd %d %ju",
+		  &msgno, &ino, &mtime, &fsize, &cur, &len) != 6)
+	{
+	  rc = MU_ERR_PARSE;
+	  break;
+	}
+
+      ent = cache_insert (cache, msgno);
+      ent->ino = ino;
+      ent->mtime = mtime;
+      ent->size = fsize;
+      ent->cur = cur;
+      ent->visited = 0;
+      ent->len = len;
+      ent->line = mu_alloc (len);
+      rc = mu_stream_read (str, ent->line, len, &n);
+      if (rc == 0 && n != len)
+	rc = MU_ERR_PARSE;
+    }
+
+  free (buf);
+  mu_stream_destroy (&str);
+
+  if (rc)
+    cache_clear (cache);
+  return rc;
+}
+
+/* Open the scan cache for mailbox MBOX and format machine FVM.
+   Return 0 on success.  Return MU_ERR_NOENT if the cache cannot be
+   used: either MBOX is not a MH folder, or the format program output
+   depends on something other than the message itself. */
+int
+mh_scan_cache_open (mh_scan_cache_t *pcache, mu_mailbox_t mbox,
+		    mh_fvm_t fvm)
+{
+  struct mh_scan_cache *cache;
+  mu_url_t url;
+  const char *dir;
+  int rc;
+
+  rc = mu_mailbox_get_url (mbox, &url);
+  if (rc)
+    return rc;
+  if (!mu_url_is_scheme (url, "mh"))
+    return MU_ERR_NOENT;
+  rc = mu_url_sget_path (url, &dir);
+  if (rc)
+    return rc;
+
+  cache = mu_zalloc (sizeof (*cache));
+  rc = mh_fvm_fingerprint (fvm, cache->fingerprint);
+  if (rc)
+    {
+      free (cache);
+      return rc;
+    }
+  rc = mu_memory_stream_create (&cache->memstr, MU_STREAM_RDWR);
+  if (rc)
+    {
+      free (cache);
+      return rc;
+    }
+
+  cache->dir = mu_strdup (dir);
+  cache->file_name = mh_safe_make_file_name (dir, MH_SCAN_CACHE_FILE);
+  cache->fvm = fvm;
+  mh_fvm_set_output (fvm, cache->memstr);
+  mh_mailbox_get_cur (mbox, &cache->cur);
+
+  if (cache_load (cache))
+    cache->dirty = 1;
+
+  *pcache = cache;
+  return 0;
+}
+
+static int
+message_stat (struct mh_scan_cache *cache, size_t msgno, struct stat *st)
+{
+  char *name;
+  int rc;
+
+  name = mh_safe_make_file_name (cache->dir, mu_umaxtostr (0, msgno));
+  rc = stat (name, st);
+  free (name);
+  return rc;
+}
+
+/* Format the message MSG using the cache and print the result to
+   the standard output. */
+void
+mh_scan_cache_run (mh_scan_cache_t cache, mu_message_t msg)
+{
+  size_t msgno;
+  struct stat st;
+  struct scan_entry *ent;
+  int cur;
+  mu_off_t size;
+  char *line;
+
+  mh_message_number (msg, &msgno);
+  cur = msgno == cache->cur;
+  if (message_stat (cache, msgno, &st) == 0)
+    {
+      ent = cache_lookup (cache, msgno, NULL);
+      if (ent
+	  && ent->ino == st.st_ino
+	  && ent->mtime == st.st_mtime
+	  && ent->size == st.st_size
+	  && ent->cur == cur)
+	{
+	  ent->visited = 1;
+	  mu_stream_write (mu_strout, ent->line, ent->len, NULL);
+	  return;
+	}
+    }
+  else
+    st.st_ino = 0;
+
+  MU_ASSERT (mu_stream_truncate (cache->memstr, 0));
+  MU_ASSERT (mu_stream_seek (cache->memstr, 0, MU_SEEK_SET, NULL));
+  mh_fvm_run (cache->fvm, msg);
+  MU_ASSERT (mu_stream_size (cache->memstr, &size));
+  line = mu_alloc (size);
+  MU_ASSERT (mu_stream_seek (cache->memstr, 0, MU_SEEK_SET, NULL));
+  MU_ASSERT (mu_stream_read (cache->memstr, line, size, NULL));
+  mu_stream_write (mu_strout, line, size, NULL);
+
+  if (st.st_ino == 0)
+    {
+      /* Message file not found: don't cache */
+      free (line);
+      return;
+    }
+
+  ent = cache_insert (cache, msgno);
+  ent->ino = st.st_ino;
+  ent->mtime = st.st_mtime;
+  ent->size = st.st_size;
+  ent->cur = cur;
+  ent->visited = 1;
+  ent->len = size;
+  ent->line = line;
+  cache->dirty = 1;
+}
+
+static int
+cache_write (struct mh_scan_cache *cache, mu_stream_t str, int complete)
+{
+  size_t i;
+  int rc;
+
+  rc = mu_stream_printf (str, "%s %d %s\n", MH_SCAN_CACHE_MAGIC,
+			 MH_SCAN_CACHE_VERSION, cache->fingerprint);
+  for (i = 0; rc == 0 && i < cache->count; i++)
+    {
+      struct scan_entry *ent = &cache->tab[i];
+
+      if (complete && !ent->visited)
+	continue;
+      rc = mu_stream_printf (str, "%zu %ju %jd %jd %d %zu\n",
+			     ent->msgno, (uintmax_t) ent->ino,
+			     (intmax_t) ent->mtime, (intmax_t) ent->size,
+			     ent->cur, ent->len);
+      if (rc == 0)
+	rc = mu_stream_write (str, ent->line, ent->len, NULL);
+    }
+  if (rc == 0)
+    rc = mu_stream_flush (str);
+  return rc;
+}
+
+static void
+cache_save (struct mh_scan_cache *cache, int complete)
+{
+  struct mu_tempfile_hints hints;
+  char *tmpname;
+  mu_stream_t str;
+  int fd;
+  int rc;
+
+  hints.tmpdir = cache->dir;
+  rc = mu_tempfile (&hints, MU_TEMPFILE_TMPDIR, &fd, &tmpname);
+  if (rc)
+    {
+      /* Read-only folders are not an error */
+      if (rc != EACCES && rc != EROFS && rc != EPERM)
+	mu_diag_funcall (MU_DIAG_WARNING, "mu_tempfile", cache->dir, rc);
+      return;
+    }
+
+  rc = mu_fd_stream_create (&str, tmpname, fd, MU_STREAM_WRITE);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_WARNING, "mu_fd_stream_create", tmpname, rc);
+      close (fd);
+    }
+  else
+    {
+      rc = cache_write (cache, str, complete);
+      if (rc)
+	mu_diag_funcall (MU_DIAG_WARNING, "cache_write", tmpname, rc);
+      mu_stream_destroy (&str);
+    }
+
+  if (rc == 0 && rename (tmpname, cache->file_name))
+    {
+      rc = errno;
+      mu_diag_funcall (MU_DIAG_WARNING, "rename", cache->file_name, rc);
+    }
+  if (rc)
+    unlink (tmpname);
+  free (tmpname);
+}
+
+/* Close the cache, saving it if it was modified.  If COMPLETE is
+   true, all messages in the folder have been formatted during this
+   run, so the entries that were not used belong to the messages that
+   no longer exist and are discarded. */
+void
+mh_scan_cache_close (mh_scan_cache_t *pcache, int complete)
+{
+  struct mh_scan_cache *cache;
+  size_t i;
+
+  if (!pcache || !*pcache)
+    return;
+  cache = *pcache;
+
+  if (complete && !cache->dirty)
+    {
+      for (i = 0; i < cache->count; i++)
+	if (!cache->tab[i].visited)
+	  {
+	    cache->dirty = 1;
+	    break;
+	  }
+    }
+  if (cache->dirty)
+    cache_save (cache, complete);
+
+  mh_fvm_set_output (cache->fvm, mu_strout);
+  mu_stream_destroy (&cache->memstr);
+  cache_clear (cache);
+  free (cache->tab);
+  free (cache->file_name);
+  free (cache->dir);
+  free (cache);
+  *pcache = NULL;
+}
@@ -29,6 +29,7 @@ static char prog_doc[] = N_("Produce a one line per message scan listing");
 static char args_doc[] = N_("[MSGLIST]");
 
 static int clear;
+static int use_cache;
 
 static int width;
 static int reverse;
@@ -36,9 +37,13 @@ static int header;
 
 static mh_format_t format;
 static mh_fvm_t fvm;
+static mh_scan_cache_t cache;
 static mu_msgset_t msgset;
 
 static struct mu_option options[] = {
+  { "cache",   0, NULL, MU_OPTION_DEFAULT,
+    N_("keep formatted lines in a per-folder cache"),
+    mu_c_bool, &use_cache },
   { "clear",   0, NULL, MU_OPTION_DEFAULT,
     N_("clear screen after displaying the list"),
     mu_c_bool, &clear },
@@ -66,11 +71,20 @@ static struct mu_option options[] = {
 static void print_header (mu_mailbox_t mbox);
 static void clear_screen (void);
 
+static void
+scan_message (mu_message_t msg)
+{
+  if (cache)
+    mh_scan_cache_run (cache, msg);
+  else
+    mh_fvm_run (fvm, msg);
+}
+
 static int
 list_message (size_t num MU_ARG_UNUSED, mu_message_t msg,
 	      void *data MU_ARG_UNUSED)
 {
-  mh_fvm_run (fvm, msg);
+  scan_message (msg);
   return 0;
 }
 
@@ -87,7 +101,7 @@ action (mu_observer_t o, size_t type, void *data, void *action_data)
       mbox = mu_observer_get_owner (o);
       counter++;
       mu_mailbox_get_message (mbox, counter, &msg);
-      mh_fvm_run (fvm, msg);
+      scan_message (msg);
     }
   return 0;
 }
@@ -98,6 +112,7 @@ main (int argc, char **argv)
   mu_mailbox_t mbox;
   int status;
   size_t total = 0;
+  int all;
   
   mh_getopt (&argc, &argv, options, MH_GETOPT_DEFAULT_FOLDER,
 	     args_doc, prog_doc, NULL);
@@ -111,7 +126,15 @@ main (int argc, char **argv)
   
   mbox = mh_open_folder (mh_current_folder (), MU_STREAM_READ);
 
-  if ((argc == 0 || strcmp (argv[0], "all") == 0) && !reverse)
+  if (use_cache)
+    {
+      int rc = mh_scan_cache_open (&cache, mbox, fvm);
+      if (rc && rc != MU_ERR_NOENT)
+	mu_diag_funcall (MU_DIAG_WARNING, "mh_scan_cache_open", NULL, rc);
+    }
+
+  all = argc == 0 || strcmp (argv[0], "all") == 0;
+  if (all && !reverse)
     {
       /* Fast approach */
       mu_observer_t observer;
@@ -145,6 +168,7 @@ main (int argc, char **argv)
     }
 
   clear_screen ();
+  mh_scan_cache_close (&cache, all && status == 0);
   mh_fvm_destroy (&fvm);
 
   mh_global_save_state ();
@@ -20,6 +20,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <signal.h>
+#include <errno.h>
 
 static char prog_doc[] = N_("Sort GNU MH messages");
 static char args_doc[] = N_("[MSGLIST]");
@@ -27,6 +28,7 @@ static char args_doc[] = N_("[MSGLIST]");
 static int limit;
 static int verbose;
 static int width;
+static int jobs;
 static mu_mailbox_t mbox;
 static const char *mbox_path;
 
@@ -44,55 +46,59 @@ enum
 
 enum
   {
+    algo_mergesort,
     algo_quicksort,
     algo_shell
   };
-static int algorithm = algo_quicksort;
+static int algorithm = algo_mergesort;
 static int action = ACTION_REORDER;
 static mh_format_t format;
 static mh_fvm_t fvm;
 
-typedef int (*compfun) (void *, void *);
-static void addop (char const *field, compfun comp);
-static void remop (compfun comp);
-static int comp_text (void *a, void *b);
-static int comp_date (void *a, void *b);
-static int comp_number (void *a, void *b);
+enum key_type
+  {
+    KEY_DATE,
+    KEY_TEXT,
+    KEY_NUMBER
+  };
+
+static void addop (char const *field, enum key_type type);
+static void remop (enum key_type type);
 
 static void
 add_datefield (struct mu_parseopt *po, struct mu_option *opt, char const *arg)
 {
-  addop (arg, comp_date);
+  addop (arg, KEY_DATE);
 }
 
 static void
 add_numfield (struct mu_parseopt *po, struct mu_option *opt, char const *arg)
 {
-  addop (arg, comp_number);
+  addop (arg, KEY_NUMBER);
 }
 
 static void
 add_textfield (struct mu_parseopt *po, struct mu_option *opt, char const *arg)
 {
-  addop (arg, comp_text);
+  addop (arg, KEY_TEXT);
 }
 
 static void
 rem_datefield (struct mu_parseopt *po, struct mu_option *opt, char const *arg)
 {
-  remop (comp_date);
+  remop (KEY_DATE);
 }
 
 static void
 rem_numfield (struct mu_parseopt *po, struct mu_option *opt, char const *arg)
 {
-  remop (comp_number);
+  remop (KEY_NUMBER);
 }
 
 static void
 rem_textfield (struct mu_parseopt *po, struct mu_option *opt, char const *arg)
 {
-  remop (comp_text);
+  remop (KEY_TEXT);
 }
 
 static void
@@ -132,6 +138,33 @@ set_algo_quicksort (struct mu_parseopt *po, struct mu_option *opt,
   algorithm = algo_quicksort;
 }
 
+static void
+set_algo_mergesort (struct mu_parseopt *po, struct mu_option *opt,
+		    char const *arg)
+{
+  algorithm = algo_mergesort;
+}
+
+static void
+set_jobs (struct mu_parseopt *po, struct mu_option *opt, char const *arg)
+{
+  char *errmsg;
+  int rc = mu_str_to_c (arg, opt->opt_type, opt->opt_ptr, &errmsg);
+  if (rc == 0 && jobs < 1)
+    {
+      mu_parseopt_error (po, _("%s%s: must be a positive number"),
+			 po->po_long_opt_start, opt->opt_long);
+      exit (po->po_exit_error);
+    }
+  else if (rc)
+    {
+      mu_parseopt_error (po, "%s%s: %s", po->po_long_opt_start,
+			 opt->opt_long, errmsg ? errmsg : mu_strerror (rc));
+      free (errmsg);
+      exit (po->po_exit_error);
+    }
+}
+
 static struct mu_option options[] = {
   { "width",   0, N_("NUMBER"), MU_OPTION_DEFAULT,
     N_("set output width (for -list)"),
@@ -183,6 +216,9 @@ static struct mu_option options[] = {
   { "verbose",  0, NULL,   MU_OPTION_DEFAULT,
     N_("verbosely list executed actions"),
     mu_c_bool, &verbose },
+  { "jobs",     0, N_("NUMBER"), MU_OPTION_DEFAULT,
+    N_("extract sort keys using NUMBER parallel processes"),
+    mu_c_int, &jobs, set_jobs },
 
   MU_OPTION_GROUP (N_("Select sort algorithm:")),
   { "shell",    0, NULL,   MU_OPTION_DEFAULT,
@@ -190,9 +226,13 @@ static struct mu_option options[] = {
     mu_c_string, NULL, set_algo_shell },
   
   { "quicksort", 0, NULL,   MU_OPTION_DEFAULT,
-    N_("use quicksort algorithm (default)"),
+    N_("use quicksort algorithm"),
     mu_c_string, NULL, set_algo_quicksort },
 
+  { "mergesort", 0, NULL,   MU_OPTION_DEFAULT,
+    N_("use merge sort algorithm (default)"),
+    mu_c_string, NULL, set_algo_mergesort },
+
   MU_OPTION_END
 };
 
@@ -200,16 +240,16 @@ static struct mu_option options[] = {
 struct comp_op
 {
   char const *field;
-  compfun comp;
+  enum key_type type;
 };
 
 static mu_list_t oplist;
 
 static void
-addop (char const *field, compfun comp)
+addop (char const *field, enum key_type type)
 {
   struct comp_op *op = mu_alloc (sizeof (*op));
-  
+
   if (!oplist)
     {
       if (mu_list_create (&oplist))
@@ -220,14 +260,14 @@ addop (char const *field, compfun comp)
       mu_list_set_destroy_item (oplist, mu_list_free_item);
     }
   op->field = field;
-  op->comp = comp;
+  op->type = type;
   mu_list_append (oplist, op);
 }
 
 struct rem_data
 {
   struct comp_op *op;
-  compfun comp;
+  enum key_type type;
 };
 
 static int
@@ -235,98 +275,148 @@ rem_action (void *item, void *data)
 {
   struct comp_op *op = item;
   struct rem_data *d = data;
-  if (d->comp == op->comp)
+  if (d->type == op->type)
     d->op = op;
   return 0;
 }
 
 static void
-remop (compfun comp)
+remop (enum key_type type)
 {
   struct rem_data d;
-  d.comp = comp;
+  d.type = type;
   d.op = NULL;
   mu_list_foreach (oplist, rem_action, &d);
   mu_list_remove (oplist, d.op);
 }
 
-struct comp_data
+/* Sort keys are extracted from the messages once, before sorting.
+   Keys of the Ith message in msgarr occupy the entries
+   [I*opcount, (I+1)*opcount) of keytab, in the order of opv. */
+
+struct sort_key
 {
-  int r;
-  mu_message_t m[2];
+  int valid;                 /* The field is present (and parsed) */
+  union
+  {
+    time_t date;
+    long number;
+    char *text;
+  } v;
 };
 
+static struct comp_op **opv;
+static size_t opcount;
+static struct sort_key *keytab;
+
+static void
+opv_init (void)
+{
+  mu_iterator_t itr;
+  size_t i = 0;
+
+  mu_list_count (oplist, &opcount);
+  opv = mu_calloc (opcount, sizeof (opv[0]));
+  mu_list_get_iterator (oplist, &itr);
+  for (mu_iterator_first (itr); !mu_iterator_is_done (itr);
+       mu_iterator_next (itr))
+    mu_iterator_current (itr, (void**) &opv[i++]);
+  mu_iterator_destroy (&itr);
+}
+
+/*FIXME: Also used in imap4d*/
 static int
-compare_action (void *item, void *data)
+_parse_822_date (char *date, time_t * timep)
 {
-  struct comp_op *op = item;
-  struct comp_data *dp = data;
-  char *a, *ap, *b, *bp;
-  mu_header_t h;
-  
-  if (mu_message_get_header (dp->m[0], &h)
-      || mu_header_aget_value (h, op->field, &a))
-    return 0;
+  struct tm tm;
+  struct mu_timezone tz;
+  const char *p = date;
 
-  if (mu_message_get_header (dp->m[1], &h)
-      || mu_header_aget_value (h, op->field, &b))
+  if (mu_parse822_date_time (&p, date + strlen (date), &tm, &tz) == 0)
     {
-      free (a);
+      *timep = mu_datetime_to_utc (&tm, &tz);
       return 0;
     }
+  return 1;
+}
 
-  ap = a;
-  bp = b;
-  if (mu_c_strcasecmp (op->field, MU_HEADER_SUBJECT) == 0)
+static void
+extract_keys (size_t i)
+{
+  struct sort_key *kp = keytab + i * opcount;
+  mu_message_t msg;
+  mu_header_t hdr;
+  size_t j;
+
+  memset (kp, 0, opcount * sizeof (kp[0]));
+  if (mu_mailbox_get_message (mbox, msgarr[i], &msg)
+      || mu_message_get_header (msg, &hdr))
+    return;
+
+  for (j = 0; j < opcount; j++)
     {
-      if (mu_c_strncasecmp (ap, "re:", 3) == 0)
-	ap += 3;
-      if (mu_c_strncasecmp (b, "re:", 3) == 0)
-	bp += 3;
-    }
-  
-  dp->r = op->comp (ap, bp);
-  free (a);
-  free (b);
+      char *val;
 
-  return dp->r ? MU_ERR_USER0 : 0; /* go on until the difference is found */
+      if (mu_header_aget_value (hdr, opv[j]->field, &val))
+	continue;
+      switch (opv[j]->type)
+	{
+	case KEY_DATE:
+	  kp[j].valid = _parse_822_date (val, &kp[j].v.date) == 0;
+	  free (val);
+	  break;
+
+	case KEY_NUMBER:
+	  kp[j].v.number = strtol (val, NULL, 0);
+	  kp[j].valid = 1;
+	  free (val);
+	  break;
+
+	case KEY_TEXT:
+	  if (mu_c_strcasecmp (opv[j]->field, MU_HEADER_SUBJECT) == 0
+	      && mu_c_strncasecmp (val, "re:", 3) == 0)
+	    memmove (val, val + 3, strlen (val + 3) + 1);
+	  kp[j].v.text = val;
+	  kp[j].valid = 1;
+	}
+    }
 }
 
-static int
-compare_messages (mu_message_t a, mu_message_t b, size_t anum, size_t bnum)
+static void
+free_keys (size_t i)
 {
-  struct comp_data d;
+  struct sort_key *kp = keytab + i * opcount;
+  size_t j;
 
-  d.r = 0;
-  d.m[0] = a;
-  d.m[1] = b;
-  mu_list_foreach (oplist, compare_action, &d);
-  if (d.r == 0)
-    {
-      if (anum < bnum)
-	d.r = -1;
-      else if (anum > bnum)
-	d.r = 1;
-    }
-      
-  if (verbose > 1)
-    fprintf (stderr, "%d\n", d.r);
-  return d.r;
+  for (j = 0; j < opcount; j++)
+    if (opv[j]->type == KEY_TEXT && kp[j].valid)
+      {
+	free (kp[j].v.text);
+	kp[j].valid = 0;
+      }
 }
 
 static int
-comp_text (void *a, void *b)
+comp_date (time_t ta, time_t tb)
 {
-  return mu_c_strcasecmp (a, b);
+  if (ta < tb)
+    {
+      if (limit && tb - ta <= limit)
+	return 0;
+      return -1;
+    }
+  else if (ta > tb)
+    {
+      if (limit && ta - tb <= limit)
+	return 0;
+      return 1;
+    }
+  return 0;
 }
 
 static int
-comp_number (void *a, void *b)
+comp_number (long na, long nb)
 {
-  long na, nb;
-
-  na = strtol (a, NULL, 0);
-  nb = strtol (b, NULL, 0);
   if (na > nb)
     return 1;
   else if (na < nb)
@@ -334,68 +424,291 @@ comp_number (void *a, void *b)
   return 0;
 }
 
-/*FIXME: Also used in imap4d*/
+/* Compare the messages msgarr[A] and msgarr[B].  Fields that are
+   missing in any of them are ignored.  Messages with equal keys are
+   ordered by their numbers. */
 static int
-_parse_822_date (char *date, time_t * timep)
+compare_keys (size_t a, size_t b)
 {
-  struct tm tm;
-  struct mu_timezone tz;
-  const char *p = date;
+  struct sort_key *ka = keytab + a * opcount;
+  struct sort_key *kb = keytab + b * opcount;
+  size_t j;
+  int r = 0;
 
-  if (mu_parse822_date_time (&p, date + strlen (date), &tm, &tz) == 0)
+  if (verbose > 1)
+    fprintf (stderr,
+	     _("comparing messages %s and %s: "),
+	     mu_umaxtostr (0, msgarr[a]),
+	     mu_umaxtostr (1, msgarr[b]));
+
+  for (j = 0; r == 0 && j < opcount; j++)
     {
-      *timep = mu_datetime_to_utc (&tm, &tz);
-      return 0;
+      if (!ka[j].valid || !kb[j].valid)
+	continue;
+      switch (opv[j]->type)
+	{
+	case KEY_DATE:
+	  r = comp_date (ka[j].v.date, kb[j].v.date);
+	  break;
+
+	case KEY_NUMBER:
+	  r = comp_number (ka[j].v.number, kb[j].v.number);
+	  break;
+
+	case KEY_TEXT:
+	  r = mu_c_strcasecmp (ka[j].v.text, kb[j].v.text);
+	}
     }
-  return 1;
+
+  if (r == 0)
+    r = comp_number (msgarr[a], msgarr[b]);
+
+  if (verbose > 1)
+    fprintf (stderr, "%d\n", r);
+  return r;
 }
 
+
+/* ************************** Key extraction ***************************** */
+
+/* With -jobs, keys are extracted by worker processes.  Each worker
+   handles a contiguous range of msgarr and writes the keys to a
+   temporary file, from which the master reads them when the worker
+   terminates.  Keys of a failed worker are extracted serially. */
+
+struct key_worker
+{
+  pid_t pid;
+  int fd;
+  size_t start, end;
+};
+
 static int
-comp_date (void *a, void *b)
+key_write (mu_stream_t str, struct sort_key const *kp, enum key_type type)
 {
-  time_t ta, tb;
-  
-  if (_parse_822_date (a, &ta) || _parse_822_date (b, &tb))
-    return 0;
+  char c = kp->valid;
+  size_t len;
+  int rc;
 
-  if (ta < tb)
+  rc = mu_stream_write (str, &c, 1, NULL);
+  if (rc || !kp->valid)
+    return rc;
+  switch (type)
     {
-      if (limit && tb - ta <= limit)
-	return 0;
-      return -1;
+    case KEY_DATE:
+      return mu_stream_write (str, &kp->v.date, sizeof (kp->v.date), NULL);
+
+    case KEY_NUMBER:
+      return mu_stream_write (str, &kp->v.number, sizeof (kp->v.number),
+			      NULL);
+
+    case KEY_TEXT:
+      len = strlen (kp->v.text);
+      rc = mu_stream_write (str, &len, sizeof (len), NULL);
+      if (rc == 0)
+	rc = mu_stream_write (str, kp->v.text, len, NULL);
     }
-  else if (ta > tb)
+  return rc;
+}
+
+static int
+key_read_buf (mu_stream_t str, void *buf, size_t size)
+{
+  size_t n;
+  int rc = mu_stream_read (str, buf, size, &n);
+  if (rc == 0 && n != size)
+    rc = MU_ERR_PARSE;
+  return rc;
+}
+
+static int
+key_read (mu_stream_t str, struct sort_key *kp, enum key_type type)
+{
+  char c;
+  size_t len;
+  int rc;
+
+  rc = key_read_buf (str, &c, 1);
+  if (rc || !c)
+    return rc;
+  switch (type)
     {
-      if (limit && ta - tb <= limit)
-	return 0;
-      return 1;
+    case KEY_DATE:
+      rc = key_read_buf (str, &kp->v.date, sizeof (kp->v.date));
+      break;
+
+    case KEY_NUMBER:
+      rc = key_read_buf (str, &kp->v.number, sizeof (kp->v.number));
+      break;
+
+    case KEY_TEXT:
+      rc = key_read_buf (str, &len, sizeof (len));
+      if (rc)
+	break;
+      kp->v.text = mu_alloc (len + 1);
+      rc = key_read_buf (str, kp->v.text, len);
+      if (rc)
+	{
+	  free (kp->v.text);
+	  break;
+	}
+      kp->v.text[len] = 0;
     }
-  return 0;
+  if (rc == 0)
+    kp->valid = 1;
+  return rc;
 }
 
-
-/* *********************** Sorting routines ***************************** */
+static void
+key_worker_run (struct key_worker *wp)
+{
+  mu_stream_t str;
+  size_t i, j;
+  int rc;
+
+  rc = mu_fd_stream_create (&str, NULL, wp->fd, MU_STREAM_WRITE);
+  if (rc)
+    _exit (1);
+  mu_stream_set_buffer (str, mu_buffer_full, 0);
+  for (i = wp->start; i < wp->end; i++)
+    {
+      extract_keys (i);
+      for (j = 0; j < opcount; j++)
+	if (key_write (str, keytab + i * opcount + j, opv[j]->type))
+	  _exit (1);
+    }
+  if (mu_stream_flush (str))
+    _exit (1);
+  _exit (0);
+}
 
 static int
-comp0 (size_t na, size_t nb)
+key_worker_collect (struct key_worker *wp)
 {
-  mu_message_t a, b;
+  mu_stream_t str;
+  size_t i, j;
+  int status;
+  int rc;
 
-  if (mu_mailbox_get_message (mbox, na, &a)
-      || mu_mailbox_get_message (mbox, nb, &b))
-    return 0;
-  if (verbose > 1)
-    fprintf (stderr,
-	     _("comparing messages %s and %s: "),
-	     mu_umaxtostr (0, na),
-	     mu_umaxtostr (1, nb));
-  return compare_messages (a, b, na, nb);
+  if (wp->pid == -1)
+    return -1;
+  if (waitpid (wp->pid, &status, 0) != wp->pid
+      || !WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    return -1;
+  if (lseek (wp->fd, 0, SEEK_SET) == -1)
+    return -1;
+  rc = mu_fd_stream_create (&str, NULL, wp->fd, MU_STREAM_READ);
+  if (rc)
+    return -1;
+  wp->fd = -1;
+  mu_stream_set_buffer (str, mu_buffer_full, 0);
+  for (i = wp->start; rc == 0 && i < wp->end; i++)
+    for (j = 0; rc == 0 && j < opcount; j++)
+      rc = key_read (str, keytab + i * opcount + j, opv[j]->type);
+  mu_stream_destroy (&str);
+  return rc;
 }
 
-int
+static void
+extract_all_keys (void)
+{
+  size_t i;
+  struct key_worker *wtab;
+
+  opv_init ();
+  keytab = mu_calloc (msgcount * opcount, sizeof (keytab[0]));
+
+  if ((size_t) jobs > msgcount)
+    jobs = msgcount;
+  if (jobs < 2)
+    {
+      for (i = 0; i < msgcount; i++)
+	extract_keys (i);
+      return;
+    }
+
+  wtab = mu_calloc (jobs, sizeof (wtab[0]));
+  fflush (stderr);
+  for (i = 0; i < (size_t) jobs; i++)
+    {
+      struct key_worker *wp = &wtab[i];
+      int rc;
+
+      wp->start = msgcount * i / jobs;
+      wp->end = msgcount * (i + 1) / jobs;
+      wp->pid = -1;
+      rc = mu_tempfile (NULL, 0, &wp->fd, NULL);
+      if (rc)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_tempfile", NULL, rc);
+	  wp->fd = -1;
+	  continue;
+	}
+      wp->pid = fork ();
+      if (wp->pid == -1)
+	mu_diag_funcall (MU_DIAG_ERROR, "fork", NULL, errno);
+      else if (wp->pid == 0)
+	key_worker_run (wp);
+    }
+
+  for (i = 0; i < (size_t) jobs; i++)
+    {
+      struct key_worker *wp = &wtab[i];
+
+      if (key_worker_collect (wp))
+	{
+	  size_t j;
+
+	  if (wp->pid != -1)
+	    mu_error (_("worker %lu failed; extracting its keys serially"),
+		      (unsigned long) wp->pid);
+	  for (j = wp->start; j < wp->end; j++)
+	    {
+	      free_keys (j);
+	      extract_keys (j);
+	    }
+	}
+      if (wp->fd != -1)
+	close (wp->fd);
+    }
+  free (wtab);
+}
+
+
+/* *********************** Sorting routines ***************************** */
+
+/* The routines below sort the array ORDER of indices into msgarr. */
+
+static size_t *order;
+
+static int
 comp (const void *a, const void *b)
 {
-  return comp0 (* (size_t*) a, * (size_t*) b);
+  return compare_keys (* (size_t*) a, * (size_t*) b);
+}
+
+static void
+merge_sort (size_t *v, size_t *tmp, size_t n)
+{
+  size_t m, i, j, k;
+
+  if (n < 2)
+    return;
+  m = n / 2;
+  merge_sort (v, tmp, m);
+  merge_sort (v + m, tmp, n - m);
+  if (compare_keys (v[m - 1], v[m]) <= 0)
+    return;
+  memcpy (tmp, v, m * sizeof (v[0]));
+  for (i = 0, j = m, k = 0; i < m && j < n; k++)
+    {
+      if (compare_keys (v[j], tmp[i]) < 0)
+	v[k] = v[j++];
+      else
+	v[k] = tmp[i++];
+    }
+  while (i < m)
+    v[k++] = tmp[i++];
 }
 
 
@@ -425,11 +738,11 @@ shell_sort ()
 	  fprintf (stderr, _("distance %d\n"), h);
         for (j = h; j < msgcount; j++)
 	  {
-            hold = msgarr[j];
+            hold = order[j];
             for (i = j - h;
-		 i >= 0 && comp0 (hold, msgarr[i]) < 0; i -= h)
-	      msgarr[i + h] = msgarr[i];
-	    msgarr[i + h] = hold;
+		 i >= 0 && compare_keys (hold, order[i]) < 0; i -= h)
+	      order[i + h] = order[i];
+	    order[i + h] = hold;
 	  }
       }
 }
@@ -445,38 +758,13 @@ list_message (size_t num)
   mh_fvm_run (fvm, msg);
 }
 
-void
-swap_message (size_t a, size_t b)
+static void
+rename_message (char const *from, char const *to)
 {
-  char *path_a, *path_b;
-  char *tmp;
-  
-  path_a = mh_safe_make_file_name (mbox_path, mu_umaxtostr (0, a));
-  path_b = mh_safe_make_file_name (mbox_path, mu_umaxtostr (1, b));
-  tmp = mu_tempname (mbox_path);
-  rename (path_a, tmp);
-  unlink (path_a);
-  rename (path_b, path_a);
-  unlink (path_b);
-  rename (tmp, path_b);
-  free (tmp);
+  if (rename (from, to))
+    mu_diag_funcall (MU_DIAG_ERROR, "rename", from, errno);
 }
 
-void
-transpose(size_t i, size_t n)
-{
-  size_t j;
-
-  for (j = i+1; j < msgcount; j++)
-    if (msgarr[j] == n)
-      {
-	size_t t = msgarr[i];
-	msgarr[i] = msgarr[j];
-	msgarr[j] = t;
-	break;
-      }
-}
-  
 static int got_signal;
 
 RETSIGTYPE
@@ -485,17 +773,117 @@ sighandler (int sig)
   got_signal = 1;
 }
 
+/* Move the messages to their new places.  The permutation ORDER is
+   decomposed into cycles.  In each cycle, the file of the first
+   message is moved aside, the rest of the files are renamed one by one
+   into the place freed by the previous rename, and the saved file is
+   moved to the last free place.  Thus, a cycle of length N takes N+1
+   renames. */
+static void
+reorder (void)
+{
+  size_t *numv;
+  char *done;
+  size_t i, j;
+  int cur_moved = 0;
+
+  numv = mu_calloc (msgcount, sizeof (numv[0]));
+  for (i = 0; i < msgcount; i++)
+    {
+      mu_message_t msg;
+
+      mu_mailbox_get_message (mbox, msgarr[i], &msg);
+      mh_message_number (msg, &numv[i]);
+    }
+  done = mu_calloc (msgcount, 1);
+
+  /* Install signal handlers */
+  signal (SIGINT, sighandler);
+  signal (SIGQUIT, sighandler);
+  signal (SIGTERM, sighandler);
+
+  if (verbose)
+    fprintf (stderr, _("Renames:\n"));
+  for (i = 0, got_signal = 0; !got_signal && i < msgcount; i++)
+    {
+      char *tmp = NULL, *from, *to;
+
+      if (done[i] || order[i] == i)
+	continue;
+
+      if (action == ACTION_REORDER)
+	{
+	  tmp = mu_tempname (mbox_path);
+	  from = mh_safe_make_file_name (mbox_path, mu_umaxtostr (0, numv[i]));
+	  rename_message (from, tmp);
+	  free (from);
+	}
+
+      for (j = i; ; j = order[j])
+	{
+	  size_t src = order[j] == i ? i : order[j];
+
+	  done[j] = 1;
+	  if (verbose)
+	    fprintf (stderr, "%s -> %s",
+		     mu_umaxtostr (0, numv[src]),
+		     mu_umaxtostr (1, numv[j]));
+	  if (!cur_moved && numv[src] == current_num)
+	    {
+	      if (verbose)
+		fputc ('*', stderr);
+	      current_num = numv[j];
+	      cur_moved = 1;
+	    }
+	  if (verbose)
+	    fputc ('\n', stderr);
+
+	  if (action == ACTION_REORDER)
+	    {
+	      to = mh_safe_make_file_name (mbox_path,
+					   mu_umaxtostr (0, numv[j]));
+	      if (src == i)
+		rename_message (tmp, to);
+	      else
+		{
+		  from = mh_safe_make_file_name (mbox_path,
+						 mu_umaxtostr (0, numv[src]));
+		  rename_message (from, to);
+		  free (from);
+		}
+	      free (to);
+	    }
+	  if (src == i)
+	    break;
+	}
+      free (tmp);
+    }
+  free (done);
+  free (numv);
+}
+
 void
 sort (void)
 {
-  size_t *oldlist, i;
-  oldlist = mu_alloc (msgcount * sizeof (*oldlist));
-  memcpy (oldlist, msgarr, msgcount * sizeof (*oldlist));
+  size_t i;
+
+  extract_all_keys ();
+  order = mu_calloc (msgcount, sizeof (order[0]));
+  for (i = 0; i < msgcount; i++)
+    order[i] = i;
 
   switch (algorithm)
     {
+    case algo_mergesort:
+      {
+	size_t *tmp = mu_calloc (msgcount / 2 + 1, sizeof (tmp[0]));
+	merge_sort (order, tmp, msgcount);
+	free (tmp);
+      }
+      break;
+
     case algo_quicksort:
-      qsort (msgarr, msgcount, sizeof (msgarr[0]), comp);
+      qsort (order, msgcount, sizeof (order[0]), comp);
       break;
 
     case algo_shell:
@@ -507,53 +895,11 @@ sort (void)
     {
     case ACTION_LIST:
       for (i = 0; i < msgcount; i++)
-	list_message (msgarr[i]);
+	list_message (msgarr[order[i]]);
       break;
 
     default:
-      /* Install signal handlers */
-      signal (SIGINT, sighandler);
-      signal (SIGQUIT, sighandler);
-      signal (SIGTERM, sighandler);
-      
-      if (verbose)
-	fprintf (stderr, _("Transpositions:\n"));
-      for (i = 0, got_signal = 0; !got_signal && i < msgcount; i++)
-	{
-	  if (msgarr[i] != oldlist[i])
-	    {
-	      size_t old_num, new_num;
-	      mu_message_t msg;
-
-	      mu_mailbox_get_message (mbox, oldlist[i], &msg);
-	      mh_message_number (msg, &old_num);
-	      mu_mailbox_get_message (mbox, msgarr[i], &msg);
-	      mh_message_number (msg, &new_num);
-	      transpose (i, oldlist[i]);
-	      if (verbose)
-		{
-		  fprintf (stderr, "{%s, %s}",
-			   mu_umaxtostr (0, old_num),
-			   mu_umaxtostr (1, new_num));
-		}
-	      if (old_num == current_num)
-		{
-		  if (verbose)
-		    fputc ('*', stderr);
-		  current_num = new_num;
-		}
-	      else if (new_num == current_num)
-		{
-		  if (verbose)
-		    fputc ('*', stderr);
-		  current_num = old_num;
-		}
-	      if (verbose)
-		fputc ('\n', stderr);
-	      if (action == ACTION_REORDER)
-		swap_message (old_num, new_num);
-	    }
-	}
+      reorder ();
     }
   if (action == ACTION_REORDER)
     {
@@ -563,6 +909,7 @@ sort (void)
       mh_mailbox_set_cur (mbox, current_num);
     }
 }
+
 
 static int
 _add_msgno (size_t n, void *data)
@@ -607,7 +954,7 @@ main (int argc, char **argv)
 	     args_doc, prog_doc, NULL);
   
   if (!oplist)
-    addop ("date", comp_date);
+    addop ("date", KEY_DATE);
 
   if (action == ACTION_LIST)
     {
@@ -0,0 +1,319 @@
+/* This file is part of the GNU Mailutils testsuite.
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   GNU Mailutils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Mailutils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+  NAME
+    mtbench - benchmark for mime.types rule evaluation
+
+  SYNOPSIS
+    mtbench [-q] [-d DIR] [-n FILES] [-r ROUNDS] [--seed=N] MIMETYPES
+
+  DESCRIPTION
+    Generates a corpus of FILES files (default 1000) of various types:
+    PDF, PNG, JPEG, GIF, ZIP, HTML, shell scripts and plain text.  File
+    kinds are assigned in round-robin order.  Every third file of each
+    kind is created without suffix, so that it can be identified only
+    by its contents.  The contents are generated using a pseudo-random
+    generator initialized with the given seed, so the same options
+    always produce the same corpus.
+
+    The corpus is then classified ROUNDS times (default 1) using rules
+    from the file MIMETYPES.  On output, the program lists each
+    detected type along with the number of files of that type, and
+    the total time spent on classification, unless -q is given.
+
+    The corpus is created in a temporary directory, which is removed
+    upon termination, unless the -d option is given.
+
+  OPTIONS
+    -d, --directory=DIR    Create the corpus in DIR and keep it.
+    -n, --files=N          Number of files to generate.
+    -q, --quiet            Don't print timing.
+    -r, --rounds=N         Number of classification rounds.
+    --seed=N               Seed for the pseudo-random generator.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <mailutils/mailutils.h>
+#include <mailutils/mimetypes.h>
+
+static size_t file_count = 1000;
+static size_t rounds = 1;
+static unsigned long seed = 1;
+static char *corpus_dir;
+static int quiet;
+
+static struct mu_option options[] = {
+  { "directory", 'd', "DIR", MU_OPTION_DEFAULT,
+    "create the corpus in DIR and keep it",
+    mu_c_string, &corpus_dir },
+  { "files", 'n', "N", MU_OPTION_DEFAULT,
+    "number of files to generate",
+    mu_c_size, &file_count },
+  { "quiet", 'q', NULL, MU_OPTION_DEFAULT,
+    "don't print timing",
+    mu_c_bool, &quiet },
+  { "rounds", 'r', "N", MU_OPTION_DEFAULT,
+    "number of classification rounds",
+    mu_c_size, &rounds },
+  { "seed", 0, "N", MU_OPTION_DEFAULT,
+    "seed for the pseudo-random generator",
+    mu_c_ulong, &seed },
+  MU_OPTION_END
+};
+
+static unsigned long rand_state;
+
+static unsigned long
+mtbench_rand (void)
+{
+  rand_state = (rand_state * 1103515245UL + 12345UL) & 0x7fffffffUL;
+  return rand_state >> 4;
+}
+
+struct kind
+{
+  char *suffix;
+  char *magic;
+  size_t magic_len;
+  int text;
+};
+
+#define S(s) s, sizeof (s) - 1
+
+static struct kind kinds[] = {
+  { "pdf",  S("%PDF-1.4\n"), 0 },
+  { "png",  S("\x89PNG\r\n\x1a\n"), 0 },
+  { "jpg",  S("\xff\xd8\xff\xe0"), 0 },
+  { "gif",  S("GIF89a"), 0 },
+  { "zip",  S("PK\x03\x04"), 0 },
+  { "html", S("<!DOCTYPE html>\n<html>\n"), 1 },
+  { "sh",   S("#!/bin/sh\n"), 1 },
+  { "txt",  S(""), 1 }
+};
+#define NKINDS (sizeof (kinds) / sizeof (kinds[0]))
+
+static char *wordlist[] = {
+  "mail", "message", "server", "client", "folder", "header", "body",
+  "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+  "elit", "sed", "do", "eiusmod", "tempor", "incididunt"
+};
+#define NWORDS (sizeof (wordlist) / sizeof (wordlist[0]))
+
+static char *
+file_name (size_t n)
+{
+  char *name;
+  struct kind *k = &kinds[n % NKINDS];
+
+  if ((n / NKINDS) % 3 == 2)
+    mu_asprintf (&name, "%s/f%05zu", corpus_dir, n);
+  else
+    mu_asprintf (&name, "%s/f%05zu.%s", corpus_dir, n, k->suffix);
+  return name;
+}
+
+static void
+gen_file (size_t n)
+{
+  struct kind *k = &kinds[n % NKINDS];
+  char *name = file_name (n);
+  mu_stream_t str;
+  size_t size, i;
+  int rc;
+
+  rc = mu_file_stream_create (&str, name, MU_STREAM_WRITE|MU_STREAM_CREAT);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_file_stream_create", name, rc);
+      exit (1);
+    }
+  mu_stream_write (str, k->magic, k->magic_len, NULL);
+  size = mtbench_rand () % 8192 + 1;
+  if (k->text)
+    {
+      size_t col = 0;
+
+      for (i = 0; i < size; )
+	{
+	  char const *w = wordlist[mtbench_rand () % NWORDS];
+	  size_t len = strlen (w);
+
+	  if (col + len + 1 > 72)
+	    {
+	      mu_stream_write (str, "\n", 1, NULL);
+	      col = 0;
+	    }
+	  else if (col)
+	    {
+	      mu_stream_write (str, " ", 1, NULL);
+	      col++;
+	    }
+	  mu_stream_write (str, w, len, NULL);
+	  col += len;
+	  i += len + 1;
+	}
+      mu_stream_write (str, "\n", 1, NULL);
+    }
+  else
+    {
+      for (i = 0; i < size; i++)
+	{
+	  char c = mtbench_rand ();
+	  mu_stream_write (str, &c, 1, NULL);
+	}
+    }
+  mu_stream_destroy (&str);
+  free (name);
+}
+
+struct type_count
+{
+  char const *type;
+  size_t count;
+};
+
+static struct type_count *type_tab;
+static size_t type_max, type_num;
+
+static void
+type_count_add (char const *type)
+{
+  size_t i;
+
+  if (!type)
+    type = "unknown";
+  for (i = 0; i < type_num; i++)
+    if (strcmp (type_tab[i].type, type) == 0)
+      {
+	type_tab[i].count++;
+	return;
+      }
+  if (type_num == type_max)
+    type_tab = mu_2nrealloc (type_tab, &type_max, sizeof (type_tab[0]));
+  type_tab[type_num].type = type;
+  type_tab[type_num].count = 1;
+  type_num++;
+}
+
+static int
+type_count_cmp (const void *a, const void *b)
+{
+  struct type_count const *ta = a;
+  struct type_count const *tb = b;
+  return strcmp (ta->type, tb->type);
+}
+
+int
+main (int argc, char **argv)
+{
+  mu_mimetypes_t mt;
+  int keep;
+  size_t i, r;
+  char **names;
+  struct timeval start, stop;
+  double elapsed;
+
+  mu_cli_simple (argc, argv,
+                 MU_CLI_OPTION_OPTIONS, options,
+		 MU_CLI_OPTION_PROG_DOC, "mime.types benchmark",
+		 MU_CLI_OPTION_PROG_ARGS, "MIMETYPES",
+		 MU_CLI_OPTION_RETURN_ARGC, &argc,
+		 MU_CLI_OPTION_RETURN_ARGV, &argv,
+		 MU_CLI_OPTION_END);
+
+  if (argc != 1)
+    {
+      mu_error ("bad arguments; try %s --help for more info", mu_program_name);
+      return 1;
+    }
+
+  mt = mu_mimetypes_open (argv[0]);
+  if (!mt)
+    return 1;
+
+  keep = corpus_dir != NULL;
+  if (keep)
+    {
+      if (access (corpus_dir, F_OK) && mkdir (corpus_dir, 0755))
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mkdir", corpus_dir, errno);
+	  return 1;
+	}
+    }
+  else
+    {
+      int rc = mu_tempfile (NULL, MU_TEMPFILE_MKDIR, NULL, &corpus_dir);
+      if (rc)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_tempfile", NULL, rc);
+	  return 1;
+	}
+    }
+
+  rand_state = seed;
+  names = mu_calloc (file_count, sizeof (names[0]));
+  for (i = 0; i < file_count; i++)
+    {
+      gen_file (i);
+      names[i] = file_name (i);
+    }
+
+  gettimeofday (&start, NULL);
+  for (r = 0; r < rounds; r++)
+    {
+      for (i = 0; i < file_count; i++)
+	{
+	  char const *type = mu_mimetypes_file_type (mt, names[i]);
+	  if (r == 0)
+	    type_count_add (type);
+	}
+    }
+  gettimeofday (&stop, NULL);
+
+  qsort (type_tab, type_num, sizeof (type_tab[0]), type_count_cmp);
+  for (i = 0; i < type_num; i++)
+    mu_printf ("%s %zu\n", type_tab[i].type, type_tab[i].count);
+
+  if (!quiet)
+    {
+      elapsed = (stop.tv_sec - start.tv_sec)
+	        + (stop.tv_usec - start.tv_usec) / 1e6;
+      mu_printf ("files=%zu rounds=%zu real=%.3f rate=%.0f\n",
+		 file_count, rounds, elapsed,
+		 elapsed > 0 ? file_count * rounds / elapsed : 0);
+    }
+
+  for (i = 0; i < file_count; i++)
+    {
+      if (!keep)
+	unlink (names[i]);
+      free (names[i]);
+    }
+  free (names);
+  if (!keep)
+    rmdir (corpus_dir);
+  mu_mimetypes_close (mt);
+  return 0;
+}
@@ -24,6 +24,7 @@
 #include <pwd.h>
 #include <grp.h>
 #include <unistd.h>
+#include <errno.h>
 #include <mailutils/mailutils.h>
 #include <mailutils/tls.h>
 #include "mailutils/cli.h"
@@ -40,6 +41,7 @@ static int uidl_option;
 static int verbose_option;
 static int ignore_errors;
 static char *program_id_option;
+static char *sync_state_option;
 static size_t max_messages_option;
 static int notify;
 static int progress_meter_option;
@@ -302,6 +304,10 @@ static struct mu_option movemail_options[] = {
   { "max-messages",  0, N_("NUMBER"), MU_OPTION_DEFAULT,
     N_("process at most NUMBER messages"),
     mu_c_size, &max_messages_option },
+
+  { "sync-state",    0, N_("FILE"), MU_OPTION_DEFAULT,
+    N_("keep UIDLs of transferred messages in FILE (implies --uidl)"),
+    mu_c_string, &sync_state_option },
   
   { "notify",        0, NULL,   MU_OPTION_DEFAULT,
     N_("enable biff notification"),
@@ -379,6 +385,9 @@ struct mu_cfg_param movemail_cfg_param[] = {
   { "max-messages", mu_c_size, &max_messages_option, 0, NULL,
     N_("Copy at most <count> messages."),
     N_("count") },
+  { "sync-state", mu_c_string, &sync_state_option, 0, NULL,
+    N_("Keep UIDLs of transferred messages in this file.  Implies uidl."),
+    N_("file") },
   { "ignore-errors", mu_c_bool, &ignore_errors, 0, NULL,
     N_("Continue after an error.") },
   { "onerror", mu_cfg_callback, NULL, 0, cb_onerror,
@@ -524,12 +533,188 @@ move_message (mu_mailbox_t dst, mu_message_t msg, size_t msgno)
   return rc;
 }
 
+static mu_mailbox_t source, dest;
+
+/* Sync state.
+
+   The sync state file keeps UIDLs of the messages transferred from
+   the source mailbox.  Its first line is "source URL", where URL
+   identifies the source mailbox.  It is followed by UIDLs, one per
+   line.  When the file is present and its URL matches, the messages
+   listed in it are skipped without looking at the destination
+   mailbox.
+
+   Before transferring messages, the file is rewritten to keep only
+   the UIDLs still present in the source.  UIDLs of the transferred
+   messages are then appended to it one by one. */
+static char *sync_state_file;       /* Expanded file name */
+static char *sync_state_tmpname;    /* Name of the new state file */
+static mu_stream_t sync_state_stream;
+
+static const char *
+source_url_name (void)
+{
+  mu_url_t url;
+  const char *name;
+
+  if (mu_mailbox_get_url (source, &url) || mu_url_sget_name (url, &name))
+    return NULL;
+  return name;
+}
+
+static int
+known_add (mu_assoc_t known, char const *uidl)
+{
+  int rc = mu_assoc_install (known, uidl, NULL);
+  if (rc == MU_ERR_EXISTS)
+    rc = 0;
+  return rc;
+}
+
+/* Read the sync state file into the KNOWN set.  Return 0 on success.
+   Return 1 if the file does not exist, cannot be read or belongs to
+   another source. */
+static int
+sync_state_read (mu_assoc_t known)
+{
+  mu_stream_t str;
+  char *buf = NULL;
+  size_t size = 0, n;
+  const char *url;
+  int rc;
+  int result = 1;
+
+  rc = mu_file_stream_create (&str, sync_state_file, MU_STREAM_READ);
+  if (rc)
+    {
+      if (rc != ENOENT)
+	mu_error (_("cannot open sync state file %s: %s"),
+		  sync_state_file, mu_strerror (rc));
+      return 1;
+    }
+
+  url = source_url_name ();
+  rc = mu_stream_getline (str, &buf, &size, &n);
+  if (rc == 0 && n > 0)
+    {
+      mu_rtrim_class (buf, MU_CTYPE_ENDLN);
+      if (url && strncmp (buf, "source ", 7) == 0
+	  && strcmp (buf + 7, url) == 0)
+	{
+	  while ((rc = mu_stream_getline (str, &buf, &size, &n)) == 0
+		 && n > 0)
+	    {
+	      mu_rtrim_class (buf, MU_CTYPE_ENDLN);
+	      if (buf[0] && (rc = known_add (known, buf)) != 0)
+		break;
+	    }
+	  if (rc == 0)
+	    result = 0;
+	}
+      else
+	mu_diag_output (MU_DIAG_WARNING,
+			_("%s: sync state refers to another source; ignoring"),
+			sync_state_file);
+    }
+  if (rc)
+    mu_error (_("error reading sync state file %s: %s"),
+	      sync_state_file, mu_strerror (rc));
+  free (buf);
+  mu_stream_destroy (&str);
+  return result;
+}
+
+/* Start writing the new sync state */
+static void
+sync_state_begin (void)
+{
+  struct mu_tempfile_hints hints;
+  char *dir, *p;
+  const char *url;
+  int fd;
+  int rc;
+
+  /* The new file is created in the same directory, so that it can be
+     renamed over the old one. */
+  dir = mu_strdup (sync_state_file);
+  p = strrchr (dir, '/');
+  if (p)
+    *p = 0;
+  else
+    strcpy (dir, ".");
+  hints.tmpdir = dir;
+  rc = mu_tempfile (&hints, MU_TEMPFILE_TMPDIR, &fd, &sync_state_tmpname);
+  free (dir);
+  if (rc)
+    {
+      mu_error (_("cannot create temporary sync state file for %s: %s"),
+		sync_state_file, mu_strerror (rc));
+      exit (1);
+    }
+  rc = mu_fd_stream_create (&sync_state_stream, sync_state_tmpname, fd,
+			    MU_STREAM_WRITE);
+  if (rc)
+    {
+      mu_error (_("cannot create sync state file %s: %s"),
+		sync_state_tmpname, mu_strerror (rc));
+      close (fd);
+      unlink (sync_state_tmpname);
+      exit (1);
+    }
+  url = source_url_name ();
+  mu_stream_printf (sync_state_stream, "source %s\n", url ? url : "");
+}
+
+/* Record UIDL in the sync state */
+static void
+sync_state_add (char const *uidl)
+{
+  if (sync_state_stream && uidl)
+    {
+      mu_stream_printf (sync_state_stream, "%s\n", uidl);
+      mu_stream_flush (sync_state_stream);
+    }
+}
+
+/* Replace the sync state file with the new one.  The stream remains
+   open, so that the subsequent calls to sync_state_add update the
+   installed file. */
+static void
+sync_state_commit (void)
+{
+  int rc;
+
+  if (!sync_state_stream)
+    return;
+  rc = mu_stream_flush (sync_state_stream);
+  if (rc)
+    {
+      mu_error (_("error writing sync state file %s: %s"),
+		sync_state_file, mu_strerror (rc));
+      unlink (sync_state_tmpname);
+      exit (1);
+    }
+  if (rename (sync_state_tmpname, sync_state_file))
+    {
+      mu_error (_("cannot rename %s to %s: %s"),
+		sync_state_tmpname, sync_state_file, mu_strerror (errno));
+      unlink (sync_state_tmpname);
+      exit (1);
+    }
+  free (sync_state_tmpname);
+  sync_state_tmpname = NULL;
+}
+
 int
-movemail (mu_mailbox_t dst, mu_message_t msg, size_t msgno)
+movemail (mu_mailbox_t dst, mu_message_t msg, size_t msgno,
+	  char const *uidl)
 {
   int rc = move_message (dst, msg, msgno);
   if (rc == 0)
-    ++msg_count;
+    {
+      ++msg_count;
+      sync_state_add (uidl);
+    }
   else
     {
       app_err_count++;
@@ -570,8 +755,6 @@ compatibility_mode (mu_mailbox_t *mbx, char *source_name, char *password,
   free (tmp);
 }
 
-static mu_mailbox_t source, dest;
-
 static void
 close_mailboxes (void)
 {
@@ -725,15 +908,6 @@ switch_owner (mu_mailbox_t mbox)
       exit (1);
     }
 }
-
-static int
-_compare_uidls (const void *item, const void *value)
-{
-  const struct mu_uidl *a = item;
-  const struct mu_uidl *b = value;
-
-  return strcmp (a->uidl, b->uidl);
-}
 
 struct movemail_getvar_closure
 {
@@ -808,43 +982,61 @@ movemail_getvar (char **ret, const char *name, size_t nlen, void *data)
   return MU_WRDSE_OK;
 }
 
+static struct movemail_getvar_closure expand_closure;
+
 static void
-set_program_id (const char *source_name, const char *dest_name)
+expand_init (const char *source_name, const char *dest_name)
 {
   int rc;
-  struct mu_wordsplit ws;
-  struct movemail_getvar_closure clos;
 
-  clos.source_name = source_name;
-  clos.dest_name = dest_name;
-  rc = mu_mailbox_get_url (source, &clos.source_url);
+  expand_closure.source_name = source_name;
+  expand_closure.dest_name = dest_name;
+  rc = mu_mailbox_get_url (source, &expand_closure.source_url);
   if (rc)
     mu_diag_output (MU_DIAG_INFO,
 		    _("cannot obtain source mailbox URL: %s"),
 		    mu_strerror (rc));
-  rc = mu_mailbox_get_url (dest, &clos.dest_url);
+  rc = mu_mailbox_get_url (dest, &expand_closure.dest_url);
   if (rc)
     mu_diag_output (MU_DIAG_INFO,
 		    _("cannot obtain destination mailbox URL: %s"),
 		    mu_strerror (rc));
-  
+}
+
+/* Expand variables in STR.  Return allocated string or NULL on error. */
+static char *
+expand_string (const char *str)
+{
+  struct mu_wordsplit ws;
+  char *ret;
+
   ws.ws_getvar = movemail_getvar;
-  ws.ws_closure = &clos;
-  if (mu_wordsplit (program_id_option, &ws,
+  ws.ws_closure = &expand_closure;
+  if (mu_wordsplit (str, &ws,
 		    MU_WRDSF_NOSPLIT | MU_WRDSF_NOCMD |
 		    MU_WRDSF_GETVAR | MU_WRDSF_CLOSURE))
     {
-      mu_error (_("cannot expand line `%s': %s"), program_id_option,
+      mu_error (_("cannot expand line `%s': %s"), str,
 		mu_wordsplit_strerror (&ws));
-      return;
+      return NULL;
     }
-  
+  ret = ws.ws_wordv[0];
+  ws.ws_wordc = 0;
+  mu_wordsplit_free (&ws);
+  return ret;
+}
+
+static void
+set_program_id (void)
+{
+  char *s = expand_string (program_id_option);
+
+  if (!s)
+    return;
   /* FIXME: Don't use mu_set_program_name here, because it
      plays wise with its argument. We need a mu_set_diag_prefix
      function. */
-  mu_program_name = ws.ws_wordv[0];
-  ws.ws_wordc = 0;
-  mu_wordsplit_free (&ws);
+  mu_program_name = s;
   mu_stdstream_strerr_setup (MU_STRERR_STDERR);
 }
 
@@ -950,6 +1142,9 @@ main (int argc, char **argv)
   if (ignore_errors)
     onerror_flags |= ONERROR_SKIP|ONERROR_COUNT;
 
+  if (sync_state_option)
+    uidl_option = 1;
+
   if (!isatty (1))
     progress_meter_option = 0;
   
@@ -978,8 +1173,16 @@ main (int argc, char **argv)
   open_mailbox (&dest, dest_name,
 		MU_STREAM_APPEND | MU_STREAM_READ | MU_STREAM_CREAT, NULL);
 
+  if (program_id_option || sync_state_option)
+    expand_init (source_name, dest_name);
   if (program_id_option)
-    set_program_id (source_name, dest_name);
+    set_program_id ();
+  if (sync_state_option)
+    {
+      sync_state_file = expand_string (sync_state_option);
+      if (!sync_state_file)
+	exit (1);
+    }
 
   if (notify)
     {
@@ -1015,17 +1218,48 @@ main (int argc, char **argv)
   
   if (uidl_option)
     {
-      mu_list_t dst_uidl_list = NULL;
+      mu_assoc_t known;
 
       rc = mu_mailbox_get_uidls (source, &src_uidl_list);
       if (rc)
 	die (source, _("cannot get UIDLs"), rc);
-      rc = mu_mailbox_get_uidls (dest, &dst_uidl_list);
+
+      /* Collect UIDLs of the messages that need not be transferred.
+	 If the sync state is available, these are taken from it.
+	 Otherwise, the UIDLs of the destination mailbox are used. */
+      rc = mu_assoc_create (&known, 0);
       if (rc)
-	die (dest, _("cannot get UIDLs"), rc);
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_assoc_create", NULL, rc);
+	  exit (1);
+	}
+      if (!sync_state_file || sync_state_read (known))
+	{
+	  mu_list_t dst_uidl_list = NULL;
 
-      mu_list_set_comparator (dst_uidl_list, _compare_uidls);
-      
+	  rc = mu_mailbox_get_uidls (dest, &dst_uidl_list);
+	  if (rc)
+	    die (dest, _("cannot get UIDLs"), rc);
+	  mu_list_get_iterator (dst_uidl_list, &itr);
+	  for (mu_iterator_first (itr); !mu_iterator_is_done (itr);
+	       mu_iterator_next (itr))
+	    {
+	      struct mu_uidl *uidl;
+
+	      mu_iterator_current (itr, (void **)&uidl);
+	      if ((rc = known_add (known, uidl->uidl)) != 0)
+		{
+		  mu_diag_funcall (MU_DIAG_ERROR, "mu_assoc_install",
+				   uidl->uidl, rc);
+		  exit (1);
+		}
+	    }
+	  mu_iterator_destroy (&itr);
+	  mu_list_destroy (&dst_uidl_list);
+	}
+
+      if (sync_state_file)
+	sync_state_begin ();
       mu_list_get_iterator (src_uidl_list, &itr);
       for (mu_iterator_first (itr); !mu_iterator_is_done (itr);
 	   mu_iterator_next (itr))
@@ -1033,11 +1267,14 @@ main (int argc, char **argv)
 	  struct mu_uidl *uidl;
 	      
 	  mu_iterator_current (itr, (void **)&uidl);
-	  if (mu_list_locate (dst_uidl_list, uidl, NULL) == 0)
-	    mu_iterator_ctl (itr, mu_itrctl_delete, NULL);
+	  if (mu_assoc_lookup (known, uidl->uidl, NULL) == 0)
+	    {
+	      sync_state_add (uidl->uidl);
+	      mu_iterator_ctl (itr, mu_itrctl_delete, NULL);
+	    }
 	}
-      mu_list_destroy (&dst_uidl_list);
-      mu_list_set_comparator (src_uidl_list, NULL);
+      mu_assoc_destroy (&known);
+      sync_state_commit ();
 
       rc = mu_iterator_ctl (itr, mu_itrctl_set_direction, &reverse_order);
       if (rc)
@@ -1098,7 +1335,7 @@ main (int argc, char **argv)
 		}
 	    }
 	  progress_mark (itr);
-	  if (movemail (dest, msg, uidl->msgno))
+	  if (movemail (dest, msg, uidl->msgno, uidl->uidl))
 	    break;
 	}
     }
@@ -1143,7 +1380,7 @@ main (int argc, char **argv)
 	      continue;
 	    }
 	  
-	  if (movemail (dest, msg, msgno))
+	  if (movemail (dest, msg, msgno, NULL))
 	    break;
 	  progress_mark (itr);
 	}
@@ -0,0 +1,910 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   GNU Mailutils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Mailutils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Mailbox driver benchmark.
+
+   For each requested mailbox type, a synthetic mailbox is generated
+   from a pseudo-random sequence determined by the seed, so that the
+   same options always produce the same mailbox.  Each workload is then
+   run in a separate child process on a fresh copy of that mailbox, and
+   its resource usage is reported as a line of KEYWORD=VALUE pairs. */
+
+#if defined(HAVE_CONFIG_H)
+# include <config.h>
+#endif
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <mailutils/mailutils.h>
+#include <sysexits.h>
+#include "mu.h"
+
+char bench_docstring[] = N_("mailbox driver benchmark");
+static char bench_args_doc[] = N_("[WORKLOAD...]");
+
+static char *mailbox_types[] = { "mbox", "dotmail", "maildir", "mh", NULL };
+static int type_mask;
+
+static size_t message_count = 1000;
+static size_t message_size = 2048;
+static int mime_percent = 20;
+static unsigned long seed = 1;
+static char *bench_dir;
+static int keep_option;
+
+static void
+set_type (struct mu_parseopt *po, struct mu_option *opt, char const *arg)
+{
+  struct mu_wordsplit ws;
+  size_t i;
+
+  ws.ws_delim = ",";
+  if (mu_wordsplit (arg, &ws,
+		    MU_WRDSF_NOVAR | MU_WRDSF_NOCMD | MU_WRDSF_DELIM))
+    {
+      mu_parseopt_error (po, "mu_wordsplit: %s", mu_wordsplit_strerror (&ws));
+      exit (po->po_exit_error);
+    }
+  for (i = 0; i < ws.ws_wordc; i++)
+    {
+      int j;
+
+      for (j = 0; mailbox_types[j]; j++)
+	if (strcmp (mailbox_types[j], ws.ws_wordv[i]) == 0)
+	  break;
+      if (!mailbox_types[j])
+	{
+	  mu_parseopt_error (po, _("unsupported mailbox type: %s"),
+			     ws.ws_wordv[i]);
+	  exit (po->po_exit_error);
+	}
+      type_mask |= 1 << j;
+    }
+  mu_wordsplit_free (&ws);
+}
+
+static struct mu_option bench_options[] = {
+  { "type", 't', N_("TYPE[,TYPE...]"), MU_OPTION_DEFAULT,
+    N_("benchmark these mailbox types (mbox, dotmail, maildir, mh)"),
+    mu_c_string, NULL, set_type },
+  { "messages", 'n', N_("N"), MU_OPTION_DEFAULT,
+    N_("number of messages in the generated mailboxes"),
+    mu_c_size, &message_count },
+  { "size", 's', N_("N"), MU_OPTION_DEFAULT,
+    N_("average size of message body, in bytes"),
+    mu_c_size, &message_size },
+  { "mime", 'm', N_("PERCENT"), MU_OPTION_DEFAULT,
+    N_("percentage of multipart MIME messages"),
+    mu_c_int, &mime_percent },
+  { "seed", 0, N_("N"), MU_OPTION_DEFAULT,
+    N_("seed for the message generator"),
+    mu_c_ulong, &seed },
+  { "directory", 'd', N_("DIR"), MU_OPTION_DEFAULT,
+    N_("create mailboxes in DIR"),
+    mu_c_string, &bench_dir },
+  { "keep", 'k', NULL, MU_OPTION_DEFAULT,
+    N_("don't remove generated mailboxes"),
+    mu_c_bool, &keep_option },
+  MU_OPTION_END
+};
+
+/* Message generator */
+
+/* Linear congruential generator.  It is used instead of random(3) to
+   make the generated mailboxes independent of the C library. */
+static unsigned long rand_state;
+
+static unsigned long
+bench_rand (void)
+{
+  rand_state = (rand_state * 1103515245UL + 12345UL) & 0x7fffffffUL;
+  return rand_state >> 4;
+}
+
+static char *wordlist[] = {
+  "mail", "message", "server", "client", "folder", "header", "body",
+  "attachment", "protocol", "delivery", "address", "mailbox", "filter",
+  "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+  "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore",
+  "et", "dolore", "magna", "aliqua", "report", "meeting", "schedule",
+  "budget", "release", "patch", "review", "question"
+};
+#define NWORDS (sizeof (wordlist) / sizeof (wordlist[0]))
+
+/* Messages containing this word are matched by the search workload */
+#define NEEDLE "needle"
+
+/* Write approximately SIZE bytes of text to STR */
+static void
+gen_text (mu_stream_t str, size_t size, int needle)
+{
+  size_t total = 0, col = 0;
+
+  while (total < size)
+    {
+      char const *w = wordlist[bench_rand () % NWORDS];
+      size_t len = strlen (w);
+
+      if (needle && total >= size / 2)
+	{
+	  w = NEEDLE;
+	  len = sizeof (NEEDLE) - 1;
+	  needle = 0;
+	}
+      if (col + len + 1 > 72)
+	{
+	  mu_stream_write (str, "\n", 1, NULL);
+	  total++;
+	  col = 0;
+	  /* Occasionally emit a line that must be escaped in mbox */
+	  if (bench_rand () % 200 == 0)
+	    {
+	      mu_stream_printf (str, "From the desk of %s\n", w);
+	      total += 18 + len;
+	      continue;
+	    }
+	}
+      else if (col)
+	{
+	  mu_stream_write (str, " ", 1, NULL);
+	  total++;
+	  col++;
+	}
+      mu_stream_write (str, w, len, NULL);
+      total += len;
+      col += len;
+    }
+  mu_stream_write (str, "\n", 1, NULL);
+}
+
+/* Write base64-like data of SIZE bytes to STR */
+static void
+gen_base64 (mu_stream_t str, size_t size)
+{
+  static char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  char line[77];
+  size_t i;
+
+  while (size > 0)
+    {
+      size_t len = size < 76 ? size : 76;
+      for (i = 0; i < len; i++)
+	line[i] = alphabet[bench_rand () % 64];
+      line[i] = '\n';
+      mu_stream_write (str, line, len + 1, NULL);
+      size -= len;
+    }
+}
+
+/* Create Nth message and return it in PMSG */
+static int
+gen_message (size_t n, mu_message_t *pmsg)
+{
+  mu_stream_t str;
+  size_t size;
+  /* Dates start at 2021-01-01 00:00:00 UTC */
+  time_t t = 1609459200 + n * 97;
+  char datebuf[64];
+  unsigned long user;
+  char const *w1, *w2;
+  int rc;
+
+  rc = mu_memory_stream_create (&str, MU_STREAM_RDWR);
+  if (rc)
+    return rc;
+
+  /* Each bench_rand call is a separate statement, so that the sequence
+     does not depend on the order of evaluation of function arguments. */
+  size = message_size / 2 + bench_rand () % (message_size + 1);
+  mu_strftime (datebuf, sizeof datebuf, "%a, %d %b %Y %H:%M:%S +0000",
+	       gmtime (&t));
+  mu_stream_printf (str,
+		    "Received: from relay%lu.example.org by mx.example.net;\n"
+		    "  %s\n",
+		    bench_rand () % 10, datebuf);
+  mu_stream_printf (str, "Date: %s\n", datebuf);
+  user = bench_rand () % 100;
+  mu_stream_printf (str, "From: User %lu <user%lu@example.org>\n",
+		    user, user);
+  mu_stream_printf (str, "To: bench@example.net\n");
+  if (bench_rand () % 4 == 0)
+    mu_stream_printf (str,
+		      "Cc: list@example.net,\n"
+		      "  other%lu@example.com\n",
+		      bench_rand () % 100);
+  w1 = wordlist[bench_rand () % NWORDS];
+  w2 = wordlist[bench_rand () % NWORDS];
+  mu_stream_printf (str, "Subject: %s %s %lu%s\n", w1, w2,
+		    (unsigned long) n, n % 10 == 0 ? " " NEEDLE : "");
+  mu_stream_printf (str, "Message-ID: <%lu.%lu@bench.example.org>\n",
+		    (unsigned long) n, bench_rand ());
+
+  if ((int) (bench_rand () % 100) < mime_percent)
+    {
+      unsigned long boundary = bench_rand ();
+
+      mu_stream_printf (str,
+			"MIME-Version: 1.0\n"
+			"Content-Type: multipart/mixed; "
+			"boundary=\"bench-%lu\"\n\n", boundary);
+      mu_stream_printf (str,
+			"--bench-%lu\n"
+			"Content-Type: text/plain; charset=us-ascii\n\n",
+			boundary);
+      gen_text (str, size / 4, n % 7 == 0);
+      mu_stream_printf (str,
+			"--bench-%lu\n"
+			"Content-Type: application/octet-stream\n"
+			"Content-Disposition: attachment; "
+			"filename=\"data%lu.bin\"\n"
+			"Content-Transfer-Encoding: base64\n\n",
+			boundary, (unsigned long) n);
+      gen_base64 (str, size - size / 4);
+      mu_stream_printf (str, "--bench-%lu--\n", boundary);
+    }
+  else
+    {
+      mu_stream_printf (str, "\n");
+      gen_text (str, size, n % 7 == 0);
+    }
+
+  rc = mu_stream_to_message (str, pmsg);
+  mu_stream_unref (str);
+  return rc;
+}
+
+static int
+append_messages (mu_mailbox_t mbox, size_t start, size_t count)
+{
+  size_t i;
+  int rc = 0;
+
+  for (i = 0; i < count; i++)
+    {
+      mu_message_t msg;
+
+      rc = gen_message (start + i, &msg);
+      if (rc)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "gen_message", NULL, rc);
+	  break;
+	}
+      rc = mu_mailbox_append_message (mbox, msg);
+      mu_message_unref (msg);
+      if (rc)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_append_message", NULL,
+			   rc);
+	  break;
+	}
+    }
+  return rc;
+}
+
+static int
+open_mailbox (mu_mailbox_t *pmbox, char const *url, int flags)
+{
+  int rc;
+
+  rc = mu_mailbox_create (pmbox, url);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_create", url, rc);
+      return rc;
+    }
+  rc = mu_mailbox_open (*pmbox, flags);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_open", url, rc);
+      mu_mailbox_destroy (pmbox);
+    }
+  return rc;
+}
+
+static int
+close_mailbox (mu_mailbox_t *pmbox)
+{
+  int rc = mu_mailbox_close (*pmbox);
+  if (rc)
+    mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_close", NULL, rc);
+  mu_mailbox_destroy (pmbox);
+  return rc;
+}
+
+static int
+generate_mailbox (char const *url)
+{
+  mu_mailbox_t mbox;
+  int rc;
+
+  rc = open_mailbox (&mbox, url, MU_STREAM_RDWR | MU_STREAM_CREAT);
+  if (rc)
+    return rc;
+  rand_state = seed;
+  rc = append_messages (mbox, 1, message_count);
+  if (close_mailbox (&mbox) && rc == 0)
+    rc = 1;
+  return rc;
+}
+
+/* Workloads */
+
+typedef int (*workload_fn) (char const *url, size_t *result);
+
+/* Open and close the mailbox */
+static int
+wl_open (char const *url, size_t *result)
+{
+  mu_mailbox_t mbox;
+  int rc;
+
+  rc = open_mailbox (&mbox, url, MU_STREAM_READ);
+  if (rc)
+    return rc;
+  *result = 0;
+  return close_mailbox (&mbox);
+}
+
+/* Open the mailbox and scan it */
+static int
+wl_scan (char const *url, size_t *result)
+{
+  mu_mailbox_t mbox;
+  int rc;
+
+  rc = open_mailbox (&mbox, url, MU_STREAM_READ);
+  if (rc)
+    return rc;
+  rc = mu_mailbox_messages_count (mbox, result);
+  if (rc)
+    mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_messages_count", NULL, rc);
+  close_mailbox (&mbox);
+  return rc;
+}
+
+/* Parse headers of all messages and access every header field */
+static int
+wl_headers (char const *url, size_t *result)
+{
+  mu_mailbox_t mbox;
+  size_t i, j, count, nf, total = 0;
+  int rc;
+
+  rc = open_mailbox (&mbox, url, MU_STREAM_READ);
+  if (rc)
+    return rc;
+  mu_mailbox_messages_count (mbox, &count);
+  for (i = 1; i <= count; i++)
+    {
+      mu_message_t msg;
+      mu_header_t hdr;
+
+      if ((rc = mu_mailbox_get_message (mbox, i, &msg)) != 0
+	  || (rc = mu_message_get_header (msg, &hdr)) != 0
+	  || (rc = mu_header_get_field_count (hdr, &nf)) != 0)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_header_get_field_count", NULL,
+			   rc);
+	  break;
+	}
+      for (j = 1; j <= nf; j++)
+	{
+	  char const *s;
+	  if (mu_header_sget_field_value (hdr, j, &s) == 0)
+	    total++;
+	}
+    }
+  *result = total;
+  close_mailbox (&mbox);
+  return rc;
+}
+
+/* Find messages whose subject or body contains NEEDLE */
+static int
+wl_search (char const *url, size_t *result)
+{
+  mu_mailbox_t mbox;
+  size_t i, count, found = 0;
+  char *buf = NULL;
+  size_t size = 0, n;
+  int rc;
+
+  rc = open_mailbox (&mbox, url, MU_STREAM_READ);
+  if (rc)
+    return rc;
+  mu_mailbox_messages_count (mbox, &count);
+  for (i = 1; i <= count; i++)
+    {
+      mu_message_t msg;
+      mu_header_t hdr;
+      mu_body_t body;
+      mu_stream_t str;
+      char const *s;
+
+      if ((rc = mu_mailbox_get_message (mbox, i, &msg)) != 0
+	  || (rc = mu_message_get_header (msg, &hdr)) != 0)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_message_get_header", NULL, rc);
+	  break;
+	}
+      if (mu_header_sget_value (hdr, MU_HEADER_SUBJECT, &s) == 0
+	  && strstr (s, NEEDLE))
+	{
+	  found++;
+	  continue;
+	}
+      if ((rc = mu_message_get_body (msg, &body)) != 0
+	  || (rc = mu_body_get_streamref (body, &str)) != 0)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_body_get_streamref", NULL, rc);
+	  break;
+	}
+      while (mu_stream_getline (str, &buf, &size, &n) == 0 && n > 0)
+	if (strstr (buf, NEEDLE))
+	  {
+	    found++;
+	    break;
+	  }
+      mu_stream_destroy (&str);
+    }
+  free (buf);
+  *result = found;
+  close_mailbox (&mbox);
+  return rc;
+}
+
+/* Change flags of every other message and save the mailbox */
+static int
+wl_flags (char const *url, size_t *result)
+{
+  mu_mailbox_t mbox;
+  size_t i, count, changed = 0;
+  int rc;
+
+  rc = open_mailbox (&mbox, url, MU_STREAM_RDWR);
+  if (rc)
+    return rc;
+  mu_mailbox_messages_count (mbox, &count);
+  for (i = 1; i <= count; i += 2)
+    {
+      mu_message_t msg;
+      mu_attribute_t attr;
+
+      if ((rc = mu_mailbox_get_message (mbox, i, &msg)) != 0
+	  || (rc = mu_message_get_attribute (msg, &attr)) != 0)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_message_get_attribute", NULL,
+			   rc);
+	  break;
+	}
+      mu_attribute_set_flags (attr, MU_ATTRIBUTE_SEEN |
+			      (i % 3 == 0 ? MU_ATTRIBUTE_FLAGGED : 0));
+      changed++;
+    }
+  if (rc == 0)
+    {
+      rc = mu_mailbox_sync (mbox);
+      if (rc)
+	mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_sync", NULL, rc);
+    }
+  *result = changed;
+  close_mailbox (&mbox);
+  return rc;
+}
+
+/* Delete every third message and expunge the mailbox */
+static int
+wl_expunge (char const *url, size_t *result)
+{
+  mu_mailbox_t mbox;
+  size_t i, count, deleted = 0;
+  int rc;
+
+  rc = open_mailbox (&mbox, url, MU_STREAM_RDWR);
+  if (rc)
+    return rc;
+  mu_mailbox_messages_count (mbox, &count);
+  for (i = 1; i <= count; i += 3)
+    {
+      mu_message_t msg;
+      mu_attribute_t attr;
+
+      if ((rc = mu_mailbox_get_message (mbox, i, &msg)) != 0
+	  || (rc = mu_message_get_attribute (msg, &attr)) != 0)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_message_get_attribute", NULL,
+			   rc);
+	  break;
+	}
+      mu_attribute_set_deleted (attr);
+      deleted++;
+    }
+  if (rc == 0)
+    {
+      rc = mu_mailbox_expunge (mbox);
+      if (rc)
+	mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_expunge", NULL, rc);
+    }
+  *result = deleted;
+  close_mailbox (&mbox);
+  return rc;
+}
+
+/* Append 10% more messages to the mailbox */
+static int
+wl_append (char const *url, size_t *result)
+{
+  mu_mailbox_t mbox;
+  size_t count = message_count / 10;
+  int rc;
+
+  if (count == 0)
+    count = 1;
+  rc = open_mailbox (&mbox, url, MU_STREAM_RDWR);
+  if (rc)
+    return rc;
+  rand_state = seed + 1;
+  rc = append_messages (mbox, message_count + 1, count);
+  *result = count;
+  if (close_mailbox (&mbox) && rc == 0)
+    rc = 1;
+  return rc;
+}
+
+/* Decode the transfer encoding of the message part MSG and add the
+   number of decoded bytes to *TOTAL. */
+static int
+decode_part (mu_message_t msg, mu_stream_t null, size_t *total)
+{
+  mu_header_t hdr;
+  mu_body_t body;
+  mu_stream_t str, flt;
+  char const *encoding;
+  mu_off_t n;
+  int rc;
+
+  if ((rc = mu_message_get_header (msg, &hdr)) != 0
+      || (rc = mu_message_get_body (msg, &body)) != 0
+      || (rc = mu_body_get_streamref (body, &str)) != 0)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_body_get_streamref", NULL, rc);
+      return rc;
+    }
+  if (mu_header_sget_value (hdr, MU_HEADER_CONTENT_TRANSFER_ENCODING,
+			    &encoding))
+    encoding = "7bit";
+  rc = mu_filter_create (&flt, str, encoding, MU_FILTER_DECODE,
+			 MU_STREAM_READ);
+  mu_stream_unref (str);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_filter_create", encoding, rc);
+      return rc;
+    }
+  rc = mu_stream_copy (null, flt, 0, &n);
+  mu_stream_destroy (&flt);
+  if (rc)
+    mu_diag_funcall (MU_DIAG_ERROR, "mu_stream_copy", NULL, rc);
+  else
+    *total += n;
+  return rc;
+}
+
+/* Decode all parts of all messages, as decodemail does */
+static int
+wl_decode (char const *url, size_t *result)
+{
+  mu_mailbox_t mbox;
+  mu_stream_t null;
+  size_t i, j, count, nparts, total = 0;
+  int rc;
+
+  rc = mu_nullstream_create (&null, MU_STREAM_WRITE);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_nullstream_create", NULL, rc);
+      return rc;
+    }
+  rc = open_mailbox (&mbox, url, MU_STREAM_READ);
+  if (rc)
+    {
+      mu_stream_destroy (&null);
+      return rc;
+    }
+  mu_mailbox_messages_count (mbox, &count);
+  for (i = 1; rc == 0 && i <= count; i++)
+    {
+      mu_message_t msg, part;
+      int ismime;
+
+      if ((rc = mu_mailbox_get_message (mbox, i, &msg)) != 0)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_get_message", NULL, rc);
+	  break;
+	}
+      if (mu_message_is_multipart (msg, &ismime) == 0 && ismime
+	  && mu_message_get_num_parts (msg, &nparts) == 0)
+	{
+	  for (j = 1; rc == 0 && j <= nparts; j++)
+	    {
+	      if ((rc = mu_message_get_part (msg, j, &part)) != 0)
+		mu_diag_funcall (MU_DIAG_ERROR, "mu_message_get_part", NULL,
+				 rc);
+	      else
+		rc = decode_part (part, null, &total);
+	    }
+	}
+      else
+	rc = decode_part (msg, null, &total);
+    }
+  *result = total;
+  mu_stream_destroy (&null);
+  close_mailbox (&mbox);
+  return rc;
+}
+
+struct workload
+{
+  char const *name;
+  workload_fn fn;
+  int enabled;
+};
+
+static struct workload workloads[] = {
+  { "open",    wl_open },
+  { "scan",    wl_scan },
+  { "headers", wl_headers },
+  { "search",  wl_search },
+  { "flags",   wl_flags },
+  { "expunge", wl_expunge },
+  { "append",  wl_append },
+  { "decode",  wl_decode },
+  { NULL }
+};
+
+/* Measurement */
+
+/* Get the number of read and write system calls issued by the process.
+   Return 0 on success and -1 if this information is not available. */
+static int
+get_syscalls (unsigned long *rd, unsigned long *wr)
+{
+  FILE *fp;
+  char buf[128];
+  int n = 0;
+
+  fp = fopen ("/proc/self/io", "r");
+  if (!fp)
+    return -1;
+  while (fgets (buf, sizeof buf, fp))
+    {
+      if (strncmp (buf, "syscr:", 6) == 0)
+	{
+	  *rd = strtoul (buf + 6, NULL, 10);
+	  n++;
+	}
+      else if (strncmp (buf, "syscw:", 6) == 0)
+	{
+	  *wr = strtoul (buf + 6, NULL, 10);
+	  n++;
+	}
+    }
+  fclose (fp);
+  return n == 2 ? 0 : -1;
+}
+
+static double
+tvsec (struct timeval const *a, struct timeval const *b)
+{
+  return (double) (b->tv_sec - a->tv_sec)
+    + (double) (b->tv_usec - a->tv_usec) / 1000000;
+}
+
+/* Run the workload WL on the mailbox URL in a child process and print
+   the result. */
+static int
+run_workload (char const *type, char const *url, struct workload *wl)
+{
+  pid_t pid;
+  int status;
+
+  mu_stream_flush (mu_strout);
+  pid = fork ();
+  if (pid == -1)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "fork", NULL, errno);
+      return 1;
+    }
+
+  if (pid == 0)
+    {
+      struct timeval t0, t1;
+      struct rusage r0, r1;
+      unsigned long rd0 = 0, wr0 = 0, rd1 = 0, wr1 = 0;
+      int have_syscalls;
+      size_t result = 0;
+      int rc;
+
+      have_syscalls = get_syscalls (&rd0, &wr0) == 0;
+      getrusage (RUSAGE_SELF, &r0);
+      gettimeofday (&t0, NULL);
+      rc = wl->fn (url, &result);
+      gettimeofday (&t1, NULL);
+      getrusage (RUSAGE_SELF, &r1);
+      if (have_syscalls)
+	have_syscalls = get_syscalls (&rd1, &wr1) == 0;
+
+      if (rc)
+	_exit (EX_SOFTWARE);
+
+      mu_printf ("type=%s workload=%s messages=%zu size=%zu mime=%d"
+		 " real=%.6f user=%.6f sys=%.6f maxrss=%ld",
+		 type, wl->name, message_count, message_size, mime_percent,
+		 tvsec (&t0, &t1),
+		 tvsec (&r0.ru_utime, &r1.ru_utime),
+		 tvsec (&r0.ru_stime, &r1.ru_stime),
+		 r1.ru_maxrss);
+      if (have_syscalls)
+	mu_printf (" syscr=%lu syscw=%lu", rd1 - rd0, wr1 - wr0);
+      mu_printf (" result=%zu\n", result);
+      mu_stream_flush (mu_strout);
+      _exit (EX_OK);
+    }
+
+  if (waitpid (pid, &status, 0) != pid)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "waitpid", NULL, errno);
+      return 1;
+    }
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != EX_OK)
+    {
+      mu_error (_("%s: workload %s failed"), type, wl->name);
+      return 1;
+    }
+  return 0;
+}
+
+static int
+bench_type (char const *type)
+{
+  char *orig, *path, *orig_url, *url;
+  struct workload *wl;
+  int rc, status = 0;
+
+  orig = mu_make_file_name (bench_dir, type);
+  path = mu_make_file_name (bench_dir, "bench");
+  mu_asprintf (&orig_url, "%s:%s", type, orig);
+  mu_asprintf (&url, "%s:%s", type, path);
+
+  if (access (orig, F_OK) == 0)
+    mu_remove_file (orig);
+  rc = generate_mailbox (orig_url);
+  if (rc == 0)
+    {
+      for (wl = workloads; wl->name; wl++)
+	{
+	  if (!wl->enabled)
+	    continue;
+	  if (access (path, F_OK) == 0)
+	    mu_remove_file (path);
+	  rc = mu_copy_file (orig, path, MU_COPY_MODE);
+	  if (rc)
+	    {
+	      mu_diag_funcall (MU_DIAG_ERROR, "mu_copy_file", orig, rc);
+	      status = 1;
+	      break;
+	    }
+	  if (run_workload (type, url, wl))
+	    status = 1;
+	}
+    }
+  else
+    status = 1;
+
+  if (!keep_option)
+    {
+      if (access (path, F_OK) == 0)
+	mu_remove_file (path);
+      if (access (orig, F_OK) == 0)
+	mu_remove_file (orig);
+    }
+  free (orig);
+  free (path);
+  free (orig_url);
+  free (url);
+  return status;
+}
+
+int
+main (int argc, char **argv)
+{
+  int i, j;
+  int status = 0;
+  char *tmpdir = NULL;
+
+  mu_action_getopt (&argc, &argv, bench_options, bench_docstring,
+		    bench_args_doc);
+
+  if (argc == 0)
+    {
+      for (j = 0; workloads[j].name; j++)
+	workloads[j].enabled = 1;
+    }
+  else
+    {
+      for (i = 0; i < argc; i++)
+	{
+	  for (j = 0; workloads[j].name; j++)
+	    if (strcmp (workloads[j].name, argv[i]) == 0)
+	      break;
+	  if (!workloads[j].name)
+	    {
+	      mu_error (_("unknown workload: %s"), argv[i]);
+	      return EX_USAGE;
+	    }
+	  workloads[j].enabled = 1;
+	}
+    }
+
+  if (type_mask == 0)
+    type_mask = ~0;
+  if (message_count == 0)
+    {
+      mu_error (_("number of messages must be positive"));
+      return EX_USAGE;
+    }
+  if (mime_percent < 0 || mime_percent > 100)
+    {
+      mu_error (_("MIME percentage out of range"));
+      return EX_USAGE;
+    }
+
+  if (!bench_dir)
+    {
+      int rc = mu_tempfile (NULL, MU_TEMPFILE_MKDIR, NULL, &tmpdir);
+      if (rc)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_tempfile", NULL, rc);
+	  return EX_CANTCREAT;
+	}
+      bench_dir = tmpdir;
+    }
+
+  mu_register_all_mbox_formats ();
+
+  for (i = 0; mailbox_types[i]; i++)
+    if (type_mask & (1 << i))
+      {
+	if (bench_type (mailbox_types[i]))
+	  status = EX_SOFTWARE;
+      }
+
+  if (tmpdir)
+    {
+      if (keep_option)
+	mu_diag_output (MU_DIAG_INFO, _("mailboxes kept in %s"), tmpdir);
+      else
+	rmdir (tmpdir);
+      free (tmpdir);
+    }
+
+  return status;
+}
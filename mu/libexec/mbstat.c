@@ -0,0 +1,523 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   GNU Mailutils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Mailutils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Batch mailbox statistics.
+
+   Each mailbox from the command line (or from the list file) is opened
+   read-only for header access, and its message count, size, number of
+   recent and unseen messages are printed as a CSV or JSON record.
+
+   With --jobs=N, up to N mailboxes are scanned simultaneously, each in
+   a separate child process.  A child sends its results to the master as
+   a fixed-size structure over a pipe.  The structure is smaller than
+   PIPE_BUF, so the child never blocks on write.  The master prints the
+   records in the order in which the mailboxes were given. */
+
+#if defined(HAVE_CONFIG_H)
+# include <config.h>
+#endif
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <glob.h>
+#include <mailutils/mailutils.h>
+#include <sysexits.h>
+#include "mu.h"
+
+char mbstat_docstring[] = N_("display statistics of multiple mailboxes");
+static char mbstat_args_doc[] = N_("[MAILBOX...]");
+
+enum
+  {
+    FORMAT_CSV,
+    FORMAT_JSON
+  };
+
+static int output_format = FORMAT_CSV;
+static int jobs = 1;
+static char *list_file;
+static int no_header;
+
+static void
+set_format (struct mu_parseopt *po, struct mu_option *opt, char const *arg)
+{
+  if (strcmp (arg, "csv") == 0)
+    output_format = FORMAT_CSV;
+  else if (strcmp (arg, "json") == 0)
+    output_format = FORMAT_JSON;
+  else
+    {
+      mu_parseopt_error (po, _("unknown output format: %s"), arg);
+      exit (po->po_exit_error);
+    }
+}
+
+static struct mu_option mbstat_options[] = {
+  { "format", 'f', N_("FORMAT"), MU_OPTION_DEFAULT,
+    N_("output format: csv (default) or json"),
+    mu_c_string, NULL, set_format },
+  { "no-header", 'H', NULL, MU_OPTION_DEFAULT,
+    N_("don't print CSV header line"),
+    mu_c_bool, &no_header },
+  { "jobs", 'j', N_("N"), MU_OPTION_DEFAULT,
+    N_("scan up to N mailboxes in parallel"),
+    mu_c_int, &jobs },
+  { "files-from", 'T', N_("FILE"), MU_OPTION_DEFAULT,
+    N_("read mailbox names from FILE (one per line, - for stdin)"),
+    mu_c_string, &list_file },
+  MU_OPTION_END
+};
+
+/* List of mailboxes */
+static char **mbtab;
+static size_t mbcount, mbmax;
+
+static void
+add_mailbox (char const *name)
+{
+  if (mbcount == mbmax)
+    mbtab = mu_2nrealloc (mbtab, &mbmax, sizeof mbtab[0]);
+  mbtab[mbcount++] = mu_strdup (name);
+}
+
+/* Add mailboxes matching NAME.  If NAME begins with a URL scheme, the
+   pattern is matched against the rest of it, and the scheme is
+   prepended to each match.  If there are no matches, NAME is added
+   as is. */
+static void
+add_pattern (char const *name)
+{
+  char const *path = name;
+  size_t plen;
+  glob_t gbuf;
+  size_t i;
+
+  if (strcspn (name, "*?[") == strlen (name))
+    {
+      add_mailbox (name);
+      return;
+    }
+
+  plen = strcspn (name, ":/");
+  if (name[plen] == ':')
+    path += plen + 1;
+  else
+    plen = 0;
+
+  if (glob (path, 0, NULL, &gbuf) != 0)
+    {
+      add_mailbox (name);
+      return;
+    }
+
+  for (i = 0; i < gbuf.gl_pathc; i++)
+    {
+      if (plen)
+	{
+	  char *s;
+	  mu_asprintf (&s, "%*.*s%s", (int) plen + 1, (int) plen + 1, name,
+		       gbuf.gl_pathv[i]);
+	  add_mailbox (s);
+	  free (s);
+	}
+      else
+	add_mailbox (gbuf.gl_pathv[i]);
+    }
+  globfree (&gbuf);
+}
+
+static void
+read_list (char const *file)
+{
+  mu_stream_t str;
+  char *buf = NULL;
+  size_t size = 0, n;
+  int rc;
+
+  if (strcmp (file, "-") == 0)
+    {
+      str = mu_strin;
+      mu_stream_ref (str);
+    }
+  else
+    {
+      rc = mu_file_stream_create (&str, file, MU_STREAM_READ);
+      if (rc)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_file_stream_create", file, rc);
+	  exit (EX_NOINPUT);
+	}
+    }
+
+  while ((rc = mu_stream_getline (str, &buf, &size, &n)) == 0 && n > 0)
+    {
+      mu_rtrim_class (buf, MU_CTYPE_ENDLN);
+      if (buf[0])
+	add_pattern (buf);
+    }
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_stream_getline", file, rc);
+      exit (EX_IOERR);
+    }
+  free (buf);
+  mu_stream_destroy (&str);
+}
+
+/* Scanning */
+
+enum
+  {
+    STAGE_CREATE,
+    STAGE_OPEN,
+    STAGE_COUNT,
+    STAGE_SIZE,
+    STAGE_MESSAGE
+  };
+
+static char const *stage_name[] = {
+  "create",
+  "open",
+  "count",
+  "size",
+  "message"
+};
+
+struct mbstat
+{
+  int status;        /* Error code, or 0 */
+  int stage;         /* Stage at which the error occurred */
+  char type[32];     /* Mailbox type */
+  mu_off_t size;     /* Mailbox size */
+  size_t count;      /* Number of messages */
+  size_t recent;     /* Number of recent messages */
+  size_t unseen;     /* Number of unseen messages */
+};
+
+static void
+mbstat_scan (char const *name, struct mbstat *st)
+{
+  mu_mailbox_t mbox;
+  mu_url_t url;
+  char const *s;
+  size_t i;
+
+  memset (st, 0, sizeof *st);
+
+  st->stage = STAGE_CREATE;
+  if ((st->status = mu_mailbox_create_default (&mbox, name)) != 0)
+    return;
+
+  st->stage = STAGE_OPEN;
+  st->status = mu_mailbox_open (mbox, MU_STREAM_READ|MU_STREAM_HEADERS_ONLY);
+  if (st->status)
+    {
+      mu_mailbox_destroy (&mbox);
+      return;
+    }
+
+  if (mu_mailbox_get_url (mbox, &url) == 0
+      && mu_url_sget_scheme (url, &s) == 0)
+    snprintf (st->type, sizeof st->type, "%s", s);
+
+  st->stage = STAGE_COUNT;
+  if ((st->status = mu_mailbox_messages_count (mbox, &st->count)) != 0)
+    goto end;
+
+  st->stage = STAGE_SIZE;
+  if ((st->status = mu_mailbox_get_size (mbox, &st->size)) != 0)
+    goto end;
+
+  st->stage = STAGE_MESSAGE;
+  for (i = 1; i <= st->count; i++)
+    {
+      mu_message_t msg;
+      mu_attribute_t attr;
+
+      if ((st->status = mu_mailbox_get_message (mbox, i, &msg)) != 0
+	  || (st->status = mu_message_get_attribute (msg, &attr)) != 0)
+	goto end;
+      if (mu_attribute_is_recent (attr))
+	st->recent++;
+      if (!mu_attribute_is_seen (attr))
+	st->unseen++;
+    }
+
+ end:
+  mu_mailbox_close (mbox);
+  mu_mailbox_destroy (&mbox);
+}
+
+/* Output */
+
+static void
+print_csv_string (char const *s)
+{
+  if (s[strcspn (s, ",\"\r\n")] == 0)
+    {
+      mu_printf ("%s", s);
+      return;
+    }
+  mu_printf ("\"");
+  for (; *s; s++)
+    {
+      if (*s == '"')
+	mu_printf ("\"\"");
+      else
+	mu_stream_write (mu_strout, s, 1, NULL);
+    }
+  mu_printf ("\"");
+}
+
+static void
+print_json_string (char const *s)
+{
+  mu_printf ("\"");
+  for (; *s; s++)
+    {
+      unsigned char c = *s;
+      if (c == '"' || c == '\\')
+	mu_printf ("\\%c", c);
+      else if (c < 0x20)
+	mu_printf ("\\u%04x", c);
+      else
+	mu_stream_write (mu_strout, s, 1, NULL);
+    }
+  mu_printf ("\"");
+}
+
+static void
+print_header (void)
+{
+  if (output_format == FORMAT_CSV && !no_header)
+    mu_printf ("mailbox,type,messages,size,recent,unseen,error\n");
+}
+
+static void
+print_record (char const *name, struct mbstat const *st)
+{
+  char *err = NULL;
+
+  if (st->status)
+    mu_asprintf (&err, "%s: %s", stage_name[st->stage],
+		 mu_strerror (st->status));
+
+  switch (output_format)
+    {
+    case FORMAT_CSV:
+      print_csv_string (name);
+      mu_printf (",%s,", st->type);
+      if (err)
+	{
+	  mu_printf (",,,,");
+	  print_csv_string (err);
+	}
+      else
+	mu_printf ("%zu,%" MU_PRI_OFF_T ",%zu,%zu,",
+		   st->count, st->size, st->recent, st->unseen);
+      break;
+
+    case FORMAT_JSON:
+      mu_printf ("{\"mailbox\":");
+      print_json_string (name);
+      if (st->type[0])
+	{
+	  mu_printf (",\"type\":");
+	  print_json_string (st->type);
+	}
+      if (err)
+	{
+	  mu_printf (",\"error\":");
+	  print_json_string (err);
+	}
+      else
+	mu_printf (",\"messages\":%zu,\"size\":%" MU_PRI_OFF_T
+		   ",\"recent\":%zu,\"unseen\":%zu",
+		   st->count, st->size, st->recent, st->unseen);
+      mu_printf ("}");
+      break;
+    }
+  mu_printf ("\n");
+  free (err);
+}
+
+/* Worker pool */
+
+struct mbstat_job
+{
+  pid_t pid;             /* Worker PID, or 0 if not started */
+  int fd;                /* Read end of the result pipe */
+  int done;              /* Result is available */
+  struct mbstat st;      /* Result */
+};
+
+static void
+job_start (struct mbstat_job *tab, size_t n)
+{
+  struct mbstat_job *job = &tab[n];
+  int p[2];
+
+  if (pipe (p) == 0)
+    {
+      job->pid = fork ();
+      if (job->pid == 0)
+	{
+	  size_t i;
+
+	  close (p[0]);
+	  for (i = 0; i < n; i++)
+	    if (tab[i].pid > 0 && !tab[i].done)
+	      close (tab[i].fd);
+	  mbstat_scan (mbtab[n], &job->st);
+	  _exit (write (p[1], &job->st, sizeof job->st) == sizeof job->st
+		 ? EX_OK : EX_IOERR);
+	}
+      close (p[1]);
+      if (job->pid > 0)
+	{
+	  job->fd = p[0];
+	  return;
+	}
+      mu_diag_funcall (MU_DIAG_ERROR, "fork", NULL, errno);
+      close (p[0]);
+    }
+  else
+    mu_diag_funcall (MU_DIAG_ERROR, "pipe", NULL, errno);
+
+  /* Fall back to scanning in the master */
+  job->pid = 0;
+  mbstat_scan (mbtab[n], &job->st);
+  job->done = 1;
+}
+
+static int
+mbstat_parallel (void)
+{
+  struct mbstat_job *tab;
+  size_t next = 0, out = 0, running = 0;
+  int status = 0;
+
+  tab = mu_calloc (mbcount, sizeof tab[0]);
+  mu_stream_flush (mu_strout);
+  mu_stream_flush (mu_strerr);
+  while (out < mbcount)
+    {
+      while (running < (size_t) jobs && next < mbcount)
+	{
+	  job_start (tab, next);
+	  if (!tab[next].done)
+	    running++;
+	  next++;
+	}
+
+      if (running > 0)
+	{
+	  pid_t pid = waitpid ((pid_t) -1, NULL, 0);
+	  size_t i;
+
+	  if (pid == -1)
+	    {
+	      mu_diag_funcall (MU_DIAG_ERROR, "waitpid", NULL, errno);
+	      abort ();
+	    }
+	  for (i = out; i < next; i++)
+	    if (tab[i].pid == pid && !tab[i].done)
+	      {
+		ssize_t n = read (tab[i].fd, &tab[i].st, sizeof tab[i].st);
+		close (tab[i].fd);
+		if (n != sizeof tab[i].st)
+		  {
+		    mu_error (_("worker %lu failed; scanning %s serially"),
+			      (unsigned long) pid, mbtab[i]);
+		    mbstat_scan (mbtab[i], &tab[i].st);
+		  }
+		tab[i].done = 1;
+		running--;
+		break;
+	      }
+	}
+
+      for (; out < next && tab[out].done; out++)
+	{
+	  print_record (mbtab[out], &tab[out].st);
+	  if (tab[out].st.status)
+	    status = EX_UNAVAILABLE;
+	}
+      mu_stream_flush (mu_strout);
+    }
+  free (tab);
+  return status;
+}
+
+static int
+mbstat_serial (void)
+{
+  size_t i;
+  int status = 0;
+
+  for (i = 0; i < mbcount; i++)
+    {
+      struct mbstat st;
+
+      mbstat_scan (mbtab[i], &st);
+      print_record (mbtab[i], &st);
+      if (st.status)
+	status = EX_UNAVAILABLE;
+    }
+  return status;
+}
+
+int
+main (int argc, char **argv)
+{
+  int i;
+
+  mu_register_all_mbox_formats ();
+
+  mu_action_getopt (&argc, &argv, mbstat_options, mbstat_docstring,
+		    mbstat_args_doc);
+
+  if (list_file)
+    read_list (list_file);
+  for (i = 0; i < argc; i++)
+    add_pattern (argv[i]);
+  if (mbcount == 0)
+    {
+      mu_mailbox_t mbox;
+      mu_url_t url;
+      int rc;
+
+      if (list_file)
+	return EX_OK;
+      /* Use the default mailbox */
+      if ((rc = mu_mailbox_create_default (&mbox, NULL)) != 0
+	  || (rc = mu_mailbox_get_url (mbox, &url)) != 0)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_create_default", NULL,
+			   rc);
+	  return EX_UNAVAILABLE;
+	}
+      add_mailbox (mu_url_to_string (url));
+      mu_mailbox_destroy (&mbox);
+    }
+
+  print_header ();
+  if (jobs > 1 && mbcount > 1)
+    return mbstat_parallel ();
+  return mbstat_serial ();
+}
@@ -0,0 +1,255 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   GNU Mailutils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Mailutils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
+
+#if defined(HAVE_CONFIG_H)
+# include <config.h>
+#endif
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <mailutils/mailutils.h>
+#include <mailutils/server.h>
+#include <sysexits.h>
+#include "mu.h"
+
+char srvstat_docstring[] = N_("display server statistics");
+static char srvstat_args_doc[] = N_("SOCKET");
+
+static int raw_option;
+static int all_option;
+
+static struct mu_option srvstat_options[] = {
+  { "raw", 'r', NULL, MU_OPTION_DEFAULT,
+    N_("print statistics as returned by the server"),
+    mu_c_bool, &raw_option },
+  { "all", 'a', NULL, MU_OPTION_DEFAULT,
+    N_("list also entries with zero count"),
+    mu_c_bool, &all_option },
+  MU_OPTION_END
+};
+
+static int
+srvstat_connect (char const *name)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen (name) >= sizeof addr.sun_path)
+    {
+      mu_error (_("%s: UNIX socket name too long"), name);
+      exit (EX_USAGE);
+    }
+  fd = socket (PF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "socket", NULL, errno);
+      exit (EX_UNAVAILABLE);
+    }
+  memset (&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, name);
+  if (connect (fd, (struct sockaddr *) &addr, sizeof addr))
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "connect", name, errno);
+      exit (EX_UNAVAILABLE);
+    }
+  return fd;
+}
+
+struct histogram
+{
+  size_t n;
+  unsigned long bound[MU_SRVSTAT_BUCKETS];
+  unsigned long count[MU_SRVSTAT_BUCKETS];
+};
+
+static int
+parse_histogram (char const *str, struct histogram *hist)
+{
+  hist->n = 0;
+  while (*str)
+    {
+      char *p;
+
+      if (hist->n == MU_SRVSTAT_BUCKETS)
+	return -1;
+      hist->bound[hist->n] = strtoul (str, &p, 10);
+      if (*p != ':')
+	return -1;
+      hist->count[hist->n] = strtoul (p + 1, &p, 10);
+      hist->n++;
+      if (*p == ',')
+	p++;
+      else if (*p)
+	return -1;
+      str = p;
+    }
+  return 0;
+}
+
+/* Return the upper bound of the bucket containing the Nth percentile.
+   The result is an overestimate by at most 25%. */
+static unsigned long
+percentile (struct histogram *hist, unsigned long total, int n)
+{
+  unsigned long rank = (total * n + 99) / 100;
+  unsigned long sum = 0;
+  size_t i;
+
+  for (i = 0; i < hist->n; i++)
+    {
+      sum += hist->count[i];
+      if (sum >= rank)
+	return hist->bound[i];
+    }
+  return hist->n ? hist->bound[hist->n - 1] : 0;
+}
+
+/* Format time interval USEC in human-readable form */
+static char *
+fmtusec (char *buf, size_t size, unsigned long usec)
+{
+  if (usec < 1000)
+    snprintf (buf, size, "%luus", usec);
+  else if (usec < 1000000)
+    snprintf (buf, size, "%.1fms", (double) usec / 1000);
+  else
+    snprintf (buf, size, "%.2fs", (double) usec / 1000000);
+  return buf;
+}
+
+static void
+format_stat (struct mu_wordsplit *ws)
+{
+  unsigned long count = 0, sum = 0, max = 0, in = 0, out = 0;
+  struct histogram hist;
+  char b[5][32];
+  size_t i;
+
+  hist.n = 0;
+  for (i = 2; i < ws->ws_wordc; i++)
+    {
+      char *kw = ws->ws_wordv[i];
+      char *val = strchr (kw, '=');
+
+      if (!val)
+	continue;
+      *val++ = 0;
+      if (strcmp (kw, "count") == 0)
+	count = strtoul (val, NULL, 10);
+      else if (strcmp (kw, "sum") == 0)
+	sum = strtoul (val, NULL, 10);
+      else if (strcmp (kw, "max") == 0)
+	max = strtoul (val, NULL, 10);
+      else if (strcmp (kw, "in") == 0)
+	in = strtoul (val, NULL, 10);
+      else if (strcmp (kw, "out") == 0)
+	out = strtoul (val, NULL, 10);
+      else if (strcmp (kw, "hist") == 0)
+	{
+	  if (parse_histogram (val, &hist))
+	    {
+	      mu_error (_("%s: malformed histogram"), ws->ws_wordv[1]);
+	      hist.n = 0;
+	    }
+	}
+    }
+
+  if (count == 0 && !all_option)
+    return;
+
+  mu_printf ("%-16s %8lu %9s %9s %9s %9s %9s %10lu %10lu\n",
+	     ws->ws_wordv[1], count,
+	     fmtusec (b[0], sizeof b[0], count ? sum / count : 0),
+	     fmtusec (b[1], sizeof b[1], percentile (&hist, count, 50)),
+	     fmtusec (b[2], sizeof b[2], percentile (&hist, count, 90)),
+	     fmtusec (b[3], sizeof b[3], percentile (&hist, count, 99)),
+	     fmtusec (b[4], sizeof b[4], max),
+	     in, out);
+}
+
+int
+main (int argc, char **argv)
+{
+  mu_stream_t str;
+  char *buf = NULL;
+  size_t size = 0, n;
+  struct mu_wordsplit ws;
+  int wsflags = MU_WRDSF_DEFFLAGS;
+  int rc;
+
+  mu_action_getopt (&argc, &argv, srvstat_options, srvstat_docstring,
+		    srvstat_args_doc);
+
+  if (argc != 1)
+    {
+      mu_error (_("wrong number of arguments"));
+      return EX_USAGE;
+    }
+
+  rc = mu_fd_stream_create (&str, argv[0], srvstat_connect (argv[0]),
+			    MU_STREAM_READ);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_fd_stream_create", NULL, rc);
+      return EX_UNAVAILABLE;
+    }
+
+  if (raw_option)
+    {
+      rc = mu_stream_copy (mu_strout, str, 0, NULL);
+      if (rc)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_stream_copy", NULL, rc);
+	  return EX_UNAVAILABLE;
+	}
+      mu_stream_destroy (&str);
+      return 0;
+    }
+
+  while ((rc = mu_stream_getline (str, &buf, &size, &n)) == 0 && n > 0)
+    {
+      if (mu_wordsplit (buf, &ws, wsflags))
+	{
+	  mu_error (_("cannot split line: %s"), mu_wordsplit_strerror (&ws));
+	  break;
+	}
+      wsflags |= MU_WRDSF_REUSE;
+      if (ws.ws_wordc < 2)
+	continue;
+      if (strcmp (ws.ws_wordv[0], "ident") == 0)
+	mu_printf (_("Server: %s\n"), ws.ws_wordv[1]);
+      else if (strcmp (ws.ws_wordv[0], "uptime") == 0)
+	{
+	  mu_printf (_("Uptime: %s seconds\n\n"), ws.ws_wordv[1]);
+	  mu_printf ("%-16s %8s %9s %9s %9s %9s %9s %10s %10s\n",
+		     "NAME", "COUNT", "AVG", "P50", "P90", "P99", "MAX",
+		     "IN", "OUT");
+	}
+      else if (strcmp (ws.ws_wordv[0], "stat") == 0)
+	format_stat (&ws);
+    }
+  if (rc)
+    mu_diag_funcall (MU_DIAG_ERROR, "mu_stream_getline", NULL, rc);
+
+  if (wsflags & MU_WRDSF_REUSE)
+    mu_wordsplit_free (&ws);
+  free (buf);
+  mu_stream_destroy (&str);
+  return rc ? EX_UNAVAILABLE : 0;
+}
@@ -118,6 +118,14 @@ capa_stls (const char *name, struct pop3d_session *session)
     }
 }
 
+static void
+capa_compress (const char *name, struct pop3d_session *session)
+{
+  if (state == TRANSACTION && compression_level
+      && !pop3d_compression_active ())
+    pop3d_outf ("%s DEFLATE\n", name);
+}
+
 static void
 capa_user (const char *name, struct pop3d_session *session)
 {
@@ -152,6 +160,7 @@ pop3d_session_init (struct pop3d_session *session)
 
   pop3d_append_capa_func (session, NULL, capa_user);
   pop3d_append_capa_func (session, "STLS", capa_stls);
+  pop3d_append_capa_func (session, "COMPRESS", capa_compress);
   pop3d_append_capa_func (session, "IMPLEMENTATION", capa_implementation);
 }
 
@@ -35,6 +35,7 @@ static struct pop3d_command command_table[] = {
   { "TOP",  pop3d_top },
   { "UIDL", pop3d_uidl },
   { "CAPA", pop3d_capa },
+  { "COMPRESS", pop3d_compress },
   { NULL }
 };
 
@@ -50,6 +51,15 @@ pop3d_find_command (const char *name)
   return p->handler;
 }
 
+/* Register statistics entries for all commands */
+void
+pop3d_srvstat_register (mu_srvstat_t st)
+{
+  struct pop3d_command *p;
+  for (p = command_table; p->name; p++)
+    mu_srvstat_register (st, p->name);
+}
+
 int
 stls_server_check (struct pop3d_srv_config *cfg, char const *srvid)
 {
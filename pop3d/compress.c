@@ -0,0 +1,53 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   GNU Mailutils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Mailutils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "pop3d.h"
+
+/* COMPRESS command -- deflate compression of the session.
+
+   There is no standard compression extension for POP3.  This command
+   follows the semantics of the IMAP COMPRESS command (RFC 4978): its only
+   argument is the name of the compression mechanism, which must be
+   DEFLATE.  Both parties start to compress their output right after the
+   +OK response.  */
+
+/* Compression level to use.  0 means COMPRESS is disabled. */
+int compression_level;
+
+int
+pop3d_compress (char *arg, struct pop3d_session *session)
+{
+  if (!compression_level)
+    return ERR_BAD_CMD;
+
+  if (mu_c_strcasecmp (arg, "DEFLATE"))
+    return ERR_BAD_ARGS;
+
+  if (state != TRANSACTION || pop3d_compression_active ())
+    return ERR_WRONG_STATE;
+
+  pop3d_outf ("+OK DEFLATE active\n");
+  pop3d_flush_output ();
+
+  if (pop3d_compress_init (compression_level))
+    {
+      mu_diag_output (MU_DIAG_ERROR, _("Session terminated"));
+      state = ABORT;
+      return ERR_UNKNOWN;
+    }
+
+  return OK;
+}
@@ -16,8 +16,21 @@
 
 #include "pop3d.h"
 #include "mailutils/property.h"
+#include "mailutils/datetime.h"
+#include <sys/resource.h>
 
 mu_stream_t iostream;
+/* The CRLF filter.  It is the same as iostream, unless transcript is
+   enabled. */
+static mu_stream_t crlf_stream;
+
+/* Compression layer, if active */
+static mu_stream_t zstream;
+/* Statistics of the compressed session: uncompressed data as seen by
+   the protocol layer, and compressed data sent over the wire. */
+static mu_stream_stat_buffer zstat_plain, zstat_wire;
+/* Statistics of the protocol stream, for server statistics */
+static mu_stream_stat_buffer io_stat;
 
 void
 pop3d_parse_command (char *cmd, char **pcmd, char **parg)
@@ -203,8 +216,16 @@ pop3d_setio (int ifd, int ofd, struct mu_tls_config *tls_conf)
   mu_stream_unref (str);
   if (rc)
     pop3d_abquit (ERR_FILE);
+  crlf_stream = iostream;
   /* Change buffering scheme: filter streams are fully buffered by default. */
   mu_stream_set_buffer (iostream, mu_buffer_line, 0);
+  /* Count the protocol traffic if server statistics are enabled.  The
+     CRLF filter stays in place when TLS or compression are started. */
+  if (mu_srvstat_get_default ())
+    mu_stream_set_stat (iostream,
+			MU_STREAM_STAT_MASK (MU_STREAM_STAT_IN) |
+			MU_STREAM_STAT_MASK (MU_STREAM_STAT_OUT),
+			io_stat);
   
   if (pop3d_transcript)
     {
@@ -247,11 +268,77 @@ pop3d_init_tls_server (struct mu_tls_config *tls_conf)
   return rc;
 }
 
+int
+pop3d_compress_init (int level)
+{
+  int rc;
+  mu_stream_t str[2];
+
+  rc = mu_deflate_stream_install (iostream, level, &zstream);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_deflate_stream_install", NULL, rc);
+      return rc;
+    }
+  mu_stream_set_stat (zstream,
+		      MU_STREAM_STAT_MASK (MU_STREAM_STAT_IN) |
+		      MU_STREAM_STAT_MASK (MU_STREAM_STAT_OUT),
+		      zstat_plain);
+  if (mu_stream_ioctl (zstream, MU_IOCTL_TOPSTREAM, MU_IOCTL_OP_GET, str)
+      == 0)
+    {
+      mu_stream_set_stat (str[0],
+			  MU_STREAM_STAT_MASK (MU_STREAM_STAT_IN) |
+			  MU_STREAM_STAT_MASK (MU_STREAM_STAT_OUT),
+			  zstat_wire);
+      mu_stream_unref (str[0]);
+    }
+  mu_diag_output (MU_DIAG_INFO, _("compression enabled (level %d)"), level);
+  return 0;
+}
+
+int
+pop3d_compression_active (void)
+{
+  return zstream != NULL;
+}
+
+/* Return the number of bytes received and sent so far */
+void
+pop3d_get_stat (mu_off_t *pin, mu_off_t *pout)
+{
+  *pin = io_stat[MU_STREAM_STAT_IN];
+  *pout = io_stat[MU_STREAM_STAT_OUT];
+}
+
+static void
+log_compression (void)
+{
+  struct rusage ru;
+
+  if (!zstream)
+    return;
+  getrusage (RUSAGE_SELF, &ru);
+  ru.ru_utime = mu_timeval_add (&ru.ru_utime, &ru.ru_stime);
+  mu_diag_output (MU_DIAG_INFO,
+		  _("compression: received %ju bytes (%ju uncompressed), "
+		    "sent %ju bytes (%ju uncompressed), CPU time %lu.%06lu"),
+		  (uintmax_t) zstat_wire[MU_STREAM_STAT_IN],
+		  (uintmax_t) zstat_plain[MU_STREAM_STAT_IN],
+		  (uintmax_t) zstat_wire[MU_STREAM_STAT_OUT],
+		  (uintmax_t) zstat_plain[MU_STREAM_STAT_OUT],
+		  (unsigned long) ru.ru_utime.tv_sec,
+		  (unsigned long) ru.ru_utime.tv_usec);
+  zstream = NULL;
+}
+
 void
 pop3d_bye (void)
 {
   mu_stream_close (iostream);
+  log_compression ();
   mu_stream_destroy (&iostream);
+  crlf_stream = NULL;
 }
 
 void
@@ -283,6 +370,65 @@ pop3d_outf (const char *fmt, ...)
     }
 }
 
+/* Copy SIZE bytes of data already in CRLF form from SRC to the client.
+   The data bypass the CRLF filter, but still pass through TLS and
+   compression layers, if these are active.  Otherwise they are written
+   directly to the output descriptor, which allows mu_stream_copy to
+   use zero-copy transfer.  The data are copied in chunks of at most
+   pop3d_output_bufsize bytes. */
+void
+pop3d_send_wire (mu_stream_t src, mu_off_t size)
+{
+  mu_stream_t sub[2], pair[2], dst;
+  mu_off_t total = 0;
+  int rc;
+
+  rc = mu_stream_flush (iostream);
+  if (rc == 0)
+    rc = mu_stream_ioctl (crlf_stream, MU_IOCTL_TOPSTREAM, MU_IOCTL_OP_GET,
+			  sub);
+  if (rc)
+    {
+      mu_diag_output (MU_DIAG_ERROR, _("Write failed: %s"), mu_strerror (rc));
+      pop3d_abquit (ERR_IO);
+    }
+  dst = sub[0];
+  /* Unless TLS or compression is in effect, dst is the I/O stream
+     combining input and output channels.  Use the latter. */
+  if (mu_stream_ioctl (dst, MU_IOCTL_TOPSTREAM, MU_IOCTL_OP_GET, pair) == 0)
+    {
+      if (pair[1])
+	{
+	  mu_stream_unref (dst);
+	  dst = pair[1];
+	}
+      mu_stream_unref (pair[0]);
+    }
+
+  while (size > 0)
+    {
+      mu_off_t n = size;
+
+      if (pop3d_output_bufsize && n > pop3d_output_bufsize)
+	n = pop3d_output_bufsize;
+      rc = mu_stream_copy (dst, src, n, NULL);
+      if (rc)
+	break;
+      size -= n;
+      total += n;
+    }
+  if (rc == 0)
+    rc = mu_stream_flush (dst);
+  mu_stream_unref (dst);
+  if (rc)
+    {
+      mu_diag_output (MU_DIAG_ERROR, _("Write failed: %s"), mu_strerror (rc));
+      pop3d_abquit (ERR_IO);
+    }
+  if (mu_srvstat_get_default ())
+    io_stat[MU_STREAM_STAT_OUT] += total;
+}
+
 /* Gets a line of input from the client, caller should free() */
 char *
 pop3d_readline (char *buffer, size_t size)
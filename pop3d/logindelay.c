@@ -144,8 +144,17 @@ void
 login_delay_capa (const char *name, struct pop3d_session *session)
 {
   mu_dbm_file_t db;
+  int cache_flags;
 
-  if (login_delay && (db = open_stat_db (MU_STREAM_RDWR)) != NULL)
+  if (login_delay == 0)
+    return;
+  /* Make sure the database can actually be opened for writing: with
+     write caching the open would be deferred until exit. */
+  cache_flags = mu_dbm_cache_get_flags ();
+  mu_dbm_cache_set_flags (cache_flags & ~MU_DBM_CACHE_WRITE);
+  db = open_stat_db (MU_STREAM_RDWR);
+  mu_dbm_cache_set_flags (cache_flags);
+  if (db)
     {
       pop3d_outf ("%lu\n", (unsigned long) login_delay);
       mu_dbm_destroy (&db);
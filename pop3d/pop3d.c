@@ -188,6 +188,30 @@ cb_tls (void *data, mu_config_value_t *val)
   return 0;
 }
 
+static int
+cb_compression_level (void *data, mu_config_value_t *val)
+{
+  char *p;
+  unsigned long n;
+  
+  if (mu_cfg_assert_value_type (val, MU_CFG_STRING))
+    return 1;
+  n = strtoul (val->v.string, &p, 10);
+  if (*p || n > 9)
+    {
+      mu_error (_("invalid compression level: %s"), val->v.string);
+      return 1;
+    }
+#ifndef WITH_ZLIB
+  if (n)
+    mu_error (_("compression is not supported; "
+		"statement ignored"));
+#else
+  *(int*)data = n;
+#endif
+  return 0;
+}
+
 static struct mu_cfg_param pop3d_srv_param[] = {
   { "tls-mode", mu_cfg_callback,
     NULL, mu_offsetof (struct pop3d_srv_config, tls_mode), cb_tls,
@@ -254,6 +278,15 @@ static struct mu_cfg_param pop3d_cfg_param[] = {
 #endif
   { "output-buffer-size", mu_c_size, &pop3d_output_bufsize, 0, NULL,
     N_("Size of the output buffer.") },
+  { "retr-cache-dir", mu_c_string, &retr_cache_dir, 0, NULL,
+    N_("Keep the wire form of retrieved messages in this directory."),
+    N_("dir") },
+  { "compression-level", mu_cfg_callback, &compression_level, 0,
+    cb_compression_level,
+    N_("Enable the COMPRESS command and set the compression level: "
+       "1 gives best speed, 9 gives best compression.  0 (the default) "
+       "disables compression."),
+    N_("level: number") },
   { "mandatory-locking", mu_cfg_section },
   { ".server", mu_cfg_section, NULL, 0, NULL,
     N_("Server configuration.") },
@@ -362,6 +395,10 @@ pop3d_mainloop (int ifd, int ofd, struct pop3d_srv_config *cfg)
       char *arg, *cmd;
       pop3d_command_handler_t handler;
       
+#ifdef ENABLE_DBM
+      /* Don't hold database locks while waiting for the client */
+      mu_dbm_cache_release ();
+#endif
       pop3d_flush_output ();
       status = OK;
       buf = pop3d_readline (buffer, sizeof (buffer));
@@ -382,10 +419,22 @@ pop3d_mainloop (int ifd, int ofd, struct pop3d_srv_config *cfg)
       /* Refresh the Lock.  */
       manlock_touchlock (mbox);
 
-      if ((handler = pop3d_find_command (cmd)) != NULL)
-	status = handler (arg, &session);
-      else
+      if ((handler = pop3d_find_command (cmd)) == NULL)
 	status = ERR_BAD_CMD;
+      else if (mu_srvstat_get_default ())
+	{
+	  struct timeval tv;
+	  mu_off_t in, out, in1, out1;
+
+	  pop3d_get_stat (&in, &out);
+	  mu_srvstat_start (&tv);
+	  status = handler (arg, &session);
+	  pop3d_flush_output ();
+	  pop3d_get_stat (&in1, &out1);
+	  mu_srvstat_finish (cmd, &tv, in1 - in, out1 - out);
+	}
+      else
+	status = handler (arg, &session);
 
       if (status != OK)
 	pop3d_outf ("-ERR %s\n", pop3d_error_string (status));
@@ -466,6 +515,7 @@ main (int argc, char **argv)
 
 #ifdef ENABLE_DBM
   set_dbm_safety ();
+  mu_dbm_cache_set_flags (MU_DBM_CACHE_READ | MU_DBM_CACHE_WRITE);
 #endif
 
   mu_cli (argc, argv, &cli, capa, server, &argc, &argv);
@@ -528,6 +578,8 @@ main (int argc, char **argv)
   if (mu_m_server_mode (server) == MODE_DAEMON)
     {
       mu_m_server_begin (server);
+      if (mu_m_server_srvstat (server))
+	pop3d_srvstat_register (mu_m_server_srvstat (server));
       status = mu_m_server_run (server);
       mu_m_server_end (server);
       mu_m_server_destroy (&server);
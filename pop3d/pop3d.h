@@ -241,7 +241,9 @@ extern struct mu_auth_data *auth_data;
 extern unsigned int idle_timeout;
 extern int pop3d_transcript;
 extern size_t pop3d_output_bufsize;
+extern char *retr_cache_dir;
 extern int pop3d_xlines;
+extern int compression_level;
 extern char *apop_database_name;
 extern int apop_database_safety;
 extern uid_t apop_database_owner;
@@ -262,6 +264,7 @@ extern int global_tls_mode;
 
 
 extern pop3d_command_handler_t pop3d_find_command (const char *name);
+extern void pop3d_srvstat_register (mu_srvstat_t st);
 
 extern int pop3d_stat           (char *, struct pop3d_session *);
 extern int pop3d_top            (char *, struct pop3d_session *);
@@ -280,6 +283,23 @@ extern int pop3d_rset           (char *, struct pop3d_session *);
 void pop3d_send_payload (mu_stream_t stream, mu_stream_t linestr,
 			 size_t maxlines);
 
+/* Cached wire form of a message (retrcache.c) */
+struct retr_cache
+{
+  mu_stream_t stream;   /* Cache file */
+  mu_off_t hlen;        /* Length of the header data */
+  mu_off_t blen;        /* Length of the body data */
+  size_t nlines;        /* Number of body lines */
+  int eol;              /* Body data end with a newline */
+};
+
+extern int retr_cache_open (mu_message_t msg, int create,
+			    struct retr_cache *cache);
+extern void retr_cache_close (struct retr_cache *cache);
+extern void retr_cache_send (struct retr_cache *cache, int top,
+			     size_t maxlines);
+extern void retr_cache_sweep (void);
+
 extern void pop3d_bye           (void);
 extern int pop3d_abquit         (int);
 extern char *pop3d_apopuser     (const char *);
@@ -291,6 +311,7 @@ extern RETSIGTYPE pop3d_master_signal  (int);
 extern RETSIGTYPE pop3d_child_signal  (int);
 
 extern int pop3d_stls           (char *, struct pop3d_session *);
+extern int pop3d_compress       (char *, struct pop3d_session *);
 int stls_preflight (mu_m_server_t msrv);
 int stls_server_check (struct pop3d_srv_config *cfg, char const *srvid);
 
@@ -299,6 +320,7 @@ extern void pop3d_outf          (const char *fmt, ...) MU_PRINTFLIKE(1,2);
 extern void pop3d_setio         (int, int, struct mu_tls_config *);
 extern char *pop3d_readline     (char *, size_t);
 extern void pop3d_flush_output  (void);
+extern void pop3d_send_wire     (mu_stream_t, mu_off_t);
 
 extern int pop3d_is_master      (void);
 
@@ -308,6 +330,9 @@ extern void pop3d_unset_deleted (mu_attribute_t attr);
 void pop3d_undelete_all (void);
 
 extern int pop3d_init_tls_server    (struct mu_tls_config *tls_conf);
+extern int pop3d_compress_init      (int level);
+extern int pop3d_compression_active (void);
+extern void pop3d_get_stat (mu_off_t *pin, mu_off_t *pout);
 
 extern void pop3d_mark_retr (mu_attribute_t attr);
 extern int pop3d_is_retr (mu_attribute_t attr);
@@ -37,6 +37,7 @@ pop3d_quit (char *arg, struct pop3d_session *sess)
 
       if (mu_mailbox_flush (mbox, 1) != 0)
 	err = ERR_FILE;
+      retr_cache_sweep ();
       if (mu_mailbox_close (mbox) != 0) 
 	err = ERR_FILE;
       manlock_unlock (mbox);
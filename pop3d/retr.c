@@ -69,6 +69,7 @@ pop3d_retr (char *arg, struct pop3d_session *sess)
   mu_message_t msg = NULL;
   mu_attribute_t attr = NULL;
   mu_stream_t stream;
+  struct retr_cache cache;
   
   if ((strlen (arg) == 0) || (strchr (arg, ' ') != NULL))
     return ERR_BAD_ARGS;
@@ -85,12 +86,21 @@ pop3d_retr (char *arg, struct pop3d_session *sess)
   if (pop3d_is_deleted (attr))
     return ERR_MESG_DELE;
 
-  if (mu_message_get_streamref (msg, &stream))
-    return ERR_UNKNOWN;
+  if (retr_cache_open (msg, 1, &cache) == 0)
+    {
+      pop3d_outf ("+OK\n");
+      retr_cache_send (&cache, 0, 0);
+      retr_cache_close (&cache);
+    }
+  else
+    {
+      if (mu_message_get_streamref (msg, &stream))
+	return ERR_UNKNOWN;
   
-  pop3d_outf ("+OK\n");
-  pop3d_send_payload (stream, NULL, 0);
-  mu_stream_destroy (&stream);
+      pop3d_outf ("+OK\n");
+      pop3d_send_payload (stream, NULL, 0);
+      mu_stream_destroy (&stream);
+    }
   
   if (!mu_attribute_is_read (attr))
     mu_attribute_set_read (attr);
@@ -0,0 +1,532 @@
+/* GNU Mailutils -- a suite of utilities for electronic mail
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   GNU Mailutils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   GNU Mailutils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "pop3d.h"
+#include <dirent.h>
+
+/* Persistent cache of messages in their on-the-wire form.
+
+   Sending a message requires reading it from the mailbox, byte-stuffing
+   lines that begin with a dot and converting line terminators to CRLF.
+   Clients that leave mail on the server tend to retrieve the same
+   messages over and over, so the result of these conversions is kept in
+   a cache file, created when the message is first retrieved by RETR.
+   Subsequent RETR and TOP commands copy the cache file directly to the
+   layer below the CRLF filter.
+
+   Cache files are kept in a per-mailbox subdirectory of retr_cache_dir.
+   Both the subdirectory and the files are named after MD5 hashes, of the
+   mailbox name and the message UIDL, respectively.  A file consists of
+   struct retr_cache_header, the wire form of the message header
+   (including the empty line that terminates it), the wire form of the
+   body and a table of body line offsets.  The Kth entry of the table
+   is the offset of the end of the K+1st body line, relative to the
+   start of the body data, so that the length of the data to send in
+   reply to TOP is looked up in constant time.
+
+   A file is used only if the size and number of lines of the message
+   did not change since it was created.  Files are created under a
+   temporary name and renamed into place, so that concurrent sessions
+   never see a partially written cache file.  Files of messages that no
+   longer exist are removed when the session ends. */
+
+char *retr_cache_dir;
+
+#define RETR_CACHE_MAGIC "MURETR1\n"
+
+struct retr_cache_header
+{
+  char magic[8];       /* RETR_CACHE_MAGIC */
+  mu_off_t size;       /* Message size */
+  mu_off_t lines;      /* Number of lines in message */
+  mu_off_t hlen;       /* Length of the header data */
+  mu_off_t blen;       /* Length of the body data */
+  mu_off_t nlines;     /* Number of body lines */
+  mu_off_t eol;        /* Body data end with a newline */
+};
+
+#define HEXDIGEST_SIZE (2 * MD5_DIGEST_SIZE)
+
+static char *cache_mbox_dir;      /* Cache directory for this mailbox */
+static int cache_dir_created;     /* Cache directory has been created */
+static int cache_disabled;        /* Cache is disabled after an error */
+
+static void
+hexdigest (char const *str, char *hexbuf)
+{
+  unsigned char digest[MD5_DIGEST_SIZE];
+  int i;
+
+  mu_md5_buffer (str, strlen (str), digest);
+  for (i = 0; i < MD5_DIGEST_SIZE; i++)
+    sprintf (hexbuf + 2 * i, "%02x", digest[i]);
+}
+
+static int
+is_hexdigest (char const *name)
+{
+  int i;
+
+  for (i = 0; i < HEXDIGEST_SIZE; i++)
+    if (!mu_isxdigit (name[i]))
+      return 0;
+  return name[i] == 0;
+}
+
+/* Return the name of the cache directory for the current mailbox.
+   If CREATE is not 0, create the directory if it does not exist. */
+static char const *
+cache_mailbox_dir (int create)
+{
+  if (!cache_mbox_dir)
+    {
+      mu_url_t url;
+      const char *name;
+      char hexbuf[HEXDIGEST_SIZE + 1];
+      char *dir;
+
+      if (mu_mailbox_get_url (mbox, &url) || mu_url_sget_name (url, &name))
+	return NULL;
+      hexdigest (name, hexbuf);
+      if (retr_cache_dir[0] == '/')
+	dir = mu_strdup (retr_cache_dir);
+      else
+	dir = mu_make_file_name (auth_data->dir, retr_cache_dir);
+      cache_mbox_dir = mu_make_file_name (dir, hexbuf);
+      free (dir);
+    }
+
+  if (create && !cache_dir_created)
+    {
+      char *dir = mu_strdup (cache_mbox_dir);
+
+      *strrchr (dir, '/') = 0;
+      if ((mkdir (dir, 0700) && errno != EEXIST)
+	  || (mkdir (cache_mbox_dir, 0700) && errno != EEXIST))
+	{
+	  mu_error (_("cannot create directory %s: %s"),
+		    cache_mbox_dir, mu_strerror (errno));
+	  cache_disabled = 1;
+	  free (dir);
+	  return NULL;
+	}
+      free (dir);
+      cache_dir_created = 1;
+    }
+  return cache_mbox_dir;
+}
+
+static char *
+cache_file_name (mu_message_t msg, int create)
+{
+  char uidl[128];
+  char hexbuf[HEXDIGEST_SIZE + 1];
+  char const *dir;
+
+  if (mu_message_get_uidl (msg, uidl, sizeof (uidl), NULL))
+    return NULL;
+  dir = cache_mailbox_dir (create);
+  if (!dir)
+    return NULL;
+  hexdigest (uidl, hexbuf);
+  return mu_make_file_name (dir, hexbuf);
+}
+
+/* Wire form encoder */
+struct wire_encoder
+{
+  mu_stream_t str;     /* Output stream */
+  mu_off_t off;        /* Number of bytes written so far */
+  int eol;             /* Last line ended with a newline */
+};
+
+static int
+wire_write (struct wire_encoder *enc, char const *buf, size_t size)
+{
+  int rc = mu_stream_write (enc->str, buf, size, NULL);
+  if (rc == 0)
+    enc->off += size;
+  return rc;
+}
+
+/* Encode a single line of input, as returned by mu_stream_getline. */
+static int
+wire_encode_line (struct wire_encoder *enc, char const *buf, size_t size)
+{
+  int rc = 0;
+
+  if (buf[0] == '.')
+    rc = wire_write (enc, ".", 1);
+  enc->eol = buf[size - 1] == '\n';
+  if (enc->eol)
+    size--;
+  if (rc == 0 && size)
+    rc = wire_write (enc, buf, size);
+  if (rc == 0 && enc->eol)
+    rc = wire_write (enc, "\r\n", 2);
+  return rc;
+}
+
+/* Render the wire form of MSG to the stream STR, which is positioned
+   right after the space reserved for the header HDR. */
+static int
+cache_render (mu_message_t msg, mu_stream_t str, struct retr_cache_header *hdr)
+{
+  mu_header_t mhdr;
+  mu_body_t body;
+  mu_stream_t hstream = NULL, bstream = NULL;
+  struct wire_encoder enc;
+  mu_off_t *tab = NULL;
+  size_t tabmax = 0;
+  size_t nlines = 0;
+  char *buf = NULL;
+  size_t size = 0, n;
+  int rc;
+
+  mu_message_get_header (msg, &mhdr);
+  mu_message_get_body (msg, &body);
+  rc = mu_header_get_streamref (mhdr, &hstream);
+  if (rc == 0)
+    rc = mu_body_get_streamref (body, &bstream);
+  if (rc)
+    goto end;
+
+  enc.str = str;
+  enc.off = 0;
+  enc.eol = 1;
+  while ((rc = mu_stream_getline (hstream, &buf, &size, &n)) == 0 && n > 0)
+    {
+      rc = wire_encode_line (&enc, buf, n);
+      if (rc)
+	goto end;
+    }
+  if (rc)
+    goto end;
+  if (!enc.eol)
+    {
+      /* The header data always end with an empty line.  If they did
+	 not, the body would be byte-stuffed differently by RETR and TOP,
+	 so the cached body data could not serve both. */
+      rc = MU_ERR_PARSE;
+      goto end;
+    }
+  hdr->hlen = enc.off;
+
+  enc.off = 0;
+  while ((rc = mu_stream_getline (bstream, &buf, &size, &n)) == 0 && n > 0)
+    {
+      rc = wire_encode_line (&enc, buf, n);
+      if (rc)
+	goto end;
+      if (nlines == tabmax)
+	tab = mu_2nrealloc (tab, &tabmax, sizeof (tab[0]));
+      tab[nlines++] = enc.off;
+    }
+  if (rc)
+    goto end;
+  hdr->blen = enc.off;
+  hdr->nlines = nlines;
+  hdr->eol = enc.eol;
+
+  if (nlines)
+    rc = mu_stream_write (str, tab, nlines * sizeof (tab[0]), NULL);
+
+ end:
+  free (tab);
+  free (buf);
+  mu_stream_destroy (&hstream);
+  mu_stream_destroy (&bstream);
+  return rc;
+}
+
+/* Create the cache file FILENAME for the message MSG. */
+static int
+cache_create (mu_message_t msg, char const *filename,
+	      struct retr_cache_header *hdr)
+{
+  struct mu_tempfile_hints hints;
+  char *tmpname;
+  mu_stream_t str;
+  int fd, rc;
+
+  hints.tmpdir = cache_mbox_dir;
+  rc = mu_tempfile (&hints, MU_TEMPFILE_TMPDIR, &fd, &tmpname);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_tempfile", cache_mbox_dir, rc);
+      return rc;
+    }
+  rc = mu_fd_stream_create (&str, tmpname, fd,
+			    MU_STREAM_WRITE | MU_STREAM_SEEK);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_fd_stream_create", tmpname, rc);
+      close (fd);
+      unlink (tmpname);
+      free (tmpname);
+      return rc;
+    }
+  mu_stream_set_buffer (str, mu_buffer_full, 0);
+
+  rc = mu_stream_write (str, hdr, sizeof (*hdr), NULL);
+  if (rc == 0)
+    rc = cache_render (msg, str, hdr);
+  if (rc == 0)
+    {
+      /* Fill in the header */
+      memcpy (hdr->magic, RETR_CACHE_MAGIC, sizeof (hdr->magic));
+      rc = mu_stream_seek (str, 0, MU_SEEK_SET, NULL);
+      if (rc == 0)
+	rc = mu_stream_write (str, hdr, sizeof (*hdr), NULL);
+    }
+  if (rc == 0)
+    rc = mu_stream_close (str);
+  mu_stream_destroy (&str);
+
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "cache_create", tmpname, rc);
+      unlink (tmpname);
+    }
+  else if (rename (tmpname, filename))
+    {
+      rc = errno;
+      mu_diag_funcall (MU_DIAG_ERROR, "rename", filename, rc);
+      unlink (tmpname);
+    }
+  free (tmpname);
+  return rc;
+}
+
+/* Open the cache file FILENAME and verify that it matches the stamp
+   given by HDR. */
+static int
+cache_open_file (char const *filename, struct retr_cache_header const *hdr,
+		 struct retr_cache *cache)
+{
+  struct retr_cache_header fhdr;
+  mu_stream_t str;
+  mu_off_t size;
+  int rc;
+
+  rc = mu_file_stream_create (&str, filename, MU_STREAM_READ|MU_STREAM_SEEK);
+  if (rc)
+    return rc;
+  rc = mu_stream_read (str, &fhdr, sizeof (fhdr), NULL);
+  if (rc == 0)
+    rc = mu_stream_size (str, &size);
+  if (rc == 0
+      && (memcmp (fhdr.magic, RETR_CACHE_MAGIC, sizeof (fhdr.magic))
+	  || fhdr.size != hdr->size
+	  || fhdr.lines != hdr->lines
+	  || size != sizeof (fhdr) + fhdr.hlen + fhdr.blen
+	              + fhdr.nlines * sizeof (mu_off_t)))
+    rc = MU_ERR_NOENT;
+  if (rc)
+    {
+      mu_stream_destroy (&str);
+      return rc;
+    }
+  cache->stream = str;
+  cache->hlen = fhdr.hlen;
+  cache->blen = fhdr.blen;
+  cache->nlines = fhdr.nlines;
+  cache->eol = fhdr.eol;
+  return 0;
+}
+
+/* Open the cache for the message MSG.  If it does not exist or is out
+   of date and CREATE is not 0, create it. */
+int
+retr_cache_open (mu_message_t msg, int create, struct retr_cache *cache)
+{
+  struct retr_cache_header hdr;
+  size_t size, lines;
+  char *filename;
+  int rc;
+
+  if (!retr_cache_dir || cache_disabled || pop3d_transcript)
+    return MU_ERR_NOENT;
+
+  if (mu_message_size (msg, &size) || mu_message_lines (msg, &lines))
+    return MU_ERR_NOENT;
+  memset (&hdr, 0, sizeof (hdr));
+  hdr.size = size;
+  hdr.lines = lines;
+
+  filename = cache_file_name (msg, create);
+  if (!filename)
+    return MU_ERR_NOENT;
+  rc = cache_open_file (filename, &hdr, cache);
+  if (rc && create)
+    {
+      rc = cache_create (msg, filename, &hdr);
+      if (rc == 0)
+	rc = cache_open_file (filename, &hdr, cache);
+      else if (rc == EACCES || rc == EPERM || rc == EROFS || rc == ENOSPC)
+	cache_disabled = 1;
+    }
+  free (filename);
+  return rc;
+}
+
+void
+retr_cache_close (struct retr_cache *cache)
+{
+  mu_stream_destroy (&cache->stream);
+}
+
+/* Return in *POFF the offset of the end of Nth body line, relative to
+   the start of the body data. */
+static int
+retr_cache_body_offset (struct retr_cache *cache, size_t n, mu_off_t *poff)
+{
+  int rc;
+
+  if (n == 0)
+    {
+      *poff = 0;
+      return 0;
+    }
+  if (n >= cache->nlines)
+    {
+      *poff = cache->blen;
+      return 0;
+    }
+  rc = mu_stream_seek (cache->stream,
+		       sizeof (struct retr_cache_header)
+		         + cache->hlen + cache->blen
+		         + (n - 1) * sizeof (mu_off_t),
+		       MU_SEEK_SET, NULL);
+  if (rc == 0)
+    rc = mu_stream_read (cache->stream, poff, sizeof (*poff), NULL);
+  return rc;
+}
+
+static void
+cache_send (struct retr_cache *cache, mu_off_t off, mu_off_t size)
+{
+  int rc;
+
+  if (size == 0)
+    return;
+  rc = mu_stream_seek (cache->stream, sizeof (struct retr_cache_header) + off,
+		       MU_SEEK_SET, NULL);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_stream_seek", NULL, rc);
+      pop3d_abquit (ERR_FILE);
+    }
+  pop3d_send_wire (cache->stream, size);
+}
+
+/* Send the cached message followed by the terminating dot line.  If
+   TOP is 0, send the entire message.  Otherwise, send its header and
+   MAXLINES lines of the body, as TOP does. */
+void
+retr_cache_send (struct retr_cache *cache, int top, size_t maxlines)
+{
+  mu_off_t blen;
+  int eol = 1;
+
+  cache_send (cache, 0, cache->hlen);
+  if (!top)
+    {
+      cache_send (cache, cache->hlen, cache->blen);
+      eol = cache->eol;
+    }
+  else if (maxlines)
+    {
+      int rc;
+
+      pop3d_outf ("\n");
+      rc = retr_cache_body_offset (cache, maxlines, &blen);
+      if (rc)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "retr_cache_body_offset", NULL, rc);
+	  pop3d_abquit (ERR_FILE);
+	}
+      cache_send (cache, cache->hlen, blen);
+      if (blen == cache->blen)
+	eol = cache->eol;
+    }
+  pop3d_outf ("%s.\n", eol ? "" : "\n");
+}
+
+static int
+cmpnames (const void *a, const void *b)
+{
+  return strcmp (*(char const **) a, *(char const **) b);
+}
+
+/* Remove cache files of the messages that no longer exist in the
+   current mailbox.  Must be called after expunging the mailbox. */
+void
+retr_cache_sweep (void)
+{
+  char const *dirname;
+  DIR *dir;
+  struct dirent *ent;
+  char **names;
+  size_t total = 0, count = 0, i;
+
+  if (!retr_cache_dir || !mbox)
+    return;
+  dirname = cache_mailbox_dir (0);
+  if (!dirname)
+    return;
+  dir = opendir (dirname);
+  if (!dir)
+    return;
+
+  mu_mailbox_messages_count (mbox, &total);
+  names = mu_calloc (total ? total : 1, sizeof (names[0]));
+  for (i = 1; i <= total; i++)
+    {
+      mu_message_t msg;
+      char uidl[128];
+
+      if (mu_mailbox_get_message (mbox, i, &msg) == 0
+	  && mu_message_get_uidl (msg, uidl, sizeof (uidl), NULL) == 0)
+	{
+	  names[count] = mu_alloc (HEXDIGEST_SIZE + 1);
+	  hexdigest (uidl, names[count]);
+	  count++;
+	}
+    }
+  qsort (names, count, sizeof (names[0]), cmpnames);
+
+  while ((ent = readdir (dir)))
+    {
+      char *p = ent->d_name;
+
+      /* Skip temporary files of other sessions. */
+      if (!is_hexdigest (p))
+	continue;
+      if (!bsearch (&p, names, count, sizeof (names[0]), cmpnames))
+	{
+	  char *file = mu_make_file_name (dirname, ent->d_name);
+	  if (unlink (file) && errno != ENOENT)
+	    mu_diag_funcall (MU_DIAG_ERROR, "unlink", file, errno);
+	  free (file);
+	}
+    }
+  closedir (dir);
+
+  for (i = 0; i < count; i++)
+    free (names[i]);
+  free (names);
+}
@@ -28,6 +28,7 @@ pop3d_top (char *arg, struct pop3d_session *sess)
   mu_header_t hdr;
   mu_body_t body;
   mu_stream_t hstream, bstream;
+  struct retr_cache cache;
   char *mesgc, *linesc, *p;
   
   if (strlen (arg) == 0)
@@ -54,6 +55,15 @@ pop3d_top (char *arg, struct pop3d_session *sess)
   if (pop3d_is_deleted (attr))
     return ERR_MESG_DELE;
   pop3d_mark_retr (attr);
+
+  /* Use the cached wire form, if the message has been retrieved before. */
+  if (retr_cache_open (msg, 0, &cache) == 0)
+    {
+      pop3d_outf ("+OK\n");
+      retr_cache_send (&cache, 1, lines);
+      retr_cache_close (&cache);
+      return OK;
+    }
   
   /* Header.  */
   mu_message_get_header (msg, &hdr);
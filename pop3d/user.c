@@ -47,6 +47,15 @@ pop3d_begin_session ()
       state = AUTHORIZATION;
       return ERR_MBOX_LOCK;
     }
+
+  if (mu_srvstat_get_default ())
+    {
+      struct timeval tv;
+      
+      mu_srvstat_start (&tv);
+      mu_mailbox_messages_count (mbox, &total);
+      mu_srvstat_finish (MU_SRVSTAT_MAILBOX_SCAN, &tv, 0, 0);
+    }
   
   username = mu_strdup (auth_data->name);
   state = TRANSACTION;
@@ -27,6 +27,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <syslog.h>
+#include <sys/wait.h>
 #include <sysexits.h>
 
 #include <mailutils/io.h>
@@ -55,6 +56,7 @@ int verbose;
 char *script;
 int expression_option;
 int dry_run;
+int jobs;
 
 static int sieve_print_locus = 1; /* Should the log messages include the
 				     locus */
@@ -187,6 +189,9 @@ static struct mu_option sieve_options[] = {
     N_("do not execute any actions, just print what would be done"),
     mu_c_bool, &dry_run },
   { "no-actions", 0, NULL, MU_OPTION_ALIAS },
+  { "jobs", 'j', N_("N"), MU_OPTION_DEFAULT,
+    N_("process the mailbox using N parallel workers"),
+    mu_c_int, &jobs },
   { "keep-going", 'k', NULL, MU_OPTION_DEFAULT,
     N_("keep on going if execution fails on a message"),
     mu_c_bool, &keep_going },
@@ -262,6 +267,9 @@ cb_email (void *data, mu_config_value_t *val)
 static struct mu_cfg_param sieve_cfg_param[] = {
   { "keep-going", mu_c_bool, &keep_going, 0, NULL,
     N_("Do not abort if execution fails on a message.") },
+  { "jobs", mu_c_int, &jobs, 0, NULL,
+    N_("Number of worker processes to use when sieving a mailbox."),
+    N_("n") },
   { "mbox-url", mu_c_string, &mbox_url, 0, NULL,
     N_("Mailbox to sieve (defaults to user's mail spool)."),
     N_("url") },
@@ -379,6 +387,357 @@ sieve_message (mu_sieve_machine_t mach)
   return mu_attribute_is_deleted (attr) ? 1 : EX_OK;
 }
 
+/* Parallel processing of mailboxes.
+
+   The mailbox is processed by JOBS worker processes.  Each worker opens
+   its own handle of the mailbox and runs the script in dry-run mode over
+   the messages assigned to it: message N goes to the worker number
+   (N - 1) % JOBS.  Actions executed on each message are recorded and
+   sent over a pipe to the master, which applies them to its mailbox in
+   message number order, so that the result is the same as that of a
+   serial run.
+
+   Only keep, discard and fileinto can be replayed this way.  A message
+   for which any other action was executed is processed anew by the
+   master.  Scripts that use commands talking to external programs (such
+   as the pipe and spamd tests) are always run serially, because these
+   behave differently in dry-run mode.
+
+   Each record sent by a worker starts with the line
+
+     MSGNO STATUS LENGTH
+
+   where STATUS is 'A' if the recorded actions are to be replayed, and 'F'
+   if the message must be processed by the master.  LENGTH is the number
+   of bytes of diagnostic output produced while processing the message.
+   It is followed by zero or more action lines:
+
+     K                  keep
+     D                  discard
+     F PERMS MAILBOX    fileinto (PERMS is "-" if not given)
+
+   The record is terminated by a line containing a single dot.
+
+   Diagnostic output of each worker goes to a temporary file, which the
+   master copies to its standard error when committing the message. */
+
+struct sieve_worker
+{
+  pid_t pid;        /* Worker PID */
+  mu_stream_t in;   /* Result records, or NULL if the worker failed */
+  int logfd;        /* Diagnostic output */
+  mu_off_t logoff;  /* Offset of the first byte not yet copied */
+};
+
+/* Actions recorded for the message being processed by the worker. */
+static mu_stream_t action_stream;
+/* Set if the message must be processed by the master. */
+static int action_fallback;
+
+static void
+_sieve_action_record (mu_sieve_machine_t mach,
+		      const char *action, const char *fmt, va_list ap)
+{
+  if (verbose)
+    _sieve_action_log (mach, action, fmt, ap);
+
+  if (strcmp (action, "KEEP") == 0)
+    mu_stream_printf (action_stream, "K\n");
+  else if (strcmp (action, "DISCARD") == 0)
+    mu_stream_printf (action_stream, "D\n");
+  else if (strcmp (action, "FILEINTO") == 0)
+    {
+      char *filename;
+      char *perms = "-";
+
+      mu_sieve_get_arg (mach, 0, SVT_STRING, &filename);
+      mu_sieve_get_tag (mach, "permissions", SVT_STRING, &perms);
+      if (strchr (filename, '\n') || strpbrk (perms, " \t\n"))
+	action_fallback = 1;
+      else
+	mu_stream_printf (action_stream, "F %s %s\n", perms, filename);
+    }
+  else if (strcmp (action, "STOP") && strcmp (action, "IMPLICIT KEEP"))
+    action_fallback = 1;
+}
+
+static void
+sieve_worker (mu_sieve_machine_t mach, size_t first, size_t total, int fd,
+	      int logfd)
+{
+  int rc;
+  mu_mailbox_t mbox;
+  mu_stream_t out;
+  mu_off_t off = 0;
+  size_t n;
+
+  if (dup2 (logfd, MU_STDERR_FD) == -1)
+    _exit (EX_OSERR);
+  close (logfd);
+  
+  if ((rc = mu_fd_stream_create (&out, NULL, fd, MU_STREAM_WRITE)) != 0
+      || (rc = mu_memory_stream_create (&action_stream, MU_STREAM_RDWR)) != 0)
+    {
+      mu_error (_("cannot create stream: %s"), mu_strerror (rc));
+      _exit (EX_SOFTWARE);
+    }
+
+  if ((rc = mu_mailbox_create_default (&mbox, mbox_url)) != 0
+      || (rc = mu_mailbox_open (mbox, MU_STREAM_READ)) != 0)
+    {
+      mu_error (_("worker cannot open mailbox: %s"), mu_strerror (rc));
+      _exit (EX_UNAVAILABLE);
+    }
+
+  mu_sieve_set_dry_run (mach, 1);
+  mu_sieve_set_logger (mach, _sieve_action_record);
+
+  for (n = first; n <= total; n += jobs)
+    {
+      mu_off_t end;
+      
+      mu_stream_truncate (action_stream, 0);
+      action_fallback = 0;
+      mu_sieve_mailbox_message (mach, mbox, n);
+
+      mu_stream_flush (mu_strerr);
+      end = lseek (MU_STDERR_FD, 0, SEEK_CUR);
+      if (end == -1)
+	end = off;
+      mu_stream_printf (out, "%lu %c %lu\n", (unsigned long) n,
+			action_fallback ? 'F' : 'A',
+			(unsigned long) (end - off));
+      off = end;
+      mu_stream_seek (action_stream, 0, MU_SEEK_SET, NULL);
+      mu_stream_copy (out, action_stream, 0, NULL);
+      rc = mu_stream_printf (out, ".\n");
+      if (rc == 0)
+	rc = mu_stream_flush (out);
+      if (rc)
+	/* Master is gone */
+	break;
+    }
+
+  mu_stream_destroy (&out);
+  mu_stream_destroy (&action_stream);
+  mu_mailbox_close (mbox);
+  mu_mailbox_destroy (&mbox);
+  _exit (EX_OK);
+}
+
+/* Copy LEN bytes of diagnostic output of the worker WP to stderr. */
+static void
+copy_worker_log (struct sieve_worker *wp, size_t len, int output)
+{
+  char buf[512];
+  
+  if (output)
+    {
+      mu_stream_flush (mu_strerr);
+      while (len)
+	{
+	  ssize_t n = pread (wp->logfd, buf,
+			     len < sizeof buf ? len : sizeof buf,
+			     wp->logoff);
+	  if (n <= 0)
+	    break;
+	  if (write (MU_STDERR_FD, buf, n) != n)
+	    break;
+	  wp->logoff += n;
+	  len -= n;
+	}
+    }
+  wp->logoff += len;
+}
+
+static void
+worker_fail (struct sieve_worker *wp)
+{
+  mu_error (_("worker %lu failed; processing its messages serially"),
+	    (unsigned long) wp->pid);
+  mu_stream_destroy (&wp->in);
+}
+
+/* Apply the actions recorded by the worker WP for the message MSGNO
+   from MBOX.  Return 0 if the message has been processed, and 1 if it
+   must be processed by the caller. */
+static int
+sieve_commit (mu_mailbox_t mbox, size_t msgno, struct sieve_worker *wp)
+{
+  char *buf = NULL;
+  size_t size = 0, n;
+  unsigned long num, len;
+  char status;
+  int replay;
+  mu_message_t msg;
+  mu_attribute_t attr;
+  int rc;
+
+  if (!wp->in)
+    return 1;
+  rc = mu_stream_getline (wp->in, &buf, &size, &n);
+  if (rc || n == 0
+      || sscanf (buf, "%lu %c %lu", &num, &status, &len) != 3
+      || num != msgno)
+    {
+      free (buf);
+      worker_fail (wp);
+      return 1;
+    }
+
+  replay = status == 'A' && !dry_run;
+  copy_worker_log (wp, len, status == 'A' || dry_run);
+  
+  mu_mailbox_get_message (mbox, msgno, &msg);
+  mu_message_get_attribute (msg, &attr);
+  while ((rc = mu_stream_getline (wp->in, &buf, &size, &n)) == 0 && n > 0)
+    {
+      mu_rtrim_class (buf, MU_CTYPE_ENDLN);
+      if (strcmp (buf, ".") == 0)
+	break;
+      if (!replay)
+	continue;
+      switch (buf[0])
+	{
+	case 'K':
+	  mu_attribute_unset_deleted (attr);
+	  break;
+
+	case 'D':
+	  mu_attribute_set_deleted (attr);
+	  break;
+
+	case 'F':
+	  {
+	    char *perms = buf + 2;
+	    char *filename = strchr (perms, ' ');
+	    int mbflags = 0;
+	    const char *p;
+	    
+	    if (!filename)
+	      break;
+	    *filename++ = 0;
+	    if (strcmp (perms, "-")
+		&& mu_parse_stream_perm_string (&mbflags, perms, &p))
+	      {
+		mu_error (_("invalid permissions (near %s)"), p);
+		break;
+	      }
+	    rc = mu_message_save_to_mailbox (msg, filename, mbflags);
+	    if (rc)
+	      mu_error (_("cannot save to mailbox: %s"), mu_strerror (rc));
+	    else
+	      mu_attribute_set_deleted (attr);
+	  }
+	}
+    }
+  free (buf);
+  if (rc || n == 0)
+    worker_fail (wp);
+  return status == 'F' && !dry_run;
+}
+
+static int
+sieve_mailbox_parallel (mu_sieve_machine_t mach, mu_mailbox_t mbox)
+{
+  int rc;
+  size_t total, i, n;
+  struct sieve_worker *wtab;
+  
+  if (mu_sieve_get_message_access (mach) & MU_SIEVE_ACCESS_EXTERNAL)
+    {
+      if (verbose)
+	mu_diag_output (MU_DIAG_NOTICE,
+			_("script uses external commands; "
+			  "running serially"));
+      return mu_sieve_mailbox (mach, mbox);
+    }
+
+  rc = mu_mailbox_messages_count (mbox, &total);
+  if (rc)
+    {
+      mu_diag_funcall (MU_DIAG_ERROR, "mu_mailbox_messages_count", NULL, rc);
+      return rc;
+    }
+  if ((size_t) jobs > total)
+    jobs = total;
+  if (jobs < 2)
+    return mu_sieve_mailbox (mach, mbox);
+  
+  wtab = mu_calloc (jobs, sizeof wtab[0]);
+
+  mu_stream_flush (mu_strout);
+  mu_stream_flush (mu_strerr);
+  for (i = 0; i < (size_t) jobs; i++)
+    {
+      int p[2];
+      struct sieve_worker *wp = &wtab[i];
+
+      rc = mu_tempfile (NULL, 0, &wp->logfd, NULL);
+      if (rc)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_tempfile", NULL, rc);
+	  wp->logfd = -1;
+	  continue;
+	}
+      if (pipe (p))
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "pipe", NULL, errno);
+	  continue;
+	}
+      
+      wp->pid = fork ();
+      if (wp->pid == -1)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "fork", NULL, errno);
+	  close (p[0]);
+	  close (p[1]);
+	  continue;
+	}
+      if (wp->pid == 0)
+	{
+	  size_t j;
+	  
+	  close (p[0]);
+	  for (j = 0; j < i; j++)
+	    {
+	      mu_stream_destroy (&wtab[j].in);
+	      if (wtab[j].logfd != -1)
+		close (wtab[j].logfd);
+	    }
+	  sieve_worker (mach, i + 1, total, p[1], wp->logfd);
+	}
+      close (p[1]);
+      rc = mu_fd_stream_create (&wp->in, NULL, p[0], MU_STREAM_READ);
+      if (rc)
+	{
+	  mu_diag_funcall (MU_DIAG_ERROR, "mu_fd_stream_create", NULL, rc);
+	  close (p[0]);
+	}
+      else
+	mu_stream_set_buffer (wp->in, mu_buffer_full, 0);
+    }
+
+  for (n = 1; n <= total; n++)
+    {
+      if (sieve_commit (mbox, n, &wtab[(n - 1) % jobs]))
+	mu_sieve_mailbox_message (mach, mbox, n);
+    }
+  
+  for (i = 0; i < (size_t) jobs; i++)
+    {
+      struct sieve_worker *wp = &wtab[i];
+      mu_stream_destroy (&wp->in);
+      if (wp->logfd != -1)
+	close (wp->logfd);
+      if (wp->pid > 0)
+	waitpid (wp->pid, NULL, 0);
+    }
+  free (wtab);
+  
+  return 0;
+}
+
 static int
 sieve_mailbox (mu_sieve_machine_t mach)
 {
@@ -421,7 +780,10 @@ sieve_mailbox (mu_sieve_machine_t mach)
     }
   
   /* Process the mailbox */
-  rc = mu_sieve_mailbox (mach, mbox);
+  if (jobs > 1)
+    rc = sieve_mailbox_parallel (mach, mbox);
+  else
+    rc = mu_sieve_mailbox (mach, mbox);
   
  cleanup:
   if (mbox && !dry_run)
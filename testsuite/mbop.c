@@ -331,6 +331,31 @@ mbop_append (int argc, char **argv, mu_assoc_t options, void *call_env)
   return 0;
 }
 
+int
+mbop_append_set (int argc, char **argv, mu_assoc_t options, void *env)
+{
+  struct interp_env *ienv = env;
+  mu_mailbox_t src;
+  mu_msgset_t mset;
+  char *end;
+
+  MU_ASSERT (mu_mailbox_create_default (&src, argv[1]));
+  MU_ASSERT (mu_mailbox_open (src, MU_STREAM_READ));
+  MU_ASSERT (mu_msgset_create (&mset, src, MU_MSGSET_NUM));
+  MU_ASSERT (mu_msgset_parse_imap (mset, MU_MSGSET_NUM, argv[2], &end));
+  if (*end)
+    {
+      mu_error ("bad message set: %s", argv[2]);
+      abort ();
+    }
+  MU_ASSERT (mu_mailbox_append_msgset (ienv->mbx, src, mset));
+  mu_msgset_free (mset);
+  mu_mailbox_close (src);
+  mu_mailbox_destroy (&src);
+  mu_printf ("OK");
+  return 0;
+}
+
 int
 mbop_expunge (int argc, char **argv, mu_assoc_t options, void *env)
 {
@@ -410,6 +435,7 @@ static char const *mbox_actions[] = {
   "expunge",
   "sync",
   "append",
+  "append_set",
   "uidvalidity",
   "uidvalidity_reset",
   "uidnext",
@@ -489,6 +515,31 @@ mbop_qget (int argc, char **argv, mu_assoc_t options, void *data)
   return 0;
 }
 
+static int
+headers_action (size_t msgno, mu_message_qid_t qid, mu_header_t hdr,
+		void *data)
+{
+  size_t *pcount = data;
+  char const *subj;
+
+  if (mu_header_sget_value (hdr, MU_HEADER_SUBJECT, &subj))
+    subj = "(NONE)";
+  if ((*pcount)++)
+    mu_printf ("\n");
+  mu_printf ("%lu %s %s", (unsigned long) msgno, qid ? qid : "-", subj);
+  return 0;
+}
+
+int
+mbop_headers_foreach (int argc, char **argv, mu_assoc_t options, void *data)
+{
+  struct interp_env *ienv = data;
+  size_t count = 0;
+
+  MU_ASSERT (mu_mailbox_headers_foreach (ienv->mbx, headers_action, &count));
+  return 0;
+}
+
 int
 mbop_uidvalidity_reset (int argc, char **argv, mu_assoc_t options, void *data)
 {
@@ -533,6 +584,7 @@ struct mu_tesh_command commands[] = {
   { "expunge",        "", mbop_expunge },
   { "sync",           "", mbop_sync },
   { "append",         "[-sender=EMAIL] [-date=DATE] [-attr=FLAGS] FILE", mbop_append },
+  { "append_set",     "MAILBOX MSGSET", mbop_append_set },
   { "uidvalidity",    "", mbop_uidvalidity },
   { "uidnext",        "", mbop_uidnext },
   { "uidvalidity_reset", "", mbop_uidvalidity_reset },
@@ -540,6 +592,7 @@ struct mu_tesh_command commands[] = {
   { "recent",         "", mbop_recent },
   { "unseen",         "", mbop_unseen },
   { "qget",           "QID", mbop_qget },
+  { "headers_foreach", "", mbop_headers_foreach },
   { "message_lines",  "", mbop_message_lines },
   { "message_size",  "", mbop_message_size },
   { NULL }
@@ -596,6 +649,7 @@ main (int argc, char **argv)
   int notify_option = 0;
   int append_option = 0;
   int ro_option = 0;
+  int headers_only_option = 0;
   int mbox_flags;
   struct mu_option options[] = {
     { "debug", 'd', NULL, MU_OPTION_DEFAULT,
@@ -616,6 +670,9 @@ main (int argc, char **argv)
     { "read-only", 'r', NULL, MU_OPTION_DEFAULT,
       "open mailbox in read-only mode",
       mu_c_incr, &ro_option },
+    { "headers-only", 'H', NULL, MU_OPTION_DEFAULT,
+      "open mailbox for reading headers only",
+      mu_c_incr, &headers_only_option },
     MU_OPTION_END
   };
 
@@ -664,6 +721,8 @@ main (int argc, char **argv)
     mbox_flags = MU_STREAM_READ;
   else
     mbox_flags = MU_STREAM_RDWR;
+  if (headers_only_option)
+    mbox_flags |= MU_STREAM_HEADERS_ONLY;
 
 #ifdef MBOP_PRE_OPEN_HOOK
   MBOP_PRE_OPEN_HOOK ();
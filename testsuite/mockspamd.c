@@ -0,0 +1,318 @@
+/*
+  NAME
+    mockspamd - mock spamd server for use in test suites
+
+  SYNOPSIS
+    mockspamd [-t SEC] [-T THRESHOLD] SOCKET LOGFILE
+
+  DESCRIPTION
+    Starts a mock SpamAssassin daemon listening on the UNIX socket
+    SOCKET.  The daemon understands the SYMBOLS command of the SPAMC
+    protocol.  The spam score of a message is computed as the number of
+    dollar signs it contains.  The message is qualified as spam if its
+    score is greater than or equal to the threshold (10, unless set
+    using the -T option).  The symbol DOLLAR_SIGNS is returned for each
+    message with a non-zero score.
+
+    The reply is formatted according to the protocol version requested
+    by the client.  For SPAMC/1.3 and later, it includes the
+    Content-length header.  As the real spamd does, the daemon closes
+    the connection after each reply.
+
+    Connections are served sequentially.  Each accepted connection and
+    its request are logged to LOGFILE as lines
+
+      connection N
+      request: SIZE SCORE
+
+    where N is the ordinal number of the connection, SIZE is the number
+    of octets received in the message body of the request, and SCORE is
+    the computed score.
+
+    The program detaches from the terminal and prints the PID of the
+    daemon process on the standard output.  The socket is ready to
+    accept connections when the program exits.  The daemon terminates
+    after 60 seconds.  This value can be configured using the -t option.
+
+    Being a mailutils test tool, mockspamd is written without relying on
+    the mailutils libraries.
+
+  OPTIONS
+    -t SEC       Terminate the daemon after this number of seconds.
+    -T THRESHOLD Set spam threshold.
+
+  EXIT CODES
+    0   Success.
+    1   Failure (see stderr for details).
+    2   Command line usage error.
+
+  LICENSE
+    This program is part of GNU Mailutils testsuite.
+    Copyright (C) 2021 Free Software Foundation, Inc.
+
+    Mockspamd is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3, or (at your option)
+    any later version.
+
+    Mockspamd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GNU Mailutils.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+char *progname;
+int daemon_timeout = 60;
+int threshold = 10;
+FILE *logfile;
+
+enum
+  {
+    EX_OK,
+    EX_FAILURE,
+    EX_USAGE
+  };
+
+static void
+usage (void)
+{
+  fprintf (stderr, "usage: %s [-t SEC] [-T THRESHOLD] SOCKET LOGFILE\n",
+	   progname);
+  exit (EX_USAGE);
+}
+
+/* Read a CRLF-terminated line from FP into BUF.  Strip off the line
+   terminator.  Return 0 on success and -1 on EOF or error. */
+static int
+getln (FILE *fp, char *buf, size_t size)
+{
+  size_t len;
+
+  if (!fgets (buf, size, fp))
+    return -1;
+  len = strlen (buf);
+  if (len > 0 && buf[len-1] == '\n')
+    buf[--len] = 0;
+  if (len > 0 && buf[len-1] == '\r')
+    buf[--len] = 0;
+  return 0;
+}
+
+/* Serve a single request. */
+static void
+spamd_request (FILE *in, FILE *out)
+{
+  char buf[1024];
+  int major, minor;
+  long length = -1;
+  long size = 0;
+  int score = 0;
+  int c;
+  char const *symbols;
+
+  if (getln (in, buf, sizeof buf))
+    return;
+  if (sscanf (buf, "SYMBOLS SPAMC/%d.%d", &major, &minor) != 2)
+    {
+      fprintf (out, "SPAMD/1.0 76 Bad header line: %s\r\n", buf);
+      return;
+    }
+
+  while (getln (in, buf, sizeof buf) == 0 && buf[0])
+    {
+      if (strncasecmp (buf, "Content-length:", 15) == 0)
+	length = strtol (buf + 15, NULL, 10);
+    }
+
+  if (length == -1)
+    {
+      fprintf (out, "SPAMD/1.0 76 Content-length required\r\n");
+      return;
+    }
+
+  while (size < length && (c = getc (in)) != EOF)
+    {
+      if (c == '$')
+	score++;
+      size++;
+    }
+
+  fprintf (logfile, "request: %ld %d\n", size, score);
+  fflush (logfile);
+
+  symbols = score ? "DOLLAR_SIGNS" : "";
+  if (major > 1 || (major == 1 && minor >= 3))
+    {
+      fprintf (out, "SPAMD/1.1 0 EX_OK\r\n"
+	       "Content-length: %lu\r\n"
+	       "Spam: %s ; %d.0 / %d.0\r\n"
+	       "\r\n"
+	       "%s",
+	       (unsigned long) strlen (symbols),
+	       score >= threshold ? "True" : "False", score, threshold,
+	       symbols);
+    }
+  else
+    fprintf (out, "SPAMD/1.1 0 EX_OK\r\n"
+	     "Spam: %s ; %d.0 / %d.0\r\n"
+	     "\r\n"
+	     "%s\r\n",
+	     score >= threshold ? "True" : "False", score, threshold,
+	     symbols);
+}
+
+static void
+spamd_run (int fd)
+{
+  int connno = 0;
+
+  while (1)
+    {
+      int sfd;
+      FILE *in, *out;
+
+      if ((sfd = accept (fd, NULL, NULL)) < 0)
+	{
+	  fprintf (stderr, "%s: accept: %s\n", progname, strerror (errno));
+	  exit (EX_FAILURE);
+	}
+      fprintf (logfile, "connection %d\n", ++connno);
+      fflush (logfile);
+
+      in = fdopen (sfd, "r");
+      out = fdopen (dup (sfd), "w");
+      if (!in || !out)
+	{
+	  fprintf (stderr, "%s: fdopen: %s\n", progname, strerror (errno));
+	  exit (EX_FAILURE);
+	}
+      spamd_request (in, out);
+      fclose (out);
+      fclose (in);
+    }
+}
+
+static int
+spamd_open (char const *name)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen (name) >= sizeof addr.sun_path)
+    {
+      fprintf (stderr, "%s: socket name too long\n", progname);
+      exit (EX_USAGE);
+    }
+
+  fd = socket (PF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    {
+      fprintf (stderr, "%s: socket: %s\n", progname, strerror (errno));
+      exit (EX_FAILURE);
+    }
+  memset (&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, name);
+  unlink (name);
+  if (bind (fd, (struct sockaddr *) &addr, sizeof addr) < 0)
+    {
+      fprintf (stderr, "%s: bind: %s\n", progname, strerror (errno));
+      exit (EX_FAILURE);
+    }
+  listen (fd, 5);
+  return fd;
+}
+
+int
+main (int argc, char **argv)
+{
+  int c;
+  int fd;
+  pid_t pid;
+
+  progname = argv[0];
+
+  while ((c = getopt (argc, argv, "t:T:")) != EOF)
+    {
+      switch (c)
+	{
+	case 't':
+	  daemon_timeout = atoi (optarg);
+	  if (daemon_timeout == 0)
+	    {
+	      fprintf (stderr, "%s: wrong timeout value\n", progname);
+	      exit (EX_USAGE);
+	    }
+	  break;
+
+	case 'T':
+	  threshold = atoi (optarg);
+	  break;
+
+	default:
+	  usage ();
+	}
+    }
+
+  argc -= optind;
+  argv += optind;
+
+  if (argc != 2)
+    usage ();
+
+  logfile = fopen (argv[1], "w");
+  if (!logfile)
+    {
+      fprintf (stderr, "%s: can't open %s for writing: %s\n",
+	       progname, argv[1], strerror (errno));
+      exit (EX_FAILURE);
+    }
+
+  fd = spamd_open (argv[0]);
+
+  pid = fork ();
+  if (pid == -1)
+    {
+      fprintf (stderr, "%s: fork: %s\n", progname, strerror (errno));
+      exit (EX_FAILURE);
+    }
+  if (pid)
+    {
+      /* master */
+      printf ("%lu\n", (unsigned long) pid);
+      return EX_OK;
+    }
+  else
+    {
+      /* child */
+      int i;
+      for (i = 0; i < sysconf (_SC_OPEN_MAX); i++)
+	{
+	  if (i != fileno (logfile) && i != fd)
+	    close (i);
+	}
+      if (open ("/dev/null", O_RDONLY) != 0 ||
+	  dup2 (fileno (logfile), 1) == -1 ||
+	  dup2 (fileno (logfile), 2) == -1)
+	abort ();
+      signal (SIGPIPE, SIG_IGN);
+      alarm (daemon_timeout);
+    }
+
+  spamd_run (fd);
+  exit (EX_OK);
+}